@@ -0,0 +1,88 @@
+#ifndef PIPER_TEST_PLUGINS_H
+#define PIPER_TEST_PLUGINS_H
+
+#include <vamp-hostsdk/Plugin.h>
+#include <string>
+
+namespace piper_vamp {
+namespace test {
+
+/**
+ * A fake plugin shared by the tests. It takes time-domain input,
+ * accepts any configuration, and returns on its single output "sum"
+ * the sum of the first sumLength values of each block on the first
+ * channel. It counts the blocks processed since the last reset, and
+ * the process calls and resets made in all, as well as the instances
+ * in existence.
+ *
+ * Tests derive from it to add outputs or remaining features, or to
+ * constrain the configuration, overriding only what they need.
+ */
+class SumPlugin : public Vamp::Plugin
+{
+public:
+    SumPlugin(std::string identifier = "sum",
+              float inputSampleRate = 44100.f,
+              int sumLength = 2) :
+        Plugin(inputSampleRate),
+        identifier(identifier),
+        sumLength(sumLength),
+        blocks(0),
+        processCount(0),
+        resets(0) {
+        ++instances();
+    }
+
+    ~SumPlugin() {
+        --instances();
+    }
+
+    std::string getIdentifier() const override { return identifier; }
+    std::string getName() const override { return identifier; }
+    std::string getDescription() const override { return ""; }
+    std::string getMaker() const override { return ""; }
+    int getPluginVersion() const override { return 1; }
+    std::string getCopyright() const override { return ""; }
+    InputDomain getInputDomain() const override { return TimeDomain; }
+    bool initialise(size_t, size_t, size_t) override { return true; }
+    void reset() override { blocks = 0; ++resets; }
+
+    OutputList getOutputDescriptors() const override {
+        OutputList outputs(1);
+        outputs[0].identifier = "sum";
+        outputs[0].hasFixedBinCount = true;
+        outputs[0].binCount = 1;
+        outputs[0].sampleType = OutputDescriptor::OneSamplePerStep;
+        return outputs;
+    }
+
+    FeatureSet process(const float *const *inputBuffers,
+                       Vamp::RealTime) override {
+        ++processCount;
+        ++blocks;
+        Feature f;
+        f.values.push_back(0.f);
+        for (int i = 0; i < sumLength; ++i) f.values[0] += inputBuffers[0][i];
+        FeatureSet fs;
+        fs[0].push_back(f);
+        return fs;
+    }
+
+    FeatureSet getRemainingFeatures() override { return {}; }
+
+    static int &instances() {
+        static int n = 0;
+        return n;
+    }
+
+    std::string identifier;
+    int sumLength;
+    int blocks;
+    int processCount;
+    int resets;
+};
+
+}
+}
+
+#endif
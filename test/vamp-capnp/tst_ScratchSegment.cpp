@@ -0,0 +1,68 @@
+#include "catch/catch.hpp"
+#include "vamp-capnp/ScratchSegment.h"
+#include <capnp/any.h>
+#include <cstring>
+
+using namespace piper_vamp;
+
+// Build a message whose root is a blob of the given size, filled with
+// non-zero bytes, in a builder using the scratch segment. Return the
+// number of segments it needed.
+static size_t
+buildBlob(ScratchSegment &scratch, size_t bytes)
+{
+    capnp::MallocMessageBuilder message(scratch.get());
+    auto data = message.getRoot<capnp::AnyPointer>()
+        .initAs<capnp::Data>(unsigned(bytes));
+    memset(data.begin(), 0x5a, data.size());
+    scratch.noteUsed(message);
+    return message.getSegmentsForOutput().size();
+}
+
+static bool
+isZeroed(kj::ArrayPtr<capnp::word> words)
+{
+    const unsigned char *bytes =
+        reinterpret_cast<const unsigned char *>(words.begin());
+    for (size_t i = 0; i < words.size() * sizeof(capnp::word); ++i) {
+        if (bytes[i] != 0) return false;
+    }
+    return true;
+}
+
+TEST_CASE("Scratch segment comes back zeroed after a builder has used it") {
+
+    ScratchSegment scratch(64);
+    
+    REQUIRE(buildBlob(scratch, 200) == 1);
+
+    auto words = scratch.get();
+    REQUIRE(words.size() == 64);
+    REQUIRE(isZeroed(words));
+
+    // and can be used again in the same way
+    REQUIRE(buildBlob(scratch, 200) == 1);
+    REQUIRE(isZeroed(scratch.get()));
+}
+
+TEST_CASE("Scratch segment grows after a message overflows it") {
+
+    ScratchSegment scratch(64, 4096);
+
+    // 8000 bytes is 1000 words, which does not fit in 64
+    REQUIRE(buildBlob(scratch, 8000) > 1);
+
+    auto words = scratch.get();
+    REQUIRE(words.size() > 1000);
+    REQUIRE(words.size() <= 4096);
+    REQUIRE(isZeroed(words));
+
+    // The next message of the same size fits in one segment
+    REQUIRE(buildBlob(scratch, 8000) == 1);
+    REQUIRE(scratch.get().size() == words.size());
+    REQUIRE(isZeroed(scratch.get()));
+
+    // and growth stops at the limit
+    REQUIRE(buildBlob(scratch, 80000) > 1);
+    REQUIRE(scratch.get().size() == 4096);
+}
@@ -0,0 +1,41 @@
+#include "catch/catch.hpp"
+#include "vamp-capnp/VampnProto.h"
+#include <capnp/message.h>
+#include <stdexcept>
+#include <vector>
+
+using namespace piper_vamp;
+
+TEST_CASE("Packed process input round-trips through VampnProto") {
+
+    std::vector<std::vector<float>> in { { 0.f, 0.5f, -0.5f, 0.25f } };
+
+    capnp::MallocMessageBuilder message;
+    auto b = message.initRoot<piper::ProcessInput>();
+    VampnProto::buildProcessInput(b, Vamp::RealTime(1, 0), in,
+                                  SampleFormat::Int16);
+
+    Vamp::RealTime timestamp;
+    std::vector<std::vector<float>> out;
+    SampleFormat format;
+    VampnProto::readProcessInput(timestamp, out, format, b.asReader());
+    REQUIRE(format == SampleFormat::Int16);
+    REQUIRE(timestamp == Vamp::RealTime(1, 0));
+    REQUIRE(out == in);
+}
+
+TEST_CASE("Packed process input of a ragged length is rejected") {
+
+    capnp::MallocMessageBuilder message;
+    auto b = message.initRoot<piper::ProcessInput>();
+    b.setSampleFormat(piper::SampleFormat::INT16);
+    auto pp = b.initPackedBuffers(1);
+    pp.init(0, 7); // three and a half 16-bit samples
+
+    Vamp::RealTime timestamp;
+    std::vector<std::vector<float>> out;
+    SampleFormat format;
+    REQUIRE_THROWS_AS(VampnProto::readProcessInput(timestamp, out, format,
+                                                   b.asReader()),
+                      const std::runtime_error &);
+}
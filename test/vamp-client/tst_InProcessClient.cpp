@@ -0,0 +1,120 @@
+#include "catch/catch.hpp"
+#include "vamp-client/InProcessClient.h"
+#include "test/TestPlugins.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace piper_vamp;
+using namespace piper_vamp::client;
+
+// The shared SumPlugin over blocks of exactly four samples on one
+// channel, which also returns the sum of the whole input from
+// getRemainingFeatures
+class RunningSumPlugin : public test::SumPlugin
+{
+public:
+    RunningSumPlugin(float rate) :
+        SumPlugin("runningsum", rate, 4), total(0.f) { }
+
+    size_t getPreferredStepSize() const override { return 4; }
+    size_t getPreferredBlockSize() const override { return 4; }
+    size_t getMaxChannelCount() const override { return 1; }
+    
+    bool initialise(size_t channels, size_t step, size_t block) override {
+        return channels == 1 && step == 4 && block == 4;
+    }
+    
+    void reset() override { SumPlugin::reset(); total = 0.f; }
+
+    FeatureSet process(const float *const *inputBuffers,
+                       Vamp::RealTime timestamp) override {
+        FeatureSet fs = SumPlugin::process(inputBuffers, timestamp);
+        total += fs[0][0].values[0];
+        return fs;
+    }
+
+    FeatureSet getRemainingFeatures() override {
+        Feature f;
+        f.values.push_back(total);
+        FeatureSet fs;
+        fs[0].push_back(f);
+        return fs;
+    }
+
+    float total;
+};
+
+static Vamp::Plugin *
+loadRunningSum(const LoadRequest &req)
+{
+    if (req.pluginKey != "test:runningsum") return nullptr;
+    return new RunningSumPlugin(req.inputSampleRate);
+}
+
+TEST_CASE("InProcessClient loads, configures, processes and finishes") {
+
+    InProcessClient client(loadRunningSum);
+
+    LoadRequest req;
+    req.pluginKey = "test:runningsum";
+    req.inputSampleRate = 8.f;
+    req.adapterFlags = 0;
+
+    LoadResponse resp = client.load(req);
+    REQUIRE(resp.plugin);
+    std::unique_ptr<Vamp::Plugin> plugin(resp.plugin);
+    REQUIRE(RunningSumPlugin::instances() == 1);
+    REQUIRE(resp.staticData.pluginKey == "test:runningsum");
+    REQUIRE(resp.defaultConfiguration.channelCount == 1);
+    REQUIRE(resp.defaultConfiguration.framing.blockSize == 4);
+
+    REQUIRE(plugin->initialise(1, 4, 4));
+    REQUIRE(plugin->getOutputDescriptors().size() == 1);
+
+    std::vector<float> block { 1.f, 2.f, 3.f, 4.f };
+    const float *buffers[] = { block.data() };
+
+    auto fs = plugin->process(buffers, Vamp::RealTime::zeroTime);
+    REQUIRE(fs[0].size() == 1);
+    REQUIRE(fs[0][0].values[0] == 10.f);
+
+    fs = plugin->process(buffers, Vamp::RealTime(0, 500000000));
+    REQUIRE(fs[0][0].values[0] == 10.f);
+
+    fs = plugin->getRemainingFeatures();
+    REQUIRE(fs[0].size() == 1);
+    REQUIRE(fs[0][0].values[0] == 20.f);
+
+    // Finishing releases the local plugin, even while the client
+    // plugin object lives on
+    REQUIRE(RunningSumPlugin::instances() == 0);
+}
+
+TEST_CASE("InProcessClient reports a failed load or initialisation") {
+
+    {
+        InProcessClient client(loadRunningSum);
+
+        LoadRequest req;
+        req.pluginKey = "test:nonexistent";
+        req.inputSampleRate = 8.f;
+        REQUIRE_THROWS_AS(client.load(req), const ServiceError &);
+
+        req.pluginKey = "test:runningsum";
+        std::unique_ptr<Vamp::Plugin> plugin(client.load(req).plugin);
+        REQUIRE_THROWS_AS(plugin->initialise(2, 4, 4), const ServiceError &);
+    
+        // Framing the plugin doesn't like is not a failure: it comes
+        // back as the plugin's preference, for the host to try again
+        // with
+        plugin.reset(client.load(req).plugin);
+        REQUIRE(!plugin->initialise(1, 4, 8));
+        REQUIRE(plugin->getPreferredBlockSize() == 4);
+        REQUIRE(plugin->initialise(1, 4, 4));
+    }
+
+    // A plugin left in failed state is never finished, but the client
+    // still releases its local instance when it goes away
+    REQUIRE(RunningSumPlugin::instances() == 0);
+}
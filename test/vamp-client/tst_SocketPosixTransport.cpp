@@ -0,0 +1,106 @@
+#include "catch/catch.hpp"
+#include "vamp-client/posix/SocketPosixTransport.h"
+#include <thread>
+#include <string>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
+
+using namespace piper_vamp::client;
+
+namespace {
+
+class LineChecker : public MessageCompletenessChecker {
+public:
+    State check(const std::vector<char> &message) const override {
+        if (!message.empty() && message.back() == '\n') return Complete;
+        return Incomplete;
+    }
+};
+
+class QuietLogger : public LogCallback {
+public:
+    void log(std::string) const override { }
+};
+
+int listenOn(std::string path)
+{
+    unlink(path.c_str());
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    REQUIRE(listener >= 0);
+    REQUIRE(::bind(listener, (sockaddr *)&addr, sizeof(addr)) == 0);
+    REQUIRE(listen(listener, 1) == 0);
+    return listener;
+}
+
+// For the first connection, echo back the given number of lines in
+// upper case before closing it
+void echoLines(int listener, int lines)
+{
+    int conn = accept(listener, nullptr, nullptr);
+    char c;
+    while (lines > 0 && read(conn, &c, 1) == 1) {
+        c = char(toupper(c));
+        if (write(conn, &c, 1) != 1) break;
+        if (c == '\n') --lines;
+    }
+    close(conn);
+}
+
+}
+
+TEST_CASE("SocketPosixTransport makes calls over a Unix socket")
+{
+    std::string path = "/tmp/tst-socket-transport-" + std::to_string(getpid());
+    int listener = listenOn(path);
+    std::thread server(echoLines, listener, 2);
+
+    // Writing to the closed connection below must not raise SIGPIPE,
+    // which would kill us by default, and the transport must manage
+    // that without changing our disposition for it
+    struct sigaction before, after;
+    REQUIRE(sigaction(SIGPIPE, nullptr, &before) == 0);
+
+    QuietLogger logger;
+    LineChecker checker;
+    {
+        SocketPosixTransport transport(path, &logger);
+        transport.setCompletenessChecker(&checker);
+        REQUIRE(transport.isOK());
+
+        std::string request = "hello\n";
+        auto response = transport.call(request.data(), request.size(),
+                                       "test", true);
+        REQUIRE(std::string(response.begin(), response.end()) == "HELLO\n");
+        request = "again\n";
+        response = transport.call(request.data(), request.size(),
+                                  "test", true);
+        REQUIRE(std::string(response.begin(), response.end()) == "AGAIN\n");
+        REQUIRE(transport.getMetrics().calls == 2);
+
+        // The server has now closed the connection
+        REQUIRE_THROWS_AS(transport.call(request.data(), request.size(),
+                                         "test", true),
+                          const ServerCrashed &);
+        REQUIRE(!transport.isOK());
+    }
+
+    REQUIRE(sigaction(SIGPIPE, nullptr, &after) == 0);
+    REQUIRE(after.sa_handler == before.sa_handler);
+
+    server.join();
+    close(listener);
+    unlink(path.c_str());
+}
+
+TEST_CASE("SocketPosixTransport is not OK if nothing is listening")
+{
+    QuietLogger logger;
+    SocketPosixTransport transport("/tmp/tst-socket-transport-none", &logger);
+    REQUIRE(!transport.isOK());
+}
@@ -0,0 +1,23 @@
+#include "catch/catch.hpp"
+#include "vamp-client/SynchronousTransport.h"
+
+using namespace piper_vamp::client;
+using std::chrono::milliseconds;
+
+TEST_CASE("Transport metrics split each call at the first byte") {
+
+    TransportMetricsRecorder recorder;
+    auto t = std::chrono::steady_clock::now();
+    recorder.recordCall(100, 2000, t, t + milliseconds(3), t + milliseconds(4), 2);
+    recorder.recordCall(50, 1000, t, t + milliseconds(1), t + milliseconds(5), 3);
+
+    auto m = recorder.getMetrics();
+    REQUIRE(m.calls == 2);
+    REQUIRE(m.bytesSent == 150);
+    REQUIRE(m.bytesReceived == 3000);
+    REQUIRE(m.readWakeups == 5);
+    REQUIRE(m.roundTrip.totalNs == 9000000);
+    REQUIRE(m.firstByte.totalNs == 4000000);
+    REQUIRE(m.drain.totalNs == 5000000);
+    REQUIRE(m.drain.maxNs == 4000000);
+}
@@ -0,0 +1,61 @@
+#include "catch/catch.hpp"
+#include "vamp-support/Blake2b.h"
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace piper_vamp;
+
+static std::string
+hexDigest(const std::vector<unsigned char> &data, size_t digestBytes,
+          size_t pieceBytes = 0)
+{
+    Blake2b b(digestBytes);
+    if (pieceBytes == 0) {
+        b.update(data.data(), data.size());
+    } else {
+        for (size_t i = 0; i < data.size(); i += pieceBytes) {
+            size_t n = std::min(pieceBytes, data.size() - i);
+            b.update(data.data() + i, n);
+        }
+    }
+    std::vector<unsigned char> out(digestBytes);
+    b.digest(out.data());
+    std::string hex;
+    for (auto c: out) {
+        char buf[3];
+        snprintf(buf, sizeof(buf), "%02x", c);
+        hex += buf;
+    }
+    return hex;
+}
+
+TEST_CASE("BLAKE2b matches the reference digests") {
+
+    std::vector<unsigned char> abc { 'a', 'b', 'c' };
+    REQUIRE(hexDigest({}, 64) ==
+            "786a02f742015903c6c6fd852552d272912f4740e15847618a86e217f71f5419"
+            "d25e1031afee585313896444934eb04b903a685b1448b755d56f701afe9be2ce");
+    REQUIRE(hexDigest(abc, 64) ==
+            "ba80a53f981c4d0d6a2797b69f12f6e94c212f14685ac4b74b12bb6fdbffa2d1"
+            "7d87c5392aab792dc252d5de4533cc9518d38aa8dbf1925ab92386edd4009923");
+    REQUIRE(hexDigest(abc, 16) == "cf4ab791c62b8d2b2109c90275287816");
+
+    // Exactly one block, which must be compressed as the final one
+    std::vector<unsigned char> zeros(128, 0);
+    REQUIRE(hexDigest(zeros, 32) ==
+            "378d0caaaa3855f1b38693c1d6ef004fd118691c95c959d4efa950d6d6fcf7c1");
+
+    // Several blocks and a partial one, however they are added
+    std::vector<unsigned char> longer;
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 256; ++j) longer.push_back((unsigned char)j);
+    }
+    longer.push_back('x');
+    longer.push_back('y');
+    for (size_t piece: { 0, 1, 7, 128, 129 }) {
+        REQUIRE(hexDigest(longer, 16, piece) ==
+                "8277b4b0c5ae2983d13d100f644bfa42");
+    }
+}
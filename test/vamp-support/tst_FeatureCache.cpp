@@ -0,0 +1,162 @@
+#include "catch/catch.hpp"
+#include "vamp-support/FeatureCache.h"
+#include "test/TestPlugins.h"
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using namespace piper_vamp;
+
+// The shared SumPlugin, which also returns the number of blocks at
+// the end on a second output
+class CountingSumPlugin : public test::SumPlugin
+{
+public:
+    FeatureSet getRemainingFeatures() override {
+        Feature f;
+        f.hasTimestamp = true;
+        f.timestamp = Vamp::RealTime(1, 0);
+        f.values.push_back(float(blocks));
+        f.label = "blocks";
+        FeatureSet fs;
+        fs[1].push_back(f);
+        return fs;
+    }
+};
+
+static std::vector<Vamp::Plugin::FeatureSet>
+run(FeatureCache &cache, CountingSumPlugin &plugin,
+    FeatureCache::Key startKey, const std::vector<float> &input)
+{
+    FeatureCacheSession session(cache, &plugin, startKey, 1024 * 1024);
+    std::vector<Vamp::Plugin::FeatureSet> results;
+    for (size_t i = 0; i + 2 <= input.size(); i += 2) {
+        const float *buffers[] = { input.data() + i };
+        results.push_back(session.process
+                          (buffers, 1, 2,
+                           Vamp::RealTime::frame2RealTime(i, 44100)));
+    }
+    results.push_back(session.finish());
+    return results;
+}
+
+TEST_CASE("Feature cache replays a repeated run without running the plugin") {
+
+    char dirTemplate[] = "/tmp/piper-fc-XXXXXX";
+    REQUIRE(mkdtemp(dirTemplate));
+    std::string dir(dirTemplate);
+    
+    LoadRequest load;
+    load.pluginKey = "test:sum";
+    load.inputSampleRate = 44100.f;
+    PluginConfiguration config;
+    config.channelCount = 1;
+    config.framing.blockSize = 2;
+    config.framing.stepSize = 2;
+    auto key = FeatureCache::startKey(load, 1, config);
+
+    std::vector<float> input { 1, 2, 3, 4, 5, 6 };
+    std::vector<float> altered { 1, 2, 3, 4, 5, 7 };
+    
+    std::vector<Vamp::Plugin::FeatureSet> first;
+    {
+        FeatureCache cache(dir, 1024 * 1024);
+        CountingSumPlugin plugin;
+        first = run(cache, plugin, key, input);
+        REQUIRE(plugin.processCount == 3);
+        REQUIRE(cache.getRunCount() == 1);
+    }
+
+    // A new cache object sees the run stored by the previous one
+    FeatureCache cache(dir, 1024 * 1024);
+    REQUIRE(cache.getRunCount() == 1);
+
+    CountingSumPlugin plugin;
+    auto second = run(cache, plugin, key, input);
+    REQUIRE(plugin.processCount == 0);
+    REQUIRE(second.size() == first.size());
+    REQUIRE(second[2].at(0)[0].values == std::vector<float> { 11 });
+    REQUIRE(second[3].at(1)[0].label == "blocks");
+    REQUIRE(second[3].at(1)[0].hasTimestamp);
+    REQUIRE(second[3].at(1)[0].values == std::vector<float> { 3 });
+
+    // Diverging in the last block means the plugin has to catch up
+    // with the earlier ones before it can process that one
+    CountingSumPlugin other;
+    auto third = run(cache, other, key, altered);
+    REQUIRE(other.processCount == 3);
+    REQUIRE(third[2].at(0)[0].values == std::vector<float> { 12 });
+    REQUIRE(third[3].at(1)[0].values == std::vector<float> { 3 });
+    REQUIRE(cache.getRunCount() == 2);
+
+    // A different configuration shares nothing with either run
+    config.parameterValues["gain"] = 2.f;
+    CountingSumPlugin configured;
+    run(cache, configured, FeatureCache::startKey(load, 1, config), input);
+    REQUIRE(configured.processCount == 3);
+
+    std::string cmd = "rm -rf " + dir;
+    REQUIRE(system(cmd.c_str()) == 0);
+}
+
+TEST_CASE("Feature cache keys distinguish inputs differing only in sign bits") {
+
+    // Negating two samples flips the top bit of two 64-bit words,
+    // which a word-wise FNV hash cannot tell apart
+    std::vector<float> input { 1, 2, 3, 4, 5, 6, 7, 8 };
+    std::vector<float> negated(input);
+    negated[1] = -negated[1];
+    negated[5] = -negated[5];
+
+    LoadRequest load;
+    load.pluginKey = "test:sum";
+    PluginConfiguration config;
+    auto start = FeatureCache::startKey(load, 1, config);
+
+    const float *a[] = { input.data() };
+    const float *b[] = { negated.data() };
+    auto ka = FeatureCache::processKey(start, a, 1, 8, Vamp::RealTime::zeroTime);
+    auto kb = FeatureCache::processKey(start, b, 1, 8, Vamp::RealTime::zeroTime);
+    REQUIRE(ka != kb);
+    REQUIRE(FeatureCache::finishKey(ka) != FeatureCache::finishKey(kb));
+    REQUIRE(FeatureCache::finishKey(ka) == FeatureCache::finishKey(ka));
+}
+
+TEST_CASE("Feature cache only answers a lookup from a run with the same start") {
+
+    char dirTemplate[] = "/tmp/piper-fc-XXXXXX";
+    REQUIRE(mkdtemp(dirTemplate));
+    std::string dir(dirTemplate);
+
+    LoadRequest load;
+    load.pluginKey = "test:sum";
+    load.inputSampleRate = 44100.f;
+    PluginConfiguration config;
+    config.channelCount = 1;
+    config.framing.blockSize = 2;
+    config.framing.stepSize = 2;
+    auto start = FeatureCache::startKey(load, 1, config);
+    config.parameterValues["gain"] = 2.f;
+    auto otherStart = FeatureCache::startKey(load, 1, config);
+    REQUIRE(start != otherStart);
+
+    std::vector<float> input { 1, 2 };
+    const float *buffers[] = { input.data() };
+    auto key = FeatureCache::processKey(start, buffers, 1, 2,
+                                        Vamp::RealTime::zeroTime);
+    {
+        FeatureCache cache(dir, 1024 * 1024);
+        CountingSumPlugin plugin;
+        run(cache, plugin, start, input);
+    }
+
+    // Also after the index has been rebuilt from the run file
+    FeatureCache cache(dir, 1024 * 1024);
+    Vamp::Plugin::FeatureSet features;
+    REQUIRE(cache.lookup(key, start, features));
+    REQUIRE(features.at(0)[0].values == std::vector<float> { 3 });
+    REQUIRE(!cache.lookup(key, otherStart, features));
+
+    std::string cmd = "rm -rf " + dir;
+    REQUIRE(system(cmd.c_str()) == 0);
+}
@@ -0,0 +1,36 @@
+#include "catch/catch.hpp"
+#include "vamp-support/LatencyHistogram.h"
+
+using namespace piper_vamp;
+
+TEST_CASE("Empty latency histogram") {
+    LatencyHistogram h;
+    REQUIRE(h.getCount() == 0);
+    REQUIRE(h.getTotal() == 0);
+    REQUIRE(h.getMax() == 0);
+    REQUIRE(h.getPercentile(0.5) == 0);
+}
+
+TEST_CASE("Latency histogram percentiles") {
+    LatencyHistogram h;
+    for (uint64_t i = 1; i <= 1000; ++i) {
+        h.record(i * 1000);
+    }
+    REQUIRE(h.getCount() == 1000);
+    REQUIRE(h.getTotal() == 500500000);
+    REQUIRE(h.getMax() == 1000000);
+
+    // Percentiles are upper bounds within 12.5% of the true value
+    for (double p: { 0.01, 0.5, 0.95, 0.99 }) {
+        double actual = p * 1000000.0;
+        double reported = double(h.getPercentile(p));
+        REQUIRE(reported >= actual);
+        REQUIRE(reported <= actual * 1.125);
+    }
+    REQUIRE(h.getPercentile(1.0) == 1000000);
+
+    // Small values are exact
+    LatencyHistogram small;
+    small.record(3);
+    REQUIRE(small.getPercentile(0.5) == 3);
+}
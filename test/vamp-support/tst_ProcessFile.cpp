@@ -0,0 +1,280 @@
+#include "catch/catch.hpp"
+#include "vamp-support/LoaderRequests.h"
+#include "test/TestPlugins.h"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+using namespace piper_vamp;
+
+// The shared SumPlugin over blocks of four samples, which also
+// returns an untimed block count on a fixed-rate output
+class BlockSumPlugin : public test::SumPlugin
+{
+public:
+    BlockSumPlugin() : SumPlugin("blocksum", 8.f, 4) { }
+
+    OutputList getOutputDescriptors() const override {
+        OutputList outputs = SumPlugin::getOutputDescriptors();
+        outputs.resize(2);
+        outputs[1].identifier = "count";
+        outputs[1].sampleType = OutputDescriptor::FixedSampleRate;
+        outputs[1].sampleRate = 2.f;
+        return outputs;
+    }
+
+    FeatureSet process(const float *const *inputBuffers,
+                       Vamp::RealTime timestamp) override {
+        FeatureSet fs = SumPlugin::process(inputBuffers, timestamp);
+        Feature count;
+        count.values.push_back(float(blocks));
+        fs[1].push_back(count);
+        return fs;
+    }
+};
+
+static void
+writeStereoWav(std::string path, const std::vector<int16_t> &left,
+               const std::vector<int16_t> &right)
+{
+    FILE *f = fopen(path.c_str(), "wb");
+    REQUIRE(f);
+    auto put32 = [&](uint32_t v) { fwrite(&v, 4, 1, f); };
+    auto put16 = [&](uint16_t v) { fwrite(&v, 2, 1, f); };
+    uint32_t dataBytes = uint32_t(left.size() * 4);
+    fwrite("RIFF", 1, 4, f); put32(36 + dataBytes); fwrite("WAVE", 1, 4, f);
+    fwrite("fmt ", 1, 4, f); put32(16);
+    put16(1); put16(2); put32(8); put32(8 * 4); put16(4); put16(16);
+    fwrite("data", 1, 4, f); put32(dataBytes);
+    for (size_t i = 0; i < left.size(); ++i) {
+        put16(uint16_t(left[i])); put16(uint16_t(right[i]));
+    }
+    fclose(f);
+}
+
+TEST_CASE("processFile frames a file, mixes it down and timestamps features") {
+
+    char pathTemplate[] = "/tmp/piper-pf-XXXXXX";
+    int fd = mkstemp(pathTemplate);
+    REQUIRE(fd >= 0);
+    close(fd);
+    std::string path(pathTemplate);
+
+    // Ten frames: left is 2^14 throughout, right is 0, so the mono
+    // mix is 0.25 per sample
+    writeStereoWav(path, std::vector<int16_t>(10, 16384),
+                   std::vector<int16_t>(10, 0));
+
+    BlockSumPlugin plugin;
+    ProcessFileRequest req;
+    req.plugin = &plugin;
+    req.filename = path;
+    PluginConfiguration config;
+    config.channelCount = 1;
+    config.framing.stepSize = 4;
+    config.framing.blockSize = 4;
+
+    auto response = LoaderRequests().processFile(req, config, 8.f);
+    
+    // Blocks at 0, 4 and 8 frames, the last one half padding
+    const auto &sums = response.features[0];
+    REQUIRE(sums.size() == 3);
+    REQUIRE(sums[0].values[0] == 1.f);
+    REQUIRE(sums[2].values[0] == 0.5f);
+    REQUIRE(sums[1].hasTimestamp);
+    REQUIRE(sums[1].timestamp == Vamp::RealTime::fromSeconds(0.5));
+
+    // Untimed fixed-rate features follow on from one another
+    const auto &counts = response.features[1];
+    REQUIRE(counts.size() == 3);
+    REQUIRE(counts[0].timestamp == Vamp::RealTime::zeroTime);
+    REQUIRE(counts[2].timestamp == Vamp::RealTime::fromSeconds(1.0));
+
+    REQUIRE(plugin.resets == 1);
+
+    // A file at the wrong rate is refused
+    REQUIRE_THROWS_AS(LoaderRequests().processFile(req, config, 44100.f),
+                      const std::runtime_error &);
+
+    unlink(path.c_str());
+}
+
+TEST_CASE("processInSegments matches a single run on a frame-local output") {
+
+    char pathTemplate[] = "/tmp/piper-pf-XXXXXX";
+    int fd = mkstemp(pathTemplate);
+    REQUIRE(fd >= 0);
+    close(fd);
+    std::string path(pathTemplate);
+
+    std::vector<int16_t> left, right;
+    for (int i = 0; i < 1000; ++i) {
+        left.push_back(int16_t((i * 37) % 2000 - 1000));
+        right.push_back(int16_t(i));
+    }
+    writeStereoWav(path, left, right);
+
+    PluginConfiguration config;
+    config.channelCount = 1;
+    config.framing.stepSize = 2;
+    config.framing.blockSize = 4;
+
+    BlockSumPlugin whole;
+    ProcessFileRequest req;
+    req.plugin = &whole;
+    req.filename = path;
+    auto expected = LoaderRequests().processFile(req, config, 8.f).features[0];
+
+    BlockSumPlugin a, b, c;
+    WavFileReader file(path);
+    WorkerPool pool(2);
+    auto features = LoaderRequests().processInSegments
+        ({ &a, &b, &c }, file, config, 8.f, 2, pool)[0];
+
+    REQUIRE(features.size() == expected.size());
+    int wrong = 0;
+    for (size_t i = 0; i < features.size(); ++i) {
+        if (features[i].timestamp != expected[i].timestamp ||
+            features[i].values != expected[i].values) {
+            ++wrong;
+        }
+    }
+    REQUIRE(wrong == 0);
+
+    // Every instance after the first was given its warm-up steps
+    int steps = int(expected.size());
+    REQUIRE(b.blocks == (steps * 2) / 3 - steps / 3 + 2);
+
+    unlink(path.c_str());
+}
+
+// BlockSumPlugin without its fixed-rate output, so that only the
+// allowlist decides whether it may be segmented
+class BlockSumOnlyPlugin : public BlockSumPlugin
+{
+public:
+    OutputList getOutputDescriptors() const override {
+        OutputList outputs = BlockSumPlugin::getOutputDescriptors();
+        outputs.resize(1);
+        return outputs;
+    }
+};
+
+static bool
+sameFeatures(const Vamp::Plugin::FeatureList &a,
+             const Vamp::Plugin::FeatureList &b)
+{
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (a[i].timestamp != b[i].timestamp ||
+            a[i].values != b[i].values) {
+            return false;
+        }
+    }
+    return true;
+}
+
+TEST_CASE("processSegmented segments only allowlisted frame-local plugins") {
+
+    char pathTemplate[] = "/tmp/piper-pf-XXXXXX";
+    int fd = mkstemp(pathTemplate);
+    REQUIRE(fd >= 0);
+    close(fd);
+    std::string path(pathTemplate);
+
+    // 600 frames at step 2 is 300 steps, enough for two segments
+    std::vector<int16_t> left, right;
+    for (int i = 0; i < 600; ++i) {
+        left.push_back(int16_t((i * 37) % 2000 - 1000));
+        right.push_back(int16_t(i));
+    }
+    writeStereoWav(path, left, right);
+
+    PluginConfiguration config;
+    config.channelCount = 1;
+    config.framing.stepSize = 2;
+    config.framing.blockSize = 4;
+
+    LoadRequest load;
+    load.inputSampleRate = 8.f;
+
+    ProcessSegmentedRequest req;
+    req.filename = path;
+    req.segmentCount = 2;
+
+    WorkerPool pool(2);
+
+    BlockSumOnlyPlugin whole;
+    ProcessFileRequest freq;
+    freq.plugin = &whole;
+    freq.filename = path;
+    auto expected = LoaderRequests().processFile(freq, config, 8.f).features;
+
+    SECTION("A plugin not on the allowlist is processed in one piece") {
+        BlockSumOnlyPlugin plugin;
+        req.plugin = &plugin;
+        load.pluginKey = "piper-test:blocksum-unlisted";
+        auto features = LoaderRequests().processSegmented
+            (req, load, config, pool).features;
+        REQUIRE(sameFeatures(features[0], expected[0]));
+        REQUIRE(plugin.resets == 1);
+    }
+
+    SECTION("An allowlisted plugin with a fixed-rate output is processed in one piece") {
+        BlockSumPlugin plugin;
+        req.plugin = &plugin;
+        load.pluginKey = "piper-test:blocksum-listed-fixed";
+        LoaderRequests::addSegmentSafePlugin(load.pluginKey);
+        auto features = LoaderRequests().processSegmented
+            (req, load, config, pool).features;
+        REQUIRE(sameFeatures(features[0], expected[0]));
+        REQUIRE(features[1].size() == expected[0].size());
+        REQUIRE(plugin.resets == 1);
+    }
+
+    SECTION("An allowlisted plugin is segmented, and reset even on failure") {
+        // The further instances are loaded by key, and there is no
+        // such plugin to load, so this fails once it has decided to
+        // segment (processing in one piece would succeed)
+        BlockSumOnlyPlugin plugin;
+        req.plugin = &plugin;
+        load.pluginKey = "piper-test:blocksum-listed";
+        LoaderRequests::addSegmentSafePlugin(load.pluginKey);
+        REQUIRE_THROWS_AS(LoaderRequests().processSegmented
+                          (req, load, config, pool),
+                          const std::runtime_error &);
+        REQUIRE(plugin.resets == 1);
+    }
+
+    unlink(path.c_str());
+}
+
+TEST_CASE("WavFileReader zero-fills a read that runs off the end") {
+
+    char pathTemplate[] = "/tmp/piper-pf-XXXXXX";
+    int fd = mkstemp(pathTemplate);
+    REQUIRE(fd >= 0);
+    close(fd);
+    std::string path = pathTemplate;
+
+    writeStereoWav(path, { 16384, 16384, 16384 }, { -16384, -16384, -16384 });
+    WavFileReader file(path);
+    REQUIRE(file.getFrameCount() == 3);
+
+    std::vector<float> left(4, 9.f), right(4, 9.f);
+    float *buffers[] = { left.data(), right.data() };
+
+    REQUIRE(file.readFrames(1, 4, buffers) == 2);
+    REQUIRE(left == (std::vector<float> { 0.5f, 0.5f, 0.f, 0.f }));
+    REQUIRE(right == (std::vector<float> { -0.5f, -0.5f, 0.f, 0.f }));
+
+    left.assign(4, 9.f);
+    right.assign(4, 9.f);
+    REQUIRE(file.readFrames(1000000, 4, buffers) == 0);
+    REQUIRE(left == std::vector<float>(4, 0.f));
+    REQUIRE(right == std::vector<float>(4, 0.f));
+
+    unlink(path.c_str());
+}
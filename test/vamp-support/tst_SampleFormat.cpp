@@ -0,0 +1,103 @@
+#include "catch/catch.hpp"
+#include "vamp-support/SampleFormat.h"
+#include "vamp-json/VampJson.h"
+#include <cmath>
+#include <vector>
+
+using namespace piper_vamp;
+
+static std::vector<float>
+roundTrip(const std::vector<float> &in, SampleFormat format)
+{
+    std::vector<char> packed(in.size() * bytesPerSample(format));
+    packSamples(in.data(), in.size(), format, packed.data());
+    std::vector<float> out(in.size());
+    unpackSamples(packed.data(), in.size(), format, out.data());
+    return out;
+}
+
+TEST_CASE("Reduced-precision sample formats round-trip within their precision") {
+
+    std::vector<float> in;
+    for (int i = 0; i < 1001; ++i) {
+        in.push_back(float(0.9 * sin(i * 0.1)));
+    }
+
+    REQUIRE(roundTrip(in, SampleFormat::Float32) == in);
+
+    auto i16 = roundTrip(in, SampleFormat::Int16);
+    auto f16 = roundTrip(in, SampleFormat::Float16);
+    int i16bad = 0, f16bad = 0;
+    for (size_t i = 0; i < in.size(); ++i) {
+        if (fabs(i16[i] - in[i]) > 0.5f / 32768.f) ++i16bad;
+        if (fabs(f16[i] - in[i]) > fabs(in[i]) / 2048.f + 1e-7f) ++f16bad;
+    }
+    REQUIRE(i16bad == 0);
+    REQUIRE(f16bad == 0);
+
+    // Int16 clamps rather than wrapping
+    REQUIRE(roundTrip({ 1.5f, -1.5f }, SampleFormat::Int16) ==
+            (std::vector<float> { 32767.f / 32768.f, -1.f }));
+
+    // Every finite half value converts to float and back unchanged
+    int halfBad = 0;
+    for (uint32_t h = 0; h < 0x10000; ++h) {
+        float f = detail::halfToFloat(uint16_t(h));
+        if (std::isnan(f)) continue;
+        if (detail::floatToHalf(f) != h) ++halfBad;
+    }
+    REQUIRE(halfBad == 0);
+}
+
+TEST_CASE("Float16 packing gives the same result on every code path") {
+
+    // 8-sample chunks may be converted with F16C, and the remainder
+    // always with the scalar code, so a length that is not a multiple
+    // of 8 exercises both wherever F16C is available
+    std::vector<float> in;
+    for (int i = 0; i < 1003; ++i) {
+        in.push_back(float(1.1 * sin(i * 0.37)) * float(i % 7 + 1));
+    }
+    in[3] = 1e-6f; // subnormal in half precision
+    in[12] = 1e6f; // overflows to infinity
+
+    std::vector<uint16_t> packed(in.size());
+    packSamples(in.data(), in.size(), SampleFormat::Float16, packed.data());
+    int bad = 0;
+    for (size_t i = 0; i < in.size(); ++i) {
+        if (packed[i] != detail::floatToHalf(in[i])) ++bad;
+    }
+    REQUIRE(bad == 0);
+
+    std::vector<float> out(in.size());
+    unpackSamples(packed.data(), in.size(), SampleFormat::Float16, out.data());
+    bad = 0;
+    for (size_t i = 0; i < in.size(); ++i) {
+        if (out[i] != detail::halfToFloat(packed[i])) ++bad;
+    }
+    REQUIRE(bad == 0);
+}
+
+TEST_CASE("A JSON sample buffer must hold a whole number of samples") {
+
+    std::vector<char> bytes(7);
+    std::string encoded;
+    bn::encode_b64(bytes.begin(), bytes.end(), back_inserter(encoded));
+
+    std::string err;
+    auto buf = VampJson::toSampleBuffer(encoded, SampleFormat::Int16, err);
+    REQUIRE(err != "");
+    REQUIRE(buf.empty());
+
+    err = "";
+    buf = VampJson::toSampleBuffer(encoded, SampleFormat::Float32, err);
+    REQUIRE(err != "");
+
+    bytes.resize(8);
+    encoded = "";
+    bn::encode_b64(bytes.begin(), bytes.end(), back_inserter(encoded));
+    err = "";
+    buf = VampJson::toSampleBuffer(encoded, SampleFormat::Float16, err);
+    REQUIRE(err == "");
+    REQUIRE(buf == std::vector<float>(4, 0.f));
+}
@@ -0,0 +1,62 @@
+#include "catch/catch.hpp"
+#include "vamp-support/SessionArchive.h"
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+
+using namespace piper_vamp;
+
+TEST_CASE("Session archive round-trips records, closed or not") {
+
+    char pathTemplate[] = "/tmp/piper-sa-XXXXXX";
+    int fd = mkstemp(pathTemplate);
+    REQUIRE(fd >= 0);
+    close(fd);
+    std::string path(pathTemplate);
+
+    {
+        SessionArchiveWriter writer(path);
+        REQUIRE(writer.append(SessionArchive::Request, "request", 7));
+        REQUIRE(writer.append(SessionArchive::Response, "response", 8));
+        REQUIRE(writer.append(SessionArchive::Request, "", 0));
+    }
+
+    {
+        SessionArchiveReader reader(path);
+        REQUIRE(reader.getRecordCount() == 3);
+        auto r0 = reader.getRecord(0);
+        auto r1 = reader.getRecord(1);
+        REQUIRE(r0.direction == SessionArchive::Request);
+        REQUIRE(r0.length == 7);
+        REQUIRE(memcmp(r0.data, "request", 7) == 0);
+        REQUIRE(r1.direction == SessionArchive::Response);
+        REQUIRE(r1.timestamp >= r0.timestamp);
+        REQUIRE(reinterpret_cast<uintptr_t>(r1.data) % 8 == 0);
+        REQUIRE(reader.getRecord(2).length == 0);
+    }
+
+    // An archive whose writer never finished it has no index, and may
+    // end part way through a record: we get the complete records only
+    {
+        SessionArchive::FileHeader header;
+        FILE *f = fopen(path.c_str(), "r+b");
+        REQUIRE(f);
+        REQUIRE(fread(&header, sizeof(header), 1, f) == 1);
+        header.recordCount = 0;
+        header.indexOffset = 0;
+        REQUIRE(fseek(f, 0, SEEK_SET) == 0);
+        REQUIRE(fwrite(&header, sizeof(header), 1, f) == 1);
+        fclose(f);
+        size_t recordSize = sizeof(SessionArchive::RecordHeader) + 8;
+        REQUIRE(truncate(path.c_str(), sizeof(header) + 2 * recordSize + 4) == 0);
+    }
+    
+    {
+        SessionArchiveReader reader(path);
+        REQUIRE(reader.getRecordCount() == 2);
+        REQUIRE(memcmp(reader.getRecord(1).data, "response", 8) == 0);
+    }
+
+    unlink(path.c_str());
+}
@@ -0,0 +1,92 @@
+#include "catch/catch.hpp"
+#include "vamp-support/SlotPluginHandleMapper.h"
+#include "test/TestPlugins.h"
+#include <string>
+#include <climits>
+
+using namespace piper_vamp;
+using Handle = PluginHandleMapper::Handle;
+
+TEST_CASE("Slot mapper allocates handles and rejects stale ones") {
+
+    SlotPluginHandleMapper mapper;
+    test::SumPlugin p1, p2, p3;
+
+    Handle h1 = mapper.addPlugin(&p1);
+    Handle h2 = mapper.addPlugin(&p2);
+    REQUIRE(h1 == 1);
+    REQUIRE(h2 == 2);
+    REQUIRE(mapper.addPlugin(&p1) == h1);
+    REQUIRE(mapper.handleToPlugin(h2) == &p2);
+    REQUIRE(mapper.pluginToHandle(&p2) == h2);
+    REQUIRE(mapper.handleToOutputIdMapper(h1)->idToIndex("sum") == 0);
+    REQUIRE(mapper.pluginToSlot(&p1) == 0);
+    REQUIRE(mapper.pluginToSlot(&p2) == 1);
+    REQUIRE(mapper.pluginToSlot(&p3) == -1);
+
+    REQUIRE(!mapper.isConfigured(h1));
+    mapper.markConfigured(h1, 2, 1024);
+    REQUIRE(mapper.isConfigured(h1));
+    REQUIRE(mapper.getChannelCount(h1) == 2);
+    REQUIRE(mapper.getBlockSize(h1) == 1024);
+
+    // Output ids come from the configured outputs once there are some
+    Vamp::Plugin::OutputList outputs(2);
+    outputs[0].identifier = "a";
+    outputs[1].identifier = "b";
+    mapper.markConfigured(h2, 1, 512, outputs);
+    REQUIRE(mapper.handleToOutputIdMapper(h2)->idToIndex("b") == 1);
+    REQUIRE(mapper.handleToOutputIdMapper(h2)->idToIndex("sum") == -1);
+    REQUIRE(mapper.pluginToOutputIdMapper(&p2)->indexToId(0) == "a");
+
+    mapper.removePlugin(h1);
+    REQUIRE(mapper.handleToPlugin(h1) == nullptr);
+    REQUIRE(!mapper.havePlugin(&p1));
+    REQUIRE(!mapper.isConfigured(h1));
+
+    // Reuses the freed slot, but with a new generation
+    Handle h3 = mapper.addPlugin(&p3);
+    REQUIRE(h3 != h1);
+    REQUIRE(mapper.handleToPlugin(h1) == nullptr);
+    REQUIRE(mapper.handleToPlugin(h3) == &p3);
+    REQUIRE(mapper.pluginToSlot(&p3) == 0);
+    REQUIRE(mapper.pluginToSlot(&p1) == -1);
+    REQUIRE(!mapper.isConfigured(h3));
+    REQUIRE(mapper.handleToPlugin(0) == nullptr);
+}
+
+TEST_CASE("Slot mapper accepts externally assigned handles") {
+
+    SlotPluginHandleMapper mapper;
+    test::SumPlugin p1, p2;
+
+    mapper.addPlugin(9999, &p1);
+    REQUIRE(mapper.handleToPlugin(9999) == &p1);
+    REQUIRE(mapper.pluginToHandle(&p1) == 9999);
+    REQUIRE_THROWS_AS(mapper.addPlugin(9999, &p2), const std::logic_error &);
+
+    // The copy is independent of the original
+    SlotPluginHandleMapper copy(mapper);
+    mapper.removePlugin(9999);
+    REQUIRE(mapper.handleToPlugin(9999) == nullptr);
+    REQUIRE(copy.handleToPlugin(9999) == &p1);
+}
+
+TEST_CASE("Slot mapper handles stay within a JSON-safe int") {
+
+    // Loading and unloading one plugin at a time reuses the same
+    // slot every time, so runs its generation count round quickly
+    SlotPluginHandleMapper mapper;
+    test::SumPlugin p;
+    Handle largest = 0;
+    int wrong = 0;
+    for (int i = 0; i < 5000; ++i) {
+        Handle h = mapper.addPlugin(&p);
+        if (mapper.handleToPlugin(h) != &p) ++wrong;
+        if (h > largest) largest = h;
+        mapper.removePlugin(h);
+    }
+    REQUIRE(wrong == 0);
+    REQUIRE(largest <= Handle(INT_MAX));
+    REQUIRE(largest > Handle(1 << 20));
+}
@@ -0,0 +1,91 @@
+#include "catch/catch.hpp"
+#include "vamp-support/TraceWriter.h"
+#include "json11/json11.hpp"
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+using namespace piper_vamp;
+
+TEST_CASE("Trace writers share a file as one event array") {
+
+    char pathTemplate[] = "/tmp/piper-tw-XXXXXX";
+    int fd = mkstemp(pathTemplate);
+    REQUIRE(fd >= 0);
+    close(fd);
+    std::string path(pathTemplate);
+
+    {
+        TraceWriter a(path, "server");
+        TraceWriter b(path, "client \"quoted\"");
+        auto t = TraceWriter::now();
+        b.span("wait process", t, t + std::chrono::milliseconds(2), 7);
+        b.flowStart(TraceWriter::requestFlowId(7), t);
+        a.span("process", t, t + std::chrono::milliseconds(1), 7);
+        a.flowEnd(TraceWriter::requestFlowId(7), t);
+    }
+
+    std::ifstream in(path);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    unlink(path.c_str());
+
+    // The array is left open with a trailing comma, for appending
+    std::string text = ss.str();
+    REQUIRE(text.substr(0, 2) == "[\n");
+    REQUIRE(text.substr(text.size() - 2) == ",\n");
+    text = text.substr(0, text.size() - 2) + "]";
+    
+    std::string err;
+    auto j = json11::Json::parse(text, err);
+    REQUIRE(err == "");
+    REQUIRE(j.array_items().size() == 6);
+    REQUIRE(j[1]["args"]["name"].string_value() == "client \"quoted\"");
+    REQUIRE(j[2]["name"].string_value() == "wait process");
+    REQUIRE(j[2]["ph"].string_value() == "X");
+    REQUIRE(j[2]["dur"].number_value() == Approx(2000.0));
+    REQUIRE(j[2]["args"]["rpcId"].int_value() == 7);
+    REQUIRE(j[3]["id"].int_value() == j[5]["id"].int_value());
+}
+
+TEST_CASE("Trace writers opening a file at once start it only once") {
+
+    char pathTemplate[] = "/tmp/piper-tw-XXXXXX";
+    int fd = mkstemp(pathTemplate);
+    REQUIRE(fd >= 0);
+    close(fd);
+    std::string path(pathTemplate);
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 8; ++i) {
+        threads.push_back(std::thread([=]() {
+                    TraceWriter w(path, "writer\t" + std::to_string(i) +
+                                  " \xc3\xa9");
+                }));
+    }
+    for (auto &t: threads) t.join();
+
+    std::ifstream in(path);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    unlink(path.c_str());
+
+    std::string text = ss.str();
+    REQUIRE(text.substr(0, 2) == "[\n");
+    REQUIRE(text.find('[', 1) == std::string::npos);
+    text = text.substr(0, text.size() - 2) + "]";
+
+    std::string err;
+    auto j = json11::Json::parse(text, err);
+    REQUIRE(err == "");
+    REQUIRE(j.array_items().size() == 8);
+
+    // Control characters are dropped from names, but UTF-8 is kept
+    std::string name = j[0]["args"]["name"].string_value();
+    REQUIRE(name.substr(0, 6) == "writer");
+    REQUIRE(name.find('\t') == std::string::npos);
+    REQUIRE(name.substr(name.size() - 2) == "\xc3\xa9");
+}
@@ -0,0 +1,46 @@
+#include "catch/catch.hpp"
+#include "vamp-support/WorkerPool.h"
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+using namespace piper_vamp;
+
+TEST_CASE("WorkerPool runs every task of each batch exactly once")
+{
+    for (int threads: { 0, 1, 4 }) {
+        WorkerPool pool(threads);
+        REQUIRE(pool.getThreadCount() == threads);
+        for (int batch = 0; batch < 20; ++batch) {
+            std::vector<std::atomic<int>> counts(50);
+            for (auto &c: counts) c = 0;
+            std::vector<WorkerPool::Task> tasks;
+            for (int i = 0; i < int(counts.size()); ++i) {
+                tasks.push_back([&counts, i]() { ++counts[i]; });
+            }
+            pool.run(tasks);
+            int wrong = 0;
+            for (auto &c: counts) if (c != 1) ++wrong;
+            REQUIRE(wrong == 0);
+        }
+    }
+}
+
+TEST_CASE("WorkerPool completes the batch and rethrows a task's exception")
+{
+    WorkerPool pool(2);
+    std::atomic<int> count(0);
+    std::vector<WorkerPool::Task> tasks;
+    for (int i = 0; i < 10; ++i) {
+        tasks.push_back([&count, i]() {
+                ++count;
+                if (i == 3) throw std::runtime_error("task failed");
+            });
+    }
+    REQUIRE_THROWS_AS(pool.run(tasks), const std::runtime_error &);
+    REQUIRE(count == 10);
+
+    // and the pool remains usable
+    pool.run({ [&count]() { ++count; } });
+    REQUIRE(count == 11);
+}
@@ -0,0 +1,172 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+/*
+  Piper C++
+
+  An API for audio analysis and feature extraction plugins.
+
+  Centre for Digital Music, Queen Mary, University of London.
+  Copyright 2006-2017 Chris Cannam and QMUL.
+  
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use, copy,
+  modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+  Except as contained in this notice, the names of the Centre for
+  Digital Music; Queen Mary, University of London; and Chris Cannam
+  shall not be used in advertising or otherwise to promote the sale,
+  use or other dealings in this Software without prior written
+  authorization.
+*/
+
+#ifndef PIPER_RAW_MESSAGE_READER_H
+#define PIPER_RAW_MESSAGE_READER_H
+
+#include <capnp/serialize.h>
+#include <kj/io.h>
+
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace piper_vamp {
+
+/**
+ * Read a stream of framed Cap'n Proto messages, returning each one as
+ * a contiguous, word-aligned array of the original bytes, in which
+ * form it can be parsed with capnp::FlatArrayMessageReader or written
+ * out again as it stands.
+ *
+ * Input is read in large chunks into a single buffer that grows as
+ * needed to hold the largest message seen. A returned message remains
+ * valid only until the next call to next().
+ */
+class RawMessageReader
+{
+public:
+    RawMessageReader(kj::InputStream &stream,
+                     size_t bufferWords = defaultBufferWords) :
+        m_stream(stream),
+        m_buffer(bufferWords),
+        m_start(0),
+        m_bytes(0),
+        m_prevWords(0) { }
+
+    /**
+     * Read the next message. Return false if the stream ended
+     * cleanly before it. Throw std::runtime_error if it ended in the
+     * middle of a message, or if the message's framing is implausible.
+     */
+    bool next(kj::ArrayPtr<const capnp::word> &message) {
+
+        // Discard the previous message
+        m_start += m_prevWords * sizeof(capnp::word);
+        m_bytes -= m_prevWords * sizeof(capnp::word);
+        m_prevWords = 0;
+
+        size_t expected = 0;
+
+        while (true) {
+
+            size_t words = m_bytes / sizeof(capnp::word);
+
+            if (words > 0) {
+                expected = capnp::expectedSizeInWordsFromPrefix
+                    (kj::ArrayPtr<const capnp::word>(wordsAt(m_start), words));
+                if (expected > maxMessageWords) {
+                    throw std::runtime_error("apparently invalid message framing");
+                }
+                if (words >= expected) {
+                    break;
+                }
+            }
+
+            if (!fill(expected)) {
+                if (m_bytes == 0) {
+                    return false;
+                }
+                throw std::runtime_error("incomplete message at end of input");
+            }
+        }
+
+        message = kj::ArrayPtr<const capnp::word>(wordsAt(m_start), expected);
+        m_prevWords = expected;
+        return true;
+    }
+
+    /**
+     * Return true if more input has already been read beyond the end
+     * of the message last returned, i.e. if the next call to next()
+     * may be able to proceed without reading from the stream.
+     */
+    bool haveBufferedInput() const {
+        return m_bytes > m_prevWords * sizeof(capnp::word);
+    }
+
+    static const size_t defaultBufferWords = 1024 * 1024; // 8MB
+
+    // As CapnpRRClient, we refuse anything projected to be over a
+    // gigaword, as it is more likely to be garbage than a message
+    static const size_t maxMessageWords = size_t(1) << 30;
+    
+private:
+    kj::InputStream &m_stream;
+    std::vector<capnp::word> m_buffer;
+    size_t m_start;          // byte offset of unconsumed data
+    size_t m_bytes;          // bytes of unconsumed data
+    size_t m_prevWords;      // size of message last returned
+
+    const capnp::word *wordsAt(size_t byteOffset) const {
+        return m_buffer.data() + byteOffset / sizeof(capnp::word);
+    }
+
+    /**
+     * Read at least some more data, making room for a message of
+     * the given size in words if necessary. Return false at end of
+     * stream.
+     */
+    bool fill(size_t wantWords) {
+
+        size_t capacity = m_buffer.size() * sizeof(capnp::word);
+        size_t want = wantWords * sizeof(capnp::word);
+        
+        if (m_start > 0 && (m_start + m_bytes == capacity ||
+                            m_start + want > capacity)) {
+            // Move the unconsumed data back to the start. m_start is
+            // always word-aligned, so messages stay aligned too
+            memmove(m_buffer.data(), wordsAt(m_start), m_bytes);
+            m_start = 0;
+        }
+
+        if (want > capacity || m_bytes == capacity) {
+            size_t words = std::max(wantWords, m_buffer.size() * 2);
+            m_buffer.resize(words);
+            capacity = m_buffer.size() * sizeof(capnp::word);
+        }
+
+        char *base = reinterpret_cast<char *>(m_buffer.data());
+        size_t end = m_start + m_bytes;
+        size_t n = m_stream.tryRead(base + end, 1, capacity - end);
+        m_bytes += n;
+        return n > 0;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,118 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+/*
+  Piper C++
+
+  An API for audio analysis and feature extraction plugins.
+
+  Centre for Digital Music, Queen Mary, University of London.
+  Copyright 2006-2017 Chris Cannam and QMUL.
+  
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use, copy,
+  modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+  Except as contained in this notice, the names of the Centre for
+  Digital Music; Queen Mary, University of London; and Chris Cannam
+  shall not be used in advertising or otherwise to promote the sale,
+  use or other dealings in this Software without prior written
+  authorization.
+*/
+
+#ifndef PIPER_SCRATCH_SEGMENT_H
+#define PIPER_SCRATCH_SEGMENT_H
+
+#include <capnp/message.h>
+#include <capnp/serialize.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace piper_vamp {
+
+/**
+ * A reusable first segment for Cap'n Proto message builders, so that
+ * building a message of a size seen before allocates nothing.
+ *
+ * capnp::MallocMessageBuilder, when given a first segment, builds in
+ * it until it is full and zeroes the part it used on destruction,
+ * leaving it ready for the next builder. When a message overflows
+ * the segment, the builder allocates further segments as usual, and
+ * the scratch segment is enlarged (up to a limit) before the next
+ * message, so that a run of similar messages soon stops allocating
+ * at all.
+ *
+ * Use one builder at a time per scratch segment:
+ *
+ *    {
+ *        capnp::MallocMessageBuilder message(scratch.get());
+ *        ... build and write the message ...
+ *        scratch.noteUsed(message);
+ *    }
+ *
+ * This class is not thread-safe; use a separate scratch segment for
+ * each thread.
+ */
+class ScratchSegment
+{
+public:
+    ScratchSegment(size_t initialWords = 8192,
+                   size_t maxWords = 2 * 1024 * 1024) :
+        m_words(initialWords),
+        m_maxWords(maxWords),
+        m_wanted(initialWords) { }
+
+    ScratchSegment(const ScratchSegment &) =delete;
+    ScratchSegment &operator=(const ScratchSegment &) =delete;
+    
+    /**
+     * Return zeroed space for use as the first segment of a new
+     * message builder. No builder using the space from a previous
+     * call may still exist.
+     */
+    kj::ArrayPtr<capnp::word> get() {
+        if (m_wanted > m_words.size()) {
+            // Value-initialised, i.e. zeroed
+            m_words = std::vector<capnp::word>(m_wanted);
+        }
+        return kj::ArrayPtr<capnp::word>(m_words.data(), m_words.size());
+    }
+
+    /**
+     * Record how much space a builder using the segment from get()
+     * ended up needing, so that the next segment can be made large
+     * enough. Call this once the message is complete.
+     */
+    void noteUsed(capnp::MessageBuilder &message) {
+        size_t total = 0;
+        for (auto s: message.getSegmentsForOutput()) {
+            total += s.size();
+        }
+        if (total > m_words.size() && total > m_wanted) {
+            m_wanted = std::min(total + total / 4, m_maxWords);
+        }
+    }
+
+private:
+    std::vector<capnp::word> m_words;
+    size_t m_maxWords;
+    size_t m_wanted;
+};
+
+}
+
+#endif
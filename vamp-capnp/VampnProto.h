@@ -525,6 +525,7 @@ public:
                       const piper::Configuration::Reader &r) {
 
         auto pp = r.getParameterValues();
+        c.parameterValues.clear();
         for (const auto &p: pp) {
             c.parameterValues[p.getParameter()] = p.getValue();
         }
@@ -632,6 +633,8 @@ public:
         for (int i = 0; i < int(flags.size()); ++i) {
             f.set(i, flags[i]);
         }
+
+        r.setOmitProgramParameters(req.omitProgramParameters);
     }
 
     static void
@@ -655,6 +658,7 @@ public:
             }
         }
         req.adapterFlags = flags;
+        req.omitProgramParameters = r.getOmitProgramParameters();
     }
 
     static void
@@ -767,10 +771,28 @@ public:
     static void
     buildProcessInput(piper::ProcessInput::Builder &b,
                       Vamp::RealTime timestamp,
-                      const std::vector<std::vector<float> > &buffers) {
+                      const std::vector<std::vector<float> > &buffers,
+                      SampleFormat format = SampleFormat::Float32) {
 
         auto t = b.initTimestamp();
         buildRealTime(t, timestamp);
+
+        if (format != SampleFormat::Float32) {
+            // Reduced-precision samples go in packedBuffers, leaving
+            // inputBuffers empty
+            b.setSampleFormat(format == SampleFormat::Int16 ?
+                              piper::SampleFormat::INT16 :
+                              piper::SampleFormat::FLOAT16);
+            size_t bytes = bytesPerSample(format);
+            auto pp = b.initPackedBuffers(unsigned(buffers.size()));
+            for (int ch = 0; ch < int(buffers.size()); ++ch) {
+                const size_t n = buffers[ch].size();
+                auto p = pp.init(ch, unsigned(n * bytes));
+                packSamples(buffers[ch].data(), n, format, p.begin());
+            }
+            return;
+        }
+        
         auto vv = b.initInputBuffers(unsigned(buffers.size()));
         for (int ch = 0; ch < int(buffers.size()); ++ch) {
             const int n = int(buffers[ch].size());
@@ -785,17 +807,54 @@ public:
     static void
     readProcessInput(Vamp::RealTime &timestamp,
                      std::vector<std::vector<float> > &buffers,
+                     SampleFormat &format,
                      const piper::ProcessInput::Reader &b) {
 
         readRealTime(timestamp, b.getTimestamp());
-        buffers.clear();
+
+        // The buffers are resized rather than rebuilt, so that a
+        // caller reading into the same request each time reuses
+        // their storage
+
+        format = SampleFormat::Float32;
+        switch (b.getSampleFormat()) {
+        case piper::SampleFormat::FLOAT32:
+            format = SampleFormat::Float32;
+            break;
+        case piper::SampleFormat::INT16:
+            format = SampleFormat::Int16;
+            break;
+        case piper::SampleFormat::FLOAT16:
+            format = SampleFormat::Float16;
+            break;
+        }
+
+        if (format != SampleFormat::Float32) {
+            size_t bytes = bytesPerSample(format);
+            auto pp = b.getPackedBuffers();
+            buffers.resize(pp.size());
+            for (unsigned ch = 0; ch < pp.size(); ++ch) {
+                auto p = pp[ch];
+                if (p.size() % bytes != 0) {
+                    throw std::runtime_error
+                        ("packed input buffer length is not a whole number of samples");
+                }
+                buffers[ch].resize(p.size() / bytes);
+                unpackSamples(p.begin(), buffers[ch].size(), format,
+                              buffers[ch].data());
+            }
+            return;
+        }
+        
         auto vv = b.getInputBuffers();
-        for (const auto &v: vv) {
-            std::vector<float> buf;
-            for (auto x: v) {
-                buf.push_back(x);
+        buffers.resize(vv.size());
+        for (unsigned ch = 0; ch < vv.size(); ++ch) {
+            auto v = vv[ch];
+            auto &buf = buffers[ch];
+            buf.resize(v.size());
+            for (unsigned i = 0; i < v.size(); ++i) {
+                buf[i] = v[i];
             }
-            buffers.push_back(buf);
         }
     }
     
@@ -806,7 +865,8 @@ public:
 
         b.setHandle(pmapper.pluginToHandle(pr.plugin));
         auto input = b.initProcessInput();
-        buildProcessInput(input, pr.timestamp, pr.inputBuffers);
+        buildProcessInput(input, pr.timestamp, pr.inputBuffers,
+                          pr.sampleFormat);
     }
 
     static void
@@ -816,7 +876,8 @@ public:
 
         auto h = r.getHandle();
         pr.plugin = pmapper.handleToPlugin(h);
-        readProcessInput(pr.timestamp, pr.inputBuffers, r.getProcessInput());
+        readProcessInput(pr.timestamp, pr.inputBuffers, pr.sampleFormat,
+                         r.getProcessInput());
     }
 
     static void
@@ -841,6 +902,26 @@ public:
                        *pmapper.handleToOutputIdMapper(r.getHandle()));
     }
 
+    static void
+    buildResourceUsage(piper::ResourceUsage::Builder &b,
+                       const ResourceUsage &u) {
+
+        b.setCalls(u.calls);
+        b.setCpuNs(u.cpuNs);
+        b.setAllocatedBytes(u.allocatedBytes);
+        b.setAllocations(u.allocations);
+    }
+
+    static void
+    readResourceUsage(ResourceUsage &u,
+                      const piper::ResourceUsage::Reader &r) {
+
+        u.calls = r.getCalls();
+        u.cpuNs = r.getCpuNs();
+        u.allocatedBytes = r.getAllocatedBytes();
+        u.allocations = r.getAllocations();
+    }
+    
     static void
     buildFinishResponse(piper::FinishResponse::Builder &b,
                         const FinishResponse &pr,
@@ -850,6 +931,10 @@ public:
         auto f = b.initFeatures();
         buildFeatureSet(f, pr.features,
                         *pmapper.pluginToOutputIdMapper(pr.plugin));
+        if (pr.hasUsage) {
+            auto u = b.initUsage();
+            buildResourceUsage(u, pr.usage);
+        }
     }
     
     static void
@@ -857,12 +942,211 @@ public:
                        const piper::FinishResponse::Reader &r,
                        const PluginHandleMapper &pmapper) {
 
+        auto h = r.getHandle();
+        pr.plugin = pmapper.handleToPlugin(h);
+        readFeatureSet(pr.features, r.getFeatures(),
+                       *pmapper.handleToOutputIdMapper(r.getHandle()));
+        pr.hasUsage = r.hasUsage();
+        if (pr.hasUsage) {
+            readResourceUsage(pr.usage, r.getUsage());
+        }
+    }
+
+    static void
+    buildProcessFileRequest(piper::ProcessFileRequest::Builder &b,
+                            const ProcessFileRequest &req,
+                            const PluginHandleMapper &pmapper) {
+
+        b.setHandle(pmapper.pluginToHandle(req.plugin));
+        b.setFilename(req.filename);
+    }
+
+    static void
+    readProcessFileRequest(ProcessFileRequest &req,
+                           const piper::ProcessFileRequest::Reader &r,
+                           const PluginHandleMapper &pmapper) {
+
+        req.plugin = pmapper.handleToPlugin(r.getHandle());
+        req.filename = r.getFilename();
+    }
+    
+    static void
+    buildProcessFileResponse(piper::ProcessFileResponse::Builder &b,
+                             const ProcessFileResponse &pr,
+                             const PluginHandleMapper &pmapper) {
+
+        b.setHandle(pmapper.pluginToHandle(pr.plugin));
+        auto f = b.initFeatures();
+        buildFeatureSet(f, pr.features,
+                        *pmapper.pluginToOutputIdMapper(pr.plugin));
+    }
+    
+    static void
+    readProcessFileResponse(ProcessFileResponse &pr,
+                            const piper::ProcessFileResponse::Reader &r,
+                            const PluginHandleMapper &pmapper) {
+
         auto h = r.getHandle();
         pr.plugin = pmapper.handleToPlugin(h);
         readFeatureSet(pr.features, r.getFeatures(),
                        *pmapper.handleToOutputIdMapper(r.getHandle()));
     }
 
+    static void
+    buildProcessSegmentedRequest(piper::ProcessSegmentedRequest::Builder &b,
+                                 const ProcessSegmentedRequest &req,
+                                 const PluginHandleMapper &pmapper) {
+
+        b.setHandle(pmapper.pluginToHandle(req.plugin));
+        b.setFilename(req.filename);
+        b.setSegmentCount(req.segmentCount);
+        b.setWarmupSteps(req.warmupSteps);
+    }
+
+    static void
+    readProcessSegmentedRequest(ProcessSegmentedRequest &req,
+                                const piper::ProcessSegmentedRequest::Reader &r,
+                                const PluginHandleMapper &pmapper) {
+
+        req.plugin = pmapper.handleToPlugin(r.getHandle());
+        req.filename = r.getFilename();
+        req.segmentCount = r.getSegmentCount();
+        req.warmupSteps = r.getWarmupSteps();
+    }
+    
+    static void
+    buildProcessSegmentedResponse(piper::ProcessSegmentedResponse::Builder &b,
+                                  const ProcessSegmentedResponse &pr,
+                                  const PluginHandleMapper &pmapper) {
+
+        b.setHandle(pmapper.pluginToHandle(pr.plugin));
+        auto f = b.initFeatures();
+        buildFeatureSet(f, pr.features,
+                        *pmapper.pluginToOutputIdMapper(pr.plugin));
+    }
+    
+    static void
+    readProcessSegmentedResponse(ProcessSegmentedResponse &pr,
+                                 const piper::ProcessSegmentedResponse::Reader &r,
+                                 const PluginHandleMapper &pmapper) {
+
+        auto h = r.getHandle();
+        pr.plugin = pmapper.handleToPlugin(h);
+        readFeatureSet(pr.features, r.getFeatures(),
+                       *pmapper.handleToOutputIdMapper(r.getHandle()));
+    }
+
+    static void
+    buildStatsResponse(piper::StatsResponse::Builder &b,
+                       const StatsResponse &sr) {
+
+        auto timings = b.initTimings(unsigned(sr.timings.size()));
+        for (int i = 0; i < int(sr.timings.size()); ++i) {
+            const auto &t = sr.timings[i];
+            auto tb = timings[i];
+            tb.setMethod(t.method);
+            tb.setPluginKey(t.pluginKey);
+            tb.setPhase(t.phase);
+            tb.setCount(t.count);
+            tb.setTotalNs(t.totalNs);
+            tb.setMaxNs(t.maxNs);
+            tb.setP50Ns(t.p50Ns);
+            tb.setP95Ns(t.p95Ns);
+            tb.setP99Ns(t.p99Ns);
+        }
+
+        auto plugins = b.initPlugins(unsigned(sr.plugins.size()));
+        for (int i = 0; i < int(sr.plugins.size()); ++i) {
+            const auto &p = sr.plugins[i];
+            auto pb = plugins[i];
+            pb.setHandle(p.handle);
+            pb.setPluginKey(p.pluginKey);
+            auto u = pb.initUsage();
+            buildResourceUsage(u, p.usage);
+        }
+    }
+
+    static void
+    readStatsResponse(StatsResponse &sr,
+                      const piper::StatsResponse::Reader &r) {
+
+        sr.timings.clear();
+        for (auto tr: r.getTimings()) {
+            StatsResponse::Timing t;
+            t.method = tr.getMethod();
+            t.pluginKey = tr.getPluginKey();
+            t.phase = tr.getPhase();
+            t.count = tr.getCount();
+            t.totalNs = tr.getTotalNs();
+            t.maxNs = tr.getMaxNs();
+            t.p50Ns = tr.getP50Ns();
+            t.p95Ns = tr.getP95Ns();
+            t.p99Ns = tr.getP99Ns();
+            sr.timings.push_back(t);
+        }
+
+        sr.plugins.clear();
+        for (auto pr: r.getPlugins()) {
+            StatsResponse::PluginUsage p;
+            p.handle = pr.getHandle();
+            p.pluginKey = pr.getPluginKey();
+            readResourceUsage(p.usage, pr.getUsage());
+            sr.plugins.push_back(p);
+        }
+    }
+
+    static void
+    buildProcessMultiRequest(piper::ProcessMultiRequest::Builder &b,
+                             const ProcessMultiRequest &pr,
+                             const PluginHandleMapper &pmapper) {
+
+        auto hh = b.initHandles(unsigned(pr.plugins.size()));
+        for (int i = 0; i < int(pr.plugins.size()); ++i) {
+            hh.set(i, pmapper.pluginToHandle(pr.plugins[i]));
+        }
+        auto input = b.initProcessInput();
+        buildProcessInput(input, pr.timestamp, pr.inputBuffers,
+                          pr.sampleFormat);
+    }
+
+    static void
+    readProcessMultiRequest(ProcessMultiRequest &pr,
+                            const piper::ProcessMultiRequest::Reader &r,
+                            const PluginHandleMapper &pmapper) {
+
+        pr.plugins.clear();
+        for (auto h: r.getHandles()) {
+            pr.plugins.push_back(pmapper.handleToPlugin(h));
+        }
+        readProcessInput(pr.timestamp, pr.inputBuffers, pr.sampleFormat,
+                         r.getProcessInput());
+    }
+
+    static void
+    buildProcessMultiResponse(piper::ProcessMultiResponse::Builder &b,
+                              const ProcessMultiResponse &pr,
+                              const PluginHandleMapper &pmapper) {
+
+        auto rr = b.initResults(unsigned(pr.responses.size()));
+        for (int i = 0; i < int(pr.responses.size()); ++i) {
+            auto r = rr[i];
+            buildProcessResponse(r, pr.responses[i], pmapper);
+        }
+    }
+
+    static void
+    readProcessMultiResponse(ProcessMultiResponse &pr,
+                             const piper::ProcessMultiResponse::Reader &r,
+                             const PluginHandleMapper &pmapper) {
+
+        pr.responses.clear();
+        for (const auto &rr: r.getResults()) {
+            ProcessResponse resp;
+            readProcessResponse(resp, rr, pmapper);
+            pr.responses.push_back(std::move(resp));
+        }
+    }
+
     static void
     buildRpcRequest_List(piper::RpcRequest::Builder &b,
                          const ListRequest &req) {
@@ -944,6 +1228,7 @@ public:
 
         auto u = b.getRequest().initFinish();
         u.setHandle(pmapper.pluginToHandle(req.plugin));
+        u.setIncludeUsage(req.includeUsage);
     }
     
     static void
@@ -955,6 +1240,93 @@ public:
         buildFinishResponse(u, pr, pmapper);
     }
 
+    static void
+    buildRpcRequest_Reset(piper::RpcRequest::Builder &b,
+                          const ResetRequest &req,
+                          const PluginHandleMapper &pmapper) {
+
+        auto u = b.getRequest().initReset();
+        u.setHandle(pmapper.pluginToHandle(req.plugin));
+    }
+    
+    static void
+    buildRpcResponse_Reset(piper::RpcResponse::Builder &b,
+                           const ResetResponse &resp,
+                           const PluginHandleMapper &pmapper) {
+
+        auto u = b.getResponse().initReset();
+        u.setHandle(pmapper.pluginToHandle(resp.plugin));
+    }
+
+    static void
+    buildRpcRequest_ProcessFile(piper::RpcRequest::Builder &b,
+                                const ProcessFileRequest &req,
+                                const PluginHandleMapper &pmapper) {
+
+        auto u = b.getRequest().initProcessFile();
+        buildProcessFileRequest(u, req, pmapper);
+    }
+    
+    static void
+    buildRpcResponse_ProcessFile(piper::RpcResponse::Builder &b,
+                                 const ProcessFileResponse &resp,
+                                 const PluginHandleMapper &pmapper) {
+
+        auto u = b.getResponse().initProcessFile();
+        buildProcessFileResponse(u, resp, pmapper);
+    }
+
+    static void
+    buildRpcRequest_ProcessMulti(piper::RpcRequest::Builder &b,
+                                 const ProcessMultiRequest &req,
+                                 const PluginHandleMapper &pmapper) {
+
+        auto u = b.getRequest().initProcessMulti();
+        buildProcessMultiRequest(u, req, pmapper);
+    }
+    
+    static void
+    buildRpcResponse_ProcessMulti(piper::RpcResponse::Builder &b,
+                                  const ProcessMultiResponse &resp,
+                                  const PluginHandleMapper &pmapper) {
+
+        auto u = b.getResponse().initProcessMulti();
+        buildProcessMultiResponse(u, resp, pmapper);
+    }
+
+    static void
+    buildRpcRequest_ProcessSegmented(piper::RpcRequest::Builder &b,
+                                     const ProcessSegmentedRequest &req,
+                                     const PluginHandleMapper &pmapper) {
+
+        auto u = b.getRequest().initProcessSegmented();
+        buildProcessSegmentedRequest(u, req, pmapper);
+    }
+    
+    static void
+    buildRpcResponse_ProcessSegmented(piper::RpcResponse::Builder &b,
+                                      const ProcessSegmentedResponse &resp,
+                                      const PluginHandleMapper &pmapper) {
+
+        auto u = b.getResponse().initProcessSegmented();
+        buildProcessSegmentedResponse(u, resp, pmapper);
+    }
+
+    static void
+    buildRpcRequest_Stats(piper::RpcRequest::Builder &b,
+                          const StatsRequest &) {
+
+        b.getRequest().initStats();
+    }
+    
+    static void
+    buildRpcResponse_Stats(piper::RpcResponse::Builder &b,
+                           const StatsResponse &resp) {
+
+        auto u = b.getResponse().initStats();
+        buildStatsResponse(u, resp);
+    }
+
     static void
     buildRpcResponse_Error(piper::RpcResponse::Builder &b,
                            const std::string &errorText,
@@ -974,6 +1346,16 @@ public:
             type = "process";
         } else if (responseType == RRType::Finish) {
             type = "finish";
+        } else if (responseType == RRType::Reset) {
+            type = "reset";
+        } else if (responseType == RRType::ProcessFile) {
+            type = "processFile";
+        } else if (responseType == RRType::ProcessMulti) {
+            type = "processMulti";
+        } else if (responseType == RRType::ProcessSegmented) {
+            type = "processSegmented";
+        } else if (responseType == RRType::Stats) {
+            type = "stats";
         } else {
             type = "invalid";
         }
@@ -1009,6 +1391,16 @@ public:
             return RRType::Process;
         case piper::RpcRequest::Request::Which::FINISH:
             return RRType::Finish;
+        case piper::RpcRequest::Request::Which::RESET:
+            return RRType::Reset;
+        case piper::RpcRequest::Request::Which::PROCESS_FILE:
+            return RRType::ProcessFile;
+        case piper::RpcRequest::Request::Which::PROCESS_MULTI:
+            return RRType::ProcessMulti;
+        case piper::RpcRequest::Request::Which::PROCESS_SEGMENTED:
+            return RRType::ProcessSegmented;
+        case piper::RpcRequest::Request::Which::STATS:
+            return RRType::Stats;
         }
         return RRType::NotValid;
     }
@@ -1028,6 +1420,16 @@ public:
             return RRType::Process;
         case piper::RpcResponse::Response::Which::FINISH:
             return RRType::Finish;
+        case piper::RpcResponse::Response::Which::RESET:
+            return RRType::Reset;
+        case piper::RpcResponse::Response::Which::PROCESS_FILE:
+            return RRType::ProcessFile;
+        case piper::RpcResponse::Response::Which::PROCESS_MULTI:
+            return RRType::ProcessMulti;
+        case piper::RpcResponse::Response::Which::PROCESS_SEGMENTED:
+            return RRType::ProcessSegmented;
+        case piper::RpcResponse::Response::Which::STATS:
+            return RRType::Stats;
         }
         return RRType::NotValid;
     }
@@ -1134,6 +1536,7 @@ public:
         }
         auto h = r.getRequest().getFinish().getHandle();
         req.plugin = pmapper.handleToPlugin(h);
+        req.includeUsage = r.getRequest().getFinish().getIncludeUsage();
     }
 
     static void
@@ -1146,6 +1549,112 @@ public:
         resp = {};
         readFinishResponse(resp, r.getResponse().getFinish(), pmapper);
     }
+
+    static void
+    readRpcRequest_Reset(ResetRequest &req,
+                         const piper::RpcRequest::Reader &r,
+                         const PluginHandleMapper &pmapper) {
+        if (getRequestResponseType(r) != RRType::Reset) {
+            throw std::logic_error("not a reset request");
+        }
+        auto h = r.getRequest().getReset().getHandle();
+        req.plugin = pmapper.handleToPlugin(h);
+    }
+
+    static void
+    readRpcResponse_Reset(ResetResponse &resp,
+                          const piper::RpcResponse::Reader &r,
+                          const PluginHandleMapper &pmapper) {
+        if (getRequestResponseType(r) != RRType::Reset) {
+            throw std::logic_error("not a reset response");
+        }
+        resp = {};
+        auto h = r.getResponse().getReset().getHandle();
+        resp.plugin = pmapper.handleToPlugin(h);
+    }
+
+    static void
+    readRpcRequest_ProcessFile(ProcessFileRequest &req,
+                               const piper::RpcRequest::Reader &r,
+                               const PluginHandleMapper &pmapper) {
+        if (getRequestResponseType(r) != RRType::ProcessFile) {
+            throw std::logic_error("not a processFile request");
+        }
+        readProcessFileRequest(req, r.getRequest().getProcessFile(), pmapper);
+    }
+
+    static void
+    readRpcResponse_ProcessFile(ProcessFileResponse &resp,
+                                const piper::RpcResponse::Reader &r,
+                                const PluginHandleMapper &pmapper) {
+        if (getRequestResponseType(r) != RRType::ProcessFile) {
+            throw std::logic_error("not a processFile response");
+        }
+        resp = {};
+        readProcessFileResponse(resp, r.getResponse().getProcessFile(), pmapper);
+    }
+
+    static void
+    readRpcRequest_ProcessMulti(ProcessMultiRequest &req,
+                                const piper::RpcRequest::Reader &r,
+                                const PluginHandleMapper &pmapper) {
+        if (getRequestResponseType(r) != RRType::ProcessMulti) {
+            throw std::logic_error("not a processMulti request");
+        }
+        readProcessMultiRequest(req, r.getRequest().getProcessMulti(), pmapper);
+    }
+
+    static void
+    readRpcResponse_ProcessMulti(ProcessMultiResponse &resp,
+                                 const piper::RpcResponse::Reader &r,
+                                 const PluginHandleMapper &pmapper) {
+        if (getRequestResponseType(r) != RRType::ProcessMulti) {
+            throw std::logic_error("not a processMulti response");
+        }
+        resp = {};
+        readProcessMultiResponse(resp, r.getResponse().getProcessMulti(), pmapper);
+    }
+
+    static void
+    readRpcRequest_ProcessSegmented(ProcessSegmentedRequest &req,
+                                    const piper::RpcRequest::Reader &r,
+                                    const PluginHandleMapper &pmapper) {
+        if (getRequestResponseType(r) != RRType::ProcessSegmented) {
+            throw std::logic_error("not a processSegmented request");
+        }
+        readProcessSegmentedRequest(req, r.getRequest().getProcessSegmented(),
+                                    pmapper);
+    }
+
+    static void
+    readRpcResponse_ProcessSegmented(ProcessSegmentedResponse &resp,
+                                     const piper::RpcResponse::Reader &r,
+                                     const PluginHandleMapper &pmapper) {
+        if (getRequestResponseType(r) != RRType::ProcessSegmented) {
+            throw std::logic_error("not a processSegmented response");
+        }
+        resp = {};
+        readProcessSegmentedResponse(resp, r.getResponse().getProcessSegmented(),
+                                     pmapper);
+    }
+
+    static void
+    readRpcRequest_Stats(StatsRequest &req,
+                         const piper::RpcRequest::Reader &r) {
+        if (getRequestResponseType(r) != RRType::Stats) {
+            throw std::logic_error("not a stats request");
+        }
+        req = {};
+    }
+
+    static void
+    readRpcResponse_Stats(StatsResponse &resp,
+                          const piper::RpcResponse::Reader &r) {
+        if (getRequestResponseType(r) != RRType::Stats) {
+            throw std::logic_error("not a stats response");
+        }
+        readStatsResponse(resp, r.getResponse().getStats());
+    }
 };
 
 }
@@ -40,11 +40,18 @@
 #include "PluginClient.h"
 #include "PiperVampPlugin.h"
 #include "SynchronousTransport.h"
+#include "Exceptions.h"
 
-#include "vamp-support/AssignedPluginHandleMapper.h"
+#include "vamp-support/SlotPluginHandleMapper.h"
+#include "vamp-support/TraceWriter.h"
 #include "vamp-capnp/VampnProto.h"
 
 #include <sstream>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <functional>
+#include <memory>
 
 #include <capnp/serialize.h>
 
@@ -63,9 +70,19 @@ namespace client {
  * Client for a request-response Piper server, i.e. using the
  * RpcRequest/RpcResponse structures with a single process call rather
  * than having individual RPC methods, with a synchronous transport
- * such as a subprocess pipe arrangement. Only one request can be
- * handled at a time. This class is thread-safe if and only if it is
- * constructed with a thread-safe SynchronousTransport implementation.
+ * such as a subprocess pipe arrangement.
+ *
+ * This class is thread-safe: plugins obtained from a single client
+ * may be used from different threads at once. Calls are serialised,
+ * not multiplexed: only one request is in flight on the transport at
+ * a time, and a thread making a call waits until any call already in
+ * progress on another thread has received its response. Request
+ * building and response parsing happen outside that lock, so they can
+ * overlap with another thread's call, and the lookups from plugin to
+ * server handle that they need read an immutable snapshot of the
+ * handle map without taking a lock. The transport must be usable
+ * from every thread that calls in, though it need not be thread-safe
+ * itself.
  *
  * This class takes Vamp-like structures (Plugin and the classes in
  * vamp-support) and uses them to communicate with a Piper server
@@ -83,6 +100,11 @@ class CapnpRRClient : public PluginClient,
     // unsigned to avoid undefined behaviour on possible wrap
     typedef uint32_t ReqId;
 
+public:
+    /**
+     * Checker for complete Cap'n Proto messages, suitable for any
+     * transport carrying them.
+     */
     class CompletenessChecker : public MessageCompletenessChecker {
     public:
         State check(const std::vector<char> &message) const override {
@@ -130,6 +152,9 @@ class CapnpRRClient : public PluginClient,
 public:
     CapnpRRClient(SynchronousTransport *transport, //!!! ownership? shared ptr?
                   LogCallback *logger) : // logger may be nullptr for cerr
+        m_nextId(0),
+        m_mapper(std::make_shared<SlotPluginHandleMapper>()),
+        m_inputSampleFormat(SampleFormat::Float32),
         m_logger(logger),
         m_transport(transport),
         m_completenessChecker(new CompletenessChecker) {
@@ -140,6 +165,63 @@ public:
         delete m_completenessChecker;
     }
 
+    /**
+     * Set the format in which to send process input to the server
+     * for plugins that take time-domain input. Int16 or Float16 halve
+     * the size of the audio in each process request, at the cost of
+     * precision; Int16 is exact for audio that came from 16-bit
+     * PCM. Input to frequency-domain plugins is always sent as
+     * Float32. The default is Float32.
+     *
+     * A server that predates this option will misread any other
+     * format, so only use one with a server known to support it.
+     */
+    void setInputSampleFormat(SampleFormat format) {
+        m_inputSampleFormat = format;
+    }
+
+    /**
+     * Write a timeline of every call to the server to the given trace
+     * writer, or stop doing so if it is null. Each call appears as
+     * spans for serialising the request, waiting on the transport
+     * for the response, and copying the response out, tagged with
+     * the RPC id. If the server is tracing to the same file, flow
+     * arrows link these to the server's spans for the same request.
+     *
+     * Set this before making any calls; it is not synchronised with
+     * calls in progress on other threads.
+     */
+    void setTraceWriter(std::shared_ptr<TraceWriter> trace) {
+        m_trace = trace;
+    }
+
+    /**
+     * A function to receive a plugin's resource usage on the server,
+     * over the lifetime of its server-side instance. See
+     * ResourceUsage for what this contains.
+     */
+    typedef std::function<void(PiperVampPlugin *plugin,
+                               const ResourceUsage &usage)> UsageCallback;
+
+    /**
+     * Ask the server for each plugin's resource usage when the plugin
+     * is finished, and pass it to the given callback, or stop doing
+     * so if the callback is empty. The callback is called from within
+     * finish(), which may be during the plugin's destruction, so it
+     * should not retain the plugin pointer. If a reset causes the
+     * plugin to be reloaded on the server, the usage of the instance
+     * it replaces is reported then as well.
+     *
+     * A server that predates resource usage reporting ignores the
+     * request, and the callback is not called.
+     *
+     * Set this before making any calls; it is not synchronised with
+     * calls in progress on other threads.
+     */
+    void setUsageCallback(UsageCallback callback) {
+        m_usageCallback = callback;
+    }
+    
     //!!! obviously, factor out all repetitive guff
 
     //!!! list and load are supposed to be called by application code,
@@ -187,6 +269,7 @@ public:
         PluginHandleMapper::Handle handle = serverLoad(req.pluginKey,
                                                        req.inputSampleRate,
                                                        req.adapterFlags,
+                                                       req.omitProgramParameters,
                                                        resp.staticData,
                                                        resp.defaultConfiguration,
                                                        resp.programParameters);
@@ -199,7 +282,9 @@ public:
                                                    resp.defaultConfiguration,
                                                    resp.programParameters);
 
-        m_mapper.addPlugin(handle, plugin);
+        updateMapper([&](SlotPluginHandleMapper &m) {
+                m.addPlugin(handle, plugin);
+            });
 
         resp.plugin = plugin;
 
@@ -226,7 +311,8 @@ public:
         capnp::MallocMessageBuilder message;
         piper::RpcRequest::Builder builder = message.initRoot<piper::RpcRequest>();
 
-        VampnProto::buildRpcRequest_Configure(builder, request, m_mapper);
+
+        VampnProto::buildRpcRequest_Configure(builder, request, *readMapper());
         ReqId id = getId();
         builder.getId().setNumber(id);
 
@@ -240,7 +326,16 @@ public:
         ConfigurationResponse cr;
         VampnProto::readConfigurationResponse(cr,
                                               reader.getResponse().getConfigure(),
-                                              m_mapper);
+                                              *readMapper());
+
+        // Features from now on are reported against the configured
+        // outputs, so map their ids using those
+        updateMapper([&](SlotPluginHandleMapper &m) {
+                m.markConfigured(m.pluginToHandle(plugin),
+                                 config.channelCount,
+                                 cr.framing.blockSize,
+                                 cr.outputs);
+            });
 
         LOG_E("CapnpRRClient::configure returning");
         
@@ -259,12 +354,16 @@ public:
         
         ProcessRequest request;
         request.plugin = plugin;
-        request.inputBuffers = inputBuffers;
+        request.inputBuffers = std::move(inputBuffers);
         request.timestamp = timestamp;
+        if (plugin->getInputDomain() == Vamp::Plugin::TimeDomain) {
+            request.sampleFormat = m_inputSampleFormat;
+        }
         
         capnp::MallocMessageBuilder message;
         piper::RpcRequest::Builder builder = message.initRoot<piper::RpcRequest>();
-        VampnProto::buildRpcRequest_Process(builder, request, m_mapper);
+        
+        VampnProto::buildRpcRequest_Process(builder, request, *readMapper());
         ReqId id = getId();
         builder.getId().setNumber(id);
 
@@ -278,13 +377,161 @@ public:
         ProcessResponse pr;
         VampnProto::readProcessResponse(pr,
                                         reader.getResponse().getProcess(),
-                                        m_mapper);
+                                        *readMapper());
 
         LOG_E("CapnpRRClient::process returning");
         
         return pr.features;
     }
 
+    /**
+     * Make the same process call on several plugins at once, sending
+     * the input to the server only once. The server may run the
+     * plugins in parallel. The plugins must all have been configured
+     * to accept the same input. Returns the features from each
+     * plugin, in the same order as the plugins were given.
+     */
+    std::vector<Vamp::Plugin::FeatureSet>
+    processMulti(const std::vector<PiperVampPlugin *> &plugins,
+                 std::vector<std::vector<float> > inputBuffers,
+                 Vamp::RealTime timestamp) {
+
+        LOG_E("CapnpRRClient::processMulti called");
+
+        checkServerOK();
+
+        ProcessMultiRequest request;
+        bool timeDomain = true;
+        for (auto p: plugins) {
+            request.plugins.push_back(p);
+            if (p->getInputDomain() != Vamp::Plugin::TimeDomain) {
+                timeDomain = false;
+            }
+        }
+        request.inputBuffers = std::move(inputBuffers);
+        request.timestamp = timestamp;
+        if (timeDomain) {
+            request.sampleFormat = m_inputSampleFormat;
+        }
+
+        capnp::MallocMessageBuilder message;
+        piper::RpcRequest::Builder builder = message.initRoot<piper::RpcRequest>();
+
+        VampnProto::buildRpcRequest_ProcessMulti(builder, request, *readMapper());
+        ReqId id = getId();
+        builder.getId().setNumber(id);
+
+        auto karr = call(message, "processMulti", false);
+
+        capnp::FlatArrayMessageReader responseMessage(karr);
+        piper::RpcResponse::Reader reader = responseMessage.getRoot<piper::RpcResponse>();
+
+        checkResponseType(reader, piper::RpcResponse::Response::Which::PROCESS_MULTI, id);
+
+        ProcessMultiResponse pr;
+        VampnProto::readProcessMultiResponse(pr,
+                                             reader.getResponse().getProcessMulti(),
+                                             *readMapper());
+
+        if (pr.responses.size() != plugins.size()) {
+            throw ProtocolError("wrong number of results in processMulti response");
+        }
+
+        std::vector<Vamp::Plugin::FeatureSet> features;
+        for (auto &r: pr.responses) {
+            features.push_back(std::move(r.features));
+        }
+
+        LOG_E("CapnpRRClient::processMulti returning");
+
+        return features;
+    }
+
+    /**
+     * Ask the server to run the given configured plugin over the
+     * whole of the named WAV file, which must be readable by the
+     * server, and return all of its features with explicit
+     * timestamps. The plugin is left reset, ready for further use.
+     */
+    Vamp::Plugin::FeatureSet
+    processFile(PiperVampPlugin *plugin, std::string filename) {
+
+        LOG_E("CapnpRRClient::processFile called");
+
+        checkServerOK();
+
+        ProcessFileRequest request;
+        request.plugin = plugin;
+        request.filename = filename;
+
+        capnp::MallocMessageBuilder message;
+        piper::RpcRequest::Builder builder = message.initRoot<piper::RpcRequest>();
+
+        VampnProto::buildRpcRequest_ProcessFile(builder, request, *readMapper());
+        ReqId id = getId();
+        builder.getId().setNumber(id);
+
+        auto karr = call(message, "processFile", true);
+
+        capnp::FlatArrayMessageReader responseMessage(karr);
+        piper::RpcResponse::Reader reader = responseMessage.getRoot<piper::RpcResponse>();
+
+        checkResponseType(reader, piper::RpcResponse::Response::Which::PROCESS_FILE, id);
+
+        ProcessFileResponse pr;
+        VampnProto::readProcessFileResponse(pr,
+                                            reader.getResponse().getProcessFile(),
+                                            *readMapper());
+
+        LOG_E("CapnpRRClient::processFile returning");
+
+        return pr.features;
+    }
+
+    /**
+     * As processFile(), but allowing the server to split the file
+     * into segments and run them in parallel on further instances of
+     * the plugin, if it knows the plugin to be safe to run that way.
+     * A segmentCount of zero, or a negative number of warmupSteps,
+     * leaves the choice to the server.
+     */
+    Vamp::Plugin::FeatureSet
+    processSegmented(PiperVampPlugin *plugin, std::string filename,
+                     int segmentCount = 0, int warmupSteps = -1) {
+
+        LOG_E("CapnpRRClient::processSegmented called");
+
+        checkServerOK();
+
+        ProcessSegmentedRequest request;
+        request.plugin = plugin;
+        request.filename = filename;
+        request.segmentCount = segmentCount;
+        request.warmupSteps = warmupSteps;
+
+        capnp::MallocMessageBuilder message;
+        piper::RpcRequest::Builder builder = message.initRoot<piper::RpcRequest>();
+
+        VampnProto::buildRpcRequest_ProcessSegmented(builder, request, *readMapper());
+        ReqId id = getId();
+        builder.getId().setNumber(id);
+
+        auto karr = call(message, "processSegmented", true);
+
+        capnp::FlatArrayMessageReader responseMessage(karr);
+        piper::RpcResponse::Reader reader = responseMessage.getRoot<piper::RpcResponse>();
+
+        checkResponseType(reader, piper::RpcResponse::Response::Which::PROCESS_SEGMENTED, id);
+
+        ProcessSegmentedResponse pr;
+        VampnProto::readProcessSegmentedResponse
+            (pr, reader.getResponse().getProcessSegmented(), *readMapper());
+
+        LOG_E("CapnpRRClient::processSegmented returning");
+
+        return pr.features;
+    }
+
     virtual Vamp::Plugin::FeatureSet
     finish(PiperVampPlugin *plugin) override {
 
@@ -294,11 +541,13 @@ public:
         
         FinishRequest request;
         request.plugin = plugin;
+        request.includeUsage = bool(m_usageCallback);
         
         capnp::MallocMessageBuilder message;
         piper::RpcRequest::Builder builder = message.initRoot<piper::RpcRequest>();
 
-        VampnProto::buildRpcRequest_Finish(builder, request, m_mapper);
+
+        VampnProto::buildRpcRequest_Finish(builder, request, *readMapper());
         ReqId id = getId();
         builder.getId().setNumber(id);
         
@@ -312,9 +561,15 @@ public:
         FinishResponse pr;
         VampnProto::readFinishResponse(pr,
                                        reader.getResponse().getFinish(),
-                                       m_mapper);
+                                       *readMapper());
 
-        m_mapper.removePlugin(m_mapper.pluginToHandle(plugin));
+        updateMapper([&](SlotPluginHandleMapper &m) {
+                m.removePlugin(m.pluginToHandle(plugin));
+            });
+
+        if (pr.hasUsage && m_usageCallback) {
+            m_usageCallback(plugin, pr.usage);
+        }
 
         // Don't delete the plugin. It's the plugin that is supposed
         // to be calling us here
@@ -328,16 +583,33 @@ public:
     reset(PiperVampPlugin *plugin,
           PluginConfiguration config) override {
 
-        // Reload the plugin on the server side, and configure it as requested
-
-        log("CapnpRRClient: reset() called, plugin will be closed and reloaded");
+        LOG_E("CapnpRRClient::reset called");
         
         checkServerOK();
-        
-        if (m_mapper.havePlugin(plugin)) {
+
+        if (readMapper()->havePlugin(plugin)) {
+
+            // The plugin is still loaded and configured on the server
+            // side, so we can just ask the server to reset it
+
+            try {
+                serverReset(plugin);
+                LOG_E("CapnpRRClient::reset returning");
+                return;
+            } catch (const ServiceError &e) {
+                // Most likely a server that predates the reset
+                // request; fall back to unloading and reloading
+                log(std::string("CapnpRRClient: reset request failed (") +
+                    e.what() + "), plugin will be closed and reloaded");
+            }
+            
             (void)finish(plugin); // server-side unload
         }
 
+        // Reload the plugin on the server side, and configure it as requested
+        
+        log("CapnpRRClient: reloading plugin for reset");
+
         PluginStaticData psd;
         PluginConfiguration defaultConfig;
         PluginProgramParameters programParameters;
@@ -345,23 +617,91 @@ public:
             serverLoad(plugin->getPluginKey(),
                        plugin->getInputSampleRate(),
                        plugin->getAdapterFlags(),
+                       true, // we already have the program parameters
                        psd,
                        defaultConfig,
                        programParameters);
 
-        m_mapper.addPlugin(handle, plugin);
+        updateMapper([&](SlotPluginHandleMapper &m) {
+                m.addPlugin(handle, plugin);
+            });
 
         (void)configure(plugin, config);
     }
-    
+
+    /**
+     * Ask the server for the request timings it has gathered so far.
+     * See StatsResponse for what these contain.
+     */
+    StatsResponse
+    stats() {
+
+        LOG_E("CapnpRRClient::stats called");
+
+        checkServerOK();
+
+        capnp::MallocMessageBuilder message;
+        piper::RpcRequest::Builder builder = message.initRoot<piper::RpcRequest>();
+        VampnProto::buildRpcRequest_Stats(builder, StatsRequest());
+        ReqId id = getId();
+        builder.getId().setNumber(id);
+
+        auto karr = call(message, "stats", false);
+
+        capnp::FlatArrayMessageReader responseMessage(karr);
+        piper::RpcResponse::Reader reader = responseMessage.getRoot<piper::RpcResponse>();
+
+        checkResponseType(reader, piper::RpcResponse::Response::Which::STATS, id);
+
+        StatsResponse sr;
+        VampnProto::readStatsResponse(sr, reader.getResponse().getStats());
+
+        LOG_E("CapnpRRClient::stats returning");
+
+        return sr;
+    }
+
 private:
-    AssignedPluginHandleMapper m_mapper;
+    std::atomic<ReqId> m_nextId;
+
+    // The handle mapper is published as an immutable snapshot.
+    // Loading, configuring and unloading a plugin copy it, modify the
+    // copy and swap it in under m_mapperWriteMutex; everything else
+    // reads the current snapshot through readMapper() without taking
+    // any lock shared with other readers or with writers
+    std::shared_ptr<const SlotPluginHandleMapper> m_mapper;
+    std::mutex m_mapperWriteMutex;
+    std::atomic<SampleFormat> m_inputSampleFormat;
+
+    // Held for the whole of each transport call, so that calls from
+    // different threads are serialised
+    std::mutex m_transportMutex;
+    std::shared_ptr<TraceWriter> m_trace;
+    UsageCallback m_usageCallback;
+
     ReqId getId() {
-        //!!! todo: mutex
-        static ReqId m_nextId = 0;
         return m_nextId++;
     }
 
+    /**
+     * Return the current snapshot of the handle mapper. The snapshot
+     * stays valid for as long as the returned pointer is held, even
+     * if a plugin is loaded or unloaded meanwhile, but it will not
+     * reflect any such change.
+     */
+    std::shared_ptr<const SlotPluginHandleMapper> readMapper() const {
+        return std::atomic_load(&m_mapper);
+    }
+
+    template <typename F>
+    void updateMapper(F modifier) {
+        std::lock_guard<std::mutex> guard(m_mapperWriteMutex);
+        auto updated = std::make_shared<SlotPluginHandleMapper>(*readMapper());
+        modifier(*updated);
+        std::atomic_store(&m_mapper,
+                          std::shared_ptr<const SlotPluginHandleMapper>(updated));
+    }
+
     static
     kj::Array<capnp::word>
     toKJArray(const std::vector<char> &buffer) {
@@ -434,16 +774,61 @@ private:
 
     kj::Array<capnp::word>
     call(capnp::MallocMessageBuilder &message, std::string type, bool slow) {
+
+        TraceWriter *trace = m_trace.get();
+        TraceWriter::Time serialising, waiting, received;
+        if (trace) serialising = TraceWriter::now();
+        
         auto arr = capnp::messageToFlatArray(message);
-        auto responseBuffer = m_transport->call(arr.asChars().begin(),
-                                                arr.asChars().size(),
-                                                type,
-                                                slow);
-        return toKJArray(responseBuffer);
+        std::vector<char> responseBuffer;
+        {
+            if (trace) waiting = TraceWriter::now();
+            std::lock_guard<std::mutex> guard(m_transportMutex);
+            responseBuffer = m_transport->call(arr.asChars().begin(),
+                                               arr.asChars().size(),
+                                               type,
+                                               slow);
+            if (trace) received = TraceWriter::now();
+        }
+        auto karr = toKJArray(responseBuffer);
+
+        if (trace) {
+            int64_t id = message.getRoot<piper::RpcRequest>().asReader()
+                .getId().getNumber();
+            trace->span("serialise", serialising, waiting, id);
+            trace->span("wait " + type, waiting, received, id);
+            trace->span("copy response", received, TraceWriter::now(), id);
+            trace->flowStart(TraceWriter::requestFlowId(id), waiting);
+            trace->flowEnd(TraceWriter::responseFlowId(id), received);
+        }
+        
+        return karr;
+    }
+    
+    void
+    serverReset(PiperVampPlugin *plugin) {
+
+        ResetRequest request;
+        request.plugin = plugin;
+
+        capnp::MallocMessageBuilder message;
+        piper::RpcRequest::Builder builder = message.initRoot<piper::RpcRequest>();
+
+        VampnProto::buildRpcRequest_Reset(builder, request, *readMapper());
+        ReqId id = getId();
+        builder.getId().setNumber(id);
+
+        auto karr = call(message, "reset", false);
+
+        capnp::FlatArrayMessageReader responseMessage(karr);
+        piper::RpcResponse::Reader reader = responseMessage.getRoot<piper::RpcResponse>();
+
+        checkResponseType(reader, piper::RpcResponse::Response::Which::RESET, id);
     }
     
     PluginHandleMapper::Handle
     serverLoad(std::string key, float inputSampleRate, int adapterFlags,
+               bool omitProgramParameters,
                PluginStaticData &psd,
                PluginConfiguration &defaultConfig,
                PluginProgramParameters &programParameters) {
@@ -452,6 +837,7 @@ private:
         request.pluginKey = key;
         request.inputSampleRate = inputSampleRate;
         request.adapterFlags = adapterFlags;
+        request.omitProgramParameters = omitProgramParameters;
 
         capnp::MallocMessageBuilder message;
         piper::RpcRequest::Builder builder = message.initRoot<piper::RpcRequest>();
@@ -0,0 +1,289 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+/*
+  Piper C++
+
+  An API for audio analysis and feature extraction plugins.
+
+  Centre for Digital Music, Queen Mary, University of London.
+  Copyright 2006-2017 Chris Cannam and QMUL.
+  
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use, copy,
+  modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+  Except as contained in this notice, the names of the Centre for
+  Digital Music; Queen Mary, University of London; and Chris Cannam
+  shall not be used in advertising or otherwise to promote the sale,
+  use or other dealings in this Software without prior written
+  authorization.
+*/
+
+#ifndef PIPER_IN_PROCESS_CLIENT_H
+#define PIPER_IN_PROCESS_CLIENT_H
+
+#include "Loader.h"
+#include "PluginClient.h"
+#include "PiperVampPlugin.h"
+#include "Exceptions.h"
+
+#include "vamp-support/LoaderRequests.h"
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace piper_vamp {
+namespace client {
+
+/**
+ * A Loader and PluginClient that loads and runs plugins in the
+ * calling process, with no serialisation or transport in between.
+ *
+ * The plugins it returns are PiperVampPlugin objects, just as from
+ * CapnpRRClient, and they behave the same way, including in their
+ * failure cases (a load or initialisation that fails on the server
+ * is reported here as a ServiceError too). So a host can choose
+ * between process isolation and in-process execution per plugin
+ * without changing anything else, and can use this client to find
+ * out how much the isolation is costing it.
+ *
+ * Of course a plugin that crashes will take the host down with it.
+ * Only use this for plugins that are trusted.
+ *
+ * This class is thread-safe, in the same sense as CapnpRRClient: any
+ * number of plugins may be used at once from different threads, but
+ * each plugin only from one thread at a time.
+ */
+class InProcessClient : public PluginClient,
+                        public Loader
+{
+public:
+    /**
+     * A function that constructs a plugin in answer to a load
+     * request, with the same contract as
+     * Vamp::HostExt::PluginLoader::loadPlugin: it returns a new
+     * plugin owned by the caller, or nullptr if the plugin can't be
+     * loaded.
+     */
+    typedef std::function<Vamp::Plugin *(const LoadRequest &)> PluginFactory;
+
+    /**
+     * Construct a client that loads plugins through the Vamp
+     * PluginLoader, from the Vamp plugin path.
+     */
+    InProcessClient() :
+        m_factory([](const LoadRequest &req) {
+                      return Vamp::HostExt::PluginLoader::getInstance()->
+                          loadPlugin(req.pluginKey,
+                                     req.inputSampleRate,
+                                     req.adapterFlags);
+                  }) { }
+
+    /**
+     * Construct a client that loads plugins using the given factory
+     * instead, for example to serve plugins built into the host.
+     */
+    InProcessClient(PluginFactory factory) :
+        m_factory(factory) { }
+
+    ~InProcessClient() {
+        // Any plugins still loaded belong to PiperVampPlugin objects
+        // that are still alive, which is a caller error, but we can at
+        // least avoid leaking them
+        std::lock_guard<std::mutex> guard(m_mutex);
+        for (auto &p: m_plugins) delete p.second.plugin;
+    }
+
+    InProcessClient(const InProcessClient &) =delete;
+    InProcessClient &operator=(const InProcessClient &) =delete;
+    
+    // Loader methods:
+
+    ListResponse
+    list(const ListRequest &req) override {
+        return LoaderRequests().listPluginData(req);
+    }
+    
+    LoadResponse
+    load(const LoadRequest &req) override {
+
+        LoadResponse resp = loadLocal(req);
+        if (!resp.plugin) {
+            throw ServiceError("unable to load plugin");
+        }
+
+        Vamp::Plugin *local = resp.plugin;
+        
+        PiperVampPlugin *plugin = new PiperVampPlugin(this,
+                                                      req.pluginKey,
+                                                      req.inputSampleRate,
+                                                      req.adapterFlags,
+                                                      resp.staticData,
+                                                      resp.defaultConfiguration,
+                                                      resp.programParameters);
+
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_plugins[plugin] = { local, false };
+        
+        resp.plugin = plugin;
+        return resp;
+    }
+
+    // PluginClient methods:
+    
+    ConfigurationResponse
+    configure(PiperVampPlugin *plugin,
+              PluginConfiguration config) override {
+
+        auto &state = stateFor(plugin);
+        if (state.configured) {
+            throw ServiceError("plugin has already been configured");
+        }
+
+        if (config.framing.stepSize == 0 || config.framing.blockSize == 0) {
+            throw ServiceError("step and block size must be non-zero");
+        }
+        
+        ConfigurationRequest req;
+        req.plugin = state.plugin;
+        req.configuration = config;
+
+        ConfigurationResponse resp = LoaderRequests().configurePlugin(req);
+        if (resp.outputs.empty()) {
+            throw ServiceError("plugin failed to initialise");
+        }
+
+        state.configured = true;
+        resp.plugin = plugin;
+        return resp;
+    }
+    
+    Vamp::Plugin::FeatureSet
+    process(PiperVampPlugin *plugin,
+            std::vector<std::vector<float> > inputBuffers,
+            Vamp::RealTime timestamp) override {
+
+        // PiperVampPlugin has already checked its state and shaped
+        // the buffers to suit its configuration, so all we have to do
+        // is pass them on
+        
+        auto &state = stateFor(plugin);
+        
+        std::vector<const float *> ptrs;
+        ptrs.reserve(inputBuffers.size());
+        for (const auto &b: inputBuffers) ptrs.push_back(b.data());
+        
+        return state.plugin->process(ptrs.data(), timestamp);
+    }
+
+    Vamp::Plugin::FeatureSet
+    finish(PiperVampPlugin *plugin) override {
+
+        Vamp::Plugin *local = nullptr;
+        bool configured = false;
+        
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+            auto itr = m_plugins.find(plugin);
+            if (itr == m_plugins.end()) {
+                throw ServiceError("unknown plugin supplied to finish");
+            }
+            local = itr->second.plugin;
+            configured = itr->second.configured;
+            m_plugins.erase(itr);
+        }
+
+        std::unique_ptr<Vamp::Plugin> deleter(local);
+
+        // As on the server, finish may be used just to unload a
+        // plugin that was never configured
+        if (!configured) return {};
+        return local->getRemainingFeatures();
+    }
+
+    void
+    reset(PiperVampPlugin *plugin,
+          PluginConfiguration config) override {
+
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+            auto itr = m_plugins.find(plugin);
+            if (itr != m_plugins.end() && itr->second.configured) {
+                itr->second.plugin->reset();
+                return;
+            }
+        }
+
+        // The plugin has been finished (or was never configured):
+        // load a new instance and configure that instead
+
+        LoadRequest req;
+        req.pluginKey = plugin->getPluginKey();
+        req.inputSampleRate = plugin->getInputSampleRate();
+        req.adapterFlags = plugin->getAdapterFlags();
+        req.omitProgramParameters = true;
+
+        LoadResponse resp = loadLocal(req);
+        if (!resp.plugin) {
+            throw ServiceError("unable to reload plugin for reset");
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+            auto &state = m_plugins[plugin];
+            delete state.plugin;
+            state = { resp.plugin, false };
+        }
+
+        (void)configure(plugin, config);
+    }
+
+private:
+    struct LocalPlugin {
+        Vamp::Plugin *plugin; // I own this
+        bool configured;
+    };
+
+    // Entries are only added and removed by load, finish and reset,
+    // which for any one plugin are not concurrent with its other
+    // calls, so the reference returned by stateFor remains valid for
+    // the duration of the call it was obtained in
+    std::map<PiperVampPlugin *, LocalPlugin> m_plugins;
+    std::mutex m_mutex;
+
+    PluginFactory m_factory;
+
+    LoadResponse loadLocal(const LoadRequest &req) {
+        return LoaderRequests().describeLoadedPlugin(req, m_factory(req));
+    }
+
+    LocalPlugin &stateFor(PiperVampPlugin *plugin) {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        auto itr = m_plugins.find(plugin);
+        if (itr == m_plugins.end()) {
+            throw ServiceError("unknown plugin");
+        }
+        return itr->second;
+    }
+};
+
+}
+}
+
+#endif
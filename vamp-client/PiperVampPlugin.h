@@ -47,6 +47,7 @@
 
 #include <cstdint>
 #include <iostream>
+#include <utility>
 
 namespace piper_vamp {
 namespace client {
@@ -368,7 +369,7 @@ public:
         }
 
         try {
-            return m_client->process(this, vecbuf, timestamp);
+            return m_client->process(this, std::move(vecbuf), timestamp);
         } catch (const std::exception &) {
             m_state = Failed;
             throw;
@@ -36,6 +36,8 @@
 #ifndef PIPER_SYNCHRONOUS_TRANSPORT_H
 #define PIPER_SYNCHRONOUS_TRANSPORT_H
 
+#include "TransportMetrics.h"
+
 #include <vector>
 #include <cstdlib>
 #include <stdexcept>
@@ -101,6 +103,16 @@ public:
      * this before using call().
      */
     virtual bool isOK() const = 0;
+
+    /**
+     * Return a summary of the calls made through this transport so
+     * far. Implementations should gather these using a
+     * TransportMetricsRecorder. The default implementation, for
+     * transports that do not, returns all zeros.
+     */
+    virtual TransportMetrics getMetrics() const {
+        return {};
+    }
 };
 
 }
@@ -0,0 +1,156 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+/*
+  Piper C++
+
+  An API for audio analysis and feature extraction plugins.
+
+  Centre for Digital Music, Queen Mary, University of London.
+  Copyright 2006-2017 Chris Cannam and QMUL.
+  
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use, copy,
+  modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+  Except as contained in this notice, the names of the Centre for
+  Digital Music; Queen Mary, University of London; and Chris Cannam
+  shall not be used in advertising or otherwise to promote the sale,
+  use or other dealings in this Software without prior written
+  authorization.
+*/
+
+#ifndef PIPER_TRANSPORT_METRICS_H
+#define PIPER_TRANSPORT_METRICS_H
+
+#include "vamp-support/LatencyHistogram.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace piper_vamp {
+namespace client {
+
+/**
+ * A summary of the traffic through a SynchronousTransport since it
+ * was created, covering the calls that completed successfully.
+ *
+ * Each call is timed from the start of writing the request. The time
+ * to the first byte of the response is mostly the server's time to
+ * read, handle and start writing the request; the drain time, from
+ * the first byte to the last, is mostly the time spent moving the
+ * response through the pipe and the transport's read loop. The read
+ * wakeups count the times the transport was woken to look for
+ * response data, so many more wakeups than calls suggests a read
+ * loop that polls rather than waits.
+ */
+struct TransportMetrics
+{
+    struct Distribution {
+        Distribution() :
+            count(0), totalNs(0), maxNs(0), p50Ns(0), p95Ns(0), p99Ns(0) { }
+        uint64_t count;
+        uint64_t totalNs;
+        uint64_t maxNs;
+        uint64_t p50Ns;
+        uint64_t p95Ns;
+        uint64_t p99Ns;
+    };
+
+    TransportMetrics() :
+        calls(0), bytesSent(0), bytesReceived(0), readWakeups(0) { }
+    
+    uint64_t calls;
+    uint64_t bytesSent;
+    uint64_t bytesReceived;
+    uint64_t readWakeups;
+    Distribution roundTrip;
+    Distribution firstByte;
+    Distribution drain;
+};
+
+/**
+ * Gathers TransportMetrics for a transport implementation, which
+ * calls recordCall() at the end of each successful call. Recording
+ * takes no lock, and getMetrics() may be called from any thread.
+ */
+class TransportMetricsRecorder
+{
+public:
+    typedef std::chrono::steady_clock::time_point Time;
+
+    TransportMetricsRecorder() :
+        m_calls(0), m_bytesSent(0), m_bytesReceived(0), m_readWakeups(0) { }
+
+    TransportMetricsRecorder(const TransportMetricsRecorder &) =delete;
+    TransportMetricsRecorder &operator=(const TransportMetricsRecorder &) =delete;
+    
+    void recordCall(size_t bytesSent, size_t bytesReceived,
+                    Time started, Time firstByte, Time finished,
+                    uint64_t readWakeups) {
+        ++m_calls;
+        m_bytesSent += bytesSent;
+        m_bytesReceived += bytesReceived;
+        m_readWakeups += readWakeups;
+        m_roundTrip.record(ns(started, finished));
+        m_firstByte.record(ns(started, firstByte));
+        m_drain.record(ns(firstByte, finished));
+    }
+
+    TransportMetrics getMetrics() const {
+        TransportMetrics m;
+        m.calls = m_calls;
+        m.bytesSent = m_bytesSent;
+        m.bytesReceived = m_bytesReceived;
+        m.readWakeups = m_readWakeups;
+        m.roundTrip = summarise(m_roundTrip);
+        m.firstByte = summarise(m_firstByte);
+        m.drain = summarise(m_drain);
+        return m;
+    }
+
+private:
+    std::atomic<uint64_t> m_calls;
+    std::atomic<uint64_t> m_bytesSent;
+    std::atomic<uint64_t> m_bytesReceived;
+    std::atomic<uint64_t> m_readWakeups;
+    LatencyHistogram m_roundTrip;
+    LatencyHistogram m_firstByte;
+    LatencyHistogram m_drain;
+
+    static uint64_t ns(Time from, Time to) {
+        return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>
+                        (to - from).count());
+    }
+    
+    static TransportMetrics::Distribution
+    summarise(const LatencyHistogram &h) {
+        TransportMetrics::Distribution d;
+        d.count = h.getCount();
+        d.totalNs = h.getTotal();
+        d.maxNs = h.getMax();
+        d.p50Ns = h.getPercentile(0.5);
+        d.p95Ns = h.getPercentile(0.95);
+        d.p99Ns = h.getPercentile(0.99);
+        return d;
+    }
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,282 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+/*
+  Piper C++
+
+  An API for audio analysis and feature extraction plugins.
+
+  Centre for Digital Music, Queen Mary, University of London.
+  Copyright 2006-2017 Chris Cannam and QMUL.
+  
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use, copy,
+  modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+  Except as contained in this notice, the names of the Centre for
+  Digital Music; Queen Mary, University of London; and Chris Cannam
+  shall not be used in advertising or otherwise to promote the sale,
+  use or other dealings in this Software without prior written
+  authorization.
+*/
+ 
+#ifndef PIPER_FD_POSIX_TRANSPORT_H
+#define PIPER_FD_POSIX_TRANSPORT_H
+
+#include "../SynchronousTransport.h"
+#include "../Exceptions.h"
+
+#include <mutex>
+#include <chrono>
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+
+//#define DEBUG_TRANSPORT 1
+
+namespace piper_vamp {
+namespace client {
+
+/**
+ * The part of a POSIX SynchronousTransport that is common to all the
+ * ways of reaching a server: it writes each request to one file
+ * descriptor and reads the response from another (which may be the
+ * same one, for a socket). Subclasses arrange the descriptors and
+ * look after them: ProcessPosixTransport uses pipes to a child
+ * process, and SocketPosixTransport a connection to a server running
+ * in zygote mode.
+ *
+ * This class is thread-safe.
+ */
+class FdPosixTransport : public SynchronousTransport
+{
+public:
+    FdPosixTransport(const FdPosixTransport &) =delete;
+    FdPosixTransport &operator=(const FdPosixTransport &) =delete;
+    
+    void
+    setCompletenessChecker(MessageCompletenessChecker *checker) override {
+        m_completenessChecker = checker;
+    }
+    
+    bool
+    isOK() const override {
+        return (m_toServer >= 0) && !m_crashed;
+    }
+    
+    std::vector<char>
+    call(const char *ptr, size_t size, std::string type, bool slow) override {
+
+        std::lock_guard<std::mutex> locker(m_mutex);
+        
+        if (!m_completenessChecker) {
+            log("call: No completeness checker set on transport");
+            throw std::logic_error("No completeness checker set on transport");
+        }
+        if (!isOK()) {
+            log("call: Transport is not OK");
+            throw std::logic_error("Transport is not OK");
+        }
+        
+#ifdef DEBUG_TRANSPORT
+        std::cerr << "writing " << size << " bytes to server" << std::endl;
+#endif
+        auto started = std::chrono::steady_clock::now();
+        auto firstByte = started;
+        size_t bytesSent = size;
+        uint64_t wakeups = 0;
+        
+        while (size > 0) {
+            ssize_t n = writeToServer(ptr, size);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                log("Server failed during " + type + " request: " +
+                    strerror(errno));
+                m_crashed = true;
+                throw ServerCrashed();
+            }
+            ptr += n;
+            size -= n;
+        }
+        
+        std::vector<char> buffer;
+        bool complete = false;
+
+        // Timeouts as in ProcessQtTransport: none before the response
+        // starts, unless the call is marked as fast, and then a
+        // shorter one for a server that stalls part way through a
+        // response. Each is measured since data was last read.
+        //
+        int beforeResponseTimeout = 0; // ms, 0 = no timeout
+        if (!slow) beforeResponseTimeout = 10000;
+        int duringResponseTimeout = 5000;
+
+        auto lastRead = std::chrono::steady_clock::now();
+        
+        const size_t blockSize = 65536;
+        
+        while (!complete) {
+
+            bool responseStarted = !buffer.empty();
+            int timeout = (responseStarted ?
+                           duringResponseTimeout : beforeResponseTimeout);
+            int ms = int(std::chrono::duration_cast<std::chrono::milliseconds>
+                         (std::chrono::steady_clock::now() - lastRead).count());
+
+            if (timeout > 0 && ms > timeout) {
+                log(responseStarted ?
+                    "Server timed out during response" :
+                    "Server timed out before response");
+                m_crashed = true;
+                throw RequestTimedOut();
+            }
+
+            pollfd pfd;
+            pfd.fd = m_fromServer;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+
+            int rv = poll(&pfd, 1, timeout > 0 ? timeout - ms + 1 : 1000);
+            ++wakeups;
+            if (rv < 0 && errno != EINTR) {
+                log("Failed to wait for server during " + type + " request");
+                m_crashed = true;
+                throw ServerCrashed();
+            }
+            if (rv <= 0) continue;
+            
+            size_t formerSize = buffer.size();
+            buffer.resize(formerSize + blockSize);
+            ssize_t n = read(m_fromServer, buffer.data() + formerSize, blockSize);
+            if (n < 0 && errno == EINTR) {
+                // Interrupted by a signal before reading anything:
+                // not an error, just go round again
+                buffer.resize(formerSize);
+                continue;
+            }
+
+            if (n <= 0) {
+                // Pipe closed (or failed) before a complete response
+                log("Server crashed during " + type + " request");
+                m_crashed = true;
+                throw ServerCrashed();
+            }
+
+            buffer.resize(formerSize + n);
+            if (formerSize == 0) {
+                firstByte = std::chrono::steady_clock::now();
+            }
+#ifdef DEBUG_TRANSPORT
+            std::cerr << "read " << n << " bytes from server" << std::endl;
+#endif
+            switch (m_completenessChecker->check(buffer)) {
+            case MessageCompletenessChecker::Complete: complete = true; break;
+            case MessageCompletenessChecker::Incomplete: break;
+            case MessageCompletenessChecker::Invalid: throw ProtocolError();
+            }
+            lastRead = std::chrono::steady_clock::now();
+        }
+
+        m_metrics.recordCall(bytesSent, buffer.size(),
+                             started, firstByte, lastRead, wakeups);
+        return buffer;
+    }
+
+    TransportMetrics
+    getMetrics() const override {
+        return m_metrics.getMetrics();
+    }
+    
+protected:
+    FdPosixTransport(LogCallback *logger) : // logger may be nullptr for cerr
+        m_logger(logger),
+        m_completenessChecker(0),
+        m_toServer(-1),
+        m_fromServer(-1),
+        m_crashed(false),
+        m_noSigPipeFd(-1) {
+    }
+
+    LogCallback *m_logger;
+    MessageCompletenessChecker *m_completenessChecker; //!!! I don't own this (currently)
+    int m_toServer;   // owned by the subclass, which must close it
+    int m_fromServer; // likewise
+    std::mutex m_mutex;
+    bool m_crashed;
+    int m_noSigPipeFd;
+    TransportMetricsRecorder m_metrics;
+
+    /**
+     * Write to the server as write() does, except that if the server
+     * has gone away the write fails with EPIPE instead of raising
+     * SIGPIPE, which would kill the host by default. This is done
+     * without changing the disposition of SIGPIPE for the process,
+     * which belongs to the host.
+     */
+    ssize_t writeToServer(const char *ptr, size_t size) {
+#ifdef F_SETNOSIGPIPE
+        // The descriptor itself can be told not to raise it
+        if (m_noSigPipeFd != m_toServer) {
+            (void)fcntl(m_toServer, F_SETNOSIGPIPE, 1);
+            m_noSigPipeFd = m_toServer;
+        }
+        return write(m_toServer, ptr, size);
+#else
+        // Block SIGPIPE for this thread around the write, and if the
+        // write raised one, take it from the pending set before
+        // unblocking again, unless one was already pending for some
+        // other reason
+        sigset_t pipeSet, oldSet, pending;
+        sigemptyset(&pipeSet);
+        sigaddset(&pipeSet, SIGPIPE);
+        pthread_sigmask(SIG_BLOCK, &pipeSet, &oldSet);
+        sigemptyset(&pending);
+        sigpending(&pending);
+        bool wasPending = sigismember(&pending, SIGPIPE);
+
+        ssize_t n = write(m_toServer, ptr, size);
+        int err = errno;
+
+        if (n < 0 && err == EPIPE && !wasPending) {
+            timespec zero { 0, 0 };
+            while (sigtimedwait(&pipeSet, nullptr, &zero) < 0 &&
+                   errno == EINTR) {
+                continue;
+            }
+        }
+        pthread_sigmask(SIG_SETMASK, &oldSet, nullptr);
+        errno = err;
+        return n;
+#endif
+    }
+
+    void log(std::string message) const {
+        if (m_logger) m_logger->log(message);
+        else std::cerr << message << std::endl;
+    }
+};
+
+}
+}
+
+#endif
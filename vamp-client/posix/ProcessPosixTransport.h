@@ -0,0 +1,152 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+/*
+  Piper C++
+
+  An API for audio analysis and feature extraction plugins.
+
+  Centre for Digital Music, Queen Mary, University of London.
+  Copyright 2006-2016 Chris Cannam and QMUL.
+  
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use, copy,
+  modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+  Except as contained in this notice, the names of the Centre for
+  Digital Music; Queen Mary, University of London; and Chris Cannam
+  shall not be used in advertising or otherwise to promote the sale,
+  use or other dealings in this Software without prior written
+  authorization.
+*/
+ 
+#ifndef PIPER_PROCESS_POSIX_TRANSPORT_H
+#define PIPER_PROCESS_POSIX_TRANSPORT_H
+
+#include "FdPosixTransport.h"
+
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+namespace piper_vamp {
+namespace client {
+
+/**
+ * A SynchronousTransport implementation that spawns a sub-process
+ * using fork and exec, and talks to it via pipes connected to its
+ * stdin and stdout. The server's stderr is shared with our own.
+ * Calls are completely serialized, as in ProcessQtTransport, whose
+ * timeout behaviour this class follows. It is for use in programs
+ * that don't otherwise need Qt. Not available on Windows.
+ *
+ * This class is thread-safe.
+ */
+class ProcessPosixTransport : public FdPosixTransport
+{
+public:
+    ProcessPosixTransport(std::string processName,
+                          std::string formatArg,
+                          LogCallback *logger) : // logger may be nullptr for cerr
+        FdPosixTransport(logger),
+        m_pid(-1) {
+
+        int in[2], out[2];
+        if (pipe(in) < 0) {
+            log("Unable to create pipe for server process " + processName);
+            return;
+        }
+        if (pipe(out) < 0) {
+            log("Unable to create pipe for server process " + processName);
+            close(in[0]);
+            close(in[1]);
+            return;
+        }
+
+        m_pid = fork();
+        
+        if (m_pid < 0) {
+            log("Unable to start server process " + processName +
+                ": " + strerror(errno));
+            close(in[0]); close(in[1]);
+            close(out[0]); close(out[1]);
+            return;
+        }
+
+        if (m_pid == 0) {
+            dup2(in[0], 0);
+            dup2(out[1], 1);
+            close(in[0]); close(in[1]);
+            close(out[0]); close(out[1]);
+            execlp(processName.c_str(), processName.c_str(),
+                   formatArg.c_str(), (char *)nullptr);
+            // Can't log from here in any useful way; the parent will
+            // see us exit with no output
+            _exit(127);
+        }
+
+        close(in[0]);
+        close(out[1]);
+        m_toServer = in[1];
+        m_fromServer = out[0];
+
+        log("Server process " + processName + " started OK");
+    }
+
+    ~ProcessPosixTransport() {
+        if (m_pid > 0) {
+            close(m_toServer);
+            if (!waitForExit(200)) {
+                kill(m_pid, SIGTERM);
+                if (!waitForExit(2000)) {
+                    kill(m_pid, SIGKILL);
+                    waitpid(m_pid, nullptr, 0);
+                }
+            }
+            close(m_fromServer);
+            log("Server process exited");
+        }
+    }
+
+    ProcessPosixTransport(const ProcessPosixTransport &) =delete;
+    ProcessPosixTransport &operator=(const ProcessPosixTransport &) =delete;
+    
+private:
+    pid_t m_pid;
+
+    bool waitForExit(int ms) {
+        auto start = std::chrono::steady_clock::now();
+        while (true) {
+            pid_t rv = waitpid(m_pid, nullptr, WNOHANG);
+            if (rv == m_pid || (rv < 0 && errno != EINTR)) return true;
+            if (std::chrono::steady_clock::now() - start >
+                std::chrono::milliseconds(ms)) {
+                return false;
+            }
+            usleep(10000);
+        }
+    }
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,114 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+/*
+  Piper C++
+
+  An API for audio analysis and feature extraction plugins.
+
+  Centre for Digital Music, Queen Mary, University of London.
+  Copyright 2006-2017 Chris Cannam and QMUL.
+  
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use, copy,
+  modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+  Except as contained in this notice, the names of the Centre for
+  Digital Music; Queen Mary, University of London; and Chris Cannam
+  shall not be used in advertising or otherwise to promote the sale,
+  use or other dealings in this Software without prior written
+  authorization.
+*/
+ 
+#ifndef PIPER_SOCKET_POSIX_TRANSPORT_H
+#define PIPER_SOCKET_POSIX_TRANSPORT_H
+
+#include "FdPosixTransport.h"
+
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+namespace piper_vamp {
+namespace client {
+
+/**
+ * A SynchronousTransport implementation that connects to a Piper
+ * server running in zygote mode (piper-vamp-simple-server -z
+ * <socket>) through its Unix-domain socket. The zygote forks a new
+ * server for each connection, so each transport object has a server
+ * of its own, as with ProcessPosixTransport, but without the cost of
+ * starting a process and scanning the plugin path.
+ *
+ * The server speaks whichever format the zygote was started with, so
+ * that must be the format the client uses: capnp for CapnpRRClient.
+ * The server exits when the transport is destroyed and the
+ * connection closed. Not available on Windows.
+ *
+ * This class is thread-safe.
+ */
+class SocketPosixTransport : public FdPosixTransport
+{
+public:
+    SocketPosixTransport(std::string socketPath,
+                         LogCallback *logger) : // logger may be nullptr for cerr
+        FdPosixTransport(logger) {
+
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (socketPath.size() >= sizeof(addr.sun_path)) {
+            log("Socket path " + socketPath + " is too long");
+            return;
+        }
+        strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+            log(std::string("Unable to create socket: ") + strerror(errno));
+            return;
+        }
+
+        if (connect(fd, (sockaddr *)&addr, sizeof(addr)) < 0) {
+            log("Unable to connect to server socket " + socketPath +
+                ": " + strerror(errno));
+            close(fd);
+            return;
+        }
+
+        m_toServer = fd;
+        m_fromServer = fd;
+
+        log("Connected to server socket " + socketPath);
+    }
+
+    ~SocketPosixTransport() {
+        if (m_toServer >= 0) {
+            close(m_toServer);
+        }
+    }
+
+    SocketPosixTransport(const SocketPosixTransport &) =delete;
+    SocketPosixTransport &operator=(const SocketPosixTransport &) =delete;
+};
+
+}
+}
+
+#endif
@@ -37,6 +37,7 @@
 #define PIPER_AUTO_PLUGIN_H
 
 #include "ProcessQtTransport.h"
+#include "PiperServerRegistry.h"
 #include "../CapnpRRClient.h"
 #include "../Exceptions.h"
 
@@ -67,6 +68,13 @@ namespace client {
  * AutoPlugin makes use of the Loader and PluginClient interfaces,
  * providing them its own transport layer object for its single server.
  *
+ * Alternatively, a PiperServerRegistry may be supplied on
+ * construction, in which case the plugin shares a server with any
+ * other AutoPlugins obtained through the same registry using the
+ * same server executable. This avoids the cost of a process per
+ * plugin in hosts that load many plugins at once. The shared server
+ * exits when the last plugin using it is deleted.
+ *
  * Note that any method may throw ServerCrashed, RequestTimedOut or
  * ProtocolError exceptions.
  */
@@ -89,28 +97,46 @@ public:
                     float inputSampleRate,
                     int adapterFlags,
                     LogCallback *logger) : // logger may be nullptr for cerr
-        Vamp::Plugin(inputSampleRate),
-        m_logger(logger),
-        m_transport(serverName, "capnp", logger),
-        m_client(&m_transport, logger)
-    {
-        LoadRequest req;
-        req.pluginKey = pluginKey;
-        req.inputSampleRate = inputSampleRate;
-        req.adapterFlags = adapterFlags;
-        try {
-            LoadResponse resp = m_client.load(req);
-            m_plugin = resp.plugin;
-        } catch (const ServerCrashed &c) {
-            log(std::string("PiperAutoPlugin: Server crashed: ") + c.what());
-            m_plugin = 0;
-        }
-    }
+        PiperAutoPlugin(std::make_shared<PiperServerRegistry::Server>
+                        (serverName, logger),
+                        pluginKey,
+                        inputSampleRate,
+                        adapterFlags,
+                        logger)
+    { }
+
+    /**
+     * Construct a PiperAutoPlugin that requests the given plugin key
+     * from a server with the given server name (executable path)
+     * obtained from the given registry. The server is started if
+     * the registry does not already have a working one with that
+     * name, and is otherwise shared with the other plugins using it.
+     *
+     * \param adapterFlags a bitwise OR of the values in the
+     * Vamp::HostExt::PluginLoader::AdapterFlags enumeration
+     *
+     * \param logger an optional callback for this plugin's own log
+     * messages. Pass a null pointer to use cerr instead. The server
+     * logs to the registry's logger instead.
+     */
+    PiperAutoPlugin(PiperServerRegistry &registry,
+                    std::string serverName,
+                    std::string pluginKey,
+                    float inputSampleRate,
+                    int adapterFlags,
+                    LogCallback *logger) : // logger may be nullptr for cerr
+        PiperAutoPlugin(registry.getServer(serverName),
+                        pluginKey,
+                        inputSampleRate,
+                        adapterFlags,
+                        logger)
+    { }
 
     virtual ~PiperAutoPlugin() {
         delete m_plugin;
-        // The transport is a plain data member and will be deleted
-        // here, which will have the effect of terminating the server
+        // If we were the last user of the server, it will be deleted
+        // when m_server goes out of scope here, which will have the
+        // effect of terminating the server process
     }
 
     bool isOK() const {
@@ -210,9 +236,32 @@ public:
 
 private:
     LogCallback *m_logger;
-    ProcessQtTransport m_transport;
-    CapnpRRClient m_client;
+    std::shared_ptr<PiperServerRegistry::Server> m_server;
     Vamp::Plugin *m_plugin;
+
+    PiperAutoPlugin(std::shared_ptr<PiperServerRegistry::Server> server,
+                    std::string pluginKey,
+                    float inputSampleRate,
+                    int adapterFlags,
+                    LogCallback *logger) :
+        Vamp::Plugin(inputSampleRate),
+        m_logger(logger),
+        m_server(server),
+        m_plugin(nullptr)
+    {
+        LoadRequest req;
+        req.pluginKey = pluginKey;
+        req.inputSampleRate = inputSampleRate;
+        req.adapterFlags = adapterFlags;
+        try {
+            LoadResponse resp = m_server->getClient().load(req);
+            m_plugin = resp.plugin;
+        } catch (const ServerCrashed &c) {
+            log(std::string("PiperAutoPlugin: Server crashed: ") + c.what());
+            m_plugin = 0;
+        }
+    }
+
     Vamp::Plugin *getPlugin() const {
         if (!m_plugin) {
             log("PiperAutoPlugin: getPlugin() failed (caller should have called PiperAutoPlugin::isOK)");
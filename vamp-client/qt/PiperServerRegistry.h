@@ -0,0 +1,181 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+/*
+  Piper C++
+
+  An API for audio analysis and feature extraction plugins.
+
+  Centre for Digital Music, Queen Mary, University of London.
+  Copyright 2006-2017 Chris Cannam and QMUL.
+  
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use, copy,
+  modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+  Except as contained in this notice, the names of the Centre for
+  Digital Music; Queen Mary, University of London; and Chris Cannam
+  shall not be used in advertising or otherwise to promote the sale,
+  use or other dealings in this Software without prior written
+  authorization.
+*/
+
+#ifndef PIPER_SERVER_REGISTRY_H
+#define PIPER_SERVER_REGISTRY_H
+
+#include "ProcessQtTransport.h"
+#include "../CapnpRRClient.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace piper_vamp {
+namespace client {
+
+/**
+ * PiperServerRegistry allows several PiperAutoPlugin instances to
+ * share a single Piper server process, rather than each running its
+ * own.
+ *
+ * Servers are keyed by server executable path, and always talk
+ * Cap'n Proto, as that is the only format CapnpRRClient speaks. Every
+ * plugin obtained through the registry still has its own plugin
+ * handle within the shared server; the server process lives for as
+ * long as any plugin (or other holder) is still using it, and exits
+ * when the last one goes away.
+ *
+ * If a shared server crashes, only the plugins that were using that
+ * server are affected: the registry will not hand out a crashed
+ * server again, but will start a new one for the next request with
+ * the same key.
+ *
+ * Use of the registry is opt-in. A PiperAutoPlugin constructed
+ * without one continues to run its own private server.
+ *
+ * Log messages from every server the registry starts go to the
+ * logger given to the registry on construction, which the servers
+ * share ownership of, so that it remains valid for as long as any of
+ * them does, whichever plugin happened to start it.
+ *
+ * The registry itself is thread-safe, but note the caveats about
+ * threads in the documentation for ProcessQtTransport.
+ */
+class PiperServerRegistry
+{
+public:
+    /**
+     * A single server process, started in capnp mode, with the
+     * client used to talk to it.
+     */
+    class Server
+    {
+    public:
+        /**
+         * Start a server that logs to the given logger, or to cerr
+         * if it is null. The server keeps a reference to the logger.
+         */
+        Server(std::string serverName,
+               std::shared_ptr<LogCallback> logger) :
+            m_logger(logger),
+            m_transport(serverName, "capnp", m_logger.get()),
+            m_client(&m_transport, m_logger.get()) { }
+
+        /**
+         * Start a server that logs to the given logger, or to cerr
+         * if it is null. The caller retains ownership of the logger,
+         * which must outlive the server.
+         */
+        Server(std::string serverName,
+               LogCallback *logger) :
+            Server(serverName,
+                   std::shared_ptr<LogCallback>(logger, [](LogCallback *) { }))
+        { }
+
+        Server(const Server &) =delete;
+        Server &operator=(const Server &) =delete;
+        
+        CapnpRRClient &getClient() {
+            return m_client;
+        }
+
+        /**
+         * Return true if the server process started successfully
+         * and has not since crashed.
+         */
+        bool isOK() const {
+            return m_transport.isOK();
+        }
+        
+    private:
+        std::shared_ptr<LogCallback> m_logger;
+        ProcessQtTransport m_transport;
+        CapnpRRClient m_client;
+    };
+
+    /**
+     * Construct a registry whose servers log to the given logger, or
+     * to cerr if it is null.
+     */
+    PiperServerRegistry(std::shared_ptr<LogCallback> logger = {}) :
+        m_logger(logger) { }
+
+    PiperServerRegistry(const PiperServerRegistry &) =delete;
+    PiperServerRegistry &operator=(const PiperServerRegistry &) =delete;
+    
+    /**
+     * Return a server for the given executable path, starting one if
+     * there is no working server for that path already in use.
+     */
+    std::shared_ptr<Server>
+    getServer(std::string serverName) {
+
+        std::lock_guard<std::mutex> guard(m_mutex);
+
+        // Forget servers that nobody is using any more, so that a
+        // long-lived registry used with many paths does not grow
+        for (auto i = m_servers.begin(); i != m_servers.end(); ) {
+            if (i->second.expired()) {
+                i = m_servers.erase(i);
+            } else {
+                ++i;
+            }
+        }
+
+        auto itr = m_servers.find(serverName);
+        if (itr != m_servers.end()) {
+            auto server = itr->second.lock();
+            if (server && server->isOK()) {
+                return server;
+            }
+        }
+
+        auto server = std::make_shared<Server>(serverName, m_logger);
+        m_servers[serverName] = server;
+        return server;
+    }
+
+private:
+    std::shared_ptr<LogCallback> m_logger;
+    std::map<std::string, std::weak_ptr<Server>> m_servers;
+    std::mutex m_mutex;
+};
+
+}
+}
+
+#endif
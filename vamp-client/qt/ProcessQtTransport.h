@@ -45,6 +45,7 @@
 #include <QElapsedTimer>
 
 #include <iostream>
+#include <chrono>
 
 //#define DEBUG_TRANSPORT 1
 
@@ -149,6 +150,10 @@ public:
 #ifdef DEBUG_TRANSPORT
         std::cerr << "writing " << size << " bytes to server" << std::endl;
 #endif
+        auto started = std::chrono::steady_clock::now();
+        auto firstByte = started;
+        uint64_t wakeups = 0;
+        
         m_process->write(ptr, size);
         m_process->waitForBytesWritten();
         
@@ -206,6 +211,7 @@ public:
 #ifdef DEBUG_TRANSPORT
                 std::cerr << "waiting for data from server (slow = " << slow << ")..." << std::endl;
 #endif
+                ++wakeups;
                 if (slow) {
                     m_process->waitForReadyRead(1000);
                 } else {
@@ -238,6 +244,9 @@ public:
                 }
             } else {
                 size_t formerSize = buffer.size();
+                if (formerSize == 0) {
+                    firstByte = std::chrono::steady_clock::now();
+                }
                 buffer.resize(formerSize + byteCount);
                 m_process->read(buffer.data() + formerSize, byteCount);
                 switch (m_completenessChecker->check(buffer)) {
@@ -249,9 +258,17 @@ public:
             }
         }
 
+        m_metrics.recordCall(size, buffer.size(), started, firstByte,
+                             std::chrono::steady_clock::now(), wakeups);
+        
         logServerErrors();
         return buffer;
     }
+
+    TransportMetrics
+    getMetrics() const override {
+        return m_metrics.getMetrics();
+    }
     
 private:
     LogCallback *m_logger;
@@ -259,6 +276,7 @@ private:
     QProcess *m_process; // I own this
     QMutex m_mutex;
     bool m_crashed;
+    TransportMetricsRecorder m_metrics;
 
     void log(std::string message) const {
         if (m_logger) m_logger->log(message);
@@ -83,7 +83,8 @@ int main(int argc, char **argv)
 
         enum {
             explicitServer = 1,
-            autoServer = 2
+            autoServer = 2,
+            sharedAutoServer = 3
         };
         enum {
             timeDomain = 1,
@@ -91,12 +92,14 @@ int main(int argc, char **argv)
             frequencyDomainClientSide = 3
         };
 
+        piper_vamp::client::PiperServerRegistry registry;
+        
         for (int domain = timeDomain;
              domain <= frequencyDomainClientSide;
              ++domain) {
 
             for (int serverSort = explicitServer;
-                 serverSort <= autoServer;
+                 serverSort <= sharedAutoServer;
                  ++serverSort) {
 
                 string id = zeroCrossing;
@@ -106,6 +109,7 @@ int main(int argc, char **argv)
                 }
             
                 Vamp::Plugin *plugin = nullptr;
+                piper_vamp::client::PiperAutoPlugin *companion = nullptr;
 
                 int adapterFlags = 0;
                 if (domain == frequencyDomainServerSide) {
@@ -130,7 +134,7 @@ int main(int argc, char **argv)
                     }
                     cerr << "+++ OK" << endl;
 
-                } else {
+                } else if (serverSort == autoServer) {
                 
                     cerr << endl << "*** Test: loading \"" << id
                          << "\" with auto-plugin" << endl;
@@ -144,6 +148,28 @@ int main(int argc, char **argv)
                     }
                     cerr << "+++ OK" << endl;
 
+                    plugin = ap;
+
+                } else {
+                
+                    cerr << endl << "*** Test: loading \"" << id
+                         << "\" with auto-plugin using shared server" << endl;
+
+                    // Load a second plugin first, so that the server
+                    // is in use by another plugin for the duration
+                    // of this one
+                    companion = new piper_vamp::client::PiperAutoPlugin
+                        (registry, server, zeroCrossing, 16, 0, logger);
+                    
+                    piper_vamp::client::PiperAutoPlugin *ap =
+                        new piper_vamp::client::PiperAutoPlugin
+                        (registry, server, id, 16, adapterFlags, logger);
+                    if (!companion->isOK() || !ap->isOK()) {
+                        cerr << "--- ERROR: PiperAutoPlugin creation failed" << endl;
+                        return 1;
+                    }
+                    cerr << "+++ OK" << endl;
+
                     plugin = ap;
                 }
 
@@ -226,6 +252,7 @@ int main(int argc, char **argv)
 
                 cerr << endl << "*** Test: deleting plugin" << endl;
                 delete plugin;
+                delete companion;
                 cerr << "+++ OK" << endl;
             }
         }
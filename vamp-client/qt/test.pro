@@ -33,6 +33,7 @@ SOURCES += \
 HEADERS += \
         ProcessQtTransport.h \
         PiperAutoPlugin.h \
+        PiperServerRegistry.h \
         ../CapnpRRClient.h \
         ../Loader.h \
         ../PluginClient.h \
@@ -429,6 +429,53 @@ public:
         return std::vector<float>(buffer, buffer + n);
     }
 
+    static std::string
+    fromSampleBuffer(const float *buffer, size_t n, SampleFormat format) {
+        if (format == SampleFormat::Float32) {
+            return fromFloatBuffer(buffer, n);
+        }
+        std::vector<char> packed(n * bytesPerSample(format));
+        packSamples(buffer, n, format, packed.data());
+        std::string encoded;
+        bn::encode_b64(packed.begin(), packed.end(), back_inserter(encoded));
+        return encoded;
+    }
+
+    static std::vector<float>
+    toSampleBuffer(std::string encoded, SampleFormat format, std::string &err) {
+        std::string decoded;
+        bn::decode_b64(encoded.begin(), encoded.end(), back_inserter(decoded));
+        if (decoded.size() % bytesPerSample(format) != 0) {
+            err = "sample buffer length " + std::to_string(decoded.size()) +
+                " is not a whole number of " +
+                fromSampleFormat(format) + " samples";
+            return {};
+        }
+        std::vector<float> buffer(decoded.size() / bytesPerSample(format));
+        unpackSamples(decoded.data(), buffer.size(), format, buffer.data());
+        return buffer;
+    }
+
+    static std::string
+    fromSampleFormat(SampleFormat format) {
+        switch (format) {
+        case SampleFormat::Float32: return "float32";
+        case SampleFormat::Int16: return "int16";
+        case SampleFormat::Float16: return "float16";
+        }
+        return "float32";
+    }
+
+    static SampleFormat
+    toSampleFormat(json11::Json j, std::string &err) {
+        std::string text = j.string_value();
+        if (text == "float32") return SampleFormat::Float32;
+        if (text == "int16") return SampleFormat::Int16;
+        if (text == "float16") return SampleFormat::Float16;
+        err = "invalid sample format string: " + text;
+        return {};
+    }
+
     static json11::Json
     fromFeature(const Vamp::Plugin::Feature &f,
                 BufferSerialisation serialisation) {
@@ -981,6 +1028,9 @@ public:
         jo["key"] = req.pluginKey;
         jo["inputSampleRate"] = req.inputSampleRate;
         jo["adapterFlags"] = fromAdapterFlags(req.adapterFlags);
+        if (req.omitProgramParameters) {
+            jo["omitProgramParameters"] = true;
+        }
         return json11::Json(jo);
     }
 
@@ -1001,6 +1051,13 @@ public:
             req.adapterFlags = toAdapterFlags(j["adapterFlags"], err);
             if (failed(err)) return {};
         }
+        if (!j["omitProgramParameters"].is_null()) {
+            if (!j["omitProgramParameters"].is_bool()) {
+                err = "boolean expected for omitProgramParameters field";
+                return {};
+            }
+            req.omitProgramParameters = j["omitProgramParameters"].bool_value();
+        }
         return req;
     }
 
@@ -1140,29 +1197,117 @@ public:
     }
 
     static json11::Json
-    fromProcessRequest(const ProcessRequest &r,
-                       const PluginHandleMapper &pmapper,
-                       BufferSerialisation serialisation) {
+    fromResourceUsage(const ResourceUsage &u) {
 
-        json11::Json::object jo;
-        jo["handle"] = double(pmapper.pluginToHandle(r.plugin));
+        json11::Json::object uo;
+        uo["calls"] = double(u.calls);
+        uo["cpuNs"] = double(u.cpuNs);
+        uo["allocatedBytes"] = double(u.allocatedBytes);
+        uo["allocations"] = double(u.allocations);
+        return json11::Json(uo);
+    }
+
+    static ResourceUsage
+    toResourceUsage(json11::Json j) {
+
+        ResourceUsage u;
+        u.calls = uint64_t(j["calls"].number_value());
+        u.cpuNs = uint64_t(j["cpuNs"].number_value());
+        u.allocatedBytes = uint64_t(j["allocatedBytes"].number_value());
+        u.allocations = uint64_t(j["allocations"].number_value());
+        return u;
+    }
+
+    static json11::Json
+    fromProcessInput(Vamp::RealTime timestamp,
+                     const std::vector<std::vector<float> > &inputBuffers,
+                     SampleFormat sampleFormat,
+                     BufferSerialisation serialisation) {
 
         json11::Json::object io;
-        io["timestamp"] = fromRealTime(r.timestamp);
+        io["timestamp"] = fromRealTime(timestamp);
 
         json11::Json::array chans;
-        for (size_t i = 0; i < r.inputBuffers.size(); ++i) {
+        for (size_t i = 0; i < inputBuffers.size(); ++i) {
             if (serialisation == BufferSerialisation::Array) {
-                chans.push_back(json11::Json::array(r.inputBuffers[i].begin(),
-                                                    r.inputBuffers[i].end()));
+                chans.push_back(json11::Json::array(inputBuffers[i].begin(),
+                                                    inputBuffers[i].end()));
             } else {
-                chans.push_back(fromFloatBuffer(r.inputBuffers[i].data(),
-                                                r.inputBuffers[i].size()));
+                chans.push_back(fromSampleBuffer(inputBuffers[i].data(),
+                                                 inputBuffers[i].size(),
+                                                 sampleFormat));
             }
         }
         io["inputBuffers"] = chans;
+
+        // In array serialisation the samples are written as numbers
+        // whatever the format, but we still record it, so that a
+        // request converted from JSON keeps the format it had
+        if (sampleFormat != SampleFormat::Float32) {
+            io["sampleFormat"] = fromSampleFormat(sampleFormat);
+        }
+
+        return json11::Json(io);
+    }
+
+    static void
+    toProcessInput(json11::Json input,
+                   Vamp::RealTime &timestamp,
+                   std::vector<std::vector<float> > &inputBuffers,
+                   SampleFormat &sampleFormat,
+                   BufferSerialisation &serialisation, std::string &err) {
+
+        if (!input.has_shape({
+                    { "timestamp", json11::Json::OBJECT },
+                    { "inputBuffers", json11::Json::ARRAY } }, err)) {
+            return;
+        }
+
+        timestamp = toRealTime(input["timestamp"], err);
+        if (failed(err)) return;
+
+        sampleFormat = SampleFormat::Float32;
+        if (!input["sampleFormat"].is_null()) {
+            sampleFormat = toSampleFormat(input["sampleFormat"], err);
+            if (failed(err)) return;
+        }
+
+        inputBuffers.clear();
         
-        jo["processInput"] = io;
+        for (const auto &a: input["inputBuffers"].array_items()) {
+
+            if (a.is_string()) {
+                std::vector<float> buf = toSampleBuffer(a.string_value(),
+                                                        sampleFormat,
+                                                        err);
+                if (failed(err)) return;
+                inputBuffers.push_back(buf);
+                serialisation = BufferSerialisation::Base64;
+
+            } else if (a.is_array()) {
+                std::vector<float> buf;
+                for (auto v : a.array_items()) {
+                    buf.push_back(float(v.number_value()));
+                }
+                inputBuffers.push_back(buf);
+                serialisation = BufferSerialisation::Array;
+
+            } else {
+                err = "expected arrays or strings in inputBuffers array";
+                return;
+            }
+        }
+    }
+    
+    static json11::Json
+    fromProcessRequest(const ProcessRequest &r,
+                       const PluginHandleMapper &pmapper,
+                       BufferSerialisation serialisation) {
+
+        json11::Json::object jo;
+        jo["handle"] = double(pmapper.pluginToHandle(r.plugin));
+        jo["processInput"] = fromProcessInput(r.timestamp, r.inputBuffers,
+                                              r.sampleFormat, serialisation);
         return json11::Json(jo);
     }
 
@@ -1178,43 +1323,62 @@ public:
             return {};
         }
 
-        auto input = j["processInput"];
+        ProcessRequest r;
+        auto h = j["handle"].int_value();
+        r.plugin = pmapper.handleToPlugin(h);
 
-        if (!input.has_shape({
-                    { "timestamp", json11::Json::OBJECT },
-                    { "inputBuffers", json11::Json::ARRAY } }, err)) {
+        toProcessInput(j["processInput"], r.timestamp, r.inputBuffers,
+                       r.sampleFormat, serialisation, err);
+        if (failed(err)) {
             err = "malformed process request: " + err;
             return {};
         }
 
-        ProcessRequest r;
-        auto h = j["handle"].int_value();
-        r.plugin = pmapper.handleToPlugin(h);
+        return r;
+    }
 
-        r.timestamp = toRealTime(input["timestamp"], err);
-        if (failed(err)) return {};
+    static json11::Json
+    fromProcessMultiRequest(const ProcessMultiRequest &r,
+                            const PluginHandleMapper &pmapper,
+                            BufferSerialisation serialisation) {
 
-        for (const auto &a: input["inputBuffers"].array_items()) {
+        json11::Json::object jo;
+        json11::Json::array handles;
+        for (auto p: r.plugins) {
+            handles.push_back(double(pmapper.pluginToHandle(p)));
+        }
+        jo["handles"] = handles;
+        jo["processInput"] = fromProcessInput(r.timestamp, r.inputBuffers,
+                                              r.sampleFormat, serialisation);
+        return json11::Json(jo);
+    }
 
-            if (a.is_string()) {
-                std::vector<float> buf = toFloatBuffer(a.string_value(),
-                                                       err);
-                if (failed(err)) return {};
-                r.inputBuffers.push_back(buf);
-                serialisation = BufferSerialisation::Base64;
+    static ProcessMultiRequest
+    toProcessMultiRequest(json11::Json j,
+                          const PluginHandleMapper &pmapper,
+                          BufferSerialisation &serialisation, std::string &err) {
 
-            } else if (a.is_array()) {
-                std::vector<float> buf;
-                for (auto v : a.array_items()) {
-                    buf.push_back(float(v.number_value()));
-                }
-                r.inputBuffers.push_back(buf);
-                serialisation = BufferSerialisation::Array;
+        if (!j.has_shape({
+                    { "handles", json11::Json::ARRAY },
+                    { "processInput", json11::Json::OBJECT } }, err)) {
+            err = "malformed processMulti request: " + err;
+            return {};
+        }
 
-            } else {
-                err = "expected arrays or strings in inputBuffers array";
+        ProcessMultiRequest r;
+        for (const auto &h: j["handles"].array_items()) {
+            if (!h.is_number()) {
+                err = "malformed processMulti request: number expected in handles array";
                 return {};
             }
+            r.plugins.push_back(pmapper.handleToPlugin(h.int_value()));
+        }
+
+        toProcessInput(j["processInput"], r.timestamp, r.inputBuffers,
+                       r.sampleFormat, serialisation, err);
+        if (failed(err)) {
+            err = "malformed processMulti request: " + err;
+            return {};
         }
 
         return r;
@@ -1428,6 +1592,9 @@ public:
 
         json11::Json::object fo;
         fo["handle"] = double(pmapper.pluginToHandle(req.plugin));
+        if (req.includeUsage) {
+            fo["includeUsage"] = true;
+        }
 
         jo["method"] = "finish";
         jo["params"] = fo;
@@ -1449,12 +1616,229 @@ public:
         po["features"] = fromFeatureSet(resp.features,
                                         *pmapper.pluginToOutputIdMapper(resp.plugin),
                                         serialisation);
+        if (resp.hasUsage) {
+            po["usage"] = fromResourceUsage(resp.usage);
+        }
         jo["method"] = "finish";
         jo["result"] = po;
         addId(jo, id);
         return json11::Json(jo);
     }
 
+    static json11::Json
+    fromRpcRequest_Reset(const ResetRequest &req,
+                         const PluginHandleMapper &pmapper,
+                         const json11::Json &id) {
+
+        json11::Json::object jo;
+        markRPC(jo);
+
+        json11::Json::object fo;
+        fo["handle"] = double(pmapper.pluginToHandle(req.plugin));
+
+        jo["method"] = "reset";
+        jo["params"] = fo;
+        addId(jo, id);
+        return json11::Json(jo);
+    }    
+    
+    static json11::Json
+    fromRpcResponse_Reset(const ResetResponse &resp,
+                          const PluginHandleMapper &pmapper,
+                          const json11::Json &id) {
+
+        json11::Json::object jo;
+        markRPC(jo);
+
+        json11::Json::object po;
+        po["handle"] = double(pmapper.pluginToHandle(resp.plugin));
+        jo["method"] = "reset";
+        jo["result"] = po;
+        addId(jo, id);
+        return json11::Json(jo);
+    }
+
+    static json11::Json
+    fromRpcRequest_ProcessFile(const ProcessFileRequest &req,
+                               const PluginHandleMapper &pmapper,
+                               const json11::Json &id) {
+
+        json11::Json::object jo;
+        markRPC(jo);
+
+        json11::Json::object fo;
+        fo["handle"] = double(pmapper.pluginToHandle(req.plugin));
+        fo["filename"] = req.filename;
+
+        jo["method"] = "processFile";
+        jo["params"] = fo;
+        addId(jo, id);
+        return json11::Json(jo);
+    }    
+    
+    static json11::Json
+    fromRpcResponse_ProcessFile(const ProcessFileResponse &resp,
+                                const PluginHandleMapper &pmapper,
+                                BufferSerialisation serialisation,
+                                const json11::Json &id) {
+
+        json11::Json::object jo;
+        markRPC(jo);
+
+        json11::Json::object po;
+        po["handle"] = double(pmapper.pluginToHandle(resp.plugin));
+        po["features"] = fromFeatureSet(resp.features,
+                                        *pmapper.pluginToOutputIdMapper(resp.plugin),
+                                        serialisation);
+        jo["method"] = "processFile";
+        jo["result"] = po;
+        addId(jo, id);
+        return json11::Json(jo);
+    }
+
+    static json11::Json
+    fromRpcRequest_ProcessMulti(const ProcessMultiRequest &req,
+                                const PluginHandleMapper &pmapper,
+                                BufferSerialisation serialisation,
+                                const json11::Json &id) {
+
+        json11::Json::object jo;
+        markRPC(jo);
+
+        jo["method"] = "processMulti";
+        jo["params"] = fromProcessMultiRequest(req, pmapper, serialisation);
+        addId(jo, id);
+        return json11::Json(jo);
+    }    
+
+    static json11::Json
+    fromRpcResponse_ProcessMulti(const ProcessMultiResponse &resp,
+                                 const PluginHandleMapper &pmapper,
+                                 BufferSerialisation serialisation,
+                                 const json11::Json &id) {
+        
+        json11::Json::object jo;
+        markRPC(jo);
+
+        json11::Json::array results;
+        for (const auto &r: resp.responses) {
+            json11::Json::object po;
+            po["handle"] = double(pmapper.pluginToHandle(r.plugin));
+            po["features"] = fromFeatureSet(r.features,
+                                            *pmapper.pluginToOutputIdMapper(r.plugin),
+                                            serialisation);
+            results.push_back(po);
+        }
+        
+        json11::Json::object ro;
+        ro["results"] = results;
+        
+        jo["method"] = "processMulti";
+        jo["result"] = ro;
+        addId(jo, id);
+        return json11::Json(jo);
+    }
+
+    static json11::Json
+    fromRpcRequest_ProcessSegmented(const ProcessSegmentedRequest &req,
+                                    const PluginHandleMapper &pmapper,
+                                    const json11::Json &id) {
+
+        json11::Json::object jo;
+        markRPC(jo);
+
+        json11::Json::object fo;
+        fo["handle"] = double(pmapper.pluginToHandle(req.plugin));
+        fo["filename"] = req.filename;
+        if (req.segmentCount > 0) {
+            fo["segmentCount"] = req.segmentCount;
+        }
+        if (req.warmupSteps >= 0) {
+            fo["warmupSteps"] = req.warmupSteps;
+        }
+
+        jo["method"] = "processSegmented";
+        jo["params"] = fo;
+        addId(jo, id);
+        return json11::Json(jo);
+    }    
+    
+    static json11::Json
+    fromRpcResponse_ProcessSegmented(const ProcessSegmentedResponse &resp,
+                                     const PluginHandleMapper &pmapper,
+                                     BufferSerialisation serialisation,
+                                     const json11::Json &id) {
+
+        json11::Json::object jo;
+        markRPC(jo);
+
+        json11::Json::object po;
+        po["handle"] = double(pmapper.pluginToHandle(resp.plugin));
+        po["features"] = fromFeatureSet(resp.features,
+                                        *pmapper.pluginToOutputIdMapper(resp.plugin),
+                                        serialisation);
+        jo["method"] = "processSegmented";
+        jo["result"] = po;
+        addId(jo, id);
+        return json11::Json(jo);
+    }
+
+    static json11::Json
+    fromRpcRequest_Stats(const StatsRequest &,
+                         const json11::Json &id) {
+
+        json11::Json::object jo;
+        markRPC(jo);
+
+        jo["method"] = "stats";
+        jo["params"] = json11::Json::object();
+        addId(jo, id);
+        return json11::Json(jo);
+    }
+
+    static json11::Json
+    fromRpcResponse_Stats(const StatsResponse &resp,
+                          const json11::Json &id) {
+
+        json11::Json::object jo;
+        markRPC(jo);
+
+        json11::Json::array timings;
+        for (const auto &t: resp.timings) {
+            json11::Json::object to;
+            to["method"] = t.method;
+            if (t.pluginKey != "") {
+                to["pluginKey"] = t.pluginKey;
+            }
+            to["phase"] = t.phase;
+            to["count"] = double(t.count);
+            to["totalNs"] = double(t.totalNs);
+            to["maxNs"] = double(t.maxNs);
+            to["p50Ns"] = double(t.p50Ns);
+            to["p95Ns"] = double(t.p95Ns);
+            to["p99Ns"] = double(t.p99Ns);
+            timings.push_back(to);
+        }
+
+        json11::Json::array plugins;
+        for (const auto &p: resp.plugins) {
+            json11::Json::object po;
+            po["handle"] = double(p.handle);
+            po["pluginKey"] = p.pluginKey;
+            po["usage"] = fromResourceUsage(p.usage);
+            plugins.push_back(po);
+        }
+
+        json11::Json::object ro;
+        ro["timings"] = timings;
+        ro["plugins"] = plugins;
+        
+        jo["method"] = "stats";
+        jo["result"] = ro;
+        addId(jo, id);
+        return json11::Json(jo);
+    }
+
     static json11::Json
     fromError(std::string errorText,
               RRType responseType,
@@ -1471,6 +1855,11 @@ public:
         else if (responseType == RRType::Configure) type = "configure";
         else if (responseType == RRType::Process) type = "process";
         else if (responseType == RRType::Finish) type = "finish";
+        else if (responseType == RRType::Reset) type = "reset";
+        else if (responseType == RRType::ProcessFile) type = "processFile";
+        else if (responseType == RRType::ProcessMulti) type = "processMulti";
+        else if (responseType == RRType::ProcessSegmented) type = "processSegmented";
+        else if (responseType == RRType::Stats) type = "stats";
         else type = "invalid";
 
         json11::Json::object eo;
@@ -1504,6 +1893,11 @@ public:
 	else if (type == "configure") return RRType::Configure;
 	else if (type == "process") return RRType::Process;
 	else if (type == "finish") return RRType::Finish;
+	else if (type == "reset") return RRType::Reset;
+	else if (type == "processFile") return RRType::ProcessFile;
+	else if (type == "processMulti") return RRType::ProcessMulti;
+	else if (type == "processSegmented") return RRType::ProcessSegmented;
+	else if (type == "stats") return RRType::Stats;
         else if (type == "invalid") return RRType::NotValid;
 	else {
 	    err = "unknown or unexpected request/response type \"" + type + "\"";
@@ -1606,6 +2000,7 @@ public:
         FinishRequest req;
         auto h = j["params"]["handle"].int_value();
         req.plugin = pmapper.handleToPlugin(h);
+        req.includeUsage = j["params"]["includeUsage"].bool_value();
         return req;
     }
     
@@ -1622,6 +2017,191 @@ public:
             resp.features = toFeatureSet(jc["features"],
                                          *pmapper.handleToOutputIdMapper(h),
                                          serialisation, err);
+            if (jc["usage"].is_object()) {
+                resp.hasUsage = true;
+                resp.usage = toResourceUsage(jc["usage"]);
+            }
+        }
+        return resp;
+    }
+
+    static ResetRequest
+    toRpcRequest_Reset(json11::Json j, const PluginHandleMapper &pmapper,
+                       std::string &err) {
+        
+        checkRpcRequestType(j, "reset", err);
+        if (failed(err)) return {};
+        ResetRequest req;
+        auto h = j["params"]["handle"].int_value();
+        req.plugin = pmapper.handleToPlugin(h);
+        return req;
+    }
+    
+    static ResetResponse
+    toRpcResponse_Reset(json11::Json j,
+                        const PluginHandleMapper &pmapper,
+                        std::string &err) {
+        
+        ResetResponse resp;
+        if (successful(j, err) && !failed(err)) {
+            auto h = j["result"]["handle"].int_value();
+            resp.plugin = pmapper.handleToPlugin(h);
+        }
+        return resp;
+    }
+
+    static ProcessFileRequest
+    toRpcRequest_ProcessFile(json11::Json j, const PluginHandleMapper &pmapper,
+                             std::string &err) {
+        
+        checkRpcRequestType(j, "processFile", err);
+        if (failed(err)) return {};
+        if (!j["params"].has_shape({
+                    { "handle", json11::Json::NUMBER },
+                    { "filename", json11::Json::STRING } }, err)) {
+            err = "malformed processFile request: " + err;
+            return {};
+        }
+        ProcessFileRequest req;
+        auto h = j["params"]["handle"].int_value();
+        req.plugin = pmapper.handleToPlugin(h);
+        req.filename = j["params"]["filename"].string_value();
+        return req;
+    }
+    
+    static ProcessFileResponse
+    toRpcResponse_ProcessFile(json11::Json j,
+                              const PluginHandleMapper &pmapper,
+                              BufferSerialisation &serialisation,
+                              std::string &err) {
+        
+        ProcessFileResponse resp;
+        if (successful(j, err) && !failed(err)) {
+            auto jc = j["result"];
+            auto h = jc["handle"].int_value();
+            resp.plugin = pmapper.handleToPlugin(h);
+            resp.features = toFeatureSet(jc["features"],
+                                         *pmapper.handleToOutputIdMapper(h),
+                                         serialisation, err);
+        }
+        return resp;
+    }
+
+    static ProcessMultiRequest
+    toRpcRequest_ProcessMulti(json11::Json j, const PluginHandleMapper &pmapper,
+                              BufferSerialisation &serialisation, std::string &err) {
+        
+        checkRpcRequestType(j, "processMulti", err);
+        if (failed(err)) return {};
+        return toProcessMultiRequest(j["params"], pmapper, serialisation, err);
+    }
+    
+    static ProcessMultiResponse
+    toRpcResponse_ProcessMulti(json11::Json j,
+                               const PluginHandleMapper &pmapper,
+                               BufferSerialisation &serialisation,
+                               std::string &err) {
+        
+        ProcessMultiResponse resp;
+        if (successful(j, err) && !failed(err)) {
+            for (const auto &jc: j["result"]["results"].array_items()) {
+                ProcessResponse r;
+                auto h = jc["handle"].int_value();
+                r.plugin = pmapper.handleToPlugin(h);
+                r.features = toFeatureSet(jc["features"],
+                                          *pmapper.handleToOutputIdMapper(h),
+                                          serialisation, err);
+                if (failed(err)) return {};
+                resp.responses.push_back(std::move(r));
+            }
+        }
+        return resp;
+    }
+
+    static ProcessSegmentedRequest
+    toRpcRequest_ProcessSegmented(json11::Json j,
+                                  const PluginHandleMapper &pmapper,
+                                  std::string &err) {
+        
+        checkRpcRequestType(j, "processSegmented", err);
+        if (failed(err)) return {};
+        auto params = j["params"];
+        if (!params.has_shape({
+                    { "handle", json11::Json::NUMBER },
+                    { "filename", json11::Json::STRING } }, err)) {
+            err = "malformed processSegmented request: " + err;
+            return {};
+        }
+        ProcessSegmentedRequest req;
+        auto h = params["handle"].int_value();
+        req.plugin = pmapper.handleToPlugin(h);
+        req.filename = params["filename"].string_value();
+        if (params["segmentCount"].is_number()) {
+            req.segmentCount = params["segmentCount"].int_value();
+        }
+        if (params["warmupSteps"].is_number()) {
+            req.warmupSteps = params["warmupSteps"].int_value();
+        }
+        return req;
+    }
+    
+    static ProcessSegmentedResponse
+    toRpcResponse_ProcessSegmented(json11::Json j,
+                                   const PluginHandleMapper &pmapper,
+                                   BufferSerialisation &serialisation,
+                                   std::string &err) {
+        
+        ProcessSegmentedResponse resp;
+        if (successful(j, err) && !failed(err)) {
+            auto jc = j["result"];
+            auto h = jc["handle"].int_value();
+            resp.plugin = pmapper.handleToPlugin(h);
+            resp.features = toFeatureSet(jc["features"],
+                                         *pmapper.handleToOutputIdMapper(h),
+                                         serialisation, err);
+        }
+        return resp;
+    }
+
+    static StatsRequest
+    toRpcRequest_Stats(json11::Json j, std::string &err) {
+
+        checkRpcRequestType(j, "stats", err);
+        return {};
+    }
+
+    static StatsResponse
+    toRpcResponse_Stats(json11::Json j, std::string &err) {
+
+        StatsResponse resp;
+        if (successful(j, err) && !failed(err)) {
+            for (const auto &to: j["result"]["timings"].array_items()) {
+                if (!to.has_shape({
+                            { "method", json11::Json::STRING },
+                            { "phase", json11::Json::STRING },
+                            { "count", json11::Json::NUMBER } }, err)) {
+                    err = "malformed stats response: " + err;
+                    return {};
+                }
+                StatsResponse::Timing t;
+                t.method = to["method"].string_value();
+                t.pluginKey = to["pluginKey"].string_value();
+                t.phase = to["phase"].string_value();
+                t.count = uint64_t(to["count"].number_value());
+                t.totalNs = uint64_t(to["totalNs"].number_value());
+                t.maxNs = uint64_t(to["maxNs"].number_value());
+                t.p50Ns = uint64_t(to["p50Ns"].number_value());
+                t.p95Ns = uint64_t(to["p95Ns"].number_value());
+                t.p99Ns = uint64_t(to["p99Ns"].number_value());
+                resp.timings.push_back(t);
+            }
+            for (const auto &po: j["result"]["plugins"].array_items()) {
+                StatsResponse::PluginUsage p;
+                p.handle = uint32_t(po["handle"].number_value());
+                p.pluginKey = po["pluginKey"].string_value();
+                p.usage = toResourceUsage(po["usage"]);
+                resp.plugins.push_back(p);
+            }
         }
         return resp;
     }
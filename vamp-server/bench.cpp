@@ -0,0 +1,828 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+/*
+    Piper C++
+
+    An API for audio analysis and feature extraction plugins.
+
+    Centre for Digital Music, Queen Mary, University of London.
+    Copyright 2006-2016 Chris Cannam and QMUL.
+  
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+    ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    Except as contained in this notice, the names of the Centre for
+    Digital Music; Queen Mary, University of London; and Chris Cannam
+    shall not be used in advertising or otherwise to promote the sale,
+    use or other dealings in this Software without prior written
+    authorization.
+*/
+
+#include "vamp-json/VampJson.h"
+#include "vamp-support/PreservingPluginHandleMapper.h"
+#include "vamp-support/LatencyHistogram.h"
+#include "vamp-client/CapnpRRClient.h"
+#include "vamp-client/posix/ProcessPosixTransport.h"
+
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+#include <map>
+#include <memory>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+
+using namespace std;
+using namespace json11;
+using namespace piper_vamp;
+using namespace piper_vamp::client;
+
+static string myname = "piper-bench";
+
+void usage()
+{
+    cerr << "\n" << myname <<
+        ": Measure the throughput of a Piper server and its plugins\n\n"
+        "    Usage: " << myname << " [-f <format>] [-p <pluginkey>] [-b <blocksizes>]\n"
+        "           [-c <channelcounts>] [-m <modes>] [-n <instances>] [-d <seconds>]\n"
+        "           [-B <baseline.json>] [-t <tolerance>] <server>\n\n"
+        "    where\n"
+        "       <format>: capnp (the default) or json\n"
+        "       <pluginkey>: a plugin to run; may be given more than once. The\n"
+        "           default is every plugin the server lists\n"
+        "       <blocksizes>: comma-separated block sizes (default 512,1024,4096)\n"
+        "       <channelcounts>: comma-separated channel counts (default 1,2)\n"
+        "       <modes>: comma-separated from process, multi and file (default all)\n"
+        "       <instances>: number of plugin instances for multi mode (default 2)\n"
+        "       <seconds>: duration of synthetic audio per run (default 10)\n"
+        "       <baseline.json>: output from an earlier run to compare against\n"
+        "       <tolerance>: percentage drop in blocks per second, relative to\n"
+        "           the baseline, beyond which a run counts as a regression\n"
+        "           (default 10)\n"
+        "       <server>: the server program to run; it is started with the single\n"
+        "           argument <format>\n\n"
+        "Runs each plugin over synthetic audio at each combination of block size,\n"
+        "channel count and mode, and writes the results to stdout as JSON. In\n"
+        "process mode each block is sent in its own process request; in multi mode\n"
+        "each block goes to several instances of the plugin in one processMulti\n"
+        "request; in file mode the audio is written to a temporary WAV file that the\n"
+        "server processes in a single processFile request.\n\n"
+        "If a baseline is given, the exit code is 1 if any run has regressed.\n\n";
+
+    exit(2);
+}
+
+/**
+ * The calls the benchmark makes on a server, independent of the
+ * message format used to make them. A driver holds at most one
+ * plugin setup at a time, of one or more identically configured
+ * instances.
+ */
+class BenchDriver
+{
+public:
+    virtual ~BenchDriver() { }
+
+    virtual vector<string> listPlugins() = 0;
+
+    /**
+     * Load and configure the given number of instances of a plugin,
+     * returning the framing the server settled on, which may differ
+     * from the one requested.
+     */
+    virtual Framing setUp(string key, float rate, int channels,
+                          int blockSize, int instances) = 0;
+
+    /// Process one block on the first instance
+    virtual void process(const vector<vector<float>> &buffers,
+                         Vamp::RealTime timestamp) = 0;
+
+    /// Process one block on every instance at once
+    virtual void processMulti(const vector<vector<float>> &buffers,
+                              Vamp::RealTime timestamp) = 0;
+
+    /// Process a whole file on the first instance
+    virtual void processFile(string path) = 0;
+
+    /// Finish and unload every instance
+    virtual void tearDown() = 0;
+
+    virtual TransportMetrics getMetrics() const = 0;
+};
+
+class CapnpDriver : public BenchDriver
+{
+public:
+    CapnpDriver(string server) :
+        m_transport(server, "capnp", nullptr),
+        m_client(&m_transport, nullptr) {
+        if (!m_transport.isOK()) {
+            throw runtime_error("failed to start server \"" + server + "\"");
+        }
+    }
+
+    ~CapnpDriver() {
+        tearDown();
+    }
+
+    vector<string> listPlugins() override {
+        vector<string> keys;
+        for (const auto &p: m_client.list({}).available) {
+            keys.push_back(p.pluginKey);
+        }
+        return keys;
+    }
+
+    Framing setUp(string key, float rate, int channels,
+                  int blockSize, int instances) override {
+
+        LoadRequest req;
+        req.pluginKey = key;
+        req.inputSampleRate = rate;
+        req.adapterFlags = Vamp::HostExt::PluginLoader::ADAPT_ALL_SAFE;
+
+        Framing framing;
+        framing.stepSize = blockSize;
+        framing.blockSize = blockSize;
+        
+        for (int i = 0; i < instances; ++i) {
+            auto resp = m_client.load(req);
+            auto plugin = static_cast<PiperVampPlugin *>(resp.plugin);
+            if (!plugin) {
+                throw runtime_error("failed to load plugin \"" + key + "\"");
+            }
+            m_plugins.push_back(plugin);
+            if (!plugin->initialise(channels,
+                                    framing.stepSize, framing.blockSize)) {
+                // The server has settled on a different framing,
+                // which the plugin now reports as its preferred one
+                framing.stepSize = int(plugin->getPreferredStepSize());
+                framing.blockSize = int(plugin->getPreferredBlockSize());
+                if (!plugin->initialise(channels, framing.stepSize,
+                                        framing.blockSize)) {
+                    throw runtime_error("failed to configure plugin \"" +
+                                        key + "\"");
+                }
+            }
+        }
+
+        return framing;
+    }
+
+    void process(const vector<vector<float>> &buffers,
+                 Vamp::RealTime timestamp) override {
+        m_client.process(m_plugins[0], buffers, timestamp);
+    }
+
+    void processMulti(const vector<vector<float>> &buffers,
+                      Vamp::RealTime timestamp) override {
+        m_client.processMulti(m_plugins, buffers, timestamp);
+    }
+
+    void processFile(string path) override {
+        m_client.processFile(m_plugins[0], path);
+    }
+
+    void tearDown() override {
+        // Deleting the plugin finishes it on the server
+        for (auto p: m_plugins) {
+            delete p;
+        }
+        m_plugins.clear();
+    }
+
+    TransportMetrics getMetrics() const override {
+        return m_transport.getMetrics();
+    }
+    
+private:
+    ProcessPosixTransport m_transport;
+    CapnpRRClient m_client;
+    vector<PiperVampPlugin *> m_plugins;
+};
+
+class JsonDriver : public BenchDriver
+{
+    // The JSON server writes one response per line
+    class LineCompletenessChecker : public MessageCompletenessChecker {
+    public:
+        State check(const vector<char> &message) const override {
+            if (!message.empty() && message.back() == '\n') {
+                return Complete;
+            }
+            return Incomplete;
+        }
+    };
+    
+public:
+    JsonDriver(string server) :
+        m_transport(server, "json", nullptr),
+        m_nextId(1) {
+        m_transport.setCompletenessChecker(&m_checker);
+        if (!m_transport.isOK()) {
+            throw runtime_error("failed to start server \"" + server + "\"");
+        }
+    }
+
+    ~JsonDriver() {
+        try {
+            tearDown();
+        } catch (const exception &e) {
+            cerr << myname << ": warning: failed to finish plugin: "
+                 << e.what() << endl;
+        }
+    }
+
+    vector<string> listPlugins() override {
+        string err;
+        auto resp = VampJson::toRpcResponse_List
+            (call(VampJson::fromRpcRequest_List({}, id()), "list", true), err);
+        check(err);
+        vector<string> keys;
+        for (const auto &p: resp.available) {
+            keys.push_back(p.pluginKey);
+        }
+        return keys;
+    }
+
+    Framing setUp(string key, float rate, int channels,
+                  int blockSize, int instances) override {
+
+        LoadRequest req;
+        req.pluginKey = key;
+        req.inputSampleRate = rate;
+        req.adapterFlags = Vamp::HostExt::PluginLoader::ADAPT_ALL_SAFE;
+
+        Framing framing;
+        
+        for (int i = 0; i < instances; ++i) {
+
+            string err;
+            auto lr = VampJson::toRpcResponse_Load
+                (call(VampJson::fromRpcRequest_Load(req, id()), "load", true),
+                 m_mapper, err);
+            check(err);
+            if (!lr.plugin) {
+                throw runtime_error("failed to load plugin \"" + key + "\"");
+            }
+            m_plugins.push_back(lr.plugin);
+
+            ConfigurationRequest creq;
+            creq.plugin = lr.plugin;
+            creq.configuration = lr.defaultConfiguration;
+            creq.configuration.channelCount = channels;
+            creq.configuration.framing.stepSize = blockSize;
+            creq.configuration.framing.blockSize = blockSize;
+
+            auto cr = VampJson::toRpcResponse_Configure
+                (call(VampJson::fromRpcRequest_Configure(creq, m_mapper, id()),
+                      "configure", true),
+                 m_mapper, err);
+            check(err);
+            if (cr.outputs.empty()) {
+                throw runtime_error("failed to configure plugin \"" +
+                                    key + "\"");
+            }
+
+            // Unlike PiperVampPlugin, we have no host to re-initialise
+            // with a different framing: we simply adopt whatever the
+            // server has chosen
+            m_mapper.markConfigured(lr.plugin, cr.outputs);
+            framing = cr.framing;
+        }
+
+        return framing;
+    }
+
+    void process(const vector<vector<float>> &buffers,
+                 Vamp::RealTime timestamp) override {
+        ProcessRequest req;
+        req.plugin = m_plugins[0];
+        req.inputBuffers = buffers;
+        req.timestamp = timestamp;
+        string err;
+        auto serialisation = VampJson::BufferSerialisation::Base64;
+        VampJson::toRpcResponse_Process
+            (call(VampJson::fromRpcRequest_Process(req, m_mapper,
+                                                   serialisation, id()),
+                  "process", false),
+             m_mapper, serialisation, err);
+        check(err);
+    }
+
+    void processMulti(const vector<vector<float>> &buffers,
+                      Vamp::RealTime timestamp) override {
+        ProcessMultiRequest req;
+        req.plugins = m_plugins;
+        req.inputBuffers = buffers;
+        req.timestamp = timestamp;
+        string err;
+        auto serialisation = VampJson::BufferSerialisation::Base64;
+        VampJson::toRpcResponse_ProcessMulti
+            (call(VampJson::fromRpcRequest_ProcessMulti(req, m_mapper,
+                                                        serialisation, id()),
+                  "processMulti", false),
+             m_mapper, serialisation, err);
+        check(err);
+    }
+
+    void processFile(string path) override {
+        ProcessFileRequest req;
+        req.plugin = m_plugins[0];
+        req.filename = path;
+        string err;
+        auto serialisation = VampJson::BufferSerialisation::Array;
+        VampJson::toRpcResponse_ProcessFile
+            (call(VampJson::fromRpcRequest_ProcessFile(req, m_mapper, id()),
+                  "processFile", true),
+             m_mapper, serialisation, err);
+        check(err);
+    }
+
+    void tearDown() override {
+        auto plugins = m_plugins;
+        m_plugins.clear();
+        for (auto p: plugins) {
+            FinishRequest req;
+            req.plugin = p;
+            string err;
+            auto serialisation = VampJson::BufferSerialisation::Array;
+            VampJson::toRpcResponse_Finish
+                (call(VampJson::fromRpcRequest_Finish(req, m_mapper, id()),
+                      "finish", true),
+                 m_mapper, serialisation, err);
+            check(err);
+        }
+    }
+
+    TransportMetrics getMetrics() const override {
+        return m_transport.getMetrics();
+    }
+    
+private:
+    ProcessPosixTransport m_transport;
+    LineCompletenessChecker m_checker;
+    PreservingPluginHandleMapper m_mapper;
+    vector<Vamp::Plugin *> m_plugins; // nominal, from m_mapper
+    int m_nextId;
+
+    Json id() {
+        return Json(m_nextId++);
+    }
+
+    Json call(const Json &request, string type, bool slow) {
+        string message = request.dump() + "\n";
+        auto response = m_transport.call(message.data(), message.size(),
+                                         type, slow);
+        string err;
+        Json j = Json::parse(string(response.begin(), response.end()), err);
+        check(err);
+        if (j["error"].is_object()) {
+            throw runtime_error(j["error"]["message"].string_value());
+        }
+        return j;
+    }
+
+    static void check(string err) {
+        if (err != "") {
+            throw ProtocolError(err.c_str());
+        }
+    }
+};
+
+/**
+ * Synthetic input: a few sinusoids per channel, at frequencies that
+ * differ between channels, plus a little deterministic noise.
+ */
+static vector<vector<float>>
+makeAudio(int channels, int frames, float rate)
+{
+    vector<vector<float>> audio(channels, vector<float>(frames, 0.f));
+    uint32_t seed = 12345;
+    for (int c = 0; c < channels; ++c) {
+        double f0 = 220.0 * (c + 1);
+        for (int i = 0; i < frames; ++i) {
+            double t = double(i) / rate;
+            double v = 0.0;
+            for (int h = 1; h <= 3; ++h) {
+                v += sin(2.0 * M_PI * f0 * h * t) / (h * 4.0);
+            }
+            seed = seed * 1664525u + 1013904223u;
+            v += (double(seed >> 8) / double(1 << 24) - 0.5) * 0.05;
+            audio[c][i] = float(v);
+        }
+    }
+    return audio;
+}
+
+static void
+put(ofstream &out, uint32_t v, int bytes)
+{
+    for (int i = 0; i < bytes; ++i) {
+        out.put(char((v >> (8 * i)) & 0xff));
+    }
+}
+
+/**
+ * Write the given audio to a temporary 32-bit float WAV file and
+ * return its path.
+ */
+static string
+writeWav(const vector<vector<float>> &audio, float rate)
+{
+    char path[] = "/tmp/piper-bench-XXXXXX.wav";
+    int fd = mkstemps(path, 4);
+    if (fd < 0) {
+        throw runtime_error("failed to create temporary file");
+    }
+    close(fd);
+
+    uint32_t channels = uint32_t(audio.size());
+    uint32_t frames = audio.empty() ? 0 : uint32_t(audio[0].size());
+    uint32_t dataBytes = frames * channels * 4;
+    
+    ofstream out(path, ios::binary);
+    out.write("RIFF", 4);
+    put(out, 36 + dataBytes, 4);
+    out.write("WAVEfmt ", 8);
+    put(out, 16, 4);
+    put(out, 3, 2); // IEEE float
+    put(out, channels, 2);
+    put(out, uint32_t(rate), 4);
+    put(out, uint32_t(rate) * channels * 4, 4);
+    put(out, channels * 4, 2);
+    put(out, 32, 2);
+    out.write("data", 4);
+    put(out, dataBytes, 4);
+    for (uint32_t i = 0; i < frames; ++i) {
+        for (uint32_t c = 0; c < channels; ++c) {
+            float f = audio[c][i];
+            uint32_t v;
+            memcpy(&v, &f, 4);
+            put(out, v, 4);
+        }
+    }
+    if (!out) {
+        unlink(path);
+        throw runtime_error(string("failed to write ") + path);
+    }
+    return path;
+}
+
+struct Settings
+{
+    string format = "capnp";
+    string server;
+    vector<string> plugins;
+    vector<int> blockSizes { 512, 1024, 4096 };
+    vector<int> channelCounts { 1, 2 };
+    vector<string> modes { "process", "multi", "file" };
+    int instances = 2;
+    double duration = 10.0;
+    float rate = 44100.f;
+};
+
+static void
+addMetrics(TransportMetrics &total, const TransportMetrics &m)
+{
+    total.calls += m.calls;
+    total.bytesSent += m.bytesSent;
+    total.bytesReceived += m.bytesReceived;
+    total.readWakeups += m.readWakeups;
+}
+
+static unique_ptr<BenchDriver>
+makeDriver(const Settings &s)
+{
+    if (s.format == "json") {
+        return unique_ptr<BenchDriver>(new JsonDriver(s.server));
+    } else {
+        return unique_ptr<BenchDriver>(new CapnpDriver(s.server));
+    }
+}
+
+/**
+ * Run one plugin in one configuration and return its result object.
+ */
+static Json::object
+run(BenchDriver &driver, const Settings &s,
+    string key, string mode, int blockSize, int channels)
+{
+    Json::object result;
+    result["plugin"] = key;
+    result["mode"] = mode;
+    result["blockSize"] = blockSize;
+    result["channels"] = channels;
+
+    Framing framing = driver.setUp(key, s.rate, channels, blockSize,
+                                   mode == "multi" ? s.instances : 1);
+    if (framing.blockSize != blockSize || framing.stepSize != blockSize) {
+        result["stepSize"] = framing.stepSize;
+        result["actualBlockSize"] = framing.blockSize;
+    }
+
+    int step = framing.stepSize;
+    int block = framing.blockSize;
+    int blocks = int(s.duration * s.rate / step);
+    if (blocks < 1) blocks = 1;
+    int frames = (blocks - 1) * step + block;
+
+    auto audio = makeAudio(channels, frames, s.rate);
+    LatencyHistogram latency;
+    double seconds = 0.0;
+    
+    if (mode == "file") {
+
+        string path = writeWav(audio, s.rate);
+        try {
+            // A single call is too coarse for percentiles to mean
+            // much, so repeat it a few times. The plugin is left
+            // reset after each one.
+            for (int i = 0; i < 3; ++i) {
+                auto start = chrono::steady_clock::now();
+                driver.processFile(path);
+                auto ns = chrono::duration_cast<chrono::nanoseconds>
+                    (chrono::steady_clock::now() - start).count();
+                latency.record(uint64_t(ns));
+                seconds += double(ns) * 1.0e-9;
+            }
+        } catch (...) {
+            unlink(path.c_str());
+            throw;
+        }
+        unlink(path.c_str());
+        blocks *= 3;
+        
+    } else {
+        
+        vector<vector<float>> buffers(channels, vector<float>(block));
+        for (int i = 0; i < blocks; ++i) {
+            for (int c = 0; c < channels; ++c) {
+                memcpy(buffers[c].data(), audio[c].data() + i * step,
+                       block * sizeof(float));
+            }
+            auto timestamp = Vamp::RealTime::frame2RealTime
+                (i * step, int(s.rate));
+            auto start = chrono::steady_clock::now();
+            if (mode == "multi") {
+                driver.processMulti(buffers, timestamp);
+            } else {
+                driver.process(buffers, timestamp);
+            }
+            auto ns = chrono::duration_cast<chrono::nanoseconds>
+                (chrono::steady_clock::now() - start).count();
+            latency.record(uint64_t(ns));
+            seconds += double(ns) * 1.0e-9;
+        }
+    }
+
+    driver.tearDown();
+
+    // MB/sec counts the input audio consumed, not the bytes sent, so
+    // that the modes can be compared with one another
+    double mb = double(blocks) * step * channels * sizeof(float) / 1.0e6;
+    double ms = 1.0e-6;
+    
+    result["blocks"] = blocks;
+    result["seconds"] = seconds;
+    result["blocksPerSecond"] = seconds > 0.0 ? blocks / seconds : 0.0;
+    result["mbPerSecond"] = seconds > 0.0 ? mb / seconds : 0.0;
+    result["latencyMs"] = Json::object {
+        { "p50", double(latency.getPercentile(0.5)) * ms },
+        { "p95", double(latency.getPercentile(0.95)) * ms },
+        { "p99", double(latency.getPercentile(0.99)) * ms },
+        { "max", double(latency.getMax()) * ms }
+    };
+    return result;
+}
+
+static string
+resultKey(const Json &r)
+{
+    return r["plugin"].string_value() + "|" + r["mode"].string_value() + "|" +
+        to_string(r["blockSize"].int_value()) + "|" +
+        to_string(r["channels"].int_value());
+}
+
+static map<string, double>
+readBaseline(string path)
+{
+    ifstream in(path);
+    if (!in) {
+        throw runtime_error("failed to open baseline file \"" + path + "\"");
+    }
+    stringstream ss;
+    ss << in.rdbuf();
+    string err;
+    Json j = Json::parse(ss.str(), err);
+    if (err != "") {
+        throw runtime_error("failed to parse baseline file \"" + path +
+                            "\": " + err);
+    }
+    map<string, double> baseline;
+    for (const auto &r: j["results"].array_items()) {
+        if (r["blocksPerSecond"].is_number()) {
+            baseline[resultKey(r)] = r["blocksPerSecond"].number_value();
+        }
+    }
+    return baseline;
+}
+
+static vector<string>
+split(string s)
+{
+    vector<string> parts;
+    stringstream ss(s);
+    string part;
+    while (getline(ss, part, ',')) {
+        if (part != "") parts.push_back(part);
+    }
+    return parts;
+}
+
+static vector<int>
+splitInts(string s)
+{
+    vector<int> ints;
+    for (auto p: split(s)) {
+        int i = atoi(p.c_str());
+        if (i <= 0) usage();
+        ints.push_back(i);
+    }
+    return ints;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        usage();
+    }
+
+    Settings s;
+    string baselinePath;
+    double tolerance = 10.0;
+    
+    for (int i = 1; i < argc; ++i) {
+
+        string arg = argv[i];
+        bool last = (i + 1 == argc);
+        
+        if (arg == "-h" || arg == "--help") {
+            usage();
+        } else if (arg == "-f" || arg == "--format") {
+            if (last) usage();
+            s.format = argv[++i];
+        } else if (arg == "-p" || arg == "--plugin") {
+            if (last) usage();
+            s.plugins.push_back(argv[++i]);
+        } else if (arg == "-b" || arg == "--block-sizes") {
+            if (last) usage();
+            s.blockSizes = splitInts(argv[++i]);
+        } else if (arg == "-c" || arg == "--channels") {
+            if (last) usage();
+            s.channelCounts = splitInts(argv[++i]);
+        } else if (arg == "-m" || arg == "--modes") {
+            if (last) usage();
+            s.modes = split(argv[++i]);
+            for (auto m: s.modes) {
+                if (m != "process" && m != "multi" && m != "file") usage();
+            }
+        } else if (arg == "-n" || arg == "--instances") {
+            if (last) usage();
+            s.instances = atoi(argv[++i]);
+            if (s.instances < 1) usage();
+        } else if (arg == "-d" || arg == "--duration") {
+            if (last) usage();
+            s.duration = atof(argv[++i]);
+            if (s.duration <= 0.0) usage();
+        } else if (arg == "-B" || arg == "--baseline") {
+            if (last) usage();
+            baselinePath = argv[++i];
+        } else if (arg == "-t" || arg == "--tolerance") {
+            if (last) usage();
+            tolerance = atof(argv[++i]);
+            if (tolerance < 0.0) usage();
+        } else if (last) {
+            s.server = arg;
+        } else {
+            usage();
+        }
+    }
+
+    if (s.server == "" || (s.format != "capnp" && s.format != "json")) {
+        usage();
+    }
+
+    int regressions = 0;
+    TransportMetrics metrics; // totals across every server started
+    
+    try {
+        map<string, double> baseline;
+        if (baselinePath != "") {
+            baseline = readBaseline(baselinePath);
+        }
+
+        auto driver = makeDriver(s);
+        
+        if (s.plugins.empty()) {
+            s.plugins = driver->listPlugins();
+        }
+
+        Json::array results;
+        
+        for (auto key: s.plugins) {
+            for (auto mode: s.modes) {
+                for (auto blockSize: s.blockSizes) {
+                    for (auto channels: s.channelCounts) {
+
+                        Json::object result;
+                        
+                        try {
+                            result = run(*driver, s, key, mode,
+                                         blockSize, channels);
+                        } catch (const exception &e) {
+                            // Some plugins won't take some channel
+                            // counts, and a failure may have taken the
+                            // server down with it, so record the error
+                            // and carry on with a new server
+                            result["plugin"] = key;
+                            result["mode"] = mode;
+                            result["blockSize"] = blockSize;
+                            result["channels"] = channels;
+                            result["error"] = string(e.what());
+                            addMetrics(metrics, driver->getMetrics());
+                            driver.reset();
+                            driver = makeDriver(s);
+                        }
+
+                        auto itr = baseline.find(resultKey(Json(result)));
+                        if (itr != baseline.end() &&
+                            result.find("error") == result.end() &&
+                            itr->second > 0.0) {
+                            double bps = result["blocksPerSecond"].number_value();
+                            double change = (bps - itr->second) / itr->second;
+                            result["baselineBlocksPerSecond"] = itr->second;
+                            result["change"] = change;
+                            if (change * 100.0 < -tolerance) {
+                                result["regression"] = true;
+                                ++regressions;
+                                cerr << myname << ": regression: " << key
+                                     << " " << mode << " block " << blockSize
+                                     << " channels " << channels << ": "
+                                     << bps << " blocks/sec against "
+                                     << itr->second << " in baseline" << endl;
+                            }
+                        }
+
+                        results.push_back(result);
+                    }
+                }
+            }
+        }
+
+        addMetrics(metrics, driver->getMetrics());
+        
+        Json output = Json::object {
+            { "format", s.format },
+            { "server", s.server },
+            { "sampleRate", double(s.rate) },
+            { "duration", s.duration },
+            { "results", results },
+            { "transport", Json::object {
+                    { "calls", double(metrics.calls) },
+                    { "bytesSent", double(metrics.bytesSent) },
+                    { "bytesReceived", double(metrics.bytesReceived) },
+                    { "readWakeups", double(metrics.readWakeups) } } }
+        };
+
+        cout << output.dump() << endl;
+        
+    } catch (const exception &e) {
+        cerr << myname << ": error: " << e.what() << endl;
+        exit(1);
+    }
+
+    return regressions > 0 ? 1 : 0;
+}
@@ -37,10 +37,19 @@
 #include "vamp-capnp/VampnProto.h"
 #include "vamp-support/RequestOrResponse.h"
 #include "vamp-support/PreservingPluginHandleMapper.h"
+#include "vamp-capnp/RawMessageReader.h"
 
 #include <iostream>
 #include <sstream>
 #include <stdexcept>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdlib>
 
 #include <capnp/serialize.h>
 
@@ -59,20 +68,23 @@ void usage()
     string myname = "piper-convert";
     cerr << "\n" << myname <<
         ": Validate and convert Piper request and response messages\n\n"
-        "    Usage: " << myname << " [-i <informat>] [-o <outformat>] request\n"
-        "           " << myname << " [-i <informat>] [-o <outformat>] response\n\n"
+        "    Usage: " << myname << " [-i <informat>] [-o <outformat>] [-j <n>] request\n"
+        "           " << myname << " [-i <informat>] [-o <outformat>] [-j <n>] response\n\n"
         "    where\n"
         "       <informat>: the format to read from stdin\n"
         "           (\"json\" or \"capnp\", default is \"json\")\n"
         "       <outformat>: the format to convert to and write to stdout\n"
         "           (\"json\", \"json-b64\" or \"capnp\", default is \"json\")\n"
+        "       <n>: the number of threads to convert messages on (default 1)\n"
         "       request|response: whether messages are Vamp request or response type\n\n"
         "If <informat> and <outformat> differ, convert from <informat> to <outformat>.\n"
         "If <informat> and <outformat> are the same, just check validity of incoming\n"
         "messages and pass them to output.\n\n"
         "Specifying \"json-b64\" as output format forces base64 encoding for process and\n"
         "feature blocks, unlike the \"json\" output format which uses text encoding.\n"
-        "The \"json\" input format accepts either.\n\n";
+        "The \"json\" input format accepts either.\n\n"
+        "With more than one thread, messages are still written in the order they\n"
+        "were read.\n\n";
 
     exit(2);
 }
@@ -120,6 +132,8 @@ convertResponseJson(string input, string &err)
 
 PreservingPluginHandleMapper mapper;
 
+static const size_t outputBufferSize = 1024 * 1024;
+
 static RequestOrResponse::RpcId
 readJsonId(const Json &j)
 {
@@ -186,19 +200,20 @@ buildCapnpId(Builder &b, const RequestOrResponse::RpcId &id)
     }
 }
 
+static string
+messageToString(capnp::MessageBuilder &message)
+{
+    auto words = capnp::messageToFlatArray(message);
+    auto bytes = words.asBytes();
+    return string(reinterpret_cast<const char *>(bytes.begin()), bytes.size());
+}
+
 RequestOrResponse
-readRequestJson(string &err, bool &eof)
+readRequestJson(const string &input, string &err)
 {
     RequestOrResponse rr;
     rr.direction = RequestOrResponse::Request;
 
-    string input;
-    if (!getline(cin, input)) {
-        // the EOF case, not actually an error
-        eof = true;
-        return rr;
-    }
-    
     Json j = convertRequestJson(input, err);
     if (err != "") return {};
 
@@ -227,6 +242,23 @@ readRequestJson(string &err, bool &eof)
     case RRType::Finish:
         rr.finishRequest = VampJson::toRpcRequest_Finish(j, mapper, err);
         break;
+    case RRType::Reset:
+        rr.resetRequest = VampJson::toRpcRequest_Reset(j, mapper, err);
+        break;
+    case RRType::ProcessFile:
+        rr.processFileRequest = VampJson::toRpcRequest_ProcessFile(j, mapper, err);
+        break;
+    case RRType::ProcessMulti:
+        rr.processMultiRequest = VampJson::toRpcRequest_ProcessMulti
+            (j, mapper, serialisation, err);
+        break;
+    case RRType::ProcessSegmented:
+        rr.processSegmentedRequest = VampJson::toRpcRequest_ProcessSegmented
+            (j, mapper, err);
+        break;
+    case RRType::Stats:
+        rr.statsRequest = VampJson::toRpcRequest_Stats(j, err);
+        break;
     case RRType::NotValid:
         break;
     }
@@ -234,7 +266,7 @@ readRequestJson(string &err, bool &eof)
     return rr;
 }
 
-void
+string
 writeRequestJson(RequestOrResponse &rr, bool useBase64)
 {
     Json j;
@@ -264,26 +296,36 @@ writeRequestJson(RequestOrResponse &rr, bool useBase64)
     case RRType::Finish:
         j = VampJson::fromRpcRequest_Finish(rr.finishRequest, mapper, id);
         break;
+    case RRType::Reset:
+        j = VampJson::fromRpcRequest_Reset(rr.resetRequest, mapper, id);
+        break;
+    case RRType::ProcessFile:
+        j = VampJson::fromRpcRequest_ProcessFile(rr.processFileRequest, mapper, id);
+        break;
+    case RRType::ProcessMulti:
+        j = VampJson::fromRpcRequest_ProcessMulti
+            (rr.processMultiRequest, mapper, serialisation, id);
+        break;
+    case RRType::ProcessSegmented:
+        j = VampJson::fromRpcRequest_ProcessSegmented
+            (rr.processSegmentedRequest, mapper, id);
+        break;
+    case RRType::Stats:
+        j = VampJson::fromRpcRequest_Stats(rr.statsRequest, id);
+        break;
     case RRType::NotValid:
         break;
     }
 
-    cout << j.dump() << endl;
+    return j.dump() + "\n";
 }
 
 RequestOrResponse
-readResponseJson(string &err, bool &eof)
+readResponseJson(const string &input, string &err)
 {
     RequestOrResponse rr;
     rr.direction = RequestOrResponse::Response;
 
-    string input;
-    if (!getline(cin, input)) {
-        // the EOF case, not actually an error
-        eof = true;
-        return rr;
-    }
-
     Json j = convertResponseJson(input, err);
     if (err != "") return {};
 
@@ -317,6 +359,24 @@ readResponseJson(string &err, bool &eof)
     case RRType::Finish:
         rr.finishResponse = VampJson::toRpcResponse_Finish(j, mapper, serialisation, err);
         break;
+    case RRType::Reset:
+        rr.resetResponse = VampJson::toRpcResponse_Reset(j, mapper, err);
+        break;
+    case RRType::ProcessFile:
+        rr.processFileResponse = VampJson::toRpcResponse_ProcessFile
+            (j, mapper, serialisation, err);
+        break;
+    case RRType::ProcessMulti:
+        rr.processMultiResponse = VampJson::toRpcResponse_ProcessMulti
+            (j, mapper, serialisation, err);
+        break;
+    case RRType::ProcessSegmented:
+        rr.processSegmentedResponse = VampJson::toRpcResponse_ProcessSegmented
+            (j, mapper, serialisation, err);
+        break;
+    case RRType::Stats:
+        rr.statsResponse = VampJson::toRpcResponse_Stats(j, err);
+        break;
     case RRType::NotValid:
         break;
     }
@@ -324,7 +384,7 @@ readResponseJson(string &err, bool &eof)
     return rr;
 }
 
-void
+string
 writeResponseJson(RequestOrResponse &rr, bool useBase64)
 {
     Json j;
@@ -362,22 +422,40 @@ writeResponseJson(RequestOrResponse &rr, bool useBase64)
             j = VampJson::fromRpcResponse_Finish
                 (rr.finishResponse, mapper, serialisation, id);
             break;
+        case RRType::Reset:
+            j = VampJson::fromRpcResponse_Reset(rr.resetResponse, mapper, id);
+            break;
+        case RRType::ProcessFile:
+            j = VampJson::fromRpcResponse_ProcessFile
+                (rr.processFileResponse, mapper, serialisation, id);
+            break;
+        case RRType::ProcessMulti:
+            j = VampJson::fromRpcResponse_ProcessMulti
+                (rr.processMultiResponse, mapper, serialisation, id);
+            break;
+        case RRType::ProcessSegmented:
+            j = VampJson::fromRpcResponse_ProcessSegmented
+                (rr.processSegmentedResponse, mapper, serialisation, id);
+            break;
+        case RRType::Stats:
+            j = VampJson::fromRpcResponse_Stats(rr.statsResponse, id);
+            break;
         case RRType::NotValid:
             j = VampJson::fromError(rr.errorText, rr.type, id);
             break;
         }
     }
     
-    cout << j.dump() << endl;
+    return j.dump() + "\n";
 }
 
 RequestOrResponse
-readRequestCapnp(kj::BufferedInputStreamWrapper &buffered)
+readRequestCapnp(kj::ArrayPtr<const capnp::word> words)
 {
     RequestOrResponse rr;
     rr.direction = RequestOrResponse::Request;
 
-    capnp::InputStreamMessageReader message(buffered);
+    capnp::FlatArrayMessageReader message(words);
     piper::RpcRequest::Reader reader = message.getRoot<piper::RpcRequest>();
     
     rr.type = VampnProto::getRequestResponseType(reader);
@@ -402,6 +480,22 @@ readRequestCapnp(kj::BufferedInputStreamWrapper &buffered)
     case RRType::Finish:
         VampnProto::readRpcRequest_Finish(rr.finishRequest, reader, mapper);
         break;
+    case RRType::Reset:
+        VampnProto::readRpcRequest_Reset(rr.resetRequest, reader, mapper);
+        break;
+    case RRType::ProcessFile:
+        VampnProto::readRpcRequest_ProcessFile(rr.processFileRequest, reader, mapper);
+        break;
+    case RRType::ProcessMulti:
+        VampnProto::readRpcRequest_ProcessMulti(rr.processMultiRequest, reader, mapper);
+        break;
+    case RRType::ProcessSegmented:
+        VampnProto::readRpcRequest_ProcessSegmented
+            (rr.processSegmentedRequest, reader, mapper);
+        break;
+    case RRType::Stats:
+        VampnProto::readRpcRequest_Stats(rr.statsRequest, reader);
+        break;
     case RRType::NotValid:
         break;
     }
@@ -409,7 +503,7 @@ readRequestCapnp(kj::BufferedInputStreamWrapper &buffered)
     return rr;
 }
 
-void
+string
 writeRequestCapnp(RequestOrResponse &rr)
 {
     capnp::MallocMessageBuilder message;
@@ -435,20 +529,36 @@ writeRequestCapnp(RequestOrResponse &rr)
     case RRType::Finish:
         VampnProto::buildRpcRequest_Finish(builder, rr.finishRequest, mapper);
         break;
+    case RRType::Reset:
+        VampnProto::buildRpcRequest_Reset(builder, rr.resetRequest, mapper);
+        break;
+    case RRType::ProcessFile:
+        VampnProto::buildRpcRequest_ProcessFile(builder, rr.processFileRequest, mapper);
+        break;
+    case RRType::ProcessMulti:
+        VampnProto::buildRpcRequest_ProcessMulti(builder, rr.processMultiRequest, mapper);
+        break;
+    case RRType::ProcessSegmented:
+        VampnProto::buildRpcRequest_ProcessSegmented
+            (builder, rr.processSegmentedRequest, mapper);
+        break;
+    case RRType::Stats:
+        VampnProto::buildRpcRequest_Stats(builder, rr.statsRequest);
+        break;
     case RRType::NotValid:
         break;
     }
 
-    writeMessageToFd(1, message);
+    return messageToString(message);
 }
 
 RequestOrResponse
-readResponseCapnp(kj::BufferedInputStreamWrapper &buffered)
+readResponseCapnp(kj::ArrayPtr<const capnp::word> words)
 {
     RequestOrResponse rr;
     rr.direction = RequestOrResponse::Response;
 
-    capnp::InputStreamMessageReader message(buffered);
+    capnp::FlatArrayMessageReader message(words);
     piper::RpcResponse::Reader reader = message.getRoot<piper::RpcResponse>();
     
     rr.type = VampnProto::getRequestResponseType(reader);
@@ -476,6 +586,22 @@ readResponseCapnp(kj::BufferedInputStreamWrapper &buffered)
     case RRType::Finish:
         VampnProto::readRpcResponse_Finish(rr.finishResponse, reader, mapper);
         break;
+    case RRType::Reset:
+        VampnProto::readRpcResponse_Reset(rr.resetResponse, reader, mapper);
+        break;
+    case RRType::ProcessFile:
+        VampnProto::readRpcResponse_ProcessFile(rr.processFileResponse, reader, mapper);
+        break;
+    case RRType::ProcessMulti:
+        VampnProto::readRpcResponse_ProcessMulti(rr.processMultiResponse, reader, mapper);
+        break;
+    case RRType::ProcessSegmented:
+        VampnProto::readRpcResponse_ProcessSegmented
+            (rr.processSegmentedResponse, reader, mapper);
+        break;
+    case RRType::Stats:
+        VampnProto::readRpcResponse_Stats(rr.statsResponse, reader);
+        break;
     case RRType::NotValid:
         VampnProto::readRpcResponse_Error(errorCode, rr.errorText, reader);
         break;
@@ -484,7 +610,7 @@ readResponseCapnp(kj::BufferedInputStreamWrapper &buffered)
     return rr;
 }
 
-void
+string
 writeResponseCapnp(RequestOrResponse &rr)
 {
     capnp::MallocMessageBuilder message;
@@ -515,86 +641,417 @@ writeResponseCapnp(RequestOrResponse &rr)
         case RRType::Finish:
             VampnProto::buildRpcResponse_Finish(builder, rr.finishResponse, mapper);
             break;
+        case RRType::Reset:
+            VampnProto::buildRpcResponse_Reset(builder, rr.resetResponse, mapper);
+            break;
+        case RRType::ProcessFile:
+            VampnProto::buildRpcResponse_ProcessFile(builder, rr.processFileResponse, mapper);
+            break;
+        case RRType::ProcessMulti:
+            VampnProto::buildRpcResponse_ProcessMulti(builder, rr.processMultiResponse, mapper);
+            break;
+        case RRType::ProcessSegmented:
+            VampnProto::buildRpcResponse_ProcessSegmented
+                (builder, rr.processSegmentedResponse, mapper);
+            break;
+        case RRType::Stats:
+            VampnProto::buildRpcResponse_Stats(builder, rr.statsResponse);
+            break;
         case RRType::NotValid:
             VampnProto::buildRpcResponse_Error(builder, rr.errorText, rr.type);
             break;
         }
     }
     
-    writeMessageToFd(1, message);
+    return messageToString(message);
 }
 
-RequestOrResponse
-readInputJson(RequestOrResponse::Direction direction, string &err, bool &eof)
+/**
+ * A single incoming message, as read from the input but not yet
+ * parsed: either a line of JSON or the words of a Cap'n Proto
+ * message.
+ */
+struct RawMessage
 {
-    if (direction == RequestOrResponse::Request) {
-        return readRequestJson(err, eof);
-    } else {
-        return readResponseJson(err, eof);
+    string json;
+    vector<capnp::word> capnp;
+};
+
+/**
+ * Split stdin into messages in the given format, without parsing
+ * them.
+ */
+class MessageSource
+{
+public:
+    MessageSource(string format) :
+        m_format(format),
+        m_stream(0), // stdin
+        m_reader(m_stream) {
+        if (format != "json" && format != "capnp") {
+            throw runtime_error("unknown input format \"" + format + "\"");
+        }
     }
-}
 
-RequestOrResponse
-readInputCapnp(RequestOrResponse::Direction direction, bool &eof)
-{
-    static kj::FdInputStream stream(0); // stdin
-    static kj::BufferedInputStreamWrapper buffered(stream);
+    bool next(RawMessage &message) {
+        if (m_format == "json") {
+            return bool(getline(cin, message.json));
+        } else {
+            kj::ArrayPtr<const capnp::word> words;
+            if (!m_reader.next(words)) {
+                return false;
+            }
+            message.capnp.assign(words.begin(), words.end());
+            return true;
+        }
+    }
 
-    if (buffered.tryGetReadBuffer() == nullptr) {
-        eof = true;
-        return {};
+    bool haveBufferedInput() const {
+        if (m_format == "json") {
+            return cin.rdbuf()->in_avail() > 0;
+        } else {
+            return m_reader.haveBufferedInput();
+        }
     }
-    
+
+private:
+    string m_format;
+    kj::FdInputStream m_stream;
+    RawMessageReader m_reader;
+};
+
+/**
+ * Check a Cap'n Proto message structurally (by traversing all of it,
+ * which bounds-checks every pointer) and for a known request or
+ * response type, without converting it.
+ */
+void
+validateCapnp(kj::ArrayPtr<const capnp::word> words,
+              RequestOrResponse::Direction direction)
+{
+    capnp::FlatArrayMessageReader message(words);
+        
     if (direction == RequestOrResponse::Request) {
-        return readRequestCapnp(buffered);
+        auto r = message.getRoot<piper::RpcRequest>();
+        (void)r.totalSize();
+        if (VampnProto::getRequestResponseType(r) == RRType::NotValid) {
+            throw runtime_error("unknown request type");
+        }
     } else {
-        return readResponseCapnp(buffered);
+        // NotValid is legitimate for a response: it's an error
+        auto r = message.getRoot<piper::RpcResponse>();
+        (void)r.totalSize();
     }
 }
 
 RequestOrResponse
-readInput(string format, RequestOrResponse::Direction direction, bool &eof)
+readInput(string format, RequestOrResponse::Direction direction,
+          const RawMessage &message)
 {
-    eof = false;
-    
     if (format == "json") {
         string err;
-        auto result = readInputJson(direction, err, eof);
+        RequestOrResponse rr;
+        if (direction == RequestOrResponse::Request) {
+            rr = readRequestJson(message.json, err);
+        } else {
+            rr = readResponseJson(message.json, err);
+        }
         if (err != "") throw runtime_error(err);
-        else return result;
+        return rr;
     } else if (format == "capnp") {
-        return readInputCapnp(direction, eof);
+        kj::ArrayPtr<const capnp::word> words(message.capnp.data(),
+                                              message.capnp.size());
+        if (direction == RequestOrResponse::Request) {
+            return readRequestCapnp(words);
+        } else {
+            return readResponseCapnp(words);
+        }
     } else {
         throw runtime_error("unknown input format \"" + format + "\"");
     }
 }
 
-void
+string
 writeOutput(string format, RequestOrResponse &rr)
 {
     if (format == "json") {
         if (rr.direction == RequestOrResponse::Request) {
-            writeRequestJson(rr, false);
+            return writeRequestJson(rr, false);
         } else {
-            writeResponseJson(rr, false);
+            return writeResponseJson(rr, false);
         }
     } else if (format == "json-b64") {
         if (rr.direction == RequestOrResponse::Request) {
-            writeRequestJson(rr, true);
+            return writeRequestJson(rr, true);
         } else {
-            writeResponseJson(rr, true);
+            return writeResponseJson(rr, true);
         }
     } else if (format == "capnp") {
         if (rr.direction == RequestOrResponse::Request) {
-            writeRequestCapnp(rr);
+            return writeRequestCapnp(rr);
         } else {
-            writeResponseCapnp(rr);
+            return writeResponseCapnp(rr);
         }
     } else {
         throw runtime_error("unknown output format \"" + format + "\"");
     }
 }
 
+/**
+ * Convert (or, if the formats are the same, validate and pass
+ * through) a single message, returning the bytes to write. A
+ * Cap'n Proto message is validated structurally, but a JSON one can
+ * only be validated by decoding it in full, so only its re-encoding
+ * is skipped. This may be called from several threads at once.
+ */
+string
+convert(const RawMessage &message,
+        string informat, string outformat,
+        RequestOrResponse::Direction direction)
+{
+    if (informat == "capnp" && outformat == "capnp") {
+        kj::ArrayPtr<const capnp::word> words(message.capnp.data(),
+                                              message.capnp.size());
+        validateCapnp(words, direction);
+        auto bytes = words.asBytes();
+        return string(reinterpret_cast<const char *>(bytes.begin()),
+                      bytes.size());
+    }
+
+    RequestOrResponse rr = readInput(informat, direction, message);
+
+    if (rr.direction == RequestOrResponse::Response &&
+        rr.type == RRType::Configure && rr.success) {
+        mapper.markConfigured(rr.configurationResponse.plugin,
+                              rr.configurationResponse.outputs);
+    }
+
+    if (informat == outformat) {
+        return message.json + "\n";
+    }
+
+    return writeOutput(outformat, rr);
+}
+
+typedef function<string(const RawMessage &)> Converter;
+
+/**
+ * Read, convert and write messages one at a time. Output is flushed
+ * whenever no further input is already buffered, so that we can
+ * still be used interactively.
+ */
+void
+runSerial(MessageSource &source,
+          kj::BufferedOutputStreamWrapper &out,
+          Converter converter)
+{
+    RawMessage message;
+    while (source.next(message)) {
+        string output = converter(message);
+        out.write(output.data(), output.size());
+        if (!source.haveBufferedInput()) {
+            out.flush();
+        }
+    }
+}
+
+/**
+ * Return true if the message may be a configure response. Converting
+ * one of those seeds the output id mapping for its plugin handle, so
+ * it must be complete before any later message for the same handle
+ * is converted. For JSON this only looks for the method name
+ * anywhere in the message, since finding out for certain would mean
+ * parsing it, and a false positive costs only a little parallelism.
+ */
+bool
+mayBeConfigureResponse(const RawMessage &message,
+                       string informat, string outformat,
+                       RequestOrResponse::Direction direction)
+{
+    if (direction != RequestOrResponse::Response ||
+        (informat == "capnp" && outformat == "capnp")) {
+        // Nothing is decoded, so no mapping is seeded
+        return false;
+    }
+    if (informat == "json") {
+        return message.json.find("configure") != string::npos;
+    }
+    try {
+        capnp::FlatArrayMessageReader reader
+            (kj::ArrayPtr<const capnp::word>(message.capnp.data(),
+                                             message.capnp.size()));
+        return VampnProto::getRequestResponseType
+            (reader.getRoot<piper::RpcResponse>()) == RRType::Configure;
+    } catch (...) {
+        // Let the conversion itself report the problem
+        return true;
+    }
+}
+
+/**
+ * Read messages on one thread, convert them on the given number of
+ * worker threads, and write them from the calling thread in the
+ * order in which they were read. A message for which isBarrier
+ * returns true is converted completely before any message after it
+ * is started. If a message fails to convert, write everything
+ * preceding it and then throw.
+ */
+void
+runParallel(shared_ptr<MessageSource> source,
+            kj::BufferedOutputStreamWrapper &out,
+            Converter converter,
+            function<bool(const RawMessage &)> isBarrier,
+            int nWorkers)
+{
+    struct Job {
+        Job() : done(false) { }
+        RawMessage input;
+        string output;
+        string error;
+        bool done;
+    };
+
+    // Everything the reader thread uses. If a conversion fails, the
+    // reader may be blocked reading input that will never arrive, so
+    // we cannot join it; it is left detached instead, and holds its
+    // own reference to this state (and to the source) so that none
+    // of it is destroyed underneath it.
+    struct Shared {
+        Shared(shared_ptr<MessageSource> s) :
+            source(s), eof(false), stopping(false) { }
+        shared_ptr<MessageSource> source;
+        mutex m;
+        condition_variable workAvailable, jobDone, spaceAvailable;
+        deque<shared_ptr<Job>> pending; // all jobs not yet written, in order
+        deque<shared_ptr<Job>> queued;  // jobs not yet taken by a worker
+        bool eof, stopping;
+        string readError;
+    };
+
+    auto shared = make_shared<Shared>(source);
+    
+    // Bound the number of messages in memory at once
+    const size_t maxPending = size_t(nWorkers) * 16;
+    
+    thread reader([shared, isBarrier, maxPending]() {
+            Shared &s = *shared;
+            try {
+                while (true) {
+                    auto job = make_shared<Job>();
+                    if (!s.source->next(job->input)) break;
+                    bool barrier = isBarrier(job->input);
+                    unique_lock<mutex> lock(s.m);
+                    s.spaceAvailable.wait(lock, [&]() {
+                            return s.pending.size() < maxPending || s.stopping;
+                        });
+                    if (s.stopping) break;
+                    s.pending.push_back(job);
+                    s.queued.push_back(job);
+                    s.workAvailable.notify_one();
+                    if (barrier) {
+                        s.jobDone.wait(lock, [&]() {
+                                return job->done || s.stopping;
+                            });
+                        if (s.stopping) break;
+                    }
+                }
+            } catch (const std::exception &e) {
+                lock_guard<mutex> lock(s.m);
+                s.readError = e.what();
+            }
+            lock_guard<mutex> lock(s.m);
+            s.eof = true;
+            s.workAvailable.notify_all();
+            s.jobDone.notify_all();
+        });
+
+    Shared &s = *shared;
+    
+    vector<thread> workers;
+    for (int i = 0; i < nWorkers; ++i) {
+        workers.push_back(thread([&]() {
+                    while (true) {
+                        shared_ptr<Job> job;
+                        {
+                            unique_lock<mutex> lock(s.m);
+                            s.workAvailable.wait(lock, [&]() {
+                                    return !s.queued.empty() || s.eof ||
+                                        s.stopping;
+                                });
+                            if (s.queued.empty() || s.stopping) return;
+                            job = s.queued.front();
+                            s.queued.pop_front();
+                        }
+                        string output, error;
+                        try {
+                            output = converter(job->input);
+                        } catch (const std::exception &e) {
+                            error = e.what();
+                        }
+                        lock_guard<mutex> lock(s.m);
+                        job->output = std::move(output);
+                        job->error = error;
+                        job->done = true;
+                        s.jobDone.notify_all();
+                    }
+                }));
+    }
+
+    string error;
+    
+    while (true) {
+        shared_ptr<Job> job;
+        {
+            unique_lock<mutex> lock(s.m);
+            auto ready = [&]() {
+                return (!s.pending.empty() && s.pending.front()->done) ||
+                (s.pending.empty() && s.eof);
+            };
+            while (!ready()) {
+                // Flush before we wait, so that we can still be used
+                // interactively
+                lock.unlock();
+                out.flush();
+                lock.lock();
+                if (ready()) break;
+                s.jobDone.wait(lock);
+            }
+            if (s.pending.empty()) {
+                error = s.readError;
+                break;
+            }
+            job = s.pending.front();
+            s.pending.pop_front();
+            s.spaceAvailable.notify_one();
+        }
+        if (job->error != "") {
+            error = job->error;
+            break;
+        }
+        out.write(job->output.data(), job->output.size());
+    }
+
+    {
+        lock_guard<mutex> lock(s.m);
+        s.stopping = true;
+        s.workAvailable.notify_all();
+        s.spaceAvailable.notify_all();
+        s.jobDone.notify_all();
+    }
+
+    for (auto &w: workers) {
+        w.join();
+    }
+
+    if (error != "") {
+        // See the comment on Shared above
+        reader.detach();
+        throw runtime_error(error);
+    }
+
+    reader.join();
+}
+
 int main(int argc, char **argv)
 {
     if (argc < 2) {
@@ -604,6 +1061,7 @@ int main(int argc, char **argv)
     string informat = "json", outformat = "json";
     RequestOrResponse::Direction direction = RequestOrResponse::Request;
     bool haveDirection = false;
+    int threads = 1;
     
     for (int i = 1; i < argc; ++i) {
 
@@ -618,6 +1076,11 @@ int main(int argc, char **argv)
             if (final) usage();
             else outformat = argv[++i];
 
+        } else if (arg == "-j") {
+            if (final) usage();
+            else threads = atoi(argv[++i]);
+            if (threads < 1) usage();
+
         } else if (arg == "request") {
             direction = RequestOrResponse::Request;
             haveDirection = true;
@@ -652,23 +1115,35 @@ int main(int argc, char **argv)
     }
 #endif
 
-    while (true) {
-
-        try {
+    ios::sync_with_stdio(false);
 
-            bool eof = false;
-            RequestOrResponse rr = readInput(informat, direction, eof);
-            if (eof) break;
+    kj::FdOutputStream stream(1); // stdout
+    kj::Array<kj::byte> buffer = kj::heapArray<kj::byte>(outputBufferSize);
+    kj::BufferedOutputStreamWrapper out(stream, buffer);
 
-            writeOutput(outformat, rr);
-
-        } catch (std::exception &e) {
-            cerr << "Error: " << e.what() << endl;
-            exit(1);
+    Converter converter = [&](const RawMessage &message) {
+        return convert(message, informat, outformat, direction);
+    };
+    
+    try {
+        auto source = make_shared<MessageSource>(informat);
+        if (threads > 1) {
+            // Copied into the reader thread, which may outlive us
+            auto isBarrier = [informat, outformat, direction]
+                (const RawMessage &message) {
+                return mayBeConfigureResponse(message, informat, outformat,
+                                              direction);
+            };
+            runParallel(source, out, converter, isBarrier, threads);
+        } else {
+            runSerial(*source, out, converter);
         }
+        out.flush();
+    } catch (std::exception &e) {
+        out.flush();
+        cerr << "Error: " << e.what() << endl;
+        exit(1);
     }
 
     exit(0);
 }
-
-
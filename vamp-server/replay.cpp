@@ -0,0 +1,233 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+/*
+    Piper C++
+
+    An API for audio analysis and feature extraction plugins.
+
+    Centre for Digital Music, Queen Mary, University of London.
+    Copyright 2006-2016 Chris Cannam and QMUL.
+  
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+    ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    Except as contained in this notice, the names of the Centre for
+    Digital Music; Queen Mary, University of London; and Chris Cannam
+    shall not be used in advertising or otherwise to promote the sale,
+    use or other dealings in this Software without prior written
+    authorization.
+*/
+
+#include "vamp-support/SessionArchive.h"
+#include "vamp-client/CapnpRRClient.h"
+#include "vamp-client/posix/ProcessPosixTransport.h"
+
+#include <iostream>
+#include <iomanip>
+#include <stdexcept>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include <capnp/serialize.h>
+
+using namespace std;
+using namespace piper_vamp;
+using namespace piper_vamp::client;
+
+static string myname = "piper-replay";
+
+void usage()
+{
+    cerr << "\n" << myname <<
+        ": Replay a recorded Piper session against a server and time it\n\n"
+        "    Usage: " << myname << " <archive> <server>\n\n"
+        "    where\n"
+        "       <archive>: a session archive recorded by piper-vamp-simple-server -r\n"
+        "       <server>: the server program to run; it is started with the single\n"
+        "           argument \"capnp\"\n\n"
+        "Sends each request in the archive to a new server process, in order and as\n"
+        "fast as the server will accept them, and reports the latency of each method.\n"
+        "Each response is compared with the one recorded, and the number that differ\n"
+        "is reported as well.\n\n";
+
+    exit(2);
+}
+
+static string
+methodName(RRType type)
+{
+    switch (type) {
+    case RRType::List: return "list";
+    case RRType::Load: return "load";
+    case RRType::Configure: return "configure";
+    case RRType::Process: return "process";
+    case RRType::Finish: return "finish";
+    case RRType::Reset: return "reset";
+    case RRType::ProcessFile: return "processFile";
+    case RRType::ProcessMulti: return "processMulti";
+    case RRType::ProcessSegmented: return "processSegmented";
+    case RRType::Stats: return "stats";
+    case RRType::NotValid: break;
+    }
+    return "invalid";
+}
+
+static double
+percentile(const vector<double> &sorted, double p)
+{
+    if (sorted.empty()) return 0.0;
+    size_t i = size_t(p * double(sorted.size() - 1) + 0.5);
+    return sorted[i];
+}
+
+static void
+report(string method, vector<double> latencies) // ms
+{
+    sort(latencies.begin(), latencies.end());
+    double total = 0.0;
+    for (auto l: latencies) total += l;
+    cout << left << setw(12) << method << right
+         << setw(8) << latencies.size()
+         << fixed << setprecision(3)
+         << setw(12) << total
+         << setw(10) << (latencies.empty() ? 0.0 : total / latencies.size())
+         << setw(10) << percentile(latencies, 0.5)
+         << setw(10) << percentile(latencies, 0.95)
+         << setw(10) << (latencies.empty() ? 0.0 : latencies.back())
+         << endl;
+}
+
+static void
+reportTransport(string phase, const TransportMetrics::Distribution &d)
+{
+    double ms = 1.0e-6;
+    cout << left << setw(12) << phase << right
+         << setw(8) << d.count
+         << fixed << setprecision(3)
+         << setw(12) << double(d.totalNs) * ms
+         << setw(10) << (d.count == 0 ? 0.0 :
+                         double(d.totalNs) * ms / double(d.count))
+         << setw(10) << double(d.p50Ns) * ms
+         << setw(10) << double(d.p95Ns) * ms
+         << setw(10) << double(d.maxNs) * ms
+         << endl;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3) {
+        usage();
+    }
+
+    string archivePath = argv[1];
+    string server = argv[2];
+
+    try {
+        SessionArchiveReader archive(archivePath);
+
+        ProcessPosixTransport transport(server, "capnp", nullptr);
+        CapnpRRClient::CompletenessChecker checker;
+        transport.setCompletenessChecker(&checker);
+        
+        if (!transport.isOK()) {
+            throw runtime_error("failed to start server \"" + server + "\"");
+        }
+
+        map<string, vector<double>> latencies;
+        vector<double> all;
+        int compared = 0, differing = 0;
+
+        size_t n = archive.getRecordCount();
+        
+        for (size_t i = 0; i < n; ++i) {
+
+            auto rec = archive.getRecord(i);
+            if (rec.direction != SessionArchive::Request) continue;
+
+            kj::ArrayPtr<const capnp::word> words
+                (static_cast<const capnp::word *>(rec.data),
+                 rec.length / sizeof(capnp::word));
+            capnp::FlatArrayMessageReader message(words);
+            RRType type = VampnProto::getRequestResponseType
+                (message.getRoot<piper::RpcRequest>());
+            string method = methodName(type);
+
+            auto start = chrono::steady_clock::now();
+            vector<char> response = transport.call
+                (static_cast<const char *>(rec.data), rec.length, method,
+                 type == RRType::Process || type == RRType::Finish ||
+                 type == RRType::ProcessFile || type == RRType::ProcessMulti ||
+                 type == RRType::ProcessSegmented);
+            double ms = chrono::duration<double, milli>
+                (chrono::steady_clock::now() - start).count();
+
+            latencies[method].push_back(ms);
+            all.push_back(ms);
+
+            // The recorded response, if there is one, follows its
+            // request directly, because the server handles only one
+            // request at a time
+            if (i + 1 < n) {
+                auto next = archive.getRecord(i + 1);
+                if (next.direction == SessionArchive::Response) {
+                    ++compared;
+                    if (next.length != response.size() ||
+                        memcmp(next.data, response.data(), next.length)) {
+                        ++differing;
+                    }
+                    ++i;
+                }
+            }
+        }
+
+        cout << left << setw(12) << "method" << right
+             << setw(8) << "count"
+             << setw(12) << "total ms"
+             << setw(10) << "mean"
+             << setw(10) << "p50"
+             << setw(10) << "p95"
+             << setw(10) << "max"
+             << endl;
+        for (const auto &m: latencies) {
+            report(m.first, m.second);
+        }
+        report("all", all);
+
+        // The transport's view of the same calls, split at the first
+        // byte of each response
+        auto metrics = transport.getMetrics();
+        cout << endl;
+        reportTransport("first byte", metrics.firstByte);
+        reportTransport("drain", metrics.drain);
+        cout << endl << metrics.bytesSent << " bytes sent, "
+             << metrics.bytesReceived << " bytes received, "
+             << metrics.readWakeups << " read wakeup(s)" << endl;
+        
+        cout << endl << compared << " response(s) compared with recording, "
+             << differing << " differ" << endl;
+        
+    } catch (const exception &e) {
+        cerr << myname << ": error: " << e.what() << endl;
+        exit(1);
+    }
+
+    return 0;
+}
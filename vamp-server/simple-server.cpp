@@ -38,10 +38,25 @@
 #include "vamp-support/RequestOrResponse.h"
 #include "vamp-support/CountingPluginHandleMapper.h"
 #include "vamp-support/LoaderRequests.h"
+#include "vamp-support/FeatureCache.h"
+#include "vamp-support/SessionArchive.h"
+#include "vamp-support/WorkerPool.h"
+#include "vamp-support/LatencyHistogram.h"
+#include "vamp-support/TraceWriter.h"
+#include "vamp-capnp/RawMessageReader.h"
+#include "vamp-capnp/ScratchSegment.h"
 
 #include <iostream>
 #include <sstream>
 #include <stdexcept>
+#include <cstdlib>
+#include <memory>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <iomanip>
+#include <atomic>
+#include <new>
 
 #include <capnp/serialize.h>
 
@@ -69,6 +84,27 @@ static int pid = getpid();
 #include <unistd.h>
 #endif
 
+// for thread CPU time
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+// for zygote mode
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
+#include <pthread.h>
+#include <dlfcn.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
 using namespace std;
 using namespace json11;
 using namespace piper_vamp;
@@ -82,34 +118,581 @@ static void version()
     exit(0);
 }
 
+static const int defaultCacheLimitMB = 1024;
+
 static void usage(bool successful = false)
 {
     cerr << "\n" << myname <<
         ": Load & run Vamp plugins in response to Piper messages\n\n"
-        "    Usage: " << myname << " [-d] <format>\n"
+        "    Usage: " << myname << " [-d] [-c <dir> [-l <mb>]] [-j <n>] [-s <key>]... [-r <archive>] [-t <trace>] <format>\n"
+        "           " << myname << " [-d] [-c <dir> [-l <mb>]] [-j <n>] [-s <key>]... [-r <archive>] [-t <trace>] -z <socket> [-p <preload>]... <format>\n"
         "           " << myname << " -v\n"
         "           " << myname << " -h\n\n"
         "    where\n"
         "       <format>: the format to read and write messages in (\"json\" or \"capnp\")\n"
         "       -d, --debug: also print debug information to stderr\n"
+        "       -c, --cache <dir>: reuse and store plugin results in the given directory\n"
+        "       -l, --cache-limit <mb>: limit the cache to about this many megabytes\n"
+        "           (default " << defaultCacheLimitMB << ")\n"
+        "       -j, --threads <n>: run the plugins of a processMulti request, or the\n"
+        "           segments of a processSegmented one, on up to <n> worker threads\n"
+        "           besides the main one (default: one fewer than the number of\n"
+        "           hardware threads)\n"
+        "       -s, --segment-safe <key>: treat the plugin with the given key as safe to\n"
+        "           run in parallel segments for processSegmented; may be repeated\n"
+        "       -r, --record <archive>: record all requests and responses to the given\n"
+        "           session archive file (capnp format only)\n"
+        "       -t, --trace <trace>: append a timeline of every request to the given\n"
+        "           file in Chrome trace-event format\n"
+        "       -z, --zygote <socket>: run as a zygote listening on the given Unix socket\n"
+        "       -p, --preload <preload>: in zygote mode, preload the library of the given\n"
+        "           plugin key, or all libraries with the given library id; may be repeated\n"
         "       -v, --version: print version number to stdout and exit\n"
         "       -h, --help: print this text to stderr and exit\n\n"
         "Expects Piper request messages in either Cap'n Proto or JSON format on stdin,\n"
         "and writes response messages in the same format to stdout.\n\n"
         "This server is intended for simple process separation. It's only suitable for\n"
         "use with a single trusted client per server invocation.\n\n"
+        "In zygote mode, the server instead listens for connections on a Unix-domain\n"
+        "socket, preloading any requested plugin libraries first. For each connection\n"
+        "it forks a child that serves that connection, reading requests from and\n"
+        "writing responses to the socket exactly as it otherwise would on stdin and\n"
+        "stdout. Because the child starts with the plugin libraries and plugin path\n"
+        "scan already in place, this avoids most of the cost of starting a server.\n"
+        "A client connects using SocketPosixTransport from vamp-client/posix, in\n"
+        "place of the usual ProcessPosixTransport or ProcessQtTransport. Zygote mode\n"
+        "is not available on Windows.\n\n"
+        "With a cache directory, the results of each plugin run are stored there, keyed\n"
+        "by the plugin, its configuration, and the complete input audio. A later run\n"
+        "that repeats an earlier one is answered from the cache without running the\n"
+        "plugin. The directory may be shared between server processes.\n\n"
+        "With a session archive, every Cap'n Proto request and response is appended to\n"
+        "the given file as it passes through, with its time of arrival. The archive can\n"
+        "be fed back to a server using piper-replay. In zygote mode each child records\n"
+        "to its own archive, whose name is the given one with the child's pid appended.\n\n"
         "The two formats behave differently in case of parser errors. JSON messages are\n"
         "expected one per input line; because the JSON support is really intended for\n"
         "interactive troubleshooting, any unparseable message is reported and discarded\n"
         "and the server waits for another message. In contrast, because of the assumption\n"
         "that the client is trusted and coupled to the server instance, a mangled\n"
-        "Cap'n Proto message causes the server to exit.\n\n";
+        "Cap'n Proto message causes the server to exit.\n\n"
+        "The server keeps histograms of the time taken to decode, handle, and encode\n"
+        "each kind of request, and to handle requests for each plugin. These are\n"
+        "returned in response to a stats request, and printed to stderr on receipt\n"
+        "of SIGUSR1 (not on Windows). The stats response also gives the CPU time,\n"
+        "and allocations attributed to each loaded plugin, which a finish request may\n"
+        "also ask for.\n\n"
+        "With a trace file, each request appears in the timeline as spans for reading,\n"
+        "decoding, handling (named after the request method), encoding and writing,\n"
+        "linked by flow arrows to the corresponding client spans if the client writes\n"
+        "to the same file. In zygote mode all children append to the one file.\n\n";
     if (successful) exit(0);
     else exit(2);
 }
 
 static CountingPluginHandleMapper mapper;
 
+// Per-plugin state beyond what the mapper holds. The load request
+// is retained so as to know the plugin's input sample rate and to be
+// able to construct a feature cache key on configure, and the
+// configuration so as to be able to frame the audio for processFile.
+// The resource usage is accumulated for stats and finish requests.
+// Each record lives at the index of the mapper slot that holds its
+// plugin, so that a request finds it without a further lookup of its
+// own. The timings are those for the plugin's key, found when the
+// plugin is loaded.
+
+struct PluginTimings;
+
+struct LoadedPlugin {
+    LoadedPlugin() : plugin(nullptr), timings(nullptr) { }
+    Vamp::Plugin *plugin;
+    LoadRequest loadRequest;
+    PluginConfiguration configuration;
+    unique_ptr<FeatureCacheSession> session;
+    ResourceUsage usage;
+    PluginTimings *timings;
+};
+
+static vector<unique_ptr<LoadedPlugin>> loadedPlugins;
+
+// Return the state recorded for the given plugin, or null if it is
+// not loaded. Fetch this once per request and pass it on, rather
+// than looking it up again for each use
+
+static LoadedPlugin *
+loadedPlugin(Vamp::Plugin *plugin)
+{
+    int slot = mapper.pluginToSlot(plugin);
+    if (slot < 0 || slot >= int(loadedPlugins.size())) return nullptr;
+    return loadedPlugins[slot].get();
+}
+
+// Feature cache, if enabled
+
+static unique_ptr<FeatureCache> featureCache;
+
+// Inputs retained while replaying from the cache, per plugin
+static const size_t maxReplayBytes = 256 * 1024 * 1024;
+
+// Worker threads for processMulti and processSegmented, started when first needed so that
+// a zygote never has any threads when it forks
+
+static unique_ptr<WorkerPool> workerPool;
+static int workerThreads = -1; // one fewer than the hardware threads
+
+// Request timings, for the stats request and the SIGUSR1 dump. Each
+// request is timed in three phases: decode, from the arrival of the
+// request to the end of its parsing; handle, the call to
+// handleRequest, which is where the plugin runs; and encode,
+// serialising and writing the response. Handle times are also kept
+// per plugin key and method. The per-plugin histograms are created
+// when a plugin with that key is first loaded, under statsMutex, and
+// never removed, so they can be read from the dump thread and
+// recorded into without the lock
+
+enum TimingPhase { DecodePhase, HandlePhase, EncodePhase, PhaseCount };
+
+static const char *const phaseNames[PhaseCount] = {
+    "decode", "handle", "encode"
+};
+
+static const int methodCount = int(RRType::NotValid) + 1;
+
+static LatencyHistogram methodTimings[methodCount][PhaseCount];
+
+struct PluginTimings {
+    LatencyHistogram handle[methodCount];
+};
+
+static map<string, unique_ptr<PluginTimings>> pluginTimings;
+static mutex statsMutex;
+
+// Time at which the request currently being read arrived, and at
+// which the response currently being written was ready to write
+static chrono::steady_clock::time_point requestArrival;
+static chrono::steady_clock::time_point responseEncoded;
+
+static uint64_t
+nsBetween(chrono::steady_clock::time_point start,
+          chrono::steady_clock::time_point end)
+{
+    return uint64_t(chrono::duration_cast<chrono::nanoseconds>
+                    (end - start).count());
+}
+
+static void
+recordTiming(RRType type, TimingPhase phase, uint64_t ns)
+{
+    methodTimings[int(type)][phase].record(ns);
+}
+
+// Resource accounting. Every allocation through operator new is
+// counted for the allocating thread, so that the allocations made
+// during a plugin call can be attributed to the plugin. Allocations
+// are also counted for the process as a whole, but only while
+// something is measuring the whole process, as the shared counters
+// cost an atomic update per allocation
+
+static thread_local uint64_t threadAllocatedBytes = 0;
+static thread_local uint64_t threadAllocations = 0;
+static atomic<int> processMeters(0);
+static atomic<uint64_t> processAllocatedBytes(0);
+static atomic<uint64_t> processAllocations(0);
+
+void *operator new(size_t size)
+{
+    threadAllocatedBytes += size;
+    ++threadAllocations;
+    if (processMeters.load(memory_order_relaxed) > 0) {
+        processAllocatedBytes.fetch_add(size, memory_order_relaxed);
+        processAllocations.fetch_add(1, memory_order_relaxed);
+    }
+    void *p = malloc(size ? size : 1);
+    if (!p) throw bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+static uint64_t
+cpuNs(bool wholeProcess)
+{
+#ifdef _WIN32
+    FILETIME creation, exited, kernel, user;
+    BOOL ok = (wholeProcess ?
+               GetProcessTimes(GetCurrentProcess(),
+                               &creation, &exited, &kernel, &user) :
+               GetThreadTimes(GetCurrentThread(),
+                              &creation, &exited, &kernel, &user));
+    if (!ok) return 0;
+    auto ticks = [](const FILETIME &t) { // 100ns units
+        return (uint64_t(t.dwHighDateTime) << 32) | t.dwLowDateTime;
+    };
+    return (ticks(kernel) + ticks(user)) * 100;
+#else
+    timespec ts;
+    if (clock_gettime(wholeProcess ?
+                      CLOCK_PROCESS_CPUTIME_ID : CLOCK_THREAD_CPUTIME_ID,
+                      &ts) != 0) {
+        return 0;
+    }
+    return uint64_t(ts.tv_sec) * 1000000000ull + uint64_t(ts.tv_nsec);
+#endif
+}
+
+// Measures the CPU time and allocations of the calling thread, or of
+// the whole process, between construction and addTo()
+
+class UsageMeter
+{
+public:
+    UsageMeter(bool wholeProcess = false) :
+        m_wholeProcess(wholeProcess) {
+        if (m_wholeProcess) {
+            processMeters.fetch_add(1);
+        }
+        m_cpu = cpuNs(m_wholeProcess);
+        m_bytes = allocatedBytes();
+        m_count = allocations();
+    }
+
+    ~UsageMeter() {
+        if (m_wholeProcess) {
+            processMeters.fetch_sub(1);
+        }
+    }
+
+    UsageMeter(const UsageMeter &) =delete;
+    UsageMeter &operator=(const UsageMeter &) =delete;
+
+    void addTo(ResourceUsage &usage) const {
+        ++usage.calls;
+        usage.cpuNs += cpuNs(m_wholeProcess) - m_cpu;
+        usage.allocatedBytes += allocatedBytes() - m_bytes;
+        usage.allocations += allocations() - m_count;
+    }
+
+private:
+    bool m_wholeProcess;
+    uint64_t m_cpu;
+    uint64_t m_bytes;
+    uint64_t m_count;
+
+    uint64_t allocatedBytes() const {
+        return m_wholeProcess ? processAllocatedBytes.load() : threadAllocatedBytes;
+    }
+    uint64_t allocations() const {
+        return m_wholeProcess ? processAllocations.load() : threadAllocations;
+    }
+};
+
+// Timeline trace, if tracing
+
+static unique_ptr<TraceWriter> trace;
+
+static int64_t
+traceId(const RequestOrResponse::RpcId &id)
+{
+    if (id.type == RequestOrResponse::RpcId::Number) return id.number;
+    else return -1;
+}
+
+// Session archive, if recording
+
+static unique_ptr<SessionArchiveWriter> archive;
+
+static void
+record(SessionArchive::Direction direction, const void *data, size_t length)
+{
+    if (!archive) return;
+    if (!archive->append(direction, data, length)) {
+        cerr << myname << " " << pid
+             << ": error: failed to write to session archive, no longer recording"
+             << endl;
+        archive.reset();
+    }
+}
+
+static FeatureCacheSession *
+cacheSessionFor(LoadedPlugin *loaded)
+{
+    if (!loaded) return nullptr;
+    return loaded->session.get();
+}
+
+// Add the usage measured by the given meter to the given plugin's
+// total. This may be called for different plugins at once from the
+// worker pool threads
+
+static void
+addUsage(LoadedPlugin *loaded, const UsageMeter &meter)
+{
+    if (!loaded) return;
+    meter.addTo(loaded->usage);
+}
+
+static ResourceUsage
+getUsage(const LoadedPlugin *loaded)
+{
+    if (!loaded) return {};
+    return loaded->usage;
+}
+
+static PluginTimings *
+timingsForPlugin(string pluginKey)
+{
+    lock_guard<mutex> guard(statsMutex);
+    auto &t = pluginTimings[pluginKey];
+    if (!t) t.reset(new PluginTimings);
+    return t.get();
+}
+
+static void
+recordPluginTiming(const LoadedPlugin *loaded, RRType type, uint64_t ns)
+{
+    if (!loaded || !loaded->timings) return;
+    loaded->timings->handle[int(type)].record(ns);
+}
+
+static string
+methodName(RRType type)
+{
+    switch (type) {
+    case RRType::List: return "list";
+    case RRType::Load: return "load";
+    case RRType::Configure: return "configure";
+    case RRType::Process: return "process";
+    case RRType::Finish: return "finish";
+    case RRType::Reset: return "reset";
+    case RRType::ProcessFile: return "processFile";
+    case RRType::ProcessMulti: return "processMulti";
+    case RRType::ProcessSegmented: return "processSegmented";
+    case RRType::Stats: return "stats";
+    case RRType::NotValid: break;
+    }
+    return "invalid";
+}
+
+static StatsResponse::Timing
+summariseTiming(string method, string pluginKey, string phase,
+                const LatencyHistogram &h)
+{
+    StatsResponse::Timing t;
+    t.method = method;
+    t.pluginKey = pluginKey;
+    t.phase = phase;
+    t.count = h.getCount();
+    t.totalNs = h.getTotal();
+    t.maxNs = h.getMax();
+    t.p50Ns = h.getPercentile(0.5);
+    t.p95Ns = h.getPercentile(0.95);
+    t.p99Ns = h.getPercentile(0.99);
+    return t;
+}
+
+static StatsResponse
+getStats()
+{
+    StatsResponse response;
+    for (int i = 0; i < methodCount; ++i) {
+        for (int phase = 0; phase < PhaseCount; ++phase) {
+            const auto &h = methodTimings[i][phase];
+            if (h.getCount() == 0) continue;
+            response.timings.push_back
+                (summariseTiming(methodName(RRType(i)), "",
+                                 phaseNames[phase], h));
+        }
+    }
+    lock_guard<mutex> guard(statsMutex);
+    for (const auto &p: pluginTimings) {
+        for (int i = 0; i < methodCount; ++i) {
+            const auto &h = p.second->handle[i];
+            if (h.getCount() == 0) continue;
+            response.timings.push_back
+                (summariseTiming(methodName(RRType(i)), p.first,
+                                 phaseNames[HandlePhase], h));
+        }
+    }
+    return response;
+}
+
+#ifndef _WIN32
+
+static void
+dumpStats()
+{
+    auto stats = getStats();
+    
+    ostringstream os;
+    os << myname << " " << pid << ": request timings in microseconds\n";
+    os << left << setw(18) << "method" << setw(8) << "phase"
+       << right << setw(10) << "count" << setw(12) << "mean"
+       << setw(12) << "p50" << setw(12) << "p95" << setw(12) << "p99"
+       << setw(12) << "max" << "  plugin\n";
+    os << fixed << setprecision(1);
+    for (const auto &t: stats.timings) {
+        double mean = (t.count > 0 ? double(t.totalNs) / double(t.count) : 0.0);
+        os << left << setw(18) << t.method << setw(8) << t.phase
+           << right << setw(10) << t.count
+           << setw(12) << mean / 1000.0
+           << setw(12) << double(t.p50Ns) / 1000.0
+           << setw(12) << double(t.p95Ns) / 1000.0
+           << setw(12) << double(t.p99Ns) / 1000.0
+           << setw(12) << double(t.maxNs) / 1000.0
+           << "  " << t.pluginKey << "\n";
+    }
+
+    // One write, so as not to be interleaved with debug output
+    cerr << os.str() << flush;
+}
+
+// Block SIGUSR1 and start a thread that waits for it and dumps the
+// request timings to stderr each time it arrives. This must happen
+// before any other thread is started, so that every thread inherits
+// the signal mask and the signal can only be taken by this one, and
+// after any zygote fork, since only the calling thread survives one
+
+static void
+startStatsDumpThread()
+{
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    if (pthread_sigmask(SIG_BLOCK, &set, nullptr) != 0) {
+        cerr << myname << " " << pid
+             << ": warning: failed to block SIGUSR1, timings will not be dumped"
+             << endl;
+        return;
+    }
+    // A zygote child inherits SIG_IGN, which would discard the signal
+    signal(SIGUSR1, SIG_DFL);
+    thread([set]() {
+            while (true) {
+                int sig = 0;
+                if (sigwait(&set, &sig) == 0 && sig == SIGUSR1) {
+                    dumpStats();
+                }
+            }
+        }).detach();
+}
+
+#endif
+
+// Check that the given plugin is ready to be run over a whole file,
+// throwing runtime_error if not, and reset it so that the run starts
+// from a clean state, discarding anything the client has already
+// processed. The feature cache is not consulted for these runs: each
+// is a single call, so there is nothing for it to save
+
+static LoadedPlugin &
+prepareForFile(Vamp::Plugin *plugin, string method)
+{
+    if (!plugin) {
+        throw runtime_error("unknown plugin handle supplied to " + method);
+    }
+
+    auto h = mapper.pluginToHandle(plugin);
+    if (!mapper.isConfigured(h)) {
+        throw runtime_error("plugin has not been configured");
+    }
+
+    auto loaded = loadedPlugin(plugin);
+    if (!loaded) {
+        throw runtime_error("no load request recorded for plugin");
+    }
+
+    if (auto session = cacheSessionFor(loaded)) {
+        session->reset();
+    } else {
+        plugin->reset();
+    }
+
+    return *loaded;
+}
+
+static WorkerPool &
+getWorkerPool()
+{
+    if (!workerPool) {
+        workerPool.reset(new WorkerPool(workerThreads));
+    }
+    return *workerPool;
+}
+
+// Check that the given input buffers are suitable for a process call
+// on the given plugin, throwing runtime_error if not, and return the
+// number of values expected in each buffer
+
+static int
+checkProcessInput(Vamp::Plugin *plugin,
+                  const vector<vector<float>> &inputBuffers)
+{
+    auto h = mapper.pluginToHandle(plugin);
+    if (!mapper.isConfigured(h)) {
+        throw runtime_error("plugin has not been configured");
+    }
+
+    int channels = int(inputBuffers.size());
+    if (channels != mapper.getChannelCount(h)) {
+        throw runtime_error("wrong number of channels supplied to process");
+    }
+                
+    bool frequencyDomain =
+        (plugin->getInputDomain() == Vamp::Plugin::FrequencyDomain);
+    int blockSize = mapper.getBlockSize(h);
+    int inputBufferSize;
+    if (frequencyDomain) {
+        inputBufferSize = 2 * (blockSize / 2) + 2;
+    } else {
+        inputBufferSize = blockSize;
+    }
+        
+    for (int i = 0; i < channels; ++i) {
+        if (int(inputBuffers[i].size()) != inputBufferSize) {
+            ostringstream os;
+            os << "wrong buffer size passed to process call as "
+               << (frequencyDomain ? "frequency" : "time")
+               << "-domain input on channel " << i << " with block size "
+               << blockSize << " (expected " << inputBufferSize
+               << " values, obtained " << inputBuffers[i].size()
+               << ")" << ends;
+            throw runtime_error(os.str());
+        }
+    }
+
+    return inputBufferSize;
+}
+
+// Run a single process call, through the feature cache if there is
+// one. This may be called for different plugins at once from the
+// worker pool threads
+
+static Plugin::FeatureSet
+runProcess(Vamp::Plugin *plugin, LoadedPlugin *loaded,
+           const float *const *inputBuffers,
+           int channels, int inputBufferSize, RealTime timestamp)
+{
+    UsageMeter meter;
+    Plugin::FeatureSet features;
+    if (auto session = cacheSessionFor(loaded)) {
+        features = session->process(inputBuffers, channels, inputBufferSize,
+                                    timestamp);
+    } else {
+        features = plugin->process(inputBuffers, timestamp);
+    }
+    addUsage(loaded, meter);
+    return features;
+}
+
 // We write our output to stdout, but want to ensure that the plugin
 // doesn't write anything itself. To do this we open a null file
 // descriptor and dup2() it into place of stdout in the gaps between
@@ -245,24 +828,28 @@ convertRequestJson(string input, string &err)
     return j;
 }
 
-RequestOrResponse
-readRequestJson(string &err, bool &eof)
+void
+readRequestJson(RequestOrResponse &rr, string &err, bool &eof)
 {
-    RequestOrResponse rr;
-    rr.direction = RequestOrResponse::Request;
+    rr.reuse(RequestOrResponse::Request);
 
     string input;
     if (!getline(cin, input)) {
         // the EOF case, not actually an error
         eof = true;
-        return rr;
+        return;
     }
+
+    requestArrival = chrono::steady_clock::now();
     
     Json j = convertRequestJson(input, err);
-    if (err != "") return {};
+    if (err != "") return;
 
     rr.type = VampJson::getRequestResponseType(j, err);
-    if (err != "") return {};
+    if (err != "") {
+        rr.type = RRType::NotValid;
+        return;
+    }
 
     rr.id = readJsonId(j);
 
@@ -286,11 +873,26 @@ readRequestJson(string &err, bool &eof)
     case RRType::Finish:
         rr.finishRequest = VampJson::toRpcRequest_Finish(j, mapper, err);
         break;
+    case RRType::Reset:
+        rr.resetRequest = VampJson::toRpcRequest_Reset(j, mapper, err);
+        break;
+    case RRType::ProcessFile:
+        rr.processFileRequest = VampJson::toRpcRequest_ProcessFile(j, mapper, err);
+        break;
+    case RRType::ProcessMulti:
+        rr.processMultiRequest = VampJson::toRpcRequest_ProcessMulti
+            (j, mapper, serialisation, err);
+        break;
+    case RRType::ProcessSegmented:
+        rr.processSegmentedRequest = VampJson::toRpcRequest_ProcessSegmented
+            (j, mapper, err);
+        break;
+    case RRType::Stats:
+        rr.statsRequest = VampJson::toRpcRequest_Stats(j, err);
+        break;
     case RRType::NotValid:
         break;
     }
-
-    return rr;
 }
 
 void
@@ -331,12 +933,32 @@ writeResponseJson(RequestOrResponse &rr, bool useBase64)
             j = VampJson::fromRpcResponse_Finish
                 (rr.finishResponse, mapper, serialisation, id);
             break;
+        case RRType::Reset:
+            j = VampJson::fromRpcResponse_Reset(rr.resetResponse, mapper, id);
+            break;
+        case RRType::ProcessFile:
+            j = VampJson::fromRpcResponse_ProcessFile
+                (rr.processFileResponse, mapper, serialisation, id);
+            break;
+        case RRType::ProcessMulti:
+            j = VampJson::fromRpcResponse_ProcessMulti
+                (rr.processMultiResponse, mapper, serialisation, id);
+            break;
+        case RRType::ProcessSegmented:
+            j = VampJson::fromRpcResponse_ProcessSegmented
+                (rr.processSegmentedResponse, mapper, serialisation, id);
+            break;
+        case RRType::Stats:
+            j = VampJson::fromRpcResponse_Stats(rr.statsResponse, id);
+            break;
         case RRType::NotValid:
             break;
         }
     }
 
-    cout << j.dump() << endl;
+    string output = j.dump();
+    responseEncoded = chrono::steady_clock::now();
+    cout << output << endl;
 }
 
 void
@@ -347,21 +969,26 @@ writeExceptionJson(const exception &e, RRType type, RequestOrResponse::RpcId id)
     cout << j.dump() << endl;
 }
 
-RequestOrResponse
-readRequestCapnp(bool &eof)
+void
+readRequestCapnp(RequestOrResponse &rr, bool &eof)
 {
-    RequestOrResponse rr;
-    rr.direction = RequestOrResponse::Request;
+    rr.reuse(RequestOrResponse::Request);
 
     static kj::FdInputStream stream(0); // stdin
-    static kj::BufferedInputStreamWrapper buffered(stream);
+    static RawMessageReader raw(stream, 64 * 1024);
 
-    if (buffered.tryGetReadBuffer() == nullptr) {
+    kj::ArrayPtr<const capnp::word> words;
+    if (!raw.next(words)) {
         eof = true;
-        return rr;
+        return;
     }
 
-    capnp::InputStreamMessageReader message(buffered);
+    requestArrival = chrono::steady_clock::now();
+
+    record(SessionArchive::Request,
+           words.begin(), words.size() * sizeof(capnp::word));
+    
+    capnp::FlatArrayMessageReader message(words);
     piper::RpcRequest::Reader reader = message.getRoot<piper::RpcRequest>();
     
     rr.type = VampnProto::getRequestResponseType(reader);
@@ -385,17 +1012,47 @@ readRequestCapnp(bool &eof)
     case RRType::Finish:
         VampnProto::readRpcRequest_Finish(rr.finishRequest, reader, mapper);
         break;
+    case RRType::Reset:
+        VampnProto::readRpcRequest_Reset(rr.resetRequest, reader, mapper);
+        break;
+    case RRType::ProcessFile:
+        VampnProto::readRpcRequest_ProcessFile(rr.processFileRequest, reader, mapper);
+        break;
+    case RRType::ProcessMulti:
+        VampnProto::readRpcRequest_ProcessMulti(rr.processMultiRequest, reader, mapper);
+        break;
+    case RRType::ProcessSegmented:
+        VampnProto::readRpcRequest_ProcessSegmented
+            (rr.processSegmentedRequest, reader, mapper);
+        break;
+    case RRType::Stats:
+        VampnProto::readRpcRequest_Stats(rr.statsRequest, reader);
+        break;
     case RRType::NotValid:
         break;
     }
+}
 
-    return rr;
+void
+writeMessageCapnp(capnp::MallocMessageBuilder &message)
+{
+    if (!archive) {
+        writeMessageToFd(1, message);
+        return;
+    }
+
+    auto words = messageToFlatArray(message);
+    auto bytes = words.asBytes();
+    kj::FdOutputStream stream(1);
+    stream.write(bytes.begin(), bytes.size());
+    record(SessionArchive::Response, bytes.begin(), bytes.size());
 }
 
 void
 writeResponseCapnp(RequestOrResponse &rr)
 {
-    capnp::MallocMessageBuilder message;
+    static ScratchSegment scratch;
+    capnp::MallocMessageBuilder message(scratch.get());
     piper::RpcResponse::Builder builder = message.initRoot<piper::RpcResponse>();
 
     buildId(builder, rr.id);
@@ -423,12 +1080,30 @@ writeResponseCapnp(RequestOrResponse &rr)
         case RRType::Finish:
             VampnProto::buildRpcResponse_Finish(builder, rr.finishResponse, mapper);
             break;
+        case RRType::Reset:
+            VampnProto::buildRpcResponse_Reset(builder, rr.resetResponse, mapper);
+            break;
+        case RRType::ProcessFile:
+            VampnProto::buildRpcResponse_ProcessFile(builder, rr.processFileResponse, mapper);
+            break;
+        case RRType::ProcessMulti:
+            VampnProto::buildRpcResponse_ProcessMulti(builder, rr.processMultiResponse, mapper);
+            break;
+        case RRType::ProcessSegmented:
+            VampnProto::buildRpcResponse_ProcessSegmented
+                (builder, rr.processSegmentedResponse, mapper);
+            break;
+        case RRType::Stats:
+            VampnProto::buildRpcResponse_Stats(builder, rr.statsResponse);
+            break;
         case RRType::NotValid:
             break;
         }
     }
-    
-    writeMessageToFd(1, message);
+
+    responseEncoded = chrono::steady_clock::now();
+    writeMessageCapnp(message);
+    scratch.noteUsed(message);
 }
 
 void
@@ -440,16 +1115,22 @@ writeExceptionCapnp(const exception &e, RRType type, RequestOrResponse::RpcId id
     buildId(builder, id);
     VampnProto::buildRpcResponse_Exception(builder, e, type);
     
-    writeMessageToFd(1, message);
+    writeMessageCapnp(message);
 }
 
-RequestOrResponse
-handleRequest(const RequestOrResponse &request, bool debug)
+// Handle the request, returning the state of the plugin it was
+// addressed to if it was addressed to a single one, for the
+// per-plugin timings
+
+static LoadedPlugin *
+handleRequest(const RequestOrResponse &request, RequestOrResponse &response,
+              bool debug)
 {
-    RequestOrResponse response;
-    response.direction = RequestOrResponse::Response;
+    response.reuse(RequestOrResponse::Response);
     response.type = request.type;
 
+    LoadedPlugin *loaded = nullptr;
+
     switch (request.type) {
 
     case RRType::List:
@@ -459,6 +1140,7 @@ handleRequest(const RequestOrResponse &request, bool debug)
         break;
 
     case RRType::Load:
+    {
         response.loadResponse =
             LoaderRequests().loadPlugin(request.loadRequest);
 
@@ -467,6 +1149,15 @@ handleRequest(const RequestOrResponse &request, bool debug)
         }
             
         mapper.addPlugin(response.loadResponse.plugin);
+        int slot = mapper.pluginToSlot(response.loadResponse.plugin);
+        if (slot >= int(loadedPlugins.size())) {
+            loadedPlugins.resize(slot + 1);
+        }
+        loadedPlugins[slot].reset(new LoadedPlugin);
+        loaded = loadedPlugins[slot].get();
+        loaded->plugin = response.loadResponse.plugin;
+        loaded->loadRequest = request.loadRequest;
+        loaded->timings = timingsForPlugin(request.loadRequest.pluginKey);
         if (debug) {
             cerr << "piper-vamp-server " << pid
                  << ": loaded plugin, handle = "
@@ -475,6 +1166,7 @@ handleRequest(const RequestOrResponse &request, bool debug)
         }
         response.success = true;
         break;
+    }
         
     case RRType::Configure:
     {
@@ -502,7 +1194,25 @@ handleRequest(const RequestOrResponse &request, bool debug)
         mapper.markConfigured
             (h,
              creq.configuration.channelCount,
-             response.configurationResponse.framing.blockSize);
+             response.configurationResponse.framing.blockSize,
+             response.configurationResponse.outputs);
+
+        loaded = loadedPlugin(creq.plugin);
+        if (loaded) {
+            PluginConfiguration config(creq.configuration);
+            config.framing = response.configurationResponse.framing;
+            loaded->configuration = config;
+            if (featureCache) {
+                auto key = FeatureCache::startKey
+                    (loaded->loadRequest,
+                     creq.plugin->getPluginVersion(),
+                     config);
+                loaded->session.reset(new FeatureCacheSession
+                                      (*featureCache, creq.plugin,
+                                       key, maxReplayBytes));
+            }
+        }
+        
         response.success = true;
         break;
     }
@@ -514,49 +1224,76 @@ handleRequest(const RequestOrResponse &request, bool debug)
             throw runtime_error("unknown plugin handle supplied to process");
         }
 
-        auto h = mapper.pluginToHandle(preq.plugin);
-        if (!mapper.isConfigured(h)) {
-            throw runtime_error("plugin has not been configured");
-        }
+        int inputBufferSize = checkProcessInput(preq.plugin, preq.inputBuffers);
 
         int channels = int(preq.inputBuffers.size());
-        if (channels != mapper.getChannelCount(h)) {
-            throw runtime_error("wrong number of channels supplied to process");
-        }
-                
-        const float **fbuffers = new const float *[channels];
-
-        bool frequencyDomain =
-            (preq.plugin->getInputDomain() == Vamp::Plugin::FrequencyDomain);
-        int blockSize = mapper.getBlockSize(h);
-        int inputBufferSize;
-        if (frequencyDomain) {
-            inputBufferSize = 2 * (blockSize / 2) + 2;
-        } else {
-            inputBufferSize = blockSize;
-        }
-        
+        static vector<const float *> fbuffers;
+        fbuffers.resize(channels);
         for (int i = 0; i < channels; ++i) {
-            if (int(preq.inputBuffers[i].size()) != inputBufferSize) {
-                ostringstream os;
-                os << "wrong buffer size passed to process call as "
-                   << (frequencyDomain ? "frequency" : "time")
-                   << "-domain input on channel " << i << " with block size "
-                   << blockSize << " (expected " << inputBufferSize
-                   << " values, obtained " << preq.inputBuffers[i].size()
-                   << ")" << ends;
-                delete[] fbuffers;
-                throw runtime_error(os.str());
-            }
             fbuffers[i] = preq.inputBuffers[i].data();
         }
 
+        loaded = loadedPlugin(preq.plugin);
         response.processResponse.plugin = preq.plugin;
         response.processResponse.features =
-            preq.plugin->process(fbuffers, preq.timestamp);
+            runProcess(preq.plugin, loaded, fbuffers.data(), channels,
+                       inputBufferSize, preq.timestamp);
         response.success = true;
+        break;
+    }
+
+    case RRType::ProcessMulti:
+    {
+        auto &pmreq = request.processMultiRequest;
+        int n = int(pmreq.plugins.size());
+
+        // Check everything before running anything, so that a bad
+        // request leaves every plugin untouched
+
+        int inputBufferSize = 0;
+        set<Vamp::Plugin *> seen;
+        vector<LoadedPlugin *> states;
+        for (auto plugin: pmreq.plugins) {
+            if (!plugin) {
+                throw runtime_error("unknown plugin handle supplied to processMulti");
+            }
+            if (!seen.insert(plugin).second) {
+                throw runtime_error("plugin handle repeated in processMulti");
+            }
+            inputBufferSize = checkProcessInput(plugin, pmreq.inputBuffers);
+            states.push_back(loadedPlugin(plugin));
+        }
+
+        int channels = int(pmreq.inputBuffers.size());
+        vector<const float *> fbuffers(channels);
+        for (int i = 0; i < channels; ++i) {
+            fbuffers[i] = pmreq.inputBuffers[i].data();
+        }
+
+        auto &responses = response.processMultiResponse.responses;
+        responses.resize(n);
+        
+        // The plugins are distinct, and each task writes only its own
+        // response, so they can run in parallel sharing the input
+        vector<WorkerPool::Task> tasks;
+        for (int i = 0; i < n; ++i) {
+            tasks.push_back([&, i]() {
+                    auto plugin = pmreq.plugins[i];
+                    auto start = chrono::steady_clock::now();
+                    responses[i].plugin = plugin;
+                    responses[i].features =
+                        runProcess(plugin, states[i], fbuffers.data(),
+                                   channels, inputBufferSize,
+                                   pmreq.timestamp);
+                    recordPluginTiming
+                        (states[i], RRType::ProcessMulti,
+                         nsBetween(start, chrono::steady_clock::now()));
+                });
+        }
 
-        delete[] fbuffers;
+        getWorkerPool().run(tasks);
+        
+        response.success = true;
         break;
     }
 
@@ -568,6 +1305,9 @@ handleRequest(const RequestOrResponse &request, bool debug)
         }
 
         response.finishResponse.plugin = freq.plugin;
+        response.finishResponse.features.clear();
+
+        loaded = loadedPlugin(freq.plugin);
 
         auto h = mapper.pluginToHandle(freq.plugin);
         // Finish can be called (to unload the plugin) even if the
@@ -575,7 +1315,19 @@ handleRequest(const RequestOrResponse &request, bool debug)
         // make sure we call getRemainingFeatures only if we have
         // actually configured the plugin.
         if (mapper.isConfigured(h)) {
-            response.finishResponse.features = freq.plugin->getRemainingFeatures();
+            UsageMeter meter;
+            if (auto session = cacheSessionFor(loaded)) {
+                response.finishResponse.features = session->finish();
+            } else {
+                response.finishResponse.features =
+                    freq.plugin->getRemainingFeatures();
+            }
+            addUsage(loaded, meter);
+        }
+
+        response.finishResponse.hasUsage = freq.includeUsage;
+        if (freq.includeUsage) {
+            response.finishResponse.usage = getUsage(loaded);
         }
 
         // We do not delete the plugin here -- we need it in the
@@ -585,23 +1337,222 @@ handleRequest(const RequestOrResponse &request, bool debug)
         break;
     }
 
+    case RRType::Reset:
+    {
+        auto &rreq = request.resetRequest;
+        if (!rreq.plugin) {
+            throw runtime_error("unknown plugin handle supplied to reset");
+        }
+
+        auto h = mapper.pluginToHandle(rreq.plugin);
+        if (!mapper.isConfigured(h)) {
+            throw runtime_error("plugin has not been configured");
+        }
+
+        loaded = loadedPlugin(rreq.plugin);
+        if (auto session = cacheSessionFor(loaded)) {
+            session->reset();
+        } else {
+            rreq.plugin->reset();
+        }
+        
+        response.resetResponse.plugin = rreq.plugin;
+        response.success = true;
+        break;
+    }
+
+    case RRType::ProcessFile:
+    {
+        auto &pfreq = request.processFileRequest;
+        loaded = &prepareForFile(pfreq.plugin, "processFile");
+        UsageMeter meter;
+        response.processFileResponse = LoaderRequests().processFile
+            (pfreq,
+             loaded->configuration,
+             loaded->loadRequest.inputSampleRate);
+        meter.addTo(loaded->usage);
+        response.success = true;
+        break;
+    }
+
+    case RRType::ProcessSegmented:
+    {
+        auto &psreq = request.processSegmentedRequest;
+        loaded = &prepareForFile(psreq.plugin, "processSegmented");
+        // The segments may run on any of the worker threads, so
+        // measure the whole process
+        UsageMeter meter(true);
+        response.processSegmentedResponse = LoaderRequests().processSegmented
+            (psreq,
+             loaded->loadRequest,
+             loaded->configuration,
+             getWorkerPool());
+        meter.addTo(loaded->usage);
+        response.success = true;
+        break;
+    }
+
+    case RRType::Stats:
+        response.statsResponse = getStats();
+        for (const auto &p: loadedPlugins) {
+            if (!p) continue;
+            StatsResponse::PluginUsage pu;
+            pu.handle = mapper.pluginToHandle(p->plugin);
+            pu.pluginKey = p->loadRequest.pluginKey;
+            pu.usage = getUsage(p.get());
+            response.statsResponse.plugins.push_back(pu);
+        }
+        response.success = true;
+        break;
+        
     case RRType::NotValid:
         break;
     }
+
+    return loaded;
+}
+
+#ifndef _WIN32
+
+static void
+preloadLibraries(const vector<string> &preload, bool debug)
+{
+    auto loader = Vamp::HostExt::PluginLoader::getInstance();
+
+    // Listing the plugins also means the loader has already scanned
+    // the plugin path by the time any child comes to load one
+    auto keys = loader->listPlugins();
+
+    set<string> paths;
+    vector<string> preloadKeys;
     
-    return response;
+    for (auto p: preload) {
+        bool found = false;
+        for (auto key: keys) {
+            if (key == p || key.substr(0, key.find(':')) == p) {
+                paths.insert(loader->getLibraryPathForPlugin(key));
+                preloadKeys.push_back(key);
+                found = true;
+            }
+        }
+        if (!found) {
+            cerr << myname << " " << pid
+                 << ": warning: no plugins found matching \"" << p
+                 << "\", not preloading anything for it" << endl;
+        }
+    }
+
+    for (auto path: paths) {
+        // These handles are deliberately never closed: holding them
+        // keeps the library mapped across the load and unload of
+        // individual plugins in the child processes
+        if (!dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL)) {
+            cerr << myname << " " << pid
+                 << ": warning: failed to preload library \"" << path
+                 << "\": " << dlerror() << endl;
+        } else if (debug) {
+            cerr << myname << " " << pid
+                 << ": preloaded library \"" << path << "\"" << endl;
+        }
+    }
+
+    // Also parse the libraries' RDF now, so that children find it
+    // already in the static output info cache
+    for (auto key: preloadKeys) {
+        (void)StaticOutputRdf().loadStaticOutputInfo(key);
+    }
 }
 
-RequestOrResponse
-readRequest(string format, bool &eof)
+/**
+ * Listen on the given Unix-domain socket, forking a child for every
+ * connection accepted. Returns only in a child process, with the
+ * connection in place as the child's stdin and stdout.
+ */
+static void
+runZygote(string socketPath, bool debug)
+{
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        throw runtime_error(string("failed to create socket: ") +
+                            strerror(errno));
+    }
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(addr.sun_path)) {
+        throw runtime_error("socket path \"" + socketPath + "\" is too long");
+    }
+    strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+    unlink(socketPath.c_str());
+    
+    if (::bind(listener, (sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(listener, 16) < 0) {
+        throw runtime_error("failed to listen on socket \"" + socketPath +
+                            "\": " + strerror(errno));
+    }
+
+    // Children are reaped automatically
+    signal(SIGCHLD, SIG_IGN);
+
+    // Timings are dumped only by the children, which restore this
+    signal(SIGUSR1, SIG_IGN);
+
+    if (debug) {
+        cerr << myname << " " << pid << ": zygote listening on \""
+             << socketPath << "\"" << endl;
+    }
+    
+    while (true) {
+
+        int conn = accept(listener, nullptr, nullptr);
+        if (conn < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            throw runtime_error(string("failed to accept connection: ") +
+                                strerror(errno));
+        }
+
+        pid_t child = fork();
+        
+        if (child < 0) {
+            cerr << myname << " " << pid << ": error: fork failed: "
+                 << strerror(errno) << endl;
+            close(conn);
+            continue;
+        }
+
+        if (child == 0) {
+            close(listener);
+            signal(SIGCHLD, SIG_DFL);
+            if (dup2(conn, 0) < 0 || dup2(conn, 1) < 0) {
+                throw runtime_error("failed to redirect stdio to connection");
+            }
+            close(conn);
+            pid = getpid();
+            return;
+        }
+
+        if (debug) {
+            cerr << myname << " " << pid << ": forked child " << child
+                 << " for new connection" << endl;
+        }
+        
+        close(conn);
+    }
+}
+
+#endif
+
+void
+readRequest(string format, RequestOrResponse &rr, bool &eof)
 {
     if (format == "capnp") {
-        return readRequestCapnp(eof);
+        readRequestCapnp(rr, eof);
     } else if (format == "json") {
         string err;
-        auto result = readRequestJson(err, eof);
+        readRequestJson(rr, err, eof);
         if (err != "") throw runtime_error(err);
-        else return result;
     } else {
         throw runtime_error("unknown input format \"" + format + "\"");
     }
@@ -637,40 +1588,149 @@ writeException(string format, const exception &e, RRType type, RequestOrResponse
 
 int main(int argc, char **argv)
 {
-    if (argc != 2 && argc != 3) {
+    if (argc < 2) {
         usage();
     }
 
     bool debug = false;
+    string zygoteSocket;
+    vector<string> preload;
+    string cacheDir;
+    string archivePath;
+    string tracePath;
+    int cacheLimitMB = defaultCacheLimitMB;
+    string format;
     
-    string arg = argv[1];
-    if (arg == "-h" || arg == "--help") {
-        if (argc == 2) {
-            usage(true);
-        } else {
-            usage();
-        }
-    } else if (arg == "-v" || arg == "--version") {
-        if (argc == 2) {
-            version();
+    for (int i = 1; i < argc; ++i) {
+
+        string arg = argv[i];
+        bool last = (i + 1 == argc);
+        
+        if (arg == "-h" || arg == "--help") {
+            if (argc == 2) {
+                usage(true);
+            } else {
+                usage();
+            }
+        } else if (arg == "-v" || arg == "--version") {
+            if (argc == 2) {
+                version();
+            } else {
+                usage();
+            }
+        } else if (arg == "-d" || arg == "--debug") {
+            debug = true;
+        } else if (arg == "-z" || arg == "--zygote") {
+            if (last) usage();
+            zygoteSocket = argv[++i];
+        } else if (arg == "-c" || arg == "--cache") {
+            if (last) usage();
+            cacheDir = argv[++i];
+        } else if (arg == "-l" || arg == "--cache-limit") {
+            if (last) usage();
+            cacheLimitMB = atoi(argv[++i]);
+            if (cacheLimitMB <= 0) usage();
+        } else if (arg == "-j" || arg == "--threads") {
+            if (last) usage();
+            workerThreads = atoi(argv[++i]);
+            if (workerThreads < 0) usage();
+        } else if (arg == "-s" || arg == "--segment-safe") {
+            if (last) usage();
+            LoaderRequests::addSegmentSafePlugin(argv[++i]);
+        } else if (arg == "-r" || arg == "--record") {
+            if (last) usage();
+            archivePath = argv[++i];
+        } else if (arg == "-t" || arg == "--trace") {
+            if (last) usage();
+            tracePath = argv[++i];
+        } else if (arg == "-p" || arg == "--preload") {
+            if (last) usage();
+            preload.push_back(argv[++i]);
+        } else if (last) {
+            format = arg;
         } else {
             usage();
         }
-    } else if (arg == "-d" || arg == "--debug") {
-        if (argc == 2) {
-            usage();
-        } else {
-            debug = true;
-            arg = argv[2];
-        }
     }
-    
-    string format = arg;
 
     if (format != "capnp" && format != "json") {
         usage();
     }
 
+    if (!preload.empty() && zygoteSocket == "") {
+        usage();
+    }
+
+    if (archivePath != "" && format != "capnp") {
+        usage();
+    }
+
+    if (zygoteSocket != "") {
+#ifdef _WIN32
+        cerr << "ERROR: zygote mode is not supported on this platform" << endl;
+        exit(2);
+#else
+        try {
+            preloadLibraries(preload, debug);
+            runZygote(zygoteSocket, debug);
+        } catch (exception &e) {
+            cerr << "ERROR: " << e.what() << endl;
+            exit(1);
+        }
+        // and if we get here, we are a child serving one connection
+#endif
+    }
+
+#ifndef _WIN32
+    startStatsDumpThread();
+#endif
+
+    if (cacheDir != "") {
+        // In zygote mode this happens in each child, so that it sees
+        // the runs stored by its predecessors
+        try {
+            featureCache.reset(new FeatureCache
+                               (cacheDir, uint64_t(cacheLimitMB) * 1024 * 1024));
+        } catch (exception &e) {
+            cerr << "ERROR: " << e.what() << endl;
+            exit(1);
+        }
+        if (debug) {
+            cerr << myname << " " << pid << ": using cache in " << cacheDir
+                 << " with " << featureCache->getRunCount() << " run(s), "
+                 << featureCache->getTotalBytes() << " bytes" << endl;
+        }
+    }
+    
+    if (archivePath != "") {
+        if (zygoteSocket != "") {
+            archivePath += "." + to_string(pid);
+        }
+        try {
+            archive.reset(new SessionArchiveWriter(archivePath));
+        } catch (exception &e) {
+            cerr << "ERROR: " << e.what() << endl;
+            exit(1);
+        }
+        if (debug) {
+            cerr << myname << " " << pid << ": recording session to "
+                 << archivePath << endl;
+        }
+    }
+    
+    if (tracePath != "") {
+        try {
+            trace.reset(new TraceWriter(tracePath, myname));
+        } catch (exception &e) {
+            cerr << "ERROR: " << e.what() << endl;
+            exit(1);
+        }
+        if (debug) {
+            cerr << myname << " " << pid << ": writing trace to "
+                 << tracePath << endl;
+        }
+    }
+    
     try {            
         initFds(format == "capnp");
     } catch (exception &e) {
@@ -687,14 +1747,20 @@ int main(int argc, char **argv)
         }
     }
     
+    // The request and response objects are reused for every message,
+    // so that the storage of whichever parts of them are in use, such
+    // as the process input buffers, is kept from one message to the
+    // next
+    RequestOrResponse request;
+    RequestOrResponse response;
+    
     while (true) {
 
-        RequestOrResponse request;
-        
         try {
 
             bool eof = false;
-            request = readRequest(format, eof);
+            auto waiting = chrono::steady_clock::now();
+            readRequest(format, request, eof);
             
             if (eof) {
                 if (debug) {
@@ -703,6 +1769,22 @@ int main(int argc, char **argv)
                 break;
             }
 
+            auto decoded = chrono::steady_clock::now();
+            recordTiming(request.type, DecodePhase,
+                         nsBetween(requestArrival, decoded));
+
+            if (trace) {
+                // The read span includes any time spent waiting for
+                // the client to send the request
+                auto id = traceId(request.id);
+                trace->span("read", waiting, requestArrival, id);
+                trace->span("decode", requestArrival, decoded, id);
+                if (id >= 0) {
+                    trace->flowEnd(TraceWriter::requestFlowId(id),
+                                   requestArrival);
+                }
+            }
+
             if (debug) {
                 cerr << myname << " " << pid << ": request received, of type "
                      << int(request.type)
@@ -727,10 +1809,25 @@ int main(int argc, char **argv)
                 }
                 exit(0);
             }
+
+            // The request may have been read only in part, so it
+            // must not be handled. Its type is kept, as above, only
+            // so that the error response can name the method
+            continue;
         }
 
         try {
-            RequestOrResponse response = handleRequest(request, debug);
+            auto start = chrono::steady_clock::now();
+            auto loaded = handleRequest(request, response, debug);
+            auto handled = chrono::steady_clock::now();
+            
+            recordTiming(request.type, HandlePhase, nsBetween(start, handled));
+            if (request.type != RRType::ProcessMulti) {
+                // processMulti is timed per plugin in handleRequest
+                recordPluginTiming(loaded, request.type,
+                                   nsBetween(start, handled));
+            }
+            
             response.id = request.id;
 
             if (debug) {
@@ -738,17 +1835,42 @@ int main(int argc, char **argv)
                      << endl;
             }
             
+            auto encoding = chrono::steady_clock::now();
             writeResponse(format, response);
+            auto written = chrono::steady_clock::now();
+
+            recordTiming(request.type, EncodePhase,
+                         nsBetween(encoding, written));
+
+            if (trace) {
+                auto id = traceId(request.id);
+                trace->span(methodName(request.type), start, handled, id);
+                trace->span("encode", encoding, responseEncoded, id);
+                trace->span("write", responseEncoded, written, id);
+                if (id >= 0) {
+                    trace->flowStart(TraceWriter::responseFlowId(id),
+                                     responseEncoded);
+                }
+            }
 
             if (debug) {
                 cerr << myname << " " << pid << ": response written" << endl;
             }
 
+            // Whole-file results may be large, and there is little
+            // to gain by keeping their storage for the next request
+            response.processFileResponse.features.clear();
+            response.processSegmentedResponse.features.clear();
+
             if (request.type == RRType::Finish) {
                 auto h = mapper.pluginToHandle(request.finishRequest.plugin);
                 if (debug) {
                     cerr << myname << " " << pid << ": deleting the plugin with handle " << h << endl;
                 }
+                int slot = mapper.pluginToSlot(request.finishRequest.plugin);
+                if (slot >= 0 && slot < int(loadedPlugins.size())) {
+                    loadedPlugins[slot].reset();
+                }
                 mapper.removePlugin(h);
                 delete request.finishRequest.plugin;
             }
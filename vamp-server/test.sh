@@ -175,4 +175,87 @@ for request_response_conversion in none json_to_json json_to_capnp ; do # nb jso
     rm "$allrespfile"
 done
 
+echo "Checking that parallel conversion matches serial conversion..."
+
+# A session with several plugin handles in use at once, so that the
+# configure responses for each handle are interleaved with process
+# responses for the others
+multireq="$tmpdir/multi-req.json"
+multiresp="$tmpdir/multi-resp.json"
+keys="zerocrossing percussiononsets amplitudefollower"
+(
+    h=1
+    for key in $keys ; do
+        echo '{"method":"load","id":'$h',"params":{"key":"vamp-example-plugins:'$key'","inputSampleRate":44100,"adapterFlags":[]}}'
+        echo '{"method":"configure","id":'$h',"params":{"handle":'$h',"configuration":{"framing":{"blockSize":8,"stepSize":8},"channelCount":1}}}'
+        h=$((h+1))
+    done
+    for step in $(seq 0 19) ; do
+        for h in 1 2 3 ; do
+            echo '{"method":"process","id":'$step',"params":{"handle":'$h',"processInput":{"timestamp":{"s":'$step',"n":0},"inputBuffers":[[1,-2,3,-4,'$step',6,-7,'$h']]}}}'
+        done
+    done
+    for h in 1 2 3 ; do
+        echo '{"method":"finish","id":'$h',"params":{"handle":'$h'}}'
+    done
+) > "$multireq"
+
+VAMP_PATH="$vampsdkdir"/examples "$bindir"/piper-vamp-simple-server json \
+         < "$multireq" > "$multiresp"
+
+for direction in request response ; do
+    if [ "$direction" = "request" ]; then
+        source="$multireq"
+    else
+        source="$multiresp"
+    fi
+    "$bindir"/piper-convert $direction -i json -o capnp < "$source" \
+             > "$tmpdir/multi.capnp"
+    for threads in 1 4 ; do
+        "$bindir"/piper-convert $direction -i capnp -o json -j $threads \
+                 < "$tmpdir/multi.capnp" > "$tmpdir/multi.$threads.json" ||
+            fail "piper-convert -j $threads failed on $direction log"
+        "$bindir"/piper-convert $direction -i json -o capnp -j $threads \
+                 < "$source" > "$tmpdir/multi.$threads.capnp" ||
+            fail "piper-convert -j $threads failed on $direction log"
+    done
+    cmp -s "$tmpdir/multi.1.json" "$tmpdir/multi.4.json" ||
+        fail "JSON output of $direction log differs between -j 1 and -j 4"
+    cmp -s "$tmpdir/multi.1.capnp" "$tmpdir/multi.4.capnp" ||
+        fail "capnp output of $direction log differs between -j 1 and -j 4"
+done
+echo OK
+
+echo "Checking that conversion stops at a malformed message..."
+
+# Everything before the malformed message is written, the same with
+# or without threads, and then the conversion fails
+lines=$(wc -l < "$multiresp")
+half=$((lines / 2))
+badresp="$tmpdir/bad-resp.json"
+( head -n $half "$multiresp" ;
+  echo '{"jsonrpc":"2.0","method":"process","result":{"handle":' ;
+  tail -n +$((half + 1)) "$multiresp" ) > "$badresp"
+head -n $half "$multiresp" |
+    "$bindir"/piper-convert response -i json -o capnp > "$tmpdir/good-half.capnp"
+for threads in 1 4 ; do
+    if "$bindir"/piper-convert response -i json -o capnp -j $threads \
+             < "$badresp" > "$tmpdir/bad.$threads.capnp" 2>/dev/null ; then
+        fail "piper-convert -j $threads accepted a malformed message"
+    fi
+    cmp -s "$tmpdir/good-half.capnp" "$tmpdir/bad.$threads.capnp" ||
+        fail "piper-convert -j $threads did not write exactly the messages before the malformed one"
+done
+echo OK
+
+echo "Checking that same-format conversion rejects an incomplete message..."
+
+# A well-formed envelope with a known method is not enough: the
+# parameters must be complete too, even when converting json to json
+if echo '{"method":"process","params":{}}' |
+        "$bindir"/piper-convert request -i json -o json > "$obtained" 2>/dev/null ; then
+    fail "piper-convert accepted a process request with no process input"
+fi
+echo OK
+
 echo "Tests succeeded"  # set -e at top should ensure we don't get here otherwise
@@ -78,7 +78,7 @@ public:
 	m_rplugins.erase(p);
     }
 
-    bool havePlugin(Vamp::Plugin *p) {
+    bool havePlugin(Vamp::Plugin *p) const {
         return (m_rplugins.find(p) != m_rplugins.end());
     }
     
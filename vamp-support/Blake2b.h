@@ -0,0 +1,190 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+/*
+  Piper C++
+
+  An API for audio analysis and feature extraction plugins.
+
+  Centre for Digital Music, Queen Mary, University of London.
+  Copyright 2006-2017 Chris Cannam and QMUL.
+  
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use, copy,
+  modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+  Except as contained in this notice, the names of the Centre for
+  Digital Music; Queen Mary, University of London; and Chris Cannam
+  shall not be used in advertising or otherwise to promote the sale,
+  use or other dealings in this Software without prior written
+  authorization.
+*/
+
+#ifndef PIPER_BLAKE2B_H
+#define PIPER_BLAKE2B_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+namespace piper_vamp {
+
+/**
+ * The BLAKE2b hash function (RFC 7693), unkeyed, with a digest of 1
+ * to 64 bytes. Data may be added in any number of pieces before the
+ * digest is taken.
+ *
+ * This is a plain portable implementation, fast enough to hash audio
+ * at many times real time, for use where a hash must be trusted not
+ * to collide (such as the keys of the FeatureCache) rather than just
+ * to spread values across a table.
+ */
+class Blake2b
+{
+public:
+    /**
+     * Start a hash with the given digest size in bytes. Throw
+     * std::logic_error if it is not between 1 and 64.
+     */
+    Blake2b(size_t digestBytes = 64) :
+        m_fill(0),
+        m_digestBytes(digestBytes) {
+        if (digestBytes < 1 || digestBytes > 64) {
+            throw std::logic_error("BLAKE2b digest size must be 1 to 64 bytes");
+        }
+        for (int i = 0; i < 8; ++i) m_h[i] = iv(i);
+        m_h[0] ^= 0x01010000ull ^ uint64_t(digestBytes);
+        m_t[0] = m_t[1] = 0;
+    }
+
+    void update(const void *data, size_t n) {
+        const unsigned char *p = static_cast<const unsigned char *>(data);
+        while (n > 0) {
+            // The final block must be compressed differently, so a
+            // full buffer is only compressed once more data arrives
+            if (m_fill == blockBytes) {
+                count(blockBytes);
+                compress(false);
+                m_fill = 0;
+            }
+            size_t take = blockBytes - m_fill;
+            if (take > n) take = n;
+            memcpy(m_buffer + m_fill, p, take);
+            m_fill += take;
+            p += take;
+            n -= take;
+        }
+    }
+
+    /**
+     * Write the digest, of the size given on construction, to out.
+     * No more data may be added afterwards.
+     */
+    void digest(unsigned char *out) {
+        count(m_fill);
+        memset(m_buffer + m_fill, 0, blockBytes - m_fill);
+        compress(true);
+        for (size_t i = 0; i < m_digestBytes; ++i) {
+            out[i] = (unsigned char)(m_h[i / 8] >> (8 * (i % 8)));
+        }
+    }
+
+private:
+    static const size_t blockBytes = 128;
+
+    uint64_t m_h[8];
+    uint64_t m_t[2];
+    unsigned char m_buffer[blockBytes];
+    size_t m_fill;
+    size_t m_digestBytes;
+
+    static uint64_t iv(int i) {
+        static const uint64_t v[8] = {
+            0x6a09e667f3bcc908ull, 0xbb67ae8584caa73bull,
+            0x3c6ef372fe94f82bull, 0xa54ff53a5f1d36f1ull,
+            0x510e527fade682d1ull, 0x9b05688c2b3e6c1full,
+            0x1f83d9abfb41bd6bull, 0x5be0cd19137e2179ull
+        };
+        return v[i];
+    }
+
+    void count(size_t n) {
+        m_t[0] += n;
+        if (m_t[0] < n) ++m_t[1];
+    }
+
+    static uint64_t rotr(uint64_t x, int n) {
+        return (x >> n) | (x << (64 - n));
+    }
+
+    static uint64_t load(const unsigned char *p) {
+        uint64_t w = 0;
+        for (int i = 7; i >= 0; --i) w = (w << 8) | p[i];
+        return w;
+    }
+
+    void compress(bool last) {
+
+        static const unsigned char sigma[10][16] = {
+            {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+            { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 },
+            { 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 },
+            {  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 },
+            {  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 },
+            {  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 },
+            { 12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11 },
+            { 13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10 },
+            {  6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5 },
+            { 10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0 }
+        };
+        
+        uint64_t m[16], v[16];
+        for (int i = 0; i < 16; ++i) m[i] = load(m_buffer + 8 * i);
+        for (int i = 0; i < 8; ++i) {
+            v[i] = m_h[i];
+            v[i + 8] = iv(i);
+        }
+        v[12] ^= m_t[0];
+        v[13] ^= m_t[1];
+        if (last) v[14] = ~v[14];
+
+        auto g = [&v](int a, int b, int c, int d, uint64_t x, uint64_t y) {
+            v[a] = v[a] + v[b] + x; v[d] = rotr(v[d] ^ v[a], 32);
+            v[c] = v[c] + v[d];     v[b] = rotr(v[b] ^ v[c], 24);
+            v[a] = v[a] + v[b] + y; v[d] = rotr(v[d] ^ v[a], 16);
+            v[c] = v[c] + v[d];     v[b] = rotr(v[b] ^ v[c], 63);
+        };
+
+        for (int r = 0; r < 12; ++r) {
+            const unsigned char *s = sigma[r % 10];
+            g(0, 4,  8, 12, m[s[ 0]], m[s[ 1]]);
+            g(1, 5,  9, 13, m[s[ 2]], m[s[ 3]]);
+            g(2, 6, 10, 14, m[s[ 4]], m[s[ 5]]);
+            g(3, 7, 11, 15, m[s[ 6]], m[s[ 7]]);
+            g(0, 5, 10, 15, m[s[ 8]], m[s[ 9]]);
+            g(1, 6, 11, 12, m[s[10]], m[s[11]]);
+            g(2, 7,  8, 13, m[s[12]], m[s[13]]);
+            g(3, 4,  9, 14, m[s[14]], m[s[15]]);
+        }
+
+        for (int i = 0; i < 8; ++i) m_h[i] ^= v[i] ^ v[i + 8];
+    }
+};
+
+}
+
+#endif
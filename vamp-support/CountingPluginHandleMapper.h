@@ -37,21 +37,17 @@
 
 #include "PluginHandleMapper.h"
 #include "PluginOutputIdMapper.h"
-#include "AssignedPluginHandleMapper.h"
-
-#include <set>
-#include <map>
+#include "SlotPluginHandleMapper.h"
 
 namespace piper_vamp {
 
 class CountingPluginHandleMapper : public PluginHandleMapper
 {
 public:
-    CountingPluginHandleMapper() : m_nextHandle(1) { }
+    CountingPluginHandleMapper() { }
 
     void addPlugin(Vamp::Plugin *p) {
-        Handle h = m_nextHandle++;
-        m_sub.addPlugin(h, p);
+        (void)m_sub.addPlugin(p);
     }
 
     void removePlugin(Handle h) {
@@ -66,6 +62,10 @@ public:
         return m_sub.handleToPlugin(h);
     }
 
+    int pluginToSlot(Vamp::Plugin *p) const noexcept {
+        return m_sub.pluginToSlot(p);
+    }
+
     const std::shared_ptr<PluginOutputIdMapper> pluginToOutputIdMapper
     (Vamp::Plugin *p) const noexcept override {
         return m_sub.pluginToOutputIdMapper(p);
@@ -84,6 +84,11 @@ public:
         m_sub.markConfigured(h, channelCount, blockSize);
     }
 
+    void markConfigured(Handle h, int channelCount, int blockSize,
+                        const Vamp::Plugin::OutputList &outputs) {
+        m_sub.markConfigured(h, channelCount, blockSize, outputs);
+    }
+
     int getChannelCount(Handle h) const noexcept {
         return m_sub.getChannelCount(h);
     }
@@ -93,8 +98,7 @@ public:
     }
     
 private:
-    Handle m_nextHandle; // NB plugin handle type must fit in JSON number
-    AssignedPluginHandleMapper m_sub;
+    SlotPluginHandleMapper m_sub;
 };
 
 }
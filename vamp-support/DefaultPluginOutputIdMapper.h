@@ -37,26 +37,41 @@
 
 #include <vamp-hostsdk/Plugin.h>
 
+#include <string>
+#include <vector>
+#include <unordered_map>
+
 namespace piper_vamp {
 
+/**
+ * The standard PluginOutputIdMapper, mapping between the ids and
+ * indices of a plugin's output list. Lookups are constant-time in
+ * both directions.
+ */
 class DefaultPluginOutputIdMapper : public PluginOutputIdMapper
 {
 public:
+    /**
+     * Construct from the plugin's current output descriptors.
+     */
     DefaultPluginOutputIdMapper(Vamp::Plugin *p) {
-	Vamp::Plugin::OutputList outputs = p->getOutputDescriptors();
-	for (const auto &d: outputs) {
-	    m_ids.push_back(d.identifier);
-	}
+        init(p->getOutputDescriptors());
+    }
+
+    /**
+     * Construct from an output list already obtained from the
+     * plugin, typically the one returned in response to configure.
+     */
+    DefaultPluginOutputIdMapper(const Vamp::Plugin::OutputList &outputs) {
+        init(outputs);
     }
 
     int idToIndex(std::string outputId) const noexcept override {
-	int n = int(m_ids.size());
-	for (int i = 0; i < n; ++i) {
-	    if (outputId == m_ids[i]) {
-		return i;
-	    }
-	}
-	return -1;
+        auto itr = m_indices.find(outputId);
+        if (itr == m_indices.end()) {
+            return -1;
+        }
+        return itr->second;
     }
 
     std::string indexToId(int index) const noexcept override {
@@ -66,6 +81,17 @@ public:
 
 private:
     std::vector<std::string> m_ids;
+    std::unordered_map<std::string, int> m_indices;
+
+    void init(const Vamp::Plugin::OutputList &outputs) {
+        m_ids.reserve(outputs.size());
+	for (const auto &d: outputs) {
+            // If an id is repeated, the first one wins, as it would
+            // in a linear search
+            m_indices.insert({ d.identifier, int(m_ids.size()) });
+	    m_ids.push_back(d.identifier);
+	}
+    }
 };
 
 }
@@ -0,0 +1,900 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+/*
+  Piper C++
+
+  An API for audio analysis and feature extraction plugins.
+
+  Centre for Digital Music, Queen Mary, University of London.
+  Copyright 2006-2017 Chris Cannam and QMUL.
+  
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use, copy,
+  modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+  Except as contained in this notice, the names of the Centre for
+  Digital Music; Queen Mary, University of London; and Chris Cannam
+  shall not be used in advertising or otherwise to promote the sale,
+  use or other dealings in this Software without prior written
+  authorization.
+*/
+
+#ifndef PIPER_FEATURE_CACHE_H
+#define PIPER_FEATURE_CACHE_H
+
+#include "PluginConfiguration.h"
+#include "RequestResponse.h"
+#include "Blake2b.h"
+
+#include <vamp-hostsdk/Plugin.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <process.h>
+#include <sys/utime.h>
+#else
+#include <dirent.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+namespace piper_vamp {
+
+/**
+ * \class FeatureCache
+ *
+ * A persistent, content-addressed store of plugin results, for use by
+ * a server that is often asked to run the same plugins with the same
+ * configuration over the same audio.
+ *
+ * Every step of a processing run has a 128-bit key that identifies
+ * everything that determines its output: the plugin (key and
+ * version), how it was loaded (sample rate and adapter flags), its
+ * configuration, and every input block it has been given so far
+ * together with its timestamp. The keys form a chain, each being a
+ * hash of the previous one together with the new input, so a key for
+ * a process call covers the whole input up to and including that
+ * call. The feature set returned at each step is stored under that
+ * step's key. The hash is BLAKE2b, truncated to 128 bits, because
+ * a collision would silently return the features of a different
+ * run.
+ *
+ * Each completed run is written to a single file in the cache
+ * directory, headed by the run's start key, and an index from key
+ * to file position is held in memory (and rebuilt from the files on
+ * startup). A lookup checks both the start key of the file it finds
+ * and the key stored with the entry, so that a stale index or a file
+ * replaced underneath us cannot produce the wrong features. When the total
+ * size of the files exceeds the configured limit, whole runs are
+ * evicted in least-recently-used order. The modification time of a
+ * file is updated when it is first used by a given cache object, so
+ * that the ordering survives a restart.
+ *
+ * Lookups that fail for any reason, including a file having been
+ * removed by another process sharing the same directory, are simply
+ * reported as misses.
+ *
+ * This class is thread-safe. See FeatureCacheSession for the logic
+ * that uses it on behalf of a single plugin.
+ */
+class FeatureCache
+{
+public:
+    /**
+     * The key of a step in a run. Its bytes are written to the run
+     * files as they are.
+     */
+    struct Key {
+        unsigned char bytes[16];
+        
+        bool operator==(const Key &other) const {
+            return memcmp(bytes, other.bytes, sizeof(bytes)) == 0;
+        }
+        bool operator!=(const Key &other) const {
+            return !(*this == other);
+        }
+    };
+
+    struct KeyHash {
+        // The key is already well mixed, so any part of it will do
+        size_t operator()(const Key &key) const {
+            size_t h;
+            memcpy(&h, key.bytes, sizeof(h));
+            return h;
+        }
+    };
+
+    /**
+     * Open or create a cache in the given directory, limiting the
+     * total size of stored runs to approximately maxBytes. The
+     * directory must already exist; std::runtime_error is thrown if
+     * it does not.
+     */
+    FeatureCache(std::string directory, uint64_t maxBytes) :
+        m_directory(directory),
+        m_maxBytes(maxBytes),
+        m_totalBytes(0),
+        m_nextFileId(1),
+        m_nextTempId(0),
+        m_openFileId(0) {
+        struct stat st;
+        if (stat(directory.c_str(), &st) != 0 || !(st.st_mode & S_IFDIR)) {
+            throw std::runtime_error("cache directory \"" + directory +
+                                     "\" does not exist");
+        }
+        scan();
+    }
+
+    ~FeatureCache() {
+        closeFile();
+    }
+
+    FeatureCache(const FeatureCache &) =delete;
+    FeatureCache &operator=(const FeatureCache &) =delete;
+
+    /**
+     * Return the key for the start of a run, before any process call.
+     */
+    static Key startKey(const LoadRequest &load,
+                        int pluginVersion,
+                        const PluginConfiguration &config) {
+        Hasher h('s');
+        h.string(load.pluginKey);
+        h.value(pluginVersion);
+        h.value(load.inputSampleRate);
+        h.value(load.adapterFlags);
+        h.value(config.channelCount);
+        h.value(config.framing.stepSize);
+        h.value(config.framing.blockSize);
+        h.string(config.currentProgram);
+        h.value(uint64_t(config.parameterValues.size()));
+        for (const auto &p: config.parameterValues) {
+            h.string(p.first);
+            h.value(p.second);
+        }
+        return h.key();
+    }
+
+    /**
+     * Return the key for a process call with the given input, made
+     * after the step whose key was previous.
+     */
+    static Key processKey(Key previous,
+                          const float *const *inputBuffers,
+                          int channels,
+                          int bufferSize,
+                          Vamp::RealTime timestamp) {
+        Hasher h('p');
+        h.value(previous);
+        h.value(timestamp.sec);
+        h.value(timestamp.nsec);
+        h.value(channels);
+        h.value(bufferSize);
+        for (int c = 0; c < channels; ++c) {
+            h.bytes(inputBuffers[c], bufferSize * sizeof(float));
+        }
+        return h.key();
+    }
+
+    /**
+     * Return the key for the getRemainingFeatures call that follows
+     * the step whose key was previous.
+     */
+    static Key finishKey(Key previous) {
+        Hasher h('f');
+        h.value(previous);
+        return h.key();
+    }
+
+    /**
+     * Look up the feature set stored for the given key, in a run that
+     * began with the given start key. Return true and fill in the
+     * feature set if one was found.
+     */
+    bool lookup(Key key, Key startKey, Vamp::Plugin::FeatureSet &features) {
+
+        std::lock_guard<std::mutex> guard(m_mutex);
+
+        auto itr = m_index.find(key);
+        if (itr == m_index.end()) {
+            return false;
+        }
+
+        Location loc = itr->second;
+        auto fitr = m_files.find(loc.fileId);
+        if (fitr == m_files.end()) {
+            m_index.erase(itr);
+            return false;
+        }
+
+        if (fitr->second.startKey != startKey) {
+            // Not the run we are replaying: the key collided, which
+            // should not happen, or the index is out of date
+            return false;
+        }
+
+        // Read the entry's own key and length as well as its payload,
+        // and check them against the index
+        Key storedKey;
+        uint32_t storedLength = 0;
+        std::vector<char> payload(loc.length);
+        if (!openFile(loc.fileId) ||
+            !m_openFile.seekg(loc.offset - entryHeaderLength()) ||
+            !m_openFile.read(reinterpret_cast<char *>(storedKey.bytes),
+                             sizeof(storedKey.bytes)) ||
+            !m_openFile.read(reinterpret_cast<char *>(&storedLength),
+                             sizeof(storedLength)) ||
+            storedKey != key ||
+            storedLength != loc.length ||
+            !m_openFile.read(payload.data(), loc.length) ||
+            !deserialise(payload, features)) {
+            // Unreadable, probably removed or replaced underneath us
+            closeFile();
+            forgetFile(loc.fileId);
+            return false;
+        }
+
+        touch(fitr->second);
+        return true;
+    }
+
+private:
+    struct Location {
+        uint64_t fileId;
+        uint64_t offset;
+        uint32_t length;
+    };
+
+public:
+    /**
+     * Accumulates the steps of a single run into a temporary file,
+     * to be added to the cache when complete. Obtain one with
+     * FeatureCache::startRun().
+     */
+    class Run
+    {
+    public:
+        ~Run() {
+            if (m_file.is_open()) {
+                m_file.close();
+                std::remove(m_tempPath.c_str());
+            }
+        }
+
+        Run(const Run &) =delete;
+        Run &operator=(const Run &) =delete;
+        
+        /**
+         * Append a step. Return false if the run could not be
+         * written, in which case it will not be committed.
+         */
+        bool add(Key key, const Vamp::Plugin::FeatureSet &features) {
+            if (!m_file.is_open()) return false;
+            std::vector<char> payload;
+            serialise(features, payload);
+            uint32_t length = uint32_t(payload.size());
+            uint64_t offset = m_written + entryHeaderLength();
+            m_file.write(reinterpret_cast<const char *>(key.bytes),
+                         sizeof(key.bytes));
+            m_file.write(reinterpret_cast<const char *>(&length), sizeof(length));
+            m_file.write(payload.data(), payload.size());
+            if (!m_file) {
+                m_file.close();
+                std::remove(m_tempPath.c_str());
+                return false;
+            }
+            m_written = offset + length;
+            m_entries.push_back({ key, { 0, offset, length } });
+            return true;
+        }
+
+    private:
+        friend class FeatureCache;
+
+        Run(std::string tempPath, Key startKey) :
+            m_tempPath(tempPath),
+            m_startKey(startKey),
+            m_file(tempPath, std::ios::out | std::ios::binary | std::ios::trunc),
+            m_written(0) {
+            m_file.write(magic(), magicLength());
+            m_file.write(reinterpret_cast<const char *>(startKey.bytes),
+                         sizeof(startKey.bytes));
+            if (m_file) {
+                m_written = fileHeaderLength();
+            } else {
+                m_file.close();
+            }
+        }
+
+        std::string m_tempPath;
+        Key m_startKey;
+        std::ofstream m_file;
+        uint64_t m_written;
+        std::vector<std::pair<Key, Location>> m_entries;
+    };
+
+    /**
+     * Start recording a new run beginning with the given start key.
+     */
+    std::unique_ptr<Run> startRun(Key startKey) {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        std::ostringstream os;
+        os << m_directory << "/.tmp-" << processId() << "-" << m_nextTempId++;
+        return std::unique_ptr<Run>(new Run(os.str(), startKey));
+    }
+
+    /**
+     * Add a completed run to the cache, naming it after its final
+     * key. Evict older runs if the cache is now over its size limit.
+     */
+    void commitRun(std::unique_ptr<Run> run) {
+
+        if (!run || !run->m_file.is_open() || run->m_entries.empty()) {
+            return;
+        }
+
+        run->m_file.close();
+        if (!run->m_file) {
+            std::remove(run->m_tempPath.c_str());
+            return;
+        }
+
+        std::lock_guard<std::mutex> guard(m_mutex);
+
+        Key finalKey = run->m_entries.rbegin()->first;
+        std::string name = fileNameFor(finalKey);
+        std::string path = m_directory + "/" + name;
+
+        for (const auto &f: m_files) {
+            if (f.second.name == name) {
+                // An identical run is already present (perhaps
+                // committed by another session at the same time)
+                std::remove(run->m_tempPath.c_str());
+                return;
+            }
+        }
+        
+        if (std::rename(run->m_tempPath.c_str(), path.c_str()) != 0) {
+            std::remove(run->m_tempPath.c_str());
+            return;
+        }
+        
+        uint64_t id = m_nextFileId++;
+        File &file = m_files[id];
+        file.name = name;
+        file.startKey = run->m_startKey;
+        file.size = run->m_written;
+        addToIndex(id, file, run->m_entries);
+        m_lru.push_back(id);
+        file.lruPosition = std::prev(m_lru.end());
+        file.touched = true;
+        m_totalBytes += file.size;
+
+        evict(id);
+    }
+
+    /**
+     * Return the total size in bytes of the runs currently stored.
+     */
+    uint64_t getTotalBytes() const {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        return m_totalBytes;
+    }
+
+    /**
+     * Return the number of runs currently stored.
+     */
+    size_t getRunCount() const {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        return m_files.size();
+    }
+
+private:
+    struct File {
+        File() : size(0), touched(false) { }
+        std::string name;
+        Key startKey;
+        uint64_t size;
+        std::vector<Key> keys;
+        std::list<uint64_t>::iterator lruPosition;
+        bool touched;
+    };
+
+    std::string m_directory;
+    uint64_t m_maxBytes;
+    uint64_t m_totalBytes;
+    uint64_t m_nextFileId;
+    uint64_t m_nextTempId;
+    std::map<uint64_t, File> m_files;
+    std::unordered_map<Key, Location, KeyHash> m_index;
+    std::list<uint64_t> m_lru; // least recently used first
+    std::ifstream m_openFile;
+    uint64_t m_openFileId;
+    mutable std::mutex m_mutex;
+
+    static const char *magic() { return "PIPERFC2"; }
+    static const char *oldMagic() { return "PIPERFC1"; }
+    static size_t magicLength() { return 8; }
+    static const char *suffix() { return ".pfc"; }
+
+    // A run file is the magic and the start key, followed by entries
+    // each of a key, a 32-bit payload length, and the payload
+    static size_t fileHeaderLength() { return magicLength() + sizeof(Key); }
+    static size_t entryHeaderLength() { return sizeof(Key) + sizeof(uint32_t); }
+
+    class Hasher
+    {
+    public:
+        // The tag distinguishes the kinds of key from one another
+        Hasher(char tag) : m_b(sizeof(Key)) { m_b.update(&tag, 1); }
+
+        void bytes(const void *data, size_t n) { m_b.update(data, n); }
+
+        template <typename T>
+        void value(const T &v) { bytes(&v, sizeof(v)); }
+
+        void string(const std::string &s) {
+            value(uint64_t(s.size()));
+            bytes(s.data(), s.size());
+        }
+
+        Key key() {
+            Key k;
+            m_b.digest(k.bytes);
+            return k;
+        }
+
+    private:
+        Blake2b m_b;
+    };
+    
+    static std::string fileNameFor(Key key) {
+        std::string name;
+        for (auto b: key.bytes) {
+            char buf[3];
+            snprintf(buf, sizeof(buf), "%02x", b);
+            name += buf;
+        }
+        return name + suffix();
+    }
+
+    static int processId() {
+#ifdef _WIN32
+        return _getpid();
+#else
+        return getpid();
+#endif
+    }
+
+    template <typename T>
+    static void put(std::vector<char> &out, T value) {
+        const char *p = reinterpret_cast<const char *>(&value);
+        out.insert(out.end(), p, p + sizeof(value));
+    }
+
+    template <typename T>
+    static bool get(const std::vector<char> &in, size_t &pos, T &value) {
+        if (pos + sizeof(value) > in.size()) return false;
+        memcpy(&value, in.data() + pos, sizeof(value));
+        pos += sizeof(value);
+        return true;
+    }
+    
+    static void serialise(const Vamp::Plugin::FeatureSet &fs,
+                          std::vector<char> &out) {
+        put(out, uint32_t(fs.size()));
+        for (const auto &fsi: fs) {
+            put(out, int32_t(fsi.first));
+            put(out, uint32_t(fsi.second.size()));
+            for (const auto &f: fsi.second) {
+                put(out, uint8_t((f.hasTimestamp ? 1 : 0) |
+                                 (f.hasDuration ? 2 : 0)));
+                put(out, int32_t(f.timestamp.sec));
+                put(out, int32_t(f.timestamp.nsec));
+                put(out, int32_t(f.duration.sec));
+                put(out, int32_t(f.duration.nsec));
+                put(out, uint32_t(f.values.size()));
+                const char *v = reinterpret_cast<const char *>(f.values.data());
+                out.insert(out.end(), v, v + f.values.size() * sizeof(float));
+                put(out, uint32_t(f.label.size()));
+                out.insert(out.end(), f.label.begin(), f.label.end());
+            }
+        }
+    }
+
+    static bool deserialise(const std::vector<char> &in,
+                            Vamp::Plugin::FeatureSet &fs) {
+        fs.clear();
+        size_t pos = 0;
+        uint32_t nOutputs;
+        if (!get(in, pos, nOutputs)) return false;
+        for (uint32_t i = 0; i < nOutputs; ++i) {
+            int32_t output;
+            uint32_t nFeatures;
+            if (!get(in, pos, output) || !get(in, pos, nFeatures)) return false;
+            Vamp::Plugin::FeatureList &fl = fs[output];
+            for (uint32_t j = 0; j < nFeatures; ++j) {
+                Vamp::Plugin::Feature f;
+                uint8_t flags;
+                int32_t tsec, tnsec, dsec, dnsec;
+                uint32_t nValues, nLabel;
+                if (!get(in, pos, flags) ||
+                    !get(in, pos, tsec) || !get(in, pos, tnsec) ||
+                    !get(in, pos, dsec) || !get(in, pos, dnsec) ||
+                    !get(in, pos, nValues)) return false;
+                if (pos + size_t(nValues) * sizeof(float) > in.size()) return false;
+                f.hasTimestamp = (flags & 1);
+                f.hasDuration = (flags & 2);
+                f.timestamp = Vamp::RealTime(tsec, tnsec);
+                f.duration = Vamp::RealTime(dsec, dnsec);
+                f.values.resize(nValues);
+                memcpy(f.values.data(), in.data() + pos, nValues * sizeof(float));
+                pos += nValues * sizeof(float);
+                if (!get(in, pos, nLabel)) return false;
+                if (pos + nLabel > in.size()) return false;
+                f.label = std::string(in.data() + pos, nLabel);
+                pos += nLabel;
+                fl.push_back(f);
+            }
+        }
+        return pos == in.size();
+    }
+
+    bool openFile(uint64_t fileId) {
+        if (m_openFileId == fileId && m_openFile.is_open()) {
+            m_openFile.clear();
+            return true;
+        }
+        closeFile();
+        m_openFile.open(m_directory + "/" + m_files.at(fileId).name,
+                        std::ios::in | std::ios::binary);
+        if (!m_openFile.is_open()) {
+            return false;
+        }
+        m_openFileId = fileId;
+        return true;
+    }
+
+    void closeFile() {
+        if (m_openFile.is_open()) {
+            m_openFile.close();
+        }
+        m_openFile.clear();
+        m_openFileId = 0;
+    }
+
+    void addToIndex(uint64_t id, File &file,
+                    const std::vector<std::pair<Key, Location>> &entries) {
+        for (const auto &e: entries) {
+            Location loc = e.second;
+            loc.fileId = id;
+            m_index[e.first] = loc;
+            file.keys.push_back(e.first);
+        }
+    }
+
+    void forgetFile(uint64_t id) {
+        auto itr = m_files.find(id);
+        if (itr == m_files.end()) return;
+        for (auto k: itr->second.keys) {
+            auto i = m_index.find(k);
+            if (i != m_index.end() && i->second.fileId == id) {
+                m_index.erase(i);
+            }
+        }
+        m_totalBytes -= itr->second.size;
+        m_lru.erase(itr->second.lruPosition);
+        m_files.erase(itr);
+    }
+
+    void touch(File &file) {
+        m_lru.splice(m_lru.end(), m_lru, file.lruPosition);
+        if (!file.touched) {
+            // Record the use on disk once per cache lifetime, so as
+            // to preserve the LRU ordering across restarts
+            std::string path = m_directory + "/" + file.name;
+#ifdef _WIN32
+            _utime(path.c_str(), nullptr);
+#else
+            utime(path.c_str(), nullptr);
+#endif
+            file.touched = true;
+        }
+    }
+
+    void evict(uint64_t keep) {
+        while (m_totalBytes > m_maxBytes && !m_lru.empty()) {
+            uint64_t id = m_lru.front();
+            if (id == keep) {
+                if (m_lru.size() == 1) break;
+                m_lru.splice(m_lru.end(), m_lru, m_lru.begin());
+                continue;
+            }
+            if (id == m_openFileId) {
+                closeFile();
+            }
+            std::string path = m_directory + "/" + m_files.at(id).name;
+            std::remove(path.c_str());
+            forgetFile(id);
+        }
+    }
+
+    static std::vector<std::string> listDirectory(std::string dir) {
+        std::vector<std::string> names;
+#ifdef _WIN32
+        WIN32_FIND_DATAA data;
+        HANDLE h = FindFirstFileA((dir + "/*").c_str(), &data);
+        if (h == INVALID_HANDLE_VALUE) return names;
+        do {
+            names.push_back(data.cFileName);
+        } while (FindNextFileA(h, &data));
+        FindClose(h);
+#else
+        DIR *d = opendir(dir.c_str());
+        if (!d) return names;
+        while (struct dirent *e = readdir(d)) {
+            names.push_back(e->d_name);
+        }
+        closedir(d);
+#endif
+        return names;
+    }
+
+    static bool hasSuffix(const std::string &name, const std::string &s) {
+        return name.size() > s.size() &&
+            name.compare(name.size() - s.size(), s.size(), s) == 0;
+    }
+
+    /**
+     * Rebuild the index from the run files present in the cache
+     * directory.
+     */
+    void scan() {
+
+        std::multimap<time_t, std::string> byTime;
+
+        for (auto name: listDirectory(m_directory)) {
+            if (!hasSuffix(name, suffix())) continue;
+            struct stat st;
+            if (stat((m_directory + "/" + name).c_str(), &st) != 0) continue;
+            byTime.insert({ st.st_mtime, name });
+        }
+
+        // Oldest first, so that later (more recently used) runs win
+        // where keys are shared
+        for (const auto &entry: byTime) {
+
+            std::string path = m_directory + "/" + entry.second;
+            std::ifstream in(path, std::ios::in | std::ios::binary);
+            char m[8];
+            if (!in.read(m, magicLength())) {
+                continue;
+            }
+            if (memcmp(m, oldMagic(), magicLength()) == 0) {
+                // From an earlier version, whose keys we can't trust
+                in.close();
+                std::remove(path.c_str());
+                continue;
+            }
+            Key startKey;
+            if (memcmp(m, magic(), magicLength()) != 0 ||
+                !in.read(reinterpret_cast<char *>(startKey.bytes),
+                         sizeof(startKey.bytes))) {
+                continue;
+            }
+
+            std::vector<std::pair<Key, Location>> entries;
+            uint64_t offset = fileHeaderLength();
+            Key key;
+            uint32_t length;
+            while (in.read(reinterpret_cast<char *>(key.bytes),
+                           sizeof(key.bytes)) &&
+                   in.read(reinterpret_cast<char *>(&length), sizeof(length))) {
+                offset += entryHeaderLength();
+                entries.push_back({ key, { 0, offset, length } });
+                offset += length;
+                if (!in.seekg(offset)) break;
+            }
+            
+            uint64_t id = m_nextFileId++;
+            File &file = m_files[id];
+            file.name = entry.second;
+            file.startKey = startKey;
+            file.size = offset;
+            addToIndex(id, file, entries);
+            m_lru.push_back(id);
+            file.lruPosition = std::prev(m_lru.end());
+            m_totalBytes += file.size;
+        }
+
+        evict(0);
+    }
+};
+
+/**
+ * \class FeatureCacheSession
+ *
+ * Runs a single configured plugin through a FeatureCache. Process
+ * and finish calls are answered from the cache for as long as every
+ * step so far has been found there, without running the plugin at
+ * all. The inputs seen during that time are retained, and on the
+ * first miss they are fed to the plugin (discarding its output, which
+ * was already returned from the cache) so that it reaches the state
+ * it would have had, before it handles the new input.
+ *
+ * The retained input is limited to maxReplayBytes. A run that goes
+ * beyond that while still hitting the cache falls back to running the
+ * plugin from that point on.
+ *
+ * Any run that was not answered entirely from the cache is recorded,
+ * and committed to the cache when finished.
+ */
+class FeatureCacheSession
+{
+public:
+    FeatureCacheSession(FeatureCache &cache,
+                        Vamp::Plugin *plugin,
+                        FeatureCache::Key startKey,
+                        size_t maxReplayBytes) :
+        m_cache(cache),
+        m_plugin(plugin),
+        m_startKey(startKey),
+        m_maxReplayBytes(maxReplayBytes) {
+        begin();
+    }
+
+    Vamp::Plugin::FeatureSet
+    process(const float *const *inputBuffers,
+            int channels,
+            int bufferSize,
+            Vamp::RealTime timestamp) {
+
+        m_key = FeatureCache::processKey(m_key, inputBuffers,
+                                         channels, bufferSize, timestamp);
+
+        Vamp::Plugin::FeatureSet features;
+        
+        if (m_replaying) {
+            if (m_cache.lookup(m_key, m_startKey, features)) {
+                Pending p;
+                p.timestamp = timestamp;
+                for (int c = 0; c < channels; ++c) {
+                    p.buffers.push_back(std::vector<float>
+                                        (inputBuffers[c],
+                                         inputBuffers[c] + bufferSize));
+                }
+                p.key = m_key;
+                p.features = features;
+                m_pendingBytes += size_t(channels) * bufferSize * sizeof(float);
+                m_pending.push_back(std::move(p));
+                if (m_pendingBytes > m_maxReplayBytes) {
+                    catchUp();
+                }
+                return features;
+            }
+            catchUp();
+        }
+
+        features = m_plugin->process(inputBuffers, timestamp);
+        record(m_key, features);
+        return features;
+    }
+
+    Vamp::Plugin::FeatureSet
+    finish() {
+
+        FeatureCache::Key key = FeatureCache::finishKey(m_key);
+        
+        Vamp::Plugin::FeatureSet features;
+
+        if (m_replaying) {
+            if (m_cache.lookup(key, m_startKey, features)) {
+                // The whole run came from the cache, so there is
+                // nothing new to store
+                m_pending.clear();
+                return features;
+            }
+            catchUp();
+        }
+
+        features = m_plugin->getRemainingFeatures();
+        record(key, features);
+        m_cache.commitRun(std::move(m_run));
+        return features;
+    }
+
+    void
+    reset() {
+        m_plugin->reset();
+        begin();
+    }
+
+private:
+    struct Pending {
+        Vamp::RealTime timestamp;
+        std::vector<std::vector<float>> buffers;
+        FeatureCache::Key key;
+        Vamp::Plugin::FeatureSet features;
+    };
+    
+    FeatureCache &m_cache;
+    Vamp::Plugin *m_plugin;
+    FeatureCache::Key m_startKey;
+    FeatureCache::Key m_key;
+    size_t m_maxReplayBytes;
+    bool m_replaying;
+    std::vector<Pending> m_pending;
+    size_t m_pendingBytes;
+    std::unique_ptr<FeatureCache::Run> m_run;
+
+    void begin() {
+        m_key = m_startKey;
+        m_replaying = true;
+        m_pending.clear();
+        m_pendingBytes = 0;
+        m_run.reset();
+    }
+
+    void catchUp() {
+        m_replaying = false;
+        m_run = m_cache.startRun(m_startKey);
+        std::vector<const float *> ptrs;
+        for (const auto &p: m_pending) {
+            ptrs.clear();
+            for (const auto &b: p.buffers) {
+                ptrs.push_back(b.data());
+            }
+            (void)m_plugin->process(ptrs.data(), p.timestamp);
+            record(p.key, p.features);
+        }
+        m_pending.clear();
+        m_pendingBytes = 0;
+    }
+
+    void record(FeatureCache::Key key,
+                const Vamp::Plugin::FeatureSet &features) {
+        if (!m_run) {
+            m_run = m_cache.startRun(m_startKey);
+        }
+        if (!m_run->add(key, features)) {
+            // Give up on recording this run, but carry on processing
+            m_run.reset();
+        }
+    }
+};
+
+}
+
+#endif
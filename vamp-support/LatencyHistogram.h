@@ -0,0 +1,178 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+/*
+  Piper C++
+
+  An API for audio analysis and feature extraction plugins.
+
+  Centre for Digital Music, Queen Mary, University of London.
+  Copyright 2006-2017 Chris Cannam and QMUL.
+  
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use, copy,
+  modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+  Except as contained in this notice, the names of the Centre for
+  Digital Music; Queen Mary, University of London; and Chris Cannam
+  shall not be used in advertising or otherwise to promote the sale,
+  use or other dealings in this Software without prior written
+  authorization.
+*/
+
+#ifndef PIPER_LATENCY_HISTOGRAM_H
+#define PIPER_LATENCY_HISTOGRAM_H
+
+#include <atomic>
+#include <cstdint>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+#include <intrin.h>
+#endif
+
+namespace piper_vamp {
+
+/**
+ * A histogram of durations in nanoseconds, cheap enough to update on
+ * every request and safe to update and read from any number of
+ * threads at once.
+ *
+ * Durations below 16ns have a bucket each; above that, each power of
+ * two is split into 8 buckets, so that a percentile read from the
+ * histogram is within 12.5% of the true value. Durations of 2^40ns
+ * (about 18 minutes) or more share the top bucket.
+ *
+ * Reads are not atomic with respect to concurrent updates as a
+ * whole, so a summary taken while updates are in progress may count
+ * a duration in one figure and not yet in another.
+ */
+class LatencyHistogram
+{
+public:
+    LatencyHistogram() :
+        m_count(0),
+        m_total(0),
+        m_max(0) {
+        for (auto &b: m_buckets) b = 0;
+    }
+
+    LatencyHistogram(const LatencyHistogram &) =delete;
+    LatencyHistogram &operator=(const LatencyHistogram &) =delete;
+    
+    void record(uint64_t ns) {
+        m_buckets[bucketFor(ns)].fetch_add(1, std::memory_order_relaxed);
+        m_count.fetch_add(1, std::memory_order_relaxed);
+        m_total.fetch_add(ns, std::memory_order_relaxed);
+        uint64_t prev = m_max.load(std::memory_order_relaxed);
+        while (ns > prev &&
+               !m_max.compare_exchange_weak(prev, ns,
+                                            std::memory_order_relaxed)) {
+        }
+    }
+
+    uint64_t getCount() const {
+        return m_count.load(std::memory_order_relaxed);
+    }
+
+    uint64_t getTotal() const {
+        return m_total.load(std::memory_order_relaxed);
+    }
+
+    uint64_t getMax() const {
+        return m_max.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Return an upper bound for the duration below which the given
+     * proportion (0 to 1) of the recorded durations fall, or 0 if
+     * nothing has been recorded.
+     */
+    uint64_t getPercentile(double p) const {
+        uint64_t counts[bucketCount];
+        uint64_t n = 0;
+        for (int i = 0; i < bucketCount; ++i) {
+            counts[i] = m_buckets[i].load(std::memory_order_relaxed);
+            n += counts[i];
+        }
+        if (n == 0) return 0;
+        uint64_t target = uint64_t(p * double(n) + 0.5);
+        if (target < 1) target = 1;
+        if (target > n) target = n;
+        uint64_t seen = 0;
+        for (int i = 0; i < bucketCount; ++i) {
+            seen += counts[i];
+            if (seen >= target) {
+                uint64_t bound = upperBoundOf(i);
+                uint64_t max = getMax();
+                return bound < max ? bound : max;
+            }
+        }
+        return getMax();
+    }
+
+private:
+    static const int linearBuckets = 16;
+    static const int subBucketBits = 3;
+    static const int maxExponent = 40;
+    static const int bucketCount =
+        linearBuckets + (maxExponent - 4) * (1 << subBucketBits);
+    
+    std::atomic<uint64_t> m_buckets[bucketCount];
+    std::atomic<uint64_t> m_count;
+    std::atomic<uint64_t> m_total;
+    std::atomic<uint64_t> m_max;
+
+    static int bucketFor(uint64_t ns) {
+        if (ns < linearBuckets) return int(ns);
+        int e = highestBit(ns); // e >= 4
+        if (e >= maxExponent) return bucketCount - 1;
+        int sub = int(ns >> (e - subBucketBits)) & ((1 << subBucketBits) - 1);
+        return linearBuckets + (e - 4) * (1 << subBucketBits) + sub;
+    }
+
+    // Index of the highest set bit; n must be non-zero
+    static int highestBit(uint64_t n) {
+#if defined(__GNUC__) || defined(__clang__)
+        return 63 - __builtin_clzll(n);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+        unsigned long index;
+        _BitScanReverse64(&index, n);
+        return int(index);
+#else
+        int e = 0;
+        for (int shift = 32; shift > 0; shift /= 2) {
+            if (n >> shift) {
+                n >>= shift;
+                e += shift;
+            }
+        }
+        return e;
+#endif
+    }
+
+    static uint64_t upperBoundOf(int bucket) {
+        if (bucket < linearBuckets) return uint64_t(bucket);
+        int i = bucket - linearBuckets;
+        int e = 4 + (i >> subBucketBits);
+        int sub = i & ((1 << subBucketBits) - 1);
+        return ((uint64_t(1 << subBucketBits) + sub + 1) <<
+                (e - subBucketBits)) - 1;
+    }
+};
+
+}
+
+#endif
@@ -42,12 +42,20 @@
 #include "PluginProgramParameters.h"
 #include "StaticOutputRdf.h"
 #include "RequestResponse.h"
+#include "WavFileReader.h"
+#include "WorkerPool.h"
 
 #include <vamp-hostsdk/PluginLoader.h>
 
+#include <algorithm>
 #include <map>
+#include <memory>
+#include <set>
 #include <string>
 #include <iostream>
+#include <mutex>
+#include <cmath>
+#include <stdexcept>
 
 namespace piper_vamp {
 
@@ -95,11 +103,24 @@ public:
 						  req.inputSampleRate,
 						  req.adapterFlags);
 
+	return describeLoadedPlugin(req, plugin);
+    }
+
+    /**
+     * Build the load response for a plugin that has already been
+     * loaded, by whatever means, in answer to the given request. The
+     * response takes ownership of the plugin, as with loadPlugin. If
+     * plugin is null, so is the plugin in the response.
+     */
+    LoadResponse
+    describeLoadedPlugin(LoadRequest req, Vamp::Plugin *plugin) {
+
+	auto loader = Vamp::HostExt::PluginLoader::getInstance();
+
 	LoadResponse response;
 	response.plugin = plugin;
 	if (!plugin) return response;
 
-	response.plugin = plugin;
 	response.staticData = PluginStaticData::fromPlugin
 	    (req.pluginKey,
 	     loader->getPluginCategory(req.pluginKey),
@@ -119,8 +140,10 @@ public:
 	     int(plugin->getPreferredStepSize()),
 	     int(plugin->getPreferredBlockSize()));
 
-        response.programParameters = PluginProgramParameters::fromPlugin
-            (plugin, response.defaultConfiguration);
+        if (!req.omitProgramParameters) {
+            response.programParameters = programParametersFor
+                (req.pluginKey, plugin, response.defaultConfiguration);
+        }
         
 	return response;
     }
@@ -215,6 +238,456 @@ public:
 
 	return response;
     }
+
+    /**
+     * Run a configured plugin over the whole of the audio file named
+     * in the request, framing the audio according to the given
+     * configuration, and return all of its features. The plugin is
+     * reset afterwards, whether or not processing succeeds.
+     *
+     * The file's sample rate must match the given input sample rate
+     * (that with which the plugin was loaded), and the plugin must
+     * take time-domain input. If the file and the plugin differ in
+     * channel count, a multi-channel file is mixed down for a mono
+     * plugin and a mono file is duplicated for a multi-channel one;
+     * any other mismatch is an error. Throws std::runtime_error on
+     * failure.
+     */
+    ProcessFileResponse
+    processFile(const ProcessFileRequest &req,
+                const PluginConfiguration &config,
+                float inputSampleRate) {
+
+        Vamp::Plugin *plugin = req.plugin;
+        ResetOnExit resetter(plugin);
+        
+        WavFileReader file(req.filename);
+        checkFileInput(plugin, file, config, inputSampleRate);
+
+        ProcessFileResponse response;
+        response.plugin = plugin;
+        response.features = processSteps(plugin, file, config, inputSampleRate,
+                                         0, 0, stepCount(file, config), true);
+        return response;
+    }
+
+    /**
+     * Return true if the plugin with the given key is known to be
+     * segment-safe, i.e. if running it over consecutive segments of
+     * a file on separate instances, each starting a short way before
+     * its segment, gives the same features as running it over the
+     * whole file on one instance. This is true of plugins whose
+     * features depend only on the audio close to them, such as most
+     * frame-by-frame spectral features. A few such plugins are known
+     * here; others may be added with addSegmentSafePlugin().
+     */
+    static bool
+    isSegmentSafe(std::string pluginKey) {
+        std::lock_guard<std::mutex> guard(segmentSafeMutex());
+        return segmentSafeKeys().find(pluginKey) != segmentSafeKeys().end();
+    }
+
+    /**
+     * Declare the plugin with the given key to be segment-safe (see
+     * isSegmentSafe()).
+     */
+    static void
+    addSegmentSafePlugin(std::string pluginKey) {
+        std::lock_guard<std::mutex> guard(segmentSafeMutex());
+        segmentSafeKeys().insert(pluginKey);
+    }
+
+    /**
+     * Run a configured plugin over the whole of the audio file named
+     * in the request, as processFile() does, but if the plugin is
+     * segment-safe, split the file into segments and process them in
+     * parallel on the given worker pool, using further instances of
+     * the plugin loaded with the given load request and configured
+     * identically.
+     *
+     * Each segment after the first is processed starting the
+     * request's number of warm-up steps early, and the features from
+     * those steps are discarded, as are the remaining features of
+     * every segment but the last. The features of all segments are
+     * then merged in timestamp order.
+     *
+     * If the plugin is not segment-safe, if it has an output with a
+     * fixed sample rate (whose features may rely on their position
+     * in the whole stream for their timestamps), or if the file is
+     * too short to be worth splitting, the file is processed in one
+     * piece exactly as by processFile(). Either way, the plugin is
+     * reset afterwards, including on failure. Throws
+     * std::runtime_error on failure.
+     */
+    ProcessSegmentedResponse
+    processSegmented(const ProcessSegmentedRequest &req,
+                     const LoadRequest &loadRequest,
+                     const PluginConfiguration &config,
+                     WorkerPool &pool) {
+
+        Vamp::Plugin *plugin = req.plugin;
+        const float rate = loadRequest.inputSampleRate;
+        ResetOnExit resetter(plugin);
+        
+        WavFileReader file(req.filename);
+        checkFileInput(plugin, file, config, rate);
+        
+        const int64_t steps = stepCount(file, config);
+        
+        int warmup = req.warmupSteps;
+        if (warmup < 0) {
+            // By default, enough for the first kept block to follow
+            // all the blocks that overlap it
+            const int stepSize = config.framing.stepSize;
+            warmup = (config.framing.blockSize + stepSize - 1) / stepSize;
+        }
+
+        int segments = req.segmentCount;
+        if (segments <= 0) {
+            segments = pool.getThreadCount() + 1;
+        }
+        const int64_t minSegmentSteps = std::max(int64_t(64), int64_t(warmup) * 4);
+        segments = int(std::min(int64_t(segments), steps / minSegmentSteps));
+
+        bool safe = isSegmentSafe(loadRequest.pluginKey);
+        for (const auto &od: plugin->getOutputDescriptors()) {
+            if (od.sampleType ==
+                Vamp::Plugin::OutputDescriptor::FixedSampleRate) {
+                safe = false;
+            }
+        }
+        
+        ProcessSegmentedResponse response;
+        response.plugin = plugin;
+        
+        if (!safe || segments < 2) {
+            response.features = processSteps(plugin, file, config, rate,
+                                             0, 0, steps, true);
+            return response;
+        }
+
+        // Segment 0 runs on the plugin we were given, the rest on
+        // new instances
+        
+        std::vector<std::unique_ptr<Vamp::Plugin>> extras;
+        auto loader = Vamp::HostExt::PluginLoader::getInstance();
+        for (int i = 1; i < segments; ++i) {
+            std::unique_ptr<Vamp::Plugin> p(loader->loadPlugin
+                                            (loadRequest.pluginKey,
+                                             rate,
+                                             loadRequest.adapterFlags));
+            if (!p) {
+                throw std::runtime_error
+                    ("failed to load plugin instance for segment");
+            }
+            ConfigurationRequest creq;
+            creq.plugin = p.get();
+            creq.configuration = config;
+            if (configurePlugin(creq).outputs.empty()) {
+                throw std::runtime_error
+                    ("failed to configure plugin instance for segment");
+            }
+            extras.push_back(std::move(p));
+        }
+
+        std::vector<Vamp::Plugin *> instances { plugin };
+        for (const auto &p: extras) instances.push_back(p.get());
+
+        response.features = processInSegments(instances, file, config, rate,
+                                              warmup, pool);
+        return response;
+    }
+
+    /**
+     * Run the given plugin instances, which must all have been
+     * configured identically, over consecutive segments of the given
+     * file, one segment per instance, in parallel on the given worker
+     * pool; discard the warm-up steps as described for
+     * processSegmented() and merge the results in timestamp order.
+     * No check is made that the plugin is segment-safe, and the
+     * instances are not reset afterwards. Throws std::runtime_error
+     * if the file is unsuitable.
+     */
+    Vamp::Plugin::FeatureSet
+    processInSegments(const std::vector<Vamp::Plugin *> &instances,
+                      const WavFileReader &file,
+                      const PluginConfiguration &config,
+                      float inputSampleRate,
+                      int warmupSteps,
+                      WorkerPool &pool) {
+
+        if (instances.empty()) {
+            throw std::runtime_error("no plugin instances to process with");
+        }
+        checkFileInput(instances[0], file, config, inputSampleRate);
+        
+        const int64_t steps = stepCount(file, config);
+        const int segments = int(instances.size());
+        
+        std::vector<Vamp::Plugin::FeatureSet> results(segments);
+        std::vector<WorkerPool::Task> tasks;
+        
+        for (int i = 0; i < segments; ++i) {
+            Vamp::Plugin *p = instances[i];
+            int64_t keep = (steps * i) / segments;
+            int64_t end = (steps * (i + 1)) / segments;
+            int64_t start = std::max(int64_t(0), keep - warmupSteps);
+            bool last = (i + 1 == segments);
+            tasks.push_back([=, &file, &config, &results]() {
+                    results[i] = processSteps(p, file, config, inputSampleRate,
+                                              start, keep, end, last);
+                });
+        }
+
+        pool.run(tasks);
+
+        Vamp::Plugin::FeatureSet features;
+        for (auto &r: results) {
+            for (auto &of: r) {
+                auto &list = features[of.first];
+                list.insert(list.end(),
+                            std::make_move_iterator(of.second.begin()),
+                            std::make_move_iterator(of.second.end()));
+            }
+        }
+        for (auto &of: features) {
+            std::stable_sort(of.second.begin(), of.second.end(),
+                             [](const Vamp::Plugin::Feature &a,
+                                const Vamp::Plugin::Feature &b) {
+                                 return a.timestamp < b.timestamp;
+                             });
+        }
+        
+        return features;
+    }
+
+private:
+    /**
+     * Resets a plugin when it goes out of scope, so that a file
+     * request that throws part way through still leaves the plugin
+     * ready for the next one.
+     */
+    class ResetOnExit
+    {
+    public:
+        ResetOnExit(Vamp::Plugin *plugin) : m_plugin(plugin) { }
+        ~ResetOnExit() { m_plugin->reset(); }
+        ResetOnExit(const ResetOnExit &) =delete;
+        ResetOnExit &operator=(const ResetOnExit &) =delete;
+    private:
+        Vamp::Plugin *m_plugin;
+    };
+    
+    static std::mutex &
+    segmentSafeMutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static std::set<std::string> &
+    segmentSafeKeys() {
+        static std::set<std::string> keys {
+            "vamp-example-plugins:powerspectrum",
+            "vamp-example-plugins:spectralcentroid",
+            "vamp-example-plugins:zerocrossing",
+            "qm-vamp-plugins:qm-chromagram",
+            "qm-vamp-plugins:qm-constantq",
+            "qm-vamp-plugins:qm-mfcc"
+        };
+        return keys;
+    }
+    
+    void
+    checkFileInput(Vamp::Plugin *plugin,
+                   const WavFileReader &file,
+                   const PluginConfiguration &config,
+                   float inputSampleRate) {
+        
+        if (plugin->getInputDomain() != Vamp::Plugin::TimeDomain) {
+            throw std::runtime_error
+                ("processFile requires a plugin with time-domain input "
+                 "(load it with the input domain adapter)");
+        }
+
+        if (fabsf(file.getSampleRate() - inputSampleRate) > 0.5f) {
+            throw std::runtime_error
+                ("sample rate of file \"" + file.getPath() +
+                 "\" does not match plugin input sample rate");
+        }
+
+        const int channels = config.channelCount;
+        const int fileChannels = file.getChannelCount();
+        
+        if (fileChannels != channels && fileChannels != 1 && channels != 1) {
+            throw std::runtime_error
+                ("channel count of file \"" + file.getPath() +
+                 "\" is incompatible with plugin configuration");
+        }
+        if (config.framing.blockSize <= 0 || config.framing.stepSize <= 0) {
+            throw std::runtime_error("step and block size must be non-zero");
+        }
+    }
+
+    int64_t
+    stepCount(const WavFileReader &file, const PluginConfiguration &config) {
+        const int64_t stepSize = config.framing.stepSize;
+        return (file.getFrameCount() + stepSize - 1) / stepSize;
+    }
+    
+    /**
+     * Run the plugin over steps start to end (exclusive) of the file,
+     * returning the features from steps keep onwards, and then its
+     * remaining features as well if remaining is true. The arguments
+     * must already have been checked with checkFileInput().
+     */
+    Vamp::Plugin::FeatureSet
+    processSteps(Vamp::Plugin *plugin,
+                 const WavFileReader &file,
+                 const PluginConfiguration &config,
+                 float inputSampleRate,
+                 int64_t start, int64_t keep, int64_t end,
+                 bool remaining) {
+        
+        const int channels = config.channelCount;
+        const int fileChannels = file.getChannelCount();
+        const int blockSize = config.framing.blockSize;
+        const int stepSize = config.framing.stepSize;
+        const int rate = int(lrintf(inputSampleRate));
+
+        // The file is read into fileBuffers, and the plugin is given
+        // pluginBuffers, which point into them unless mixing down
+        std::vector<std::vector<float>> fileData
+            (fileChannels, std::vector<float>(blockSize));
+        std::vector<float *> fileBuffers;
+        for (auto &d: fileData) fileBuffers.push_back(d.data());
+
+        std::vector<float> mixed;
+        std::vector<const float *> pluginBuffers(channels);
+        if (fileChannels == channels) {
+            for (int c = 0; c < channels; ++c) pluginBuffers[c] = fileBuffers[c];
+        } else if (fileChannels == 1) {
+            for (int c = 0; c < channels; ++c) pluginBuffers[c] = fileBuffers[0];
+        } else {
+            mixed.resize(blockSize);
+            pluginBuffers[0] = mixed.data();
+        }
+
+        FeatureFiller filler(plugin->getOutputDescriptors());
+        Vamp::Plugin::FeatureSet features;
+
+        for (int64_t step = start; step < end; ++step) {
+            int64_t pos = step * stepSize;
+            file.readFrames(pos, blockSize, fileBuffers.data());
+            if (!mixed.empty()) {
+                for (int i = 0; i < blockSize; ++i) {
+                    float sum = 0.f;
+                    for (int c = 0; c < fileChannels; ++c) sum += fileData[c][i];
+                    mixed[i] = sum / float(fileChannels);
+                }
+            }
+            auto t = Vamp::RealTime::frame2RealTime(long(pos), rate);
+            auto fs = plugin->process(pluginBuffers.data(), t);
+            if (step >= keep) {
+                filler.add(features, fs, t);
+            }
+        }
+
+        if (remaining) {
+            auto t = Vamp::RealTime::frame2RealTime(long(end * stepSize), rate);
+            filler.add(features, plugin->getRemainingFeatures(), t);
+        }
+
+        return features;
+    }
+    
+    /**
+     * Gathers the features from a sequence of process calls into a
+     * single feature set, giving each one an explicit timestamp
+     * according to its output's sample type, as a host would.
+     */
+    class FeatureFiller
+    {
+    public:
+        FeatureFiller(const Vamp::Plugin::OutputList &outputs) :
+            m_outputs(outputs),
+            m_last(outputs.size()),
+            m_haveLast(outputs.size(), false) { }
+
+        void add(Vamp::Plugin::FeatureSet &target,
+                 Vamp::Plugin::FeatureSet features,
+                 Vamp::RealTime blockTime) {
+
+            for (auto &of: features) {
+                int n = of.first;
+                if (n < 0 || n >= int(m_outputs.size())) continue;
+                const auto &od = m_outputs[n];
+                auto &list = target[n];
+                for (auto &f: of.second) {
+                    switch (od.sampleType) {
+                    case Vamp::Plugin::OutputDescriptor::OneSamplePerStep:
+                        f.timestamp = blockTime;
+                        break;
+                    case Vamp::Plugin::OutputDescriptor::FixedSampleRate:
+                        if (!f.hasTimestamp) {
+                            if (!m_haveLast[n] || od.sampleRate <= 0.f) {
+                                f.timestamp = m_haveLast[n] ?
+                                    m_last[n] : Vamp::RealTime::zeroTime;
+                            } else {
+                                f.timestamp = m_last[n] +
+                                    Vamp::RealTime::fromSeconds
+                                    (1.0 / od.sampleRate);
+                            }
+                        }
+                        break;
+                    case Vamp::Plugin::OutputDescriptor::VariableSampleRate:
+                        if (!f.hasTimestamp) f.timestamp = blockTime;
+                        break;
+                    }
+                    f.hasTimestamp = true;
+                    m_last[n] = f.timestamp;
+                    m_haveLast[n] = true;
+                    list.push_back(std::move(f));
+                }
+            }
+        }
+
+    private:
+        Vamp::Plugin::OutputList m_outputs;
+        std::vector<Vamp::RealTime> m_last;
+        std::vector<bool> m_haveLast;
+    };
+    
+    /**
+     * Return the program parameters for the plugin with the given
+     * key, obtaining them from the given newly-loaded instance the
+     * first time they are asked for and from a cache thereafter.
+     * Scanning the programs means selecting each in turn, which for
+     * a plugin with many programs can take much longer than loading
+     * it does.
+     */
+    PluginProgramParameters
+    programParametersFor(std::string key,
+                         Vamp::Plugin *plugin,
+                         const PluginConfiguration &defaultConfiguration) {
+
+        static std::mutex mutex;
+        static std::map<std::string, PluginProgramParameters> cache;
+
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            auto itr = cache.find(key);
+            if (itr != cache.end()) return itr->second;
+        }
+
+        // Don't hold the lock while scanning; another thread may
+        // scan the same plugin at the same time, harmlessly
+        auto pp = PluginProgramParameters::fromPlugin
+            (plugin, defaultConfiguration);
+        
+        std::lock_guard<std::mutex> guard(mutex);
+        cache[key] = pp;
+        return pp;
+    }
 };
 
 }
@@ -39,6 +39,9 @@
 #include "PreservingPluginOutputIdMapper.h"
 
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
 
 namespace piper_vamp {
 
@@ -46,9 +49,17 @@ namespace piper_vamp {
  * A PluginHandleMapper that accepts a handle in the handleToPlugin
  * method, storing it for later, and returns the same handle from
  * pluginToHandle when given the same plugin pointer as it had earlier
- * returned from handleToPlugin. It can only remember one handle, and
- * knows nothing about actual plugins - the plugin pointer it returns
- * is nominal and must never be dereferenced.
+ * returned from handleToPlugin. It can remember any number of
+ * handles, and knows nothing about actual plugins - the plugin
+ * pointers it returns are nominal and must never be dereferenced.
+ *
+ * Each handle has its own PreservingPluginOutputIdMapper. Call
+ * markConfigured with the output list from a configure response to
+ * have that mapper's indices match the real ones.
+ *
+ * This class is thread-safe. The output id mapper for a handle is
+ * never replaced once created, so that conversions running
+ * concurrently with markConfigured see consistent indices.
  */
 class PreservingPluginHandleMapper : public PluginHandleMapper
 {
@@ -66,67 +77,79 @@ class PreservingPluginHandleMapper : public PluginHandleMapper
         FeatureSet getRemainingFeatures() override { return {}; }
         NotAPlugin() : Plugin(1) { }
     };
+
+    struct Entry {
+        std::unique_ptr<NotAPlugin> plugin;
+        std::shared_ptr<PreservingPluginOutputIdMapper> omapper;
+    };
     
 public:
-    PreservingPluginHandleMapper() :
-        m_handle(INVALID_HANDLE),
-        m_plugin(nullptr),
-        m_omapper(std::make_shared<PreservingPluginOutputIdMapper>()) { }
-
-    virtual ~PreservingPluginHandleMapper() {
-        delete m_plugin;
-    }
+    PreservingPluginHandleMapper() { }
 
     Handle pluginToHandle(Vamp::Plugin *p) const noexcept override {
         if (!p) return INVALID_HANDLE;
-	if (p == m_plugin) return m_handle;
-	else {
-	    std::cerr << "PreservingPluginHandleMapper: p = " << p
-		      << " differs from saved m_plugin " << m_plugin
-		      << " (not returning saved handle " << m_handle << ")"
-		      << std::endl;
-            return INVALID_HANDLE;
-	}
+        std::lock_guard<std::mutex> guard(m_mutex);
+        auto itr = m_rplugins.find(p);
+        if (itr != m_rplugins.end()) return itr->second;
+        std::cerr << "PreservingPluginHandleMapper: p = " << p
+                  << " is not a plugin pointer previously returned"
+                  << " from handleToPlugin" << std::endl;
+        return INVALID_HANDLE;
     }
 
     Vamp::Plugin *handleToPlugin(Handle h) const noexcept override {
         if (h == INVALID_HANDLE) return nullptr;
-        if (h == m_handle) return m_plugin;
-        if (m_handle != INVALID_HANDLE) {
-            std::cerr << "PreservingPluginHandleMapper: m_handle " << m_handle
-                      << " is non-null when a new handle (" << h
-                      << ") is provided, but "
-                      << "this stupid stub class can only handle one handle"
-                      << std::endl;
-            return nullptr;
-        }
-	m_handle = h;
-        // We allocate something here, just so that we can
-        // sanity-check in the pluginToHandle call that the thing
-        // passed in is likely to be the pointer we returned from
-        // handleToPlugin earlier. Allocating an actual plugin allows
-        // us to return it without running afoul of strict-aliasing
-        // rules or the C++ object memory model.
-        m_plugin = new NotAPlugin();
-        return m_plugin;
+        std::lock_guard<std::mutex> guard(m_mutex);
+        return entryFor(h).plugin.get();
     }
 
     const std::shared_ptr<PluginOutputIdMapper> pluginToOutputIdMapper
     (Vamp::Plugin *p) const noexcept override {
         if (!p) return {};
-        return m_omapper;
+        return handleToOutputIdMapper(pluginToHandle(p));
     }
         
     const std::shared_ptr<PluginOutputIdMapper> handleToOutputIdMapper
     (Handle h) const noexcept override {
         if (h == INVALID_HANDLE) return {};
-        return m_omapper;
+        std::lock_guard<std::mutex> guard(m_mutex);
+        return entryFor(h).omapper;
+    }
+
+    /**
+     * Seed the output id mapper for the given plugin (a pointer
+     * returned earlier by handleToPlugin) with the given output list,
+     * so that its indices match the real ones.
+     */
+    void markConfigured(Vamp::Plugin *p,
+                        const Vamp::Plugin::OutputList &outputs) {
+        auto omapper = pluginToOutputIdMapper(p);
+        if (!omapper) return;
+        std::static_pointer_cast<PreservingPluginOutputIdMapper>(omapper)->
+            seed(outputs);
     }
     
 private:
-    mutable Handle m_handle;
-    mutable NotAPlugin *m_plugin;
-    std::shared_ptr<PreservingPluginOutputIdMapper> m_omapper;
+    // We allocate a plugin object for each handle, just so that we
+    // can sanity-check in the pluginToHandle call that the thing
+    // passed in is likely to be a pointer we returned from
+    // handleToPlugin earlier. Allocating an actual plugin allows us
+    // to return it without running afoul of strict-aliasing rules or
+    // the C++ object memory model.
+    mutable std::map<Handle, Entry> m_entries;
+    mutable std::map<Vamp::Plugin *, Handle> m_rplugins;
+    mutable std::mutex m_mutex;
+
+    // Call with m_mutex held
+    Entry &entryFor(Handle h) const {
+        auto itr = m_entries.find(h);
+        if (itr != m_entries.end()) return itr->second;
+        Entry &e = m_entries[h];
+        e.plugin.reset(new NotAPlugin());
+        e.omapper = std::make_shared<PreservingPluginOutputIdMapper>();
+        m_rplugins[e.plugin.get()] = h;
+        return e;
+    }
 };
 
 }
@@ -38,6 +38,10 @@
 #include "PluginOutputIdMapper.h"
 
 #include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
 
 namespace piper_vamp {
 
@@ -46,32 +50,46 @@ namespace piper_vamp {
  * but that accepts any string as an argument to idToIndex, returns an
  * entirely invented index that is consistent for that string, and
  * maps back to the same string through indexToId.
+ *
+ * If the real output list is known, it can be passed to seed(), so
+ * that the invented indices match the real ones for those outputs
+ * (provided none of them has been seen already).
+ *
+ * This class is thread-safe.
  */
 class PreservingPluginOutputIdMapper : public PluginOutputIdMapper
 {
 public:
     PreservingPluginOutputIdMapper() { }
 
+    void seed(const Vamp::Plugin::OutputList &outputs) {
+        for (const auto &d: outputs) {
+            (void)idToIndex(d.identifier);
+        }
+    }
+
     int idToIndex(std::string outputId) const noexcept override {
-	int n = int(m_ids.size());
-	int i = 0;
-	while (i < n) {
-	    if (outputId == m_ids[i]) {
-		return i;
-	    }
-	    ++i;
-	}
+        std::lock_guard<std::mutex> guard(m_mutex);
+        auto itr = m_indices.find(outputId);
+        if (itr != m_indices.end()) {
+            return itr->second;
+        }
+        int i = int(m_ids.size());
 	m_ids.push_back(outputId);
+        m_indices[outputId] = i;
 	return i;
     }
 
     std::string indexToId(int index) const noexcept override {
+        std::lock_guard<std::mutex> guard(m_mutex);
         if (index < 0 || size_t(index) >= m_ids.size()) return "";
 	return m_ids[index];
     }
 
 private:
     mutable std::vector<std::string> m_ids;
+    mutable std::unordered_map<std::string, int> m_indices;
+    mutable std::mutex m_mutex;
 };
 
 }
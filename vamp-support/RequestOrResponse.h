@@ -64,6 +64,26 @@ public:
         id({ RpcId::Absent, 0, "" })
     { }
 
+    /**
+     * Make this object ready to receive a new message in the given
+     * direction, resetting the type, success flag, error text and
+     * id. The request and response structures are left as they
+     * are. Only the ones for the new message's type are meaningful,
+     * and filling those in overwrites them, reusing their storage
+     * where possible. A server can therefore keep one request and
+     * one response object for its lifetime. It need not construct
+     * and destroy every structure here for each message.
+     */
+    void reuse(Direction d) {
+        direction = d;
+        type = RRType::NotValid;
+        success = false;
+        errorText.clear();
+        id.type = RpcId::Absent;
+        id.number = 0;
+        id.tag.clear();
+    }
+
     Direction direction;
     RRType type;
     bool success;
@@ -80,6 +100,16 @@ public:
     ProcessResponse processResponse;
     FinishRequest finishRequest;
     FinishResponse finishResponse;
+    ResetRequest resetRequest;
+    ResetResponse resetResponse;
+    ProcessFileRequest processFileRequest;
+    ProcessFileResponse processFileResponse;
+    ProcessMultiRequest processMultiRequest;
+    ProcessMultiResponse processMultiResponse;
+    ProcessSegmentedRequest processSegmentedRequest;
+    ProcessSegmentedResponse processSegmentedResponse;
+    StatsRequest statsRequest;
+    StatsResponse statsResponse;
 };
 
 }
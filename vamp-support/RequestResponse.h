@@ -40,9 +40,11 @@
 #include "PluginStaticData.h"
 #include "PluginConfiguration.h"
 #include "PluginProgramParameters.h"
+#include "SampleFormat.h"
 
 #include <map>
 #include <string>
+#include <cstdint>
 
 namespace piper_vamp {
 
@@ -91,7 +93,8 @@ struct LoadRequest
 {
     LoadRequest() : // invalid request by default
 	inputSampleRate(0.f),
-	adapterFlags(0) { }
+	adapterFlags(0),
+        omitProgramParameters(false) { }
 
     /**
      * PluginKey is a string type that is used to identify a plugin
@@ -119,6 +122,25 @@ struct LoadRequest
      * \see Vamp::PluginLoader::AdapterFlags
      */
     int adapterFlags;
+
+    /**
+     * If true, the programParameters field of the LoadResponse will
+     * be left empty. Finding the parameter values for each program
+     * means selecting every program in turn, which can be slow for a
+     * plugin with many programs, and most hosts don't need them.
+     * (A client-side plugin loaded this way still passes program
+     * selections on to the server, but cannot report the parameter
+     * values a program sets.)
+     *
+     * This is an opt-out rather than an opt-in because clients that
+     * predate it rely on receiving the program parameters, and they
+     * never set the flag: its absence, which reads as false in both
+     * Cap'n Proto and JSON, has to mean the old behaviour. The
+     * server caches the parameters per plugin key, so a client that
+     * leaves them in pays for the scan only on the first load of
+     * each plugin in a server's lifetime.
+     */
+    bool omitProgramParameters;
 };
 
 /**
@@ -166,7 +188,8 @@ struct LoadResponse
     /**
      * The parameter values associated with any program settings
      * available for the plugin. The contents of this structure are
-     * only valid if plugin is non-0.
+     * only valid if plugin is non-0, and it is empty if the request
+     * had omitProgramParameters set.
      */
     PluginProgramParameters programParameters;
 };
@@ -230,11 +253,20 @@ struct ProcessRequest
 {
 public:
     ProcessRequest() : // invalid by default
-        plugin(0) { }
+        plugin(0),
+        sampleFormat(SampleFormat::Float32) { }
 
     Vamp::Plugin *plugin;
     std::vector<std::vector<float> > inputBuffers;
     Vamp::RealTime timestamp;
+
+    /**
+     * The format in which to transfer the input buffers when
+     * serialising the request. The buffers themselves are always
+     * float; when a request is read, this records the format it
+     * arrived in, and the buffers hold the samples converted from it.
+     */
+    SampleFormat sampleFormat;
 };
 
 /**
@@ -256,12 +288,45 @@ public:
     Vamp::Plugin::FeatureSet features;
 };
 
+/**
+ * \class ResourceUsage
+ *
+ * The resources a server has seen a plugin use since it was loaded.
+ *
+ * The CPU time and allocations cover the plugin's process and
+ * getRemainingFeatures calls, including those made on its behalf by
+ * processMulti, processFile and processSegmented requests. The call
+ * count is the number of requests that ran the plugin, so that a
+ * whole processFile counts as one. CPU
+ * time is that of the thread making the call, except for
+ * processSegmented, where it is that of the whole server process
+ * for the duration of the request. Allocations are those made
+ * through operator new, so allocations a plugin makes with malloc
+ * are not counted. The allocations are a total, not a net figure:
+ * memory freed again is not subtracted.
+ *
+ * \see StatsResponse, FinishResponse
+ */
+struct ResourceUsage
+{
+public:
+    ResourceUsage() :
+        calls(0), cpuNs(0), allocatedBytes(0), allocations(0) { }
+
+    uint64_t calls;
+    uint64_t cpuNs;
+    uint64_t allocatedBytes;
+    uint64_t allocations;
+};
+
 /**
  * \class FinishRequest
  *
  * A structure that bundles the necessary data for finishing
- * processing, i.e. calling getRemainingFeatures(). This consists only
- * of the plugin pointer. Caller retains ownership of the plugin.
+ * processing, i.e. calling getRemainingFeatures(). This consists of
+ * the plugin pointer, and a flag asking for the plugin's resource
+ * usage to be returned with the response. Caller retains ownership
+ * of the plugin.
  *
  * \see Vamp::Plugin::getRemainingFeatures()
  */
@@ -269,9 +334,11 @@ struct FinishRequest
 {
 public:
     FinishRequest() : // invalid by default
-        plugin(0) { }
+        plugin(0),
+        includeUsage(false) { }
 
     Vamp::Plugin *plugin;
+    bool includeUsage;
 };
 
 
@@ -279,7 +346,9 @@ public:
  * \class FinishResponse
  *
  * A structure that bundles the data returned by a
- * getRemainingFeatures() call. This is identical to ProcessResponse.
+ * getRemainingFeatures() call. This is identical to ProcessResponse,
+ * except that it may also carry the plugin's resource usage over its
+ * lifetime, if the request asked for it.
  *
  * \see ProcessResponse, Vamp::Plugin::getRemainingFeatures()
  */
@@ -287,12 +356,261 @@ struct FinishResponse
 {
 public:
     FinishResponse() : // invalid by default
+        plugin(0),
+        hasUsage(false) { }
+
+    Vamp::Plugin *plugin;
+    Vamp::Plugin::FeatureSet features;
+    bool hasUsage;
+    ResourceUsage usage;
+};
+
+/**
+ * \class ResetRequest
+ *
+ * A structure that bundles the necessary data for resetting a
+ * configured plugin, i.e. calling reset() so that it is ready to
+ * process a new input from the start without being reloaded or
+ * reconfigured. This consists only of the plugin pointer. Caller
+ * retains ownership of the plugin.
+ *
+ * \see Vamp::Plugin::reset()
+ */
+struct ResetRequest
+{
+public:
+    ResetRequest() : // invalid by default
+        plugin(0) { }
+
+    Vamp::Plugin *plugin;
+};
+
+/**
+ * \class ResetResponse
+ *
+ * A structure that bundles the data returned by a reset request,
+ * which is only the plugin pointer: a successful response simply
+ * indicates that the plugin has been reset.
+ *
+ * \see ResetRequest
+ */
+struct ResetResponse
+{
+public:
+    ResetResponse() : // invalid by default
+        plugin(0) { }
+
+    Vamp::Plugin *plugin;
+};
+
+/**
+ * \class ProcessFileRequest
+ *
+ * A structure that bundles the necessary data for running a
+ * configured plugin over the whole of an audio file that the server
+ * can read, in place of a series of process requests. This consists
+ * of the plugin pointer and the name of the file, which must be a
+ * WAV file with the same sample rate as the plugin was loaded with.
+ * The plugin's configured channel count, step size and block size
+ * are used to frame the audio. Caller retains ownership of the
+ * plugin.
+ *
+ * \see ProcessRequest, ProcessFileResponse
+ */
+struct ProcessFileRequest
+{
+public:
+    ProcessFileRequest() : // invalid by default
+        plugin(0) { }
+
+    Vamp::Plugin *plugin;
+    std::string filename;
+};
+
+/**
+ * \class ProcessFileResponse
+ *
+ * A structure that bundles the data returned by a processFile
+ * request: all the features returned by the plugin for the whole
+ * file, including those from getRemainingFeatures(). Every feature
+ * has a timestamp, filled in where the plugin's output sample type
+ * left it implicit, so the features remain meaningful once gathered
+ * into a single set. After the request the plugin has been reset and
+ * may be used again.
+ *
+ * \see ProcessFileRequest
+ */
+struct ProcessFileResponse
+{
+public:
+    ProcessFileResponse() : // invalid by default
+        plugin(0) { }
+
+    Vamp::Plugin *plugin;
+    Vamp::Plugin::FeatureSet features;
+};
+
+/**
+ * \class ProcessMultiRequest
+ *
+ * A structure that bundles the necessary data for making the same
+ * process call on several plugins at once: the plugins, and a single
+ * set of input buffers and timestamp to be given to each of them. The
+ * plugins must all have been configured to accept the same input,
+ * i.e. with the same channel count and block size and the same input
+ * domain. Caller retains ownership of the plugins.
+ *
+ * \see ProcessRequest, ProcessMultiResponse
+ */
+struct ProcessMultiRequest
+{
+public:
+    ProcessMultiRequest() :
+        sampleFormat(SampleFormat::Float32) { }
+
+    std::vector<Vamp::Plugin *> plugins;
+    std::vector<std::vector<float> > inputBuffers;
+    Vamp::RealTime timestamp;
+
+    /**
+     * The format in which to transfer the input buffers, as for
+     * ProcessRequest.
+     */
+    SampleFormat sampleFormat;
+};
+
+/**
+ * \class ProcessMultiResponse
+ *
+ * A structure that bundles the data returned by a processMulti
+ * request: one ProcessResponse for each plugin in the request, in
+ * the same order.
+ *
+ * \see ProcessMultiRequest
+ */
+struct ProcessMultiResponse
+{
+public:
+    std::vector<ProcessResponse> responses;
+};
+
+/**
+ * \class ProcessSegmentedRequest
+ *
+ * A structure that bundles the necessary data for running a
+ * configured plugin over the whole of an audio file, as for
+ * ProcessFileRequest, but allowing the server to split the file into
+ * segments and process them in parallel on separate instances of the
+ * plugin if the plugin is known to be segment-safe.
+ *
+ * The segment count may be zero to let the server choose, and the
+ * number of warm-up steps (processed before each segment, with their
+ * features discarded) may be negative to let the server choose a
+ * number that covers the plugin's block size. Caller retains
+ * ownership of the plugin.
+ *
+ * \see ProcessFileRequest, ProcessSegmentedResponse,
+ * LoaderRequests::processSegmented()
+ */
+struct ProcessSegmentedRequest
+{
+public:
+    ProcessSegmentedRequest() : // invalid by default
+        plugin(0),
+        segmentCount(0),
+        warmupSteps(-1) { }
+
+    Vamp::Plugin *plugin;
+    std::string filename;
+    int segmentCount;
+    int warmupSteps;
+};
+
+/**
+ * \class ProcessSegmentedResponse
+ *
+ * A structure that bundles the data returned by a processSegmented
+ * request: all the features for the whole file, timestamped and in
+ * timestamp order, as for ProcessFileResponse.
+ *
+ * \see ProcessSegmentedRequest
+ */
+struct ProcessSegmentedResponse
+{
+public:
+    ProcessSegmentedResponse() : // invalid by default
         plugin(0) { }
 
     Vamp::Plugin *plugin;
     Vamp::Plugin::FeatureSet features;
 };
 
+/**
+ * \class StatsRequest
+ *
+ * StatsRequest asks the server for the request timings it has
+ * gathered since it started. It has no parameters.
+ *
+ * \see StatsResponse
+ */
+struct StatsRequest
+{
+public:
+    StatsRequest() { }
+};
+
+/**
+ * \class StatsResponse
+ *
+ * A structure that bundles the request timings returned by a stats
+ * request. Each timing summarises the durations of one phase of one
+ * kind of request, in nanoseconds.
+ *
+ * The phases are "decode" (from the arrival of the request to the
+ * end of its parsing), "handle" (the server's handling of the
+ * request, which for most requests is mostly time spent in the
+ * plugin) and "encode" (serialising and writing the response).
+ *
+ * Timings with an empty pluginKey cover every request of their
+ * method. Those with a pluginKey cover only the handle phase of the
+ * requests made to plugins with that key.
+ *
+ * Percentiles are upper bounds taken from a histogram and are within
+ * 12.5% of the true value.
+ *
+ * The response also lists the resources used by each plugin
+ * currently loaded, by handle.
+ *
+ * \see StatsRequest
+ */
+struct StatsResponse
+{
+public:
+    struct Timing {
+        Timing() :
+            count(0), totalNs(0), maxNs(0), p50Ns(0), p95Ns(0), p99Ns(0) { }
+        std::string method;
+        std::string pluginKey;
+        std::string phase;
+        uint64_t count;
+        uint64_t totalNs;
+        uint64_t maxNs;
+        uint64_t p50Ns;
+        uint64_t p95Ns;
+        uint64_t p99Ns;
+    };
+
+    struct PluginUsage {
+        PluginUsage() : handle(0) { }
+        uint32_t handle;
+        std::string pluginKey;
+        ResourceUsage usage;
+    };
+    
+    std::vector<Timing> timings;
+    std::vector<PluginUsage> plugins;
+};
+
 }
 
 #endif
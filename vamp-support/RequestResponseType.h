@@ -38,7 +38,8 @@
 namespace piper_vamp {
 
 enum class RRType {
-    List, Load, Configure, Process, Finish, NotValid
+    List, Load, Configure, Process, Finish, Reset, ProcessFile, ProcessMulti,
+    ProcessSegmented, Stats, NotValid
 };
 
 }
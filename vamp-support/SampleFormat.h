@@ -0,0 +1,277 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Piper C++
+
+    Centre for Digital Music, Queen Mary, University of London.
+    Copyright 2006-2016 Chris Cannam and QMUL.
+  
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+    ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    Except as contained in this notice, the names of the Centre for
+    Digital Music; Queen Mary, University of London; and Chris Cannam
+    shall not be used in advertising or otherwise to promote the sale,
+    use or other dealings in this Software without prior written
+    authorization.
+*/
+
+
+#ifndef PIPER_SAMPLE_FORMAT_H
+#define PIPER_SAMPLE_FORMAT_H
+
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define PIPER_SAMPLE_FORMAT_HAVE_F16C_DISPATCH 1
+#include <immintrin.h>
+#include <cpuid.h>
+#endif
+
+namespace piper_vamp {
+
+/**
+ * The format in which process input audio is transferred between
+ * client and server. Plugins always receive 32-bit float input; the
+ * other formats are converted on the way in, halving the size of the
+ * audio data in a process request at the cost of its precision.
+ *
+ * Int16 scales the range [-1, 1) to the full 16-bit range, clamping
+ * anything outside it, and so is only suitable for time-domain audio.
+ * Float16 is IEEE 754 half precision.
+ *
+ * Packed samples are stored in native byte order, as are the base64
+ * float buffers in the JSON protocol.
+ */
+enum class SampleFormat {
+    Float32, Int16, Float16
+};
+
+inline size_t
+bytesPerSample(SampleFormat format)
+{
+    switch (format) {
+    case SampleFormat::Float32: return 4;
+    case SampleFormat::Int16: return 2;
+    case SampleFormat::Float16: return 2;
+    }
+    return 4;
+}
+
+namespace detail {
+
+// Scalar half-precision conversions, rounding to nearest even. These
+// follow the widely used branch-light formulation by Fabian Giesen.
+
+inline uint16_t
+floatToHalf(float value)
+{
+    const uint32_t f32infty = 255u << 23;
+    const uint32_t f16max = (127u + 16u) << 23;
+    const uint32_t denormMagic = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+
+    uint32_t f;
+    memcpy(&f, &value, 4);
+    uint32_t sign = f & 0x80000000u;
+    f ^= sign;
+
+    uint16_t h;
+    if (f >= f16max) {
+        h = (f > f32infty) ? 0x7e00 : 0x7c00; // NaN or infinity
+    } else if (f < (113u << 23)) {
+        // Result is subnormal or zero: let the FPU do the rounding
+        float ff, magic;
+        memcpy(&ff, &f, 4);
+        memcpy(&magic, &denormMagic, 4);
+        ff += magic;
+        memcpy(&f, &ff, 4);
+        h = uint16_t(f - denormMagic);
+    } else {
+        uint32_t mantOdd = (f >> 13) & 1;
+        f += (uint32_t(15 - 127) << 23) + 0xfff;
+        f += mantOdd;
+        h = uint16_t(f >> 13);
+    }
+    return uint16_t(h | (sign >> 16));
+}
+
+inline float
+halfToFloat(uint16_t h)
+{
+    const uint32_t magic = 113u << 23;
+    const uint32_t shiftedExp = 0x7c00u << 13;
+
+    uint32_t o = uint32_t(h & 0x7fff) << 13;
+    uint32_t exp = shiftedExp & o;
+    o += (127u - 15u) << 23;
+
+    if (exp == shiftedExp) {
+        o += (128u - 16u) << 23; // infinity or NaN
+    } else if (exp == 0) {
+        // zero or subnormal: renormalise
+        o += 1u << 23;
+        float f, m;
+        memcpy(&f, &o, 4);
+        memcpy(&m, &magic, 4);
+        f -= m;
+        memcpy(&o, &f, 4);
+    }
+
+    o |= uint32_t(h & 0x8000) << 16;
+    float result;
+    memcpy(&result, &o, 4);
+    return result;
+}
+
+#ifdef PIPER_SAMPLE_FORMAT_HAVE_F16C_DISPATCH
+
+// The F16C conversions are compiled for that instruction set whatever
+// the build targets, and only called once the CPU has been found to
+// support it (F16C operates on AVX registers, so we need the OS to
+// support AVX as well).
+
+inline bool
+haveF16C()
+{
+    static const bool have = []() {
+        unsigned int a = 0, b = 0, c = 0, d = 0;
+        if (!__get_cpuid(1, &a, &b, &c, &d)) return false;
+        __builtin_cpu_init();
+        return (c & bit_F16C) && __builtin_cpu_supports("avx");
+    }();
+    return have;
+}
+
+// Each of these converts the largest multiple of 8 samples it can,
+// and returns the number converted
+
+__attribute__((target("avx,f16c"))) inline size_t
+floatsToHalvesF16C(const float *in, size_t n, uint16_t *out)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_loadu_ps(in + i);
+        __m128i h = _mm256_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), h);
+    }
+    return i;
+}
+
+__attribute__((target("avx,f16c"))) inline size_t
+halvesToFloatsF16C(const uint16_t *in, size_t n, float *out)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+        _mm256_storeu_ps(out + i, _mm256_cvtph_ps(h));
+    }
+    return i;
+}
+
+#endif
+
+}
+
+/**
+ * Convert n float samples to the given format, writing
+ * n * bytesPerSample(format) bytes to out.
+ */
+inline void
+packSamples(const float *in, size_t n, SampleFormat format, void *out)
+{
+    switch (format) {
+
+    case SampleFormat::Float32:
+        memcpy(out, in, n * sizeof(float));
+        break;
+
+    case SampleFormat::Int16: {
+        int16_t *o = static_cast<int16_t *>(out);
+        for (size_t i = 0; i < n; ++i) {
+            float v = in[i] * 32768.f;
+            v = (v < -32768.f ? -32768.f : (v > 32767.f ? 32767.f : v));
+            o[i] = int16_t(v < 0.f ? v - 0.5f : v + 0.5f);
+        }
+        break;
+    }
+
+    case SampleFormat::Float16: {
+        uint16_t *o = static_cast<uint16_t *>(out);
+        size_t i = 0;
+#ifdef PIPER_SAMPLE_FORMAT_HAVE_F16C_DISPATCH
+        if (detail::haveF16C()) {
+            i = detail::floatsToHalvesF16C(in, n, o);
+        }
+#endif
+        for (; i < n; ++i) {
+            o[i] = detail::floatToHalf(in[i]);
+        }
+        break;
+    }
+    }
+}
+
+/**
+ * Convert n samples of the given format, found in the
+ * n * bytesPerSample(format) bytes at in, to float.
+ *
+ * The int16 conversion is a plain loop that compilers vectorise; the
+ * float16 one uses the F16C instructions where the CPU has them,
+ * whether or not the build targets them.
+ */
+inline void
+unpackSamples(const void *in, size_t n, SampleFormat format, float *out)
+{
+    switch (format) {
+
+    case SampleFormat::Float32:
+        memcpy(out, in, n * sizeof(float));
+        break;
+
+    case SampleFormat::Int16: {
+        const int16_t *s = static_cast<const int16_t *>(in);
+        const float scale = 1.f / 32768.f;
+        for (size_t i = 0; i < n; ++i) {
+            out[i] = float(s[i]) * scale;
+        }
+        break;
+    }
+
+    case SampleFormat::Float16: {
+        const uint16_t *s = static_cast<const uint16_t *>(in);
+        size_t i = 0;
+#ifdef PIPER_SAMPLE_FORMAT_HAVE_F16C_DISPATCH
+        if (detail::haveF16C()) {
+            i = detail::halvesToFloatsF16C(s, n, out);
+        }
+#endif
+        for (; i < n; ++i) {
+            out[i] = detail::halfToFloat(s[i]);
+        }
+        break;
+    }
+    }
+}
+
+}
+
+#endif
@@ -0,0 +1,369 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+/*
+  Piper C++
+
+  An API for audio analysis and feature extraction plugins.
+
+  Centre for Digital Music, Queen Mary, University of London.
+  Copyright 2006-2017 Chris Cannam and QMUL.
+  
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use, copy,
+  modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+  Except as contained in this notice, the names of the Centre for
+  Digital Music; Queen Mary, University of London; and Chris Cannam
+  shall not be used in advertising or otherwise to promote the sale,
+  use or other dealings in this Software without prior written
+  authorization.
+*/
+
+#ifndef PIPER_SESSION_ARCHIVE_H
+#define PIPER_SESSION_ARCHIVE_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace piper_vamp {
+
+/**
+ * A session archive records the serialised request and response
+ * messages exchanged with a server, in order, with the time at which
+ * each was recorded. The messages themselves are opaque to the
+ * archive; in practice they are Cap'n Proto RpcRequest and
+ * RpcResponse messages.
+ *
+ * The file starts with a fixed header, followed by the records, each
+ * of which has a small header of its own and a payload padded to a
+ * multiple of 8 bytes. Every record and payload therefore starts on
+ * an 8-byte boundary, so a reader that maps the file into memory can
+ * use Cap'n Proto payloads in place. When an archive is closed
+ * properly, an index of record offsets is appended and the header
+ * updated to point to it; an archive that was not closed properly
+ * (e.g. because the server crashed) can still be read by scanning
+ * the records from the start.
+ *
+ * All integers are stored in native byte order.
+ */
+struct SessionArchive
+{
+    enum Direction : uint32_t {
+        Request = 1,
+        Response = 2
+    };
+
+    struct Record {
+        Direction direction;
+        uint64_t timestamp; // ns since the archive was created
+        const void *data;
+        size_t length;
+    };
+
+    struct FileHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t headerSize;
+        uint64_t recordCount;  // 0 if not closed properly
+        uint64_t indexOffset;  // 0 if not closed properly
+        uint64_t created;      // seconds since the epoch
+        uint64_t reserved;
+    };
+
+    struct RecordHeader {
+        uint32_t direction;
+        uint32_t reserved;
+        uint64_t timestamp;
+        uint64_t length;
+    };
+
+    static const char *magic() { return "PIPERSA1"; }
+    static uint32_t version() { return 1; }
+
+    static uint64_t padded(uint64_t length) {
+        return (length + 7) & ~uint64_t(7);
+    }
+};
+
+/**
+ * Write a SessionArchive. The archive is finalised (its index
+ * written) on destruction.
+ */
+class SessionArchiveWriter
+{
+public:
+    /**
+     * Create an archive file at the given path, replacing any
+     * existing file. Throw std::runtime_error on failure.
+     */
+    SessionArchiveWriter(std::string path) :
+        m_file(fopen(path.c_str(), "wb")),
+        m_start(std::chrono::steady_clock::now()),
+        m_offset(0),
+        m_ok(true) {
+        
+        if (!m_file) {
+            throw std::runtime_error("failed to open archive file \"" +
+                                     path + "\" for writing");
+        }
+
+        memset(&m_header, 0, sizeof(m_header));
+        memcpy(m_header.magic, SessionArchive::magic(), 8);
+        m_header.version = SessionArchive::version();
+        m_header.headerSize = sizeof(m_header);
+        m_header.created = uint64_t(time(nullptr));
+
+        if (!write(&m_header, sizeof(m_header))) {
+            fclose(m_file);
+            throw std::runtime_error("failed to write archive file \"" +
+                                     path + "\"");
+        }
+    }
+
+    ~SessionArchiveWriter() {
+        if (m_ok) {
+            m_header.recordCount = m_offsets.size();
+            m_header.indexOffset = m_offset;
+            if (write(m_offsets.data(), m_offsets.size() * sizeof(uint64_t)) &&
+                fseek(m_file, 0, SEEK_SET) == 0) {
+                (void)fwrite(&m_header, sizeof(m_header), 1, m_file);
+            }
+        }
+        fclose(m_file);
+    }
+
+    SessionArchiveWriter(const SessionArchiveWriter &) =delete;
+    SessionArchiveWriter &operator=(const SessionArchiveWriter &) =delete;
+
+    /**
+     * Append a record. Return false if it could not be written, in
+     * which case the archive is abandoned and no further records
+     * will be written to it.
+     */
+    bool append(SessionArchive::Direction direction,
+                const void *data, size_t length) {
+
+        if (!m_ok) return false;
+        
+        SessionArchive::RecordHeader rh;
+        rh.direction = direction;
+        rh.reserved = 0;
+        rh.timestamp = uint64_t
+            (std::chrono::duration_cast<std::chrono::nanoseconds>
+             (std::chrono::steady_clock::now() - m_start).count());
+        rh.length = length;
+
+        uint64_t recordOffset = m_offset;
+        static const char padding[8] = { 0 };
+        size_t padLength = SessionArchive::padded(length) - length;
+        
+        if (!write(&rh, sizeof(rh)) ||
+            !write(data, length) ||
+            !write(padding, padLength)) {
+            m_ok = false;
+            return false;
+        }
+
+        m_offsets.push_back(recordOffset);
+
+        // Don't hold records in our buffer for long, so that an
+        // archive from a server that crashes is as complete as
+        // possible
+        fflush(m_file);
+        return true;
+    }
+
+private:
+    FILE *m_file;
+    std::chrono::steady_clock::time_point m_start;
+    SessionArchive::FileHeader m_header;
+    uint64_t m_offset;
+    std::vector<uint64_t> m_offsets;
+    bool m_ok;
+
+    bool write(const void *data, size_t length) {
+        if (length == 0) return true;
+        if (fwrite(data, 1, length, m_file) != length) return false;
+        m_offset += length;
+        return true;
+    }
+};
+
+/**
+ * Read a SessionArchive, mapping the file into memory where possible.
+ */
+class SessionArchiveReader
+{
+public:
+    /**
+     * Open the archive at the given path. Throw std::runtime_error if
+     * it cannot be read or is not an archive.
+     */
+    SessionArchiveReader(std::string path) :
+        m_base(nullptr),
+        m_size(0) {
+
+#ifdef _WIN32
+        FILE *f = fopen(path.c_str(), "rb");
+        if (!f) {
+            throw std::runtime_error("failed to open archive file \"" +
+                                     path + "\"");
+        }
+        fseek(f, 0, SEEK_END);
+        long size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        if (size > 0) {
+            m_buffer.resize(SessionArchive::padded(size) / 8);
+            m_size = fread(m_buffer.data(), 1, size, f);
+        }
+        fclose(f);
+        m_base = reinterpret_cast<const char *>(m_buffer.data());
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("failed to open archive file \"" +
+                                     path + "\"");
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (p != MAP_FAILED) {
+                m_base = static_cast<const char *>(p);
+                m_size = st.st_size;
+            }
+        }
+        close(fd);
+#endif
+        
+        SessionArchive::FileHeader header;
+        if (!m_base || m_size < sizeof(header)) {
+            unmap();
+            throw std::runtime_error("failed to read archive file \"" +
+                                     path + "\"");
+        }
+        memcpy(&header, m_base, sizeof(header));
+        if (memcmp(header.magic, SessionArchive::magic(), 8) ||
+            header.version != SessionArchive::version() ||
+            header.headerSize < sizeof(header)) {
+            unmap();
+            throw std::runtime_error("file \"" + path +
+                                     "\" is not a Piper session archive");
+        }
+
+        if (!readIndex(header)) {
+            scan(header.headerSize);
+        }
+    }
+
+    ~SessionArchiveReader() {
+        unmap();
+    }
+    
+    SessionArchiveReader(const SessionArchiveReader &) =delete;
+    SessionArchiveReader &operator=(const SessionArchiveReader &) =delete;
+
+    size_t getRecordCount() const {
+        return m_offsets.size();
+    }
+
+    /**
+     * Return the record with the given index. The data pointer is
+     * valid for the lifetime of the reader, and is 8-byte aligned.
+     */
+    SessionArchive::Record getRecord(size_t index) const {
+        SessionArchive::RecordHeader rh;
+        uint64_t offset = m_offsets.at(index);
+        memcpy(&rh, m_base + offset, sizeof(rh));
+        SessionArchive::Record r;
+        r.direction = SessionArchive::Direction(rh.direction);
+        r.timestamp = rh.timestamp;
+        r.data = m_base + offset + sizeof(rh);
+        r.length = rh.length;
+        return r;
+    }
+
+private:
+    const char *m_base;
+    size_t m_size;
+    std::vector<uint64_t> m_offsets;
+#ifdef _WIN32
+    std::vector<uint64_t> m_buffer;
+#endif
+
+    void unmap() {
+#ifndef _WIN32
+        if (m_base) {
+            munmap(const_cast<char *>(m_base), m_size);
+        }
+#endif
+        m_base = nullptr;
+    }
+
+    bool recordFits(uint64_t offset) const {
+        SessionArchive::RecordHeader rh;
+        if (offset % 8 != 0 || offset + sizeof(rh) > m_size) return false;
+        memcpy(&rh, m_base + offset, sizeof(rh));
+        return (rh.length <= m_size - offset - sizeof(rh));
+    }
+    
+    bool readIndex(const SessionArchive::FileHeader &header) {
+        if (header.indexOffset == 0 ||
+            header.indexOffset % 8 != 0 ||
+            header.indexOffset > m_size ||
+            header.recordCount > (m_size - header.indexOffset) / 8) {
+            return false;
+        }
+        m_offsets.resize(header.recordCount);
+        memcpy(m_offsets.data(), m_base + header.indexOffset,
+               header.recordCount * sizeof(uint64_t));
+        for (auto offset: m_offsets) {
+            if (!recordFits(offset)) {
+                m_offsets.clear();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void scan(uint64_t offset) {
+        // Read records up to the first incomplete one, which is
+        // where a server that did not exit cleanly stopped writing
+        while (recordFits(offset)) {
+            SessionArchive::RecordHeader rh;
+            memcpy(&rh, m_base + offset, sizeof(rh));
+            m_offsets.push_back(offset);
+            offset += sizeof(rh) + SessionArchive::padded(rh.length);
+        }
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,295 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+/*
+  Piper C++
+
+  An API for audio analysis and feature extraction plugins.
+
+  Centre for Digital Music, Queen Mary, University of London.
+  Copyright 2006-2017 Chris Cannam and QMUL.
+  
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use, copy,
+  modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+  Except as contained in this notice, the names of the Centre for
+  Digital Music; Queen Mary, University of London; and Chris Cannam
+  shall not be used in advertising or otherwise to promote the sale,
+  use or other dealings in this Software without prior written
+  authorization.
+*/
+
+#ifndef PIPER_SLOT_PLUGIN_HANDLE_MAPPER_H
+#define PIPER_SLOT_PLUGIN_HANDLE_MAPPER_H
+
+#include "PluginHandleMapper.h"
+#include "PluginOutputIdMapper.h"
+#include "DefaultPluginOutputIdMapper.h"
+
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include <iostream>
+#include <stdexcept>
+
+namespace piper_vamp {
+
+/**
+ * A PluginHandleMapper that keeps everything it knows about each
+ * plugin in a single record in a contiguous array of slots, for
+ * servers and clients with many plugins live at once.
+ *
+ * Handles allocated by the mapper itself (through addPlugin(Plugin*))
+ * encode the slot index in their low 20 bits and a per-slot
+ * generation count in the 11 bits above that, leaving the top bit
+ * clear so that every handle is below 2^31 and can be read back from
+ * a JSON number as an int. A handle is looked up by direct
+ * indexing, and a stale handle, whose plugin has been removed and its
+ * slot reused, is rejected because its generation no longer
+ * matches. Freed slots are reused oldest-first, so that a given
+ * handle value is not seen again until its slot has been through all
+ * 2048 generations.
+ *
+ * Handles allocated elsewhere (e.g. by a server, in the case of a
+ * client) can be added through addPlugin(Handle, Plugin*). These are
+ * found through a hash table instead, and the records themselves are
+ * held in the same way.
+ */
+class SlotPluginHandleMapper : public PluginHandleMapper
+{
+public:
+    SlotPluginHandleMapper() { }
+
+    /**
+     * Add a plugin, allocating and returning a new handle for it. If
+     * the plugin is already present, return its existing handle.
+     */
+    Handle addPlugin(Vamp::Plugin *p) {
+        if (!p) return INVALID_HANDLE;
+        Handle existing = pluginToHandle(p);
+        if (existing != INVALID_HANDLE) return existing;
+        uint32_t index = allocateSlot();
+        Slot &slot = m_slots[index];
+        Handle h = makeHandle(index, slot.generation);
+        while (m_assigned.find(h) != m_assigned.end()) {
+            // Clashes with an externally-assigned handle: skip a
+            // generation
+            slot.generation = (slot.generation + 1) & generationMask;
+            h = makeHandle(index, slot.generation);
+        }
+        fillSlot(slot, h, p);
+        m_rplugins[p] = index;
+        return h;
+    }
+
+    /**
+     * Add a plugin with a handle that was assigned elsewhere. Throw
+     * std::logic_error if the handle is already in use for a
+     * different plugin.
+     */
+    void addPlugin(Handle h, Vamp::Plugin *p) {
+        if (!p || h == INVALID_HANDLE) return;
+        if (pluginToHandle(p) != INVALID_HANDLE) return;
+        if (const Slot *existing = findSlot(h)) {
+            std::cerr << "ERROR: Duplicate plugin handle " << h
+                      << " for plugin " << p << " (already used for plugin "
+                      << existing->plugin << ")" << std::endl;
+            throw std::logic_error("Duplicate plugin handle");
+        }
+        uint32_t index = allocateSlot();
+        fillSlot(m_slots[index], h, p);
+        m_rplugins[p] = index;
+        m_assigned[h] = index;
+    }
+
+    void removePlugin(Handle h) {
+        Slot *slot = findSlot(h);
+        if (!slot) return;
+        uint32_t index = uint32_t(slot - m_slots.data());
+        m_rplugins.erase(slot->plugin);
+        m_assigned.erase(h);
+        slot->plugin = nullptr;
+        slot->handle = INVALID_HANDLE;
+        slot->configured = false;
+        slot->outputMapper.reset();
+        slot->generation = (slot->generation + 1) & generationMask;
+        m_free.push_back(index);
+    }
+
+    bool havePlugin(Vamp::Plugin *p) const {
+        return (m_rplugins.find(p) != m_rplugins.end());
+    }
+    
+    Handle pluginToHandle(Vamp::Plugin *p) const noexcept override {
+        auto itr = m_rplugins.find(p);
+        if (itr == m_rplugins.end()) {
+            return INVALID_HANDLE;
+        }
+        return m_slots[itr->second].handle;
+    }
+    
+    Vamp::Plugin *handleToPlugin(Handle h) const noexcept override {
+        const Slot *slot = findSlot(h);
+        return slot ? slot->plugin : nullptr;
+    }
+
+    /**
+     * Return the index of the slot holding the given plugin, or -1 if
+     * it is not present. Slot indices are small and dense, and are
+     * reused once their plugins have been removed, so a caller may
+     * keep further per-plugin state of its own in an array indexed
+     * by them.
+     */
+    int pluginToSlot(Vamp::Plugin *p) const noexcept {
+        auto itr = m_rplugins.find(p);
+        if (itr == m_rplugins.end()) {
+            return -1;
+        }
+        return int(itr->second);
+    }
+
+    const std::shared_ptr<PluginOutputIdMapper> pluginToOutputIdMapper
+    (Vamp::Plugin *p) const noexcept override {
+        auto itr = m_rplugins.find(p);
+        if (itr == m_rplugins.end()) {
+            return {};
+        }
+        return m_slots[itr->second].outputMapper;
+    }
+
+    const std::shared_ptr<PluginOutputIdMapper> handleToOutputIdMapper
+    (Handle h) const noexcept override {
+        const Slot *slot = findSlot(h);
+        if (slot) {
+            return slot->outputMapper;
+        } else {
+            return {};
+        }
+    }
+
+    bool isConfigured(Handle h) const noexcept {
+        const Slot *slot = findSlot(h);
+        return slot && slot->configured;
+    }
+
+    void markConfigured(Handle h, int channelCount, int blockSize) {
+        Slot *slot = findSlot(h);
+        if (!slot) return;
+        slot->configured = true;
+        slot->channelCount = channelCount;
+        slot->blockSize = blockSize;
+    }
+
+    /**
+     * Mark the plugin as configured, also replacing its output id
+     * mapper with one built from the configured output list. This is
+     * the list the features will actually be reported against, and
+     * may differ from the one available when the plugin was added.
+     */
+    void markConfigured(Handle h, int channelCount, int blockSize,
+                        const Vamp::Plugin::OutputList &outputs) {
+        Slot *slot = findSlot(h);
+        if (!slot) return;
+        markConfigured(h, channelCount, blockSize);
+        slot->outputMapper =
+            std::make_shared<DefaultPluginOutputIdMapper>(outputs);
+    }
+
+    int getChannelCount(Handle h) const noexcept {
+        const Slot *slot = findSlot(h);
+        return (slot && slot->configured) ? slot->channelCount : 0;
+    }
+
+    int getBlockSize(Handle h) const noexcept {
+        const Slot *slot = findSlot(h);
+        return (slot && slot->configured) ? slot->blockSize : 0;
+    }
+    
+private:
+    struct Slot {
+        Slot() : handle(0), plugin(nullptr), generation(0),
+                 configured(false), channelCount(0), blockSize(0) { }
+        Handle handle;
+        Vamp::Plugin *plugin;
+        uint32_t generation;
+        bool configured;
+        int channelCount;
+        int blockSize;
+        std::shared_ptr<PluginOutputIdMapper> outputMapper;
+    };
+
+    static const int indexBits = 20;
+    static const uint32_t indexMask = (1u << indexBits) - 1;
+    static const int generationBits = 11;
+    static const uint32_t generationMask = (1u << generationBits) - 1;
+    static_assert(indexBits + generationBits < 32,
+                  "handles must fit in a signed 32-bit int");
+
+    std::vector<Slot> m_slots;
+    std::deque<uint32_t> m_free;
+    std::unordered_map<Vamp::Plugin *, uint32_t> m_rplugins;
+    std::unordered_map<Handle, uint32_t> m_assigned;
+
+    static Handle makeHandle(uint32_t index, uint32_t generation) {
+        // Index is offset by one so that no handle is ever zero
+        // (INVALID_HANDLE), and the first is 1
+        return (generation << indexBits) | (index + 1);
+    }
+
+    uint32_t allocateSlot() {
+        if (!m_free.empty()) {
+            uint32_t index = m_free.front();
+            m_free.pop_front();
+            return index;
+        }
+        if (m_slots.size() >= indexMask) {
+            throw std::runtime_error("Too many plugins loaded");
+        }
+        m_slots.push_back({});
+        return uint32_t(m_slots.size() - 1);
+    }
+
+    void fillSlot(Slot &slot, Handle h, Vamp::Plugin *p) {
+        slot.handle = h;
+        slot.plugin = p;
+        slot.configured = false;
+        slot.channelCount = 0;
+        slot.blockSize = 0;
+        slot.outputMapper = std::make_shared<DefaultPluginOutputIdMapper>(p);
+    }
+
+    const Slot *findSlot(Handle h) const noexcept {
+        if (h == INVALID_HANDLE) return nullptr;
+        uint32_t index = (h & indexMask) - 1;
+        if (index < m_slots.size() && m_slots[index].handle == h) {
+            return &m_slots[index];
+        }
+        if (m_assigned.empty()) return nullptr;
+        auto itr = m_assigned.find(h);
+        if (itr == m_assigned.end()) return nullptr;
+        return &m_slots[itr->second];
+    }
+
+    Slot *findSlot(Handle h) noexcept {
+        return const_cast<Slot *>
+            (static_cast<const SlotPluginHandleMapper *>(this)->findSlot(h));
+    }
+};
+
+}
+
+#endif
@@ -44,6 +44,10 @@
 #include <sord/sord.h>
 
 #include <mutex>
+#include <map>
+
+#include <sys/types.h>
+#include <sys/stat.h>
 
 namespace piper_vamp {
 
@@ -51,32 +55,112 @@ namespace piper_vamp {
 //!!! exists before parsing it to avoid spurious error messages;
 //!!! refactoring
 
+/**
+ * Load static output info (output type URIs) for a plugin from the
+ * RDF description installed alongside its library.
+ *
+ * The RDF for each library is parsed only once per process, the
+ * first time static info is requested for any plugin in that
+ * library, and is retained along with the info extracted for each
+ * plugin. A library with no RDF is also remembered. The cache is
+ * keyed by library path and library modification time, so replacing
+ * a library causes its RDF to be read again. All instances share the
+ * cache and a single SordWorld, under a common lock.
+ */
 class StaticOutputRdf
 {
 public:
     StaticOutputRdf() :
-        m_world(sord_world_new())
+        m_world(sharedWorld())
     {}
 
-    ~StaticOutputRdf() {
-        sord_world_free(m_world);
-    }
-    
     StaticOutputInfo loadStaticOutputInfo(Vamp::HostExt::PluginLoader::PluginKey
                                           pluginKey) {
 
+        std::string library = Vamp::HostExt::PluginLoader::getInstance()->
+            getLibraryPathForPlugin(pluginKey);
+
+        std::lock_guard<std::mutex> guard(cacheMutex());
+        
+        LibraryRdf &rdf = libraryRdfFor(library);
+
+        auto itr = rdf.info.find(pluginKey);
+        if (itr != rdf.info.end()) {
+            return itr->second;
+        }
+        
         StaticOutputInfo info;
-        SordModel *model = sord_new(m_world, SORD_SPO|SORD_OPS|SORD_POS, false);
-        if (loadRdf(model, candidateRdfFilesFor(pluginKey))) {
-            loadStaticOutputInfoFromModel(model, pluginKey, info);
+        if (rdf.model) {
+            loadStaticOutputInfoFromModel(rdf.model, pluginKey, info);
         }
-        sord_free(model);
+        rdf.info[pluginKey] = info;
         return info;
     }
 
 private:
     SordWorld *m_world;
 
+    struct LibraryRdf {
+        LibraryRdf() : mtime(0), model(nullptr) { }
+        ~LibraryRdf() { if (model) sord_free(model); }
+        LibraryRdf(const LibraryRdf &) =delete;
+        LibraryRdf &operator=(const LibraryRdf &) =delete;
+        long long mtime;
+        SordModel *model; // null if the library has no RDF
+        std::map<std::string, StaticOutputInfo> info; // by plugin key
+    };
+
+    // These are deliberately never destroyed, so that they remain
+    // valid throughout static destruction
+    
+    static SordWorld *sharedWorld() {
+        static SordWorld *world = sord_world_new();
+        return world;
+    }
+
+    static std::mutex &cacheMutex() {
+        static std::mutex *mutex = new std::mutex;
+        return *mutex;
+    }
+
+    static std::map<std::string, LibraryRdf> &cache() {
+        static auto *c = new std::map<std::string, LibraryRdf>;
+        return *c;
+    }
+
+    static long long modificationTime(std::string path) {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) return 0;
+        return (long long)st.st_mtime;
+    }
+
+    // Call with the cache mutex held
+    LibraryRdf &libraryRdfFor(std::string library) {
+
+        long long mtime = modificationTime(library);
+        
+        auto itr = cache().find(library);
+        if (itr != cache().end() && itr->second.mtime == mtime) {
+            return itr->second;
+        }
+
+        if (itr != cache().end()) {
+            cache().erase(itr);
+        }
+
+        LibraryRdf &rdf = cache()[library];
+        rdf.mtime = mtime;
+        
+        SordModel *model = sord_new(m_world, SORD_SPO|SORD_OPS|SORD_POS, false);
+        if (loadRdf(model, candidateRdfFilesFor(library))) {
+            rdf.model = model;
+        } else {
+            sord_free(model);
+        }
+
+        return rdf;
+    }
+
     bool loadRdf(SordModel *targetModel, std::vector<std::string> filenames) {
         for (auto f: filenames) {
             if (loadRdfFile(targetModel, f)) {
@@ -118,12 +202,8 @@ private:
         return success;
     }
     
-    std::vector<std::string> candidateRdfFilesFor(Vamp::HostExt::
-                                                  PluginLoader::PluginKey key) {
+    std::vector<std::string> candidateRdfFilesFor(std::string library) {
 
-        std::string library = Vamp::HostExt::PluginLoader::getInstance()->
-            getLibraryPathForPlugin(key);
-	
         auto li = library.rfind('.');
         if (li == std::string::npos) return {};
         auto withoutSuffix = library.substr(0, li);
@@ -0,0 +1,248 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+/*
+  Piper C++
+
+  An API for audio analysis and feature extraction plugins.
+
+  Centre for Digital Music, Queen Mary, University of London.
+  Copyright 2006-2017 Chris Cannam and QMUL.
+  
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use, copy,
+  modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+  Except as contained in this notice, the names of the Centre for
+  Digital Music; Queen Mary, University of London; and Chris Cannam
+  shall not be used in advertising or otherwise to promote the sale,
+  use or other dealings in this Software without prior written
+  authorization.
+*/
+
+#ifndef PIPER_TRACE_WRITER_H
+#define PIPER_TRACE_WRITER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#include <process.h>
+#include <io.h>
+#include <sys/locking.h>
+#else
+#include <unistd.h>
+#include <sys/file.h>
+#endif
+
+namespace piper_vamp {
+
+/**
+ * Writes a timeline of spans in the Chrome trace-event JSON format,
+ * for viewing in chrome://tracing or Perfetto.
+ *
+ * The file is opened for appending and each event is written with a
+ * single write, so that a server and its client, or several server
+ * processes, may share one trace file and appear together on one
+ * timeline. Only the first writer to find the file empty writes the
+ * opening bracket of the event array, holding a lock on the file
+ * while it checks, so that writers opening the file at the same time
+ * write just one bracket between them. The closing bracket is never
+ * written, and the trailing comma it leaves is accepted by the trace
+ * viewers.
+ *
+ * Times are taken from std::chrono::steady_clock, which on Linux and
+ * macOS is shared between processes, so spans from different
+ * processes line up.
+ *
+ * Spans may carry the id of the RPC they belong to. The flow events
+ * that link a request or response across the process boundary use
+ * requestFlowId() and responseFlowId() of that id, so that both
+ * sides agree on them without any further coordination. Ids are
+ * only unique per client, so flows are reliable only when a trace
+ * file is shared by one client and its server.
+ *
+ * A TraceWriter may be used from several threads at once.
+ */
+class TraceWriter
+{
+public:
+    typedef std::chrono::steady_clock::time_point Time;
+
+    /**
+     * Open the given file for appending trace events, labelling the
+     * calling process with the given name in the timeline. Throw
+     * std::runtime_error on failure.
+     */
+    TraceWriter(std::string path, std::string processName) :
+        m_file(fopen(path.c_str(), "ab")),
+#ifdef _WIN32
+        m_pid(_getpid())
+#else
+        m_pid(getpid())
+#endif
+    {
+        if (!m_file) {
+            throw std::runtime_error("failed to open trace file \"" +
+                                     path + "\"");
+        }
+        setvbuf(m_file, nullptr, _IOFBF, bufferSize);
+        startArrayIfEmpty();
+        emit("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" +
+             std::to_string(m_pid) + ",\"args\":{\"name\":\"" +
+             escape(processName) + "\"}},\n");
+    }
+
+    ~TraceWriter() {
+        fclose(m_file);
+    }
+
+    TraceWriter(const TraceWriter &) =delete;
+    TraceWriter &operator=(const TraceWriter &) =delete;
+    
+    static Time now() {
+        return std::chrono::steady_clock::now();
+    }
+
+    static int64_t requestFlowId(int64_t rpcId) {
+        return rpcId * 2;
+    }
+    
+    static int64_t responseFlowId(int64_t rpcId) {
+        return rpcId * 2 + 1;
+    }
+    
+    /**
+     * Write a span with the given name covering the given times, on
+     * the calling thread's track. If rpcId is non-negative, record
+     * it with the span.
+     */
+    void span(std::string name, Time start, Time end, int64_t rpcId = -1) {
+        std::string e = "{\"name\":\"" + escape(name) +
+            "\",\"cat\":\"piper\",\"ph\":\"X\",\"ts\":" + micros(start) +
+            ",\"dur\":" + micros(end - start) + ids();
+        if (rpcId >= 0) {
+            e += ",\"args\":{\"rpcId\":" + std::to_string(rpcId) + "}";
+        }
+        emit(e + "},\n");
+    }
+
+    /**
+     * Write the start of a flow with the given id, attached to the
+     * span enclosing the given time on the calling thread's track.
+     */
+    void flowStart(int64_t flowId, Time t) {
+        flow("s", flowId, t);
+    }
+
+    /**
+     * Write the end of a flow with the given id, attached to the
+     * span enclosing the given time on the calling thread's track.
+     */
+    void flowEnd(int64_t flowId, Time t) {
+        flow("f", flowId, t);
+    }
+
+private:
+    static const size_t bufferSize = 4096;
+    
+    FILE *m_file;
+    int m_pid;
+    std::mutex m_mutex;
+
+    void startArrayIfEmpty() {
+        // The lock is advisory and only taken here, to make the
+        // check and the write atomic with respect to other writers
+        // doing the same. If it can't be had, go ahead anyway
+#ifdef _WIN32
+        int fd = _fileno(m_file);
+        _lseek(fd, 0, SEEK_SET); // _locking locks from the position
+        bool locked = (_locking(fd, _LK_LOCK, 1) == 0);
+#else
+        int fd = fileno(m_file);
+        bool locked = (flock(fd, LOCK_EX) == 0);
+#endif
+        fseek(m_file, 0, SEEK_END);
+        if (ftell(m_file) == 0) {
+            emit("[\n");
+        }
+        if (locked) {
+#ifdef _WIN32
+            _lseek(fd, 0, SEEK_SET);
+            _locking(fd, _LK_UNLCK, 1);
+#else
+            flock(fd, LOCK_UN);
+#endif
+        }
+    }
+
+    void flow(std::string phase, int64_t flowId, Time t) {
+        emit("{\"name\":\"rpc\",\"cat\":\"piper\",\"ph\":\"" + phase +
+             "\",\"bp\":\"e\",\"id\":" + std::to_string(flowId) +
+             ",\"ts\":" + micros(t) + ids() + "},\n");
+    }
+    
+    void emit(const std::string &event) {
+        // Each event is smaller than the buffer, so that flushing
+        // writes it in one go
+        std::lock_guard<std::mutex> guard(m_mutex);
+        fwrite(event.data(), 1, event.size(), m_file);
+        fflush(m_file);
+    }
+
+    std::string ids() const {
+        return ",\"pid\":" + std::to_string(m_pid) +
+            ",\"tid\":" + std::to_string(threadId());
+    }
+    
+    static int threadId() {
+        static std::atomic<int> nextId(1);
+        thread_local int id = nextId++;
+        return id;
+    }
+
+    static std::string micros(std::chrono::steady_clock::duration d) {
+        char buf[40];
+        snprintf(buf, sizeof(buf), "%.3f",
+                 std::chrono::duration<double, std::micro>(d).count());
+        return buf;
+    }
+
+    static std::string micros(Time t) {
+        return micros(t.time_since_epoch());
+    }
+
+    static std::string escape(std::string s) {
+        std::string out;
+        for (char c: s) {
+            if (c == '"' || c == '\\') out += '\\';
+            // Drop control characters, but not the bytes of UTF-8
+            // sequences, whether char is signed or not
+            if (static_cast<unsigned char>(c) < 0x20) continue;
+            out += c;
+        }
+        return out;
+    }
+};
+
+}
+
+#endif
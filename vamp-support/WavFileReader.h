@@ -0,0 +1,319 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Piper C++
+
+    Centre for Digital Music, Queen Mary, University of London.
+    Copyright 2006-2016 Chris Cannam and QMUL.
+  
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+    ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    Except as contained in this notice, the names of the Centre for
+    Digital Music; Queen Mary, University of London; and Chris Cannam
+    shall not be used in advertising or otherwise to promote the sale,
+    use or other dealings in this Software without prior written
+    authorization.
+*/
+
+
+#ifndef PIPER_WAV_FILE_READER_H
+#define PIPER_WAV_FILE_READER_H
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace piper_vamp {
+
+/**
+ * Read audio from a WAV file, mapping the file into memory where
+ * possible so that it can be read in blocks without copying or
+ * buffering. Supports PCM at 8, 16, 24 and 32 bits per sample and
+ * IEEE float at 32 and 64 bits, in plain or extensible format
+ * files. Samples are assumed to be little-endian, as the format
+ * specifies, and the reader therefore only works on little-endian
+ * hosts.
+ */
+class WavFileReader
+{
+public:
+    /**
+     * Open the given file. Throw std::runtime_error if it cannot be
+     * read or is not a WAV file in a supported format.
+     */
+    WavFileReader(std::string path) :
+        m_path(path),
+        m_base(nullptr),
+        m_size(0),
+        m_mapped(false),
+        m_data(nullptr),
+        m_channels(0),
+        m_sampleRate(0),
+        m_frameCount(0),
+        m_bytesPerSample(0),
+        m_float(false) {
+
+        open();
+        try {
+            parse();
+        } catch (...) {
+            close();
+            throw;
+        }
+    }
+
+    ~WavFileReader() {
+        close();
+    }
+
+    WavFileReader(const WavFileReader &) =delete;
+    WavFileReader &operator=(const WavFileReader &) =delete;
+
+    std::string getPath() const { return m_path; }
+    int getChannelCount() const { return m_channels; }
+    float getSampleRate() const { return float(m_sampleRate); }
+    int64_t getFrameCount() const { return m_frameCount; }
+
+    /**
+     * Read count frames starting at the given frame into the given
+     * per-channel buffers, each of which must have room for count
+     * samples. The start frame must not be negative, but may be at
+     * or beyond the end of the file: any part of the range beyond the
+     * end is filled with zeros. Return the number of frames actually
+     * read from the file. This may be called from several threads at
+     * once.
+     */
+    int64_t readFrames(int64_t start, int64_t count, float *const *buffers) const {
+
+        int64_t available = m_frameCount - start;
+        if (available < 0) available = 0;
+        int64_t n = (count < available ? count : available);
+        if (n < 0) n = 0;
+
+        const int frameBytes = m_bytesPerSample * m_channels;
+
+        for (int c = 0; c < m_channels; ++c) {
+            float *out = buffers[c];
+            if (n > 0) {
+                // Only form the pointer when it is within the data
+                const unsigned char *q =
+                    m_data + start * frameBytes + c * m_bytesPerSample;
+                convert(q, frameBytes, n, out);
+            }
+            for (int64_t i = n; i < count; ++i) out[i] = 0.f;
+        }
+
+        return n;
+    }
+
+private:
+    std::string m_path;
+    const unsigned char *m_base;
+    size_t m_size;
+    bool m_mapped;
+    std::vector<unsigned char> m_buffer; // if not mapped
+    const unsigned char *m_data;
+    int m_channels;
+    int m_sampleRate;
+    int64_t m_frameCount;
+    int m_bytesPerSample;
+    bool m_float;
+
+    [[noreturn]] void fail(std::string why) const {
+        throw std::runtime_error("failed to read WAV file \"" + m_path +
+                                 "\": " + why);
+    }
+
+    void open() {
+#ifndef _WIN32
+        int fd = ::open(m_path.c_str(), O_RDONLY);
+        if (fd < 0) fail(strerror(errno));
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                m_base = static_cast<const unsigned char *>(p);
+                m_size = st.st_size;
+                m_mapped = true;
+                madvise(p, st.st_size, MADV_SEQUENTIAL);
+            }
+        }
+        ::close(fd);
+        if (m_mapped) return;
+#endif
+        FILE *f = fopen(m_path.c_str(), "rb");
+        if (!f) fail(strerror(errno));
+        unsigned char block[65536];
+        size_t n;
+        while ((n = fread(block, 1, sizeof(block), f)) > 0) {
+            m_buffer.insert(m_buffer.end(), block, block + n);
+        }
+        fclose(f);
+        m_base = m_buffer.data();
+        m_size = m_buffer.size();
+    }
+
+    void close() {
+#ifndef _WIN32
+        if (m_mapped) {
+            munmap(const_cast<unsigned char *>(m_base), m_size);
+            m_mapped = false;
+        }
+#endif
+        m_base = nullptr;
+    }
+
+    static uint32_t u32(const unsigned char *p) {
+        return uint32_t(p[0]) | (uint32_t(p[1]) << 8) |
+            (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+    }
+    
+    static uint16_t u16(const unsigned char *p) {
+        return uint16_t(p[0] | (p[1] << 8));
+    }
+    
+    void parse() {
+
+        if (m_size < 12 ||
+            memcmp(m_base, "RIFF", 4) || memcmp(m_base + 8, "WAVE", 4)) {
+            fail("not a RIFF/WAVE file");
+        }
+
+        bool haveFormat = false;
+        int format = 0, bits = 0;
+        size_t dataBytes = 0;
+        size_t pos = 12;
+
+        while (pos + 8 <= m_size) {
+
+            const unsigned char *chunk = m_base + pos;
+            size_t length = u32(chunk + 4);
+            size_t available = m_size - pos - 8;
+            
+            if (!memcmp(chunk, "fmt ", 4)) {
+                if (length < 16 || length > available) {
+                    fail("malformed format chunk");
+                }
+                format = u16(chunk + 8);
+                m_channels = u16(chunk + 10);
+                m_sampleRate = int(u32(chunk + 12));
+                bits = u16(chunk + 22);
+                if (format == 0xfffe) { // WAVE_FORMAT_EXTENSIBLE
+                    if (length < 40) fail("malformed extensible format chunk");
+                    format = u16(chunk + 32); // first two bytes of the GUID
+                }
+                haveFormat = true;
+
+            } else if (!memcmp(chunk, "data", 4)) {
+                if (!haveFormat) fail("data chunk precedes format chunk");
+                // A writer that didn't know the length in advance
+                // (e.g. streaming) may leave this unfilled: then the
+                // data runs to the end of the file
+                if (length > available || length == 0) length = available;
+                m_data = chunk + 8;
+                dataBytes = length;
+                break;
+            }
+
+            pos += 8 + length + (length & 1);
+        }
+
+        if (!m_data) fail("no audio data found");
+
+        if (format == 1 && (bits == 8 || bits == 16 || bits == 24 || bits == 32)) {
+            m_float = false;
+        } else if (format == 3 && (bits == 32 || bits == 64)) {
+            m_float = true;
+        } else {
+            fail("unsupported sample format (format tag " +
+                 std::to_string(format) + ", " + std::to_string(bits) + " bits)");
+        }
+        if (m_channels < 1 || m_sampleRate < 1) {
+            fail("invalid channel count or sample rate");
+        }
+
+        m_bytesPerSample = bits / 8;
+        m_frameCount = int64_t(dataBytes / (m_bytesPerSample * m_channels));
+    }
+
+    void convert(const unsigned char *p, int stride, int64_t n, float *out) const {
+
+        // Written as separate simple loops, one per format, so that
+        // each can be vectorised
+        switch (m_bytesPerSample) {
+        case 1:
+            for (int64_t i = 0; i < n; ++i) {
+                out[i] = (float(p[i * stride]) - 128.f) / 128.f;
+            }
+            break;
+        case 2:
+            for (int64_t i = 0; i < n; ++i) {
+                int16_t s;
+                memcpy(&s, p + i * stride, 2);
+                out[i] = float(s) / 32768.f;
+            }
+            break;
+        case 3:
+            for (int64_t i = 0; i < n; ++i) {
+                const unsigned char *q = p + i * stride;
+                int32_t s = int32_t((uint32_t(q[0]) << 8) |
+                                    (uint32_t(q[1]) << 16) |
+                                    (uint32_t(q[2]) << 24));
+                out[i] = float(s) / 2147483648.f;
+            }
+            break;
+        case 4:
+            if (m_float) {
+                for (int64_t i = 0; i < n; ++i) {
+                    memcpy(out + i, p + i * stride, 4);
+                }
+            } else {
+                for (int64_t i = 0; i < n; ++i) {
+                    int32_t s;
+                    memcpy(&s, p + i * stride, 4);
+                    out[i] = float(s) / 2147483648.f;
+                }
+            }
+            break;
+        case 8:
+            for (int64_t i = 0; i < n; ++i) {
+                double d;
+                memcpy(&d, p + i * stride, 8);
+                out[i] = float(d);
+            }
+            break;
+        }
+    }
+};
+
+}
+
+#endif
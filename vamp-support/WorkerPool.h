@@ -0,0 +1,204 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+/*
+  Piper C++
+
+  An API for audio analysis and feature extraction plugins.
+
+  Centre for Digital Music, Queen Mary, University of London.
+  Copyright 2006-2017 Chris Cannam and QMUL.
+  
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation
+  files (the "Software"), to deal in the Software without
+  restriction, including without limitation the rights to use, copy,
+  modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+  Except as contained in this notice, the names of the Centre for
+  Digital Music; Queen Mary, University of London; and Chris Cannam
+  shall not be used in advertising or otherwise to promote the sale,
+  use or other dealings in this Software without prior written
+  authorization.
+*/
+
+#ifndef PIPER_WORKER_POOL_H
+#define PIPER_WORKER_POOL_H
+
+#include <atomic>
+#include <cstdint>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace piper_vamp {
+
+/**
+ * \class WorkerPool
+ *
+ * A fixed set of worker threads for running a batch of independent
+ * tasks in parallel and waiting for them all to complete. The thread
+ * calling run() takes tasks from the batch as well, so a pool with N
+ * worker threads runs up to N+1 tasks at once, and a pool with none
+ * simply runs the tasks in turn.
+ *
+ * Only one batch runs at a time; concurrent calls to run() are
+ * serialised. The threads are started on construction and joined on
+ * destruction, so a pool should not be constructed in a process that
+ * is going to fork and use it in the child.
+ */
+class WorkerPool
+{
+public:
+    typedef std::function<void()> Task;
+
+    /**
+     * Start the given number of worker threads. If threads is
+     * negative, start one fewer than the number of hardware threads
+     * available, to leave one for the caller.
+     */
+    WorkerPool(int threads = -1) :
+        m_batch(nullptr),
+        m_generation(0),
+        m_active(0),
+        m_exiting(false) {
+        if (threads < 0) {
+            threads = int(std::thread::hardware_concurrency()) - 1;
+        }
+        for (int i = 0; i < threads; ++i) {
+            m_threads.push_back(std::thread([this]() { workerLoop(); }));
+        }
+    }
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+            m_exiting = true;
+        }
+        m_cond.notify_all();
+        for (auto &t: m_threads) {
+            t.join();
+        }
+    }
+
+    WorkerPool(const WorkerPool &) =delete;
+    WorkerPool &operator=(const WorkerPool &) =delete;
+
+    /**
+     * Return the number of worker threads, not counting the caller.
+     */
+    int getThreadCount() const {
+        return int(m_threads.size());
+    }
+    
+    /**
+     * Run all of the given tasks, in no particular order, and return
+     * when they have all completed. If any task throws an exception,
+     * the remaining tasks are still run and the first exception
+     * caught is then rethrown here.
+     */
+    void run(const std::vector<Task> &tasks) {
+
+        if (tasks.empty()) return;
+
+        std::lock_guard<std::mutex> runGuard(m_runMutex);
+
+        Batch batch(tasks);
+
+        if (tasks.size() > 1 && !m_threads.empty()) {
+            {
+                std::lock_guard<std::mutex> guard(m_mutex);
+                m_batch = &batch;
+                ++m_generation;
+            }
+            m_cond.notify_all();
+        }
+
+        work(batch);
+
+        {
+            // Workers only pick up the batch while m_batch refers to
+            // it, and count themselves in m_active when they do, so
+            // once it is cleared and m_active reaches zero no thread
+            // is still using it
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_batch = nullptr;
+            m_idle.wait(lock, [this]() { return m_active == 0; });
+        }
+
+        if (batch.error) {
+            std::rethrow_exception(batch.error);
+        }
+    }
+
+private:
+    struct Batch {
+        Batch(const std::vector<Task> &t) : tasks(t), next(0) { }
+        const std::vector<Task> &tasks;
+        std::atomic<size_t> next;
+        std::exception_ptr error;
+    };
+
+    std::vector<std::thread> m_threads;
+    std::mutex m_runMutex;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::condition_variable m_idle;
+    Batch *m_batch;
+    uint64_t m_generation;
+    int m_active;
+    bool m_exiting;
+
+    void work(Batch &batch) {
+        size_t n = batch.tasks.size();
+        size_t i;
+        while ((i = batch.next++) < n) {
+            try {
+                batch.tasks[i]();
+            } catch (...) {
+                std::lock_guard<std::mutex> guard(m_mutex);
+                if (!batch.error) {
+                    batch.error = std::current_exception();
+                }
+            }
+        }
+    }
+    
+    void workerLoop() {
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true) {
+            m_cond.wait(lock, [&]() {
+                    return m_exiting || (m_batch && m_generation != seen);
+                });
+            if (m_exiting) return;
+            seen = m_generation;
+            Batch *batch = m_batch;
+            ++m_active;
+            lock.unlock();
+            work(*batch);
+            lock.lock();
+            if (--m_active == 0) {
+                m_idle.notify_all();
+            }
+        }
+    }
+};
+
+}
+
+#endif